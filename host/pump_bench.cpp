@@ -0,0 +1,322 @@
+// SmfPlayer::Pump benchmark: generates type-1 MIDI files with a given
+// number of tracks and plays each through the streaming merge, block by
+// block as the audio callback would, timing only the Pump calls.
+//
+//   pump_bench [options] [tracks ...]      (default 6 16 40 100)
+//
+// Reports Pump time and heap comparisons (PumpEvents / PumpHeapSteps) per
+// queued event, next to log2 of the track count the heap should track, and
+// the cost of a Pump with nothing due. Pump time includes the track window
+// refills, which here are page-cache reads rather than SD sectors, and two
+// clock reads per call.
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include <unistd.h>
+
+#include "smf_player.h"
+
+namespace
+{
+using Clock = std::chrono::steady_clock;
+
+struct Options
+{
+    std::vector<int> tracks;
+    int              notes       = 2000;
+    int              repeats     = 3;
+    size_t           block_size  = 24;
+    const char*      dir         = nullptr;
+    bool             predecoded  = false;
+};
+
+// Same work memory the module gives the player
+uint8_t   smf_work_mem[4 * 1024 * 1024];
+SmfPlayer smf_player;
+EventQueue<1024> queue;
+
+void Usage()
+{
+    std::fprintf(stderr,
+                 "usage: pump_bench [options] [tracks ...]\n"
+                 "  -n N      notes per track (2000)\n"
+                 "  -r N      runs per file, the fastest is reported (3)\n"
+                 "  -b N      audio block size in frames (24, as on the module)\n"
+                 "  -d DIR    keep the generated files in DIR (default: a temp dir, removed)\n"
+                 "  -D        also time the pre-decoded path for comparison\n");
+}
+
+bool ParseOptions(int argc, char** argv, Options& opt)
+{
+    int c;
+    while((c = getopt(argc, argv, "n:r:b:d:Dh")) != -1)
+    {
+        switch(c)
+        {
+            case 'n': opt.notes = std::atoi(optarg); break;
+            case 'r': opt.repeats = std::atoi(optarg); break;
+            case 'b': opt.block_size = std::strtoul(optarg, nullptr, 10); break;
+            case 'd': opt.dir = optarg; break;
+            case 'D': opt.predecoded = true; break;
+            default: return false;
+        }
+    }
+    while(optind < argc)
+        opt.tracks.push_back(std::atoi(argv[optind++]));
+    if(opt.tracks.empty())
+        opt.tracks = {6, 16, 40, 100};
+    for(int t : opt.tracks)
+        if(t < 2 || t > 256)
+            return false;
+    return opt.notes > 0 && opt.repeats > 0 && opt.block_size > 0 && opt.block_size <= 4096;
+}
+
+void PutVarLen(std::vector<uint8_t>& out, uint32_t v)
+{
+    uint8_t buf[4];
+    int     n = 0;
+    do
+    {
+        buf[n++] = uint8_t(v & 0x7F);
+        v >>= 7;
+    } while(v != 0);
+    while(n-- > 0)
+        out.push_back(uint8_t(buf[n] | (n ? 0x80 : 0)));
+}
+
+void PutBE(std::vector<uint8_t>& out, uint32_t v, int bytes)
+{
+    while(bytes-- > 0)
+        out.push_back(uint8_t(v >> (8 * bytes)));
+}
+
+void PutChunk(std::vector<uint8_t>& out, const char* id, const std::vector<uint8_t>& body)
+{
+    out.insert(out.end(), id, id + 4);
+    PutBE(out, uint32_t(body.size()), 4);
+    out.insert(out.end(), body.begin(), body.end());
+}
+
+// A conductor track (tempo, time signature, a few tempo changes) and
+// `tracks - 1` note tracks. Each note track plays one note at a time with
+// its own pseudo-random rhythm, so the tracks' next events interleave and
+// the heap sees real reordering rather than round-robin.
+std::vector<uint8_t> MakeSmf(int tracks, int notes)
+{
+    constexpr uint16_t kDivision = 480;
+    uint32_t           rng       = 2024u + uint32_t(tracks);
+    auto               rand      = [&rng](uint32_t n) {
+        rng = rng * 1664525u + 1013904223u;
+        return (rng >> 8) % n;
+    };
+
+    std::vector<uint8_t> smf, body;
+    body.assign({0x00, 0xFF, 0x58, 0x04, 4, 2, 24, 8});
+    const uint32_t songTicks = kDivision + uint32_t(notes) * (180 + 90); // longest note track
+    for(uint32_t at = 0, last = 0; at < songTicks; at += kDivision * 16)
+    {
+        PutVarLen(body, at - last);
+        body.insert(body.end(), {0xFF, 0x51, 0x03});
+        PutBE(body, 400000 + rand(200000), 3);
+        last = at;
+    }
+    body.insert(body.end(), {0x00, 0xFF, 0x2F, 0x00});
+
+    PutChunk(smf, "MThd", {0, 1, uint8_t(tracks >> 8), uint8_t(tracks), kDivision >> 8, kDivision & 0xFF});
+    PutChunk(smf, "MTrk", body);
+
+    for(int t = 1; t < tracks; t++)
+    {
+        const uint8_t ch    = uint8_t((t - 1) % 16);
+        uint32_t      delta = rand(kDivision);
+        body.clear();
+        for(int i = 0; i < notes; i++)
+        {
+            const uint8_t  key  = uint8_t(36 + rand(48));
+            const uint32_t len  = 30 + rand(150);
+            const uint32_t rest = 30 + rand(60);
+            if(i % 16 == 0)
+            {
+                PutVarLen(body, delta);
+                body.insert(body.end(), {uint8_t(0xB0 | ch), 11, uint8_t(64 + rand(64))});
+                delta = 0;
+            }
+            PutVarLen(body, delta);
+            body.insert(body.end(), {uint8_t(0x90 | ch), key, uint8_t(40 + rand(80))});
+            PutVarLen(body, len);
+            body.insert(body.end(), {uint8_t(0x80 | ch), key, 64});
+            delta = rest;
+        }
+        body.insert(body.end(), {0x00, 0xFF, 0x2F, 0x00});
+        PutChunk(smf, "MTrk", body);
+    }
+    return smf;
+}
+
+struct Result
+{
+    double   busy_ns    = 0.0; // Pump calls that queued events
+    double   idle_ns    = 0.0; // calls with nothing due yet
+    uint32_t idle_calls = 0;
+    uint32_t events     = 0;
+    uint32_t steps      = 0;
+    uint32_t refills    = 0;
+};
+
+// One pass over the whole song, one Pump per audio block; the queue is
+// drained after every block as the transport does. Most blocks have nothing
+// due, so their cost (the lookahead conversion and the clock reads) is kept
+// apart from the calls that merge events.
+bool RunOnce(const char* path, const Options& opt, bool predecoded, Result& res)
+{
+    smf_player.SetPredecodeBudget(predecoded ? sizeof(smf_work_mem) : 0);
+    if(!smf_player.Open(path))
+        return false;
+    smf_player.SetSampleRate(48000.0f);
+    smf_player.SetLookaheadSamples(opt.block_size * 256);
+    queue.Clear();
+    smf_player.Start(0);
+
+    res             = Result();
+    uint32_t queued = 0;
+    Clock::duration busy{}, idle{};
+    for(uint64_t now = 0; smf_player.IsPlaying(); now += opt.block_size)
+    {
+        const Clock::time_point start = Clock::now();
+        smf_player.Pump(queue, now);
+        const Clock::duration spent = Clock::now() - start;
+
+        uint32_t n = 0;
+        MidiEv   ev;
+        while(queue.Pop(ev))
+            n++;
+        if(n > 0)
+            busy += spent;
+        else
+        {
+            idle += spent;
+            res.idle_calls++;
+        }
+        queued += n;
+    }
+    res.busy_ns = std::chrono::duration<double, std::nano>(busy).count();
+    res.idle_ns = std::chrono::duration<double, std::nano>(idle).count();
+    res.events  = predecoded ? queued : smf_player.PumpEvents();
+    res.steps   = smf_player.PumpHeapSteps();
+    res.refills = smf_player.ReadRefills();
+    smf_player.Close();
+    return res.events == queued && queued > 0;
+}
+
+bool Bench(const char* path, int tracks, const Options& opt, bool predecoded)
+{
+    // The pre-decoded stream has to fit the work memory
+    if(predecoded)
+    {
+        smf_player.SetPredecodeBudget(sizeof(smf_work_mem));
+        const bool fits = smf_player.Open(path) && smf_player.IsPredecoded();
+        smf_player.Close();
+        if(!fits)
+        {
+            std::printf("%6d %-10s does not fit the work memory\n", tracks, "decoded");
+            return true;
+        }
+    }
+
+    Result best;
+    for(int r = 0; r < opt.repeats; r++)
+    {
+        Result res;
+        if(!RunOnce(path, opt, predecoded, res))
+        {
+            std::fprintf(stderr, "pump_bench: %s did not play through\n", path);
+            return false;
+        }
+        if(r == 0 || res.busy_ns < best.busy_ns)
+            best = res;
+    }
+    std::printf("%6d %-10s %9u %9.1f %8.1f",
+                tracks,
+                predecoded ? "decoded" : "streamed",
+                best.events,
+                best.busy_ns / best.events,
+                best.idle_calls ? best.idle_ns / best.idle_calls : 0.0);
+    if(!predecoded)
+        std::printf(" %11.2f %7.2f %8u",
+                    double(best.steps) / best.events,
+                    std::log2(double(tracks)),
+                    best.refills);
+    std::printf("\n");
+    return true;
+}
+} // namespace
+
+int main(int argc, char** argv)
+{
+    Options opt;
+    if(!ParseOptions(argc, argv, opt))
+    {
+        Usage();
+        return 2;
+    }
+
+    char        tmpl[] = "/tmp/pump_bench.XXXXXX";
+    std::string dir    = opt.dir ? opt.dir : "";
+    if(opt.dir == nullptr)
+    {
+        if(mkdtemp(tmpl) == nullptr)
+        {
+            std::fprintf(stderr, "pump_bench: cannot create a temp dir\n");
+            return 1;
+        }
+        dir = tmpl;
+    }
+
+    smf_player.SetWorkMemory(smf_work_mem, sizeof(smf_work_mem));
+    std::printf("%d notes per track, %zu-frame blocks, best of %d\n",
+                opt.notes,
+                opt.block_size,
+                opt.repeats);
+    std::printf("%6s %-10s %9s %9s %8s %11s %7s %8s\n",
+                "tracks",
+                "mode",
+                "events",
+                "ns/event",
+                "idle ns",
+                "steps/event",
+                "log2(n)",
+                "refills");
+
+    int failed = 0;
+    for(int tracks : opt.tracks)
+    {
+        const std::string          path = dir + "/tracks" + std::to_string(tracks) + ".mid";
+        const std::vector<uint8_t> smf  = MakeSmf(tracks, opt.notes);
+        FILE*                      f    = std::fopen(path.c_str(), "wb");
+        if(f == nullptr || std::fwrite(smf.data(), 1, smf.size(), f) != smf.size())
+        {
+            std::fprintf(stderr, "pump_bench: cannot write %s\n", path.c_str());
+            if(f != nullptr)
+                std::fclose(f);
+            failed++;
+            continue;
+        }
+        std::fclose(f);
+
+        failed += !Bench(path.c_str(), tracks, opt, false);
+        if(opt.predecoded)
+            failed += !Bench(path.c_str(), tracks, opt, true);
+        if(opt.dir == nullptr)
+            std::remove(path.c_str());
+    }
+    if(opt.dir == nullptr)
+        rmdir(dir.c_str());
+    return failed ? 1 : 0;
+}
@@ -0,0 +1,708 @@
+// Offline renderer: plays songs through the firmware's own transport and
+// synth (MixerTransport::Update / ProcessAudio -> SynthRender) into WAV
+// files, as fast as the host allows.
+//
+//   render_wav [options] soundfont.sf2 song.mid [song.mid ...]
+//
+// The SoundFont is loaded once; every song then renders in its own forked
+// worker so songs never share synth or FX state and a batch can use all
+// cores. Each song reports its realtime factor, peak voices and how its
+// audio blocks spread over the real-time budget of one block.
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "mixer_transport.h"
+#include "smf_player.h"
+#include "song_config_persist.h"
+#include "synth_tsf.h"
+
+using namespace major_midi;
+
+namespace
+{
+using Clock = std::chrono::steady_clock;
+
+struct Options
+{
+    const char*              sf2          = nullptr;
+    std::vector<const char*> songs;
+    const char*              out_path     = nullptr;
+    const char*              out_dir      = nullptr;
+    const char*              cfg_path     = nullptr;
+    float                    sample_rate  = 48000.0f;
+    size_t                   block_size   = 24;
+    int                      voices       = 0;
+    int                      loops        = 2;
+    float                    tail_seconds = 2.0f;
+    float                    max_seconds  = 900.0f;
+    int                      jobs         = 1;
+    bool                     pcm16        = false;
+    int                      stream_ms    = -1;
+    bool                     selective    = false;
+    bool                     sf2_cache    = false;
+    float                    governor_pct = 0.0f;
+};
+
+// Same work memory the module gives the player
+uint8_t   smf_work_mem[4 * 1024 * 1024];
+SmfPlayer smf_player;
+MixerTransport transport;
+AppState  app_state;
+
+void Usage()
+{
+    std::fprintf(stderr,
+                 "usage: render_wav [options] soundfont.sf2 song.mid [song.mid ...]\n"
+                 "  -o FILE   output file (one song only; default song.wav)\n"
+                 "  -d DIR    write song.wav files into DIR\n"
+                 "  -c FILE   song .cfg (one song only; default song.cfg if present)\n"
+                 "  -r HZ     sample rate (48000)\n"
+                 "  -b N      audio block size in frames (24, as on the module)\n"
+                 "  -v N      max voices (song setting, else 16)\n"
+                 "  -l N      loop passes to render for looping songs (2)\n"
+                 "  -t SEC    tail rendered after the last event (2)\n"
+                 "  -m SEC    hard cap on rendered audio (900)\n"
+                 "  -j N      songs rendered in parallel (1)\n"
+                 "  -s        16-bit PCM instead of 32-bit float\n"
+                 "  -S MS     stream samples from disk with an MS attack preload\n"
+                 "  -P        load only the song's presets, as the module does\n"
+                 "  -C        load the SF2 through its .cache image, as the module does\n"
+                 "  -G PCT    CPU governor on, with each audio callback allowed PCT%% of\n"
+                 "            its block's duration (off by default: renders are then exact)\n");
+}
+
+bool ParseOptions(int argc, char** argv, Options& opt)
+{
+    int c;
+    while((c = getopt(argc, argv, "o:d:c:r:b:v:l:t:m:j:sS:PCG:h")) != -1)
+    {
+        switch(c)
+        {
+            case 'o': opt.out_path = optarg; break;
+            case 'd': opt.out_dir = optarg; break;
+            case 'c': opt.cfg_path = optarg; break;
+            case 'r': opt.sample_rate = std::strtof(optarg, nullptr); break;
+            case 'b': opt.block_size = std::strtoul(optarg, nullptr, 10); break;
+            case 'v': opt.voices = std::atoi(optarg); break;
+            case 'l': opt.loops = std::atoi(optarg); break;
+            case 't': opt.tail_seconds = std::strtof(optarg, nullptr); break;
+            case 'm': opt.max_seconds = std::strtof(optarg, nullptr); break;
+            case 'j': opt.jobs = std::atoi(optarg); break;
+            case 's': opt.pcm16 = true; break;
+            case 'S': opt.stream_ms = std::atoi(optarg); break;
+            case 'P': opt.selective = true; break;
+            case 'C': opt.sf2_cache = true; break;
+            case 'G': opt.governor_pct = std::strtof(optarg, nullptr); break;
+            default: return false;
+        }
+    }
+    if(argc - optind < 2)
+        return false;
+    opt.sf2 = argv[optind++];
+    while(optind < argc)
+        opt.songs.push_back(argv[optind++]);
+
+    if(opt.songs.size() > 1 && (opt.out_path != nullptr || opt.cfg_path != nullptr))
+    {
+        std::fprintf(stderr, "render_wav: -o and -c take a single song\n");
+        return false;
+    }
+    if(opt.sample_rate < 8000.0f || opt.block_size == 0 || opt.block_size > 4096
+       || opt.jobs < 1 || opt.loops < 1 || opt.governor_pct < 0.0f || opt.governor_pct > 100.0f)
+        return false;
+    return true;
+}
+
+// song.mid -> song.<ext>, optionally moved into dir
+std::string SiblingPath(const char* midi_path, const char* ext, const char* dir)
+{
+    std::string path = midi_path;
+    if(dir != nullptr)
+    {
+        const size_t slash = path.rfind('/');
+        path = std::string(dir) + "/" + (slash == std::string::npos ? path : path.substr(slash + 1));
+    }
+    const size_t dot   = path.rfind('.');
+    const size_t slash = path.rfind('/');
+    if(dot != std::string::npos && (slash == std::string::npos || dot > slash))
+        path.erase(dot);
+    return path + ext;
+}
+
+bool FileExists(const std::string& path)
+{
+    struct stat st;
+    return ::stat(path.c_str(), &st) == 0 && S_ISREG(st.st_mode);
+}
+
+int TempoUsecToBpm(uint32_t tempo_usec)
+{
+    if(tempo_usec == 0)
+        return 120;
+    const int bpm = static_cast<int>((60000000.0 + tempo_usec / 2.0) / tempo_usec);
+    if(bpm < 20)
+        return 20;
+    if(bpm > 300)
+        return 300;
+    return bpm;
+}
+
+// The song-scoped part of the firmware's load path: defaults, then the
+// file's Major MIDI settings, then the .cfg on top.
+void LoadSongState(const char* cfg_path)
+{
+    app_state = AppState{};
+    app_state.bpm = TempoUsecToBpm(smf_player.TempoUsecPerQuarter());
+    transport.SetFileBpm(static_cast<float>(app_state.bpm));
+
+    const auto& settings            = smf_player.Settings();
+    app_state.song_bpm_override     = settings.bpm_override;
+    app_state.song_loop_enabled     = settings.loop_enabled;
+    app_state.sf2_master_volume_max = settings.master_volume_max;
+    app_state.sf2_expression_max    = settings.expression_max;
+    app_state.sf2_reverb_max        = settings.reverb_max;
+    app_state.sf2_chorus_max        = settings.chorus_max;
+    app_state.sf2_transpose         = settings.transpose;
+    for(int ch = 0; ch < 16; ch++)
+    {
+        ChannelState& channel    = app_state.channels[ch];
+        channel.program_override = settings.program_override[ch];
+        channel.pan = settings.pan_override[ch] >= 0 ? static_cast<uint8_t>(settings.pan_override[ch])
+                                                     : 64;
+        channel.volume          = settings.volume[ch];
+        channel.reverb_send     = settings.reverb_send[ch];
+        channel.chorus_send     = settings.chorus_send[ch];
+        channel.muted           = settings.muted[ch];
+        channel.current_program = settings.program_override[ch] >= 0
+                                      ? static_cast<uint8_t>(settings.program_override[ch])
+                                      : 0;
+    }
+    app_state.loop_start_measure = settings.loop_start_measure < 1 ? 1 : settings.loop_start_measure;
+    app_state.loop_start_beat    = settings.loop_start_beat < 1 ? 1 : settings.loop_start_beat;
+    app_state.loop_start_sub     = settings.loop_start_sub < 1 ? 1 : settings.loop_start_sub;
+    app_state.loop_length_beats  = settings.loop_length_beats < 1 ? 1 : settings.loop_length_beats;
+
+    if(cfg_path != nullptr)
+        LoadSongConfig(cfg_path, app_state);
+
+    if(app_state.song_bpm_override > 0)
+        app_state.bpm = app_state.song_bpm_override;
+    if(app_state.sf2_max_voices < 4 || app_state.sf2_max_voices > 32)
+        app_state.sf2_max_voices = 16;
+
+    SynthSetReverbTime(app_state.fx_reverb_time);
+    SynthSetReverbLpFreq(app_state.fx_reverb_lpf_hz);
+    SynthSetReverbHpFreq(app_state.fx_reverb_hpf_hz);
+    SynthSetChorusDepth(app_state.fx_chorus_depth);
+    SynthSetChorusSpeed(app_state.fx_chorus_speed_hz);
+}
+
+class WavWriter
+{
+  public:
+    bool Open(const char* path, uint32_t sample_rate, bool pcm16)
+    {
+        file_  = std::fopen(path, "wb");
+        rate_  = sample_rate;
+        pcm16_ = pcm16;
+        return file_ != nullptr && WriteHeader();
+    }
+
+    bool Write(const float* left, const float* right, size_t frames)
+    {
+        if(pcm16_)
+        {
+            int16_t buf[2 * 256];
+            while(frames > 0)
+            {
+                const size_t chunk = frames > 256 ? 256 : frames;
+                for(size_t i = 0; i < chunk; i++)
+                {
+                    buf[2 * i]     = ToPcm16(left[i]);
+                    buf[2 * i + 1] = ToPcm16(right[i]);
+                }
+                if(std::fwrite(buf, sizeof(int16_t), 2 * chunk, file_) != 2 * chunk)
+                    return false;
+                left += chunk;
+                right += chunk;
+                frames -= chunk;
+                frames_ += chunk;
+            }
+            return true;
+        }
+
+        float buf[2 * 256];
+        while(frames > 0)
+        {
+            const size_t chunk = frames > 256 ? 256 : frames;
+            for(size_t i = 0; i < chunk; i++)
+            {
+                buf[2 * i]     = left[i];
+                buf[2 * i + 1] = right[i];
+            }
+            if(std::fwrite(buf, sizeof(float), 2 * chunk, file_) != 2 * chunk)
+                return false;
+            left += chunk;
+            right += chunk;
+            frames -= chunk;
+            frames_ += chunk;
+        }
+        return true;
+    }
+
+    bool Close()
+    {
+        if(file_ == nullptr)
+            return false;
+        const bool ok = std::fseek(file_, 0, SEEK_SET) == 0 && WriteHeader();
+        return std::fclose(file_) == 0 && ok;
+    }
+
+  private:
+    static int16_t ToPcm16(float v)
+    {
+        if(v > 1.0f)
+            v = 1.0f;
+        if(v < -1.0f)
+            v = -1.0f;
+        return static_cast<int16_t>(v * 32767.0f);
+    }
+
+    static void Put16(uint8_t*& p, uint16_t v)
+    {
+        *p++ = uint8_t(v);
+        *p++ = uint8_t(v >> 8);
+    }
+
+    static void Put32(uint8_t*& p, uint32_t v)
+    {
+        Put16(p, uint16_t(v));
+        Put16(p, uint16_t(v >> 16));
+    }
+
+    bool WriteHeader()
+    {
+        const uint16_t bytes_per_sample = pcm16_ ? 2 : 4;
+        const uint32_t data_bytes       = uint32_t(frames_ * 2u * bytes_per_sample);
+        uint8_t        hdr[44];
+        uint8_t*       p = hdr;
+        std::memcpy(p, "RIFF", 4);
+        p += 4;
+        Put32(p, 36u + data_bytes);
+        std::memcpy(p, "WAVEfmt ", 8);
+        p += 8;
+        Put32(p, 16);
+        Put16(p, pcm16_ ? 1 : 3); // PCM / IEEE float
+        Put16(p, 2);
+        Put32(p, rate_);
+        Put32(p, rate_ * 2u * bytes_per_sample);
+        Put16(p, uint16_t(2u * bytes_per_sample));
+        Put16(p, uint16_t(8u * bytes_per_sample));
+        std::memcpy(p, "data", 4);
+        p += 4;
+        Put32(p, data_bytes);
+        return std::fwrite(hdr, 1, sizeof(hdr), file_) == sizeof(hdr);
+    }
+
+    FILE*    file_   = nullptr;
+    uint32_t rate_   = 48000;
+    bool     pcm16_  = false;
+    uint64_t frames_ = 0;
+};
+
+// Block render time as a share of the block's real-time budget
+constexpr int kBudgetBuckets                 = 7;
+constexpr int kBudgetEdges[kBudgetBuckets - 1] = {5, 10, 25, 50, 75, 100};
+
+int RenderSong(const Options& opt, const char* midi_path, std::string& report)
+{
+    char line[256];
+    auto say = [&](const char* fmt, auto... args) {
+        std::snprintf(line, sizeof(line), fmt, args...);
+        report += line;
+    };
+
+    const std::string out_path
+        = opt.out_path ? std::string(opt.out_path) : SiblingPath(midi_path, ".wav", opt.out_dir);
+    std::string cfg_path = opt.cfg_path ? std::string(opt.cfg_path) : SiblingPath(midi_path, ".cfg", nullptr);
+    if(opt.cfg_path == nullptr && !FileExists(cfg_path))
+        cfg_path.clear();
+
+    const Clock::time_point open_start = Clock::now();
+    if(!smf_player.Open(midi_path))
+    {
+        say("%s: cannot open\n", midi_path);
+        return 1;
+    }
+    const double open_ms
+        = std::chrono::duration<double, std::milli>(Clock::now() - open_start).count();
+
+    transport.Reset(app_state);
+    LoadSongState(cfg_path.empty() ? nullptr : cfg_path.c_str());
+    const int voices = opt.voices > 0 ? opt.voices : app_state.sf2_max_voices;
+    SynthSetMaxVoices(voices);
+    SynthSetGovernor(opt.governor_pct > 0.0f, opt.governor_pct / 100.0f);
+
+    // Same preset set LoadSongPresets gives the module
+    std::vector<SynthPresetUse> uses;
+    for(uint16_t i = 0; i < smf_player.ProgramUseCount(); i++)
+    {
+        const SmfPlayer::ProgramUse& use = smf_player.GetProgramUse(i);
+        uses.push_back(SynthPresetUse{use.bank, use.program, use.drums});
+    }
+    for(uint8_t ch = 0; ch < 16; ch++)
+    {
+        if(app_state.channels[ch].program_override < 0)
+            continue;
+        const uint8_t  program  = static_cast<uint8_t>(app_state.channels[ch].program_override);
+        const uint16_t bit      = static_cast<uint16_t>(1u << ch);
+        bool           has_bank = false;
+        for(uint16_t i = 0; i < smf_player.ProgramUseCount(); i++)
+        {
+            const SmfPlayer::ProgramUse& use = smf_player.GetProgramUse(i);
+            if(use.channels & bit)
+            {
+                uses.push_back(SynthPresetUse{use.bank, program, ch == 9});
+                has_bank = true;
+            }
+        }
+        if(!has_bank)
+            uses.push_back(SynthPresetUse{0, program, ch == 9});
+    }
+    const Clock::time_point presets_start = Clock::now();
+    const bool              presets_ok    = SynthRequirePresets(uses.data(), uses.size());
+    const double            presets_ms
+        = std::chrono::duration<double, std::milli>(Clock::now() - presets_start).count();
+
+    WavWriter wav;
+    if(!wav.Open(out_path.c_str(), uint32_t(opt.sample_rate), opt.pcm16))
+    {
+        say("%s: cannot write %s\n", midi_path, out_path.c_str());
+        return 1;
+    }
+
+    // Looping songs never end on their own; render whole passes instead.
+    const bool     looping    = app_state.song_loop_enabled && app_state.loop_length_beats > 0;
+    const int      ts_den     = smf_player.TimeSigDenominator() > 0 ? smf_player.TimeSigDenominator() : 4;
+    const uint64_t loop_frames = uint64_t(double(opt.sample_rate) * 60.0 / app_state.bpm * 4.0 / ts_den
+                                          * app_state.loop_length_beats);
+    const uint64_t tail_frames = uint64_t(opt.tail_seconds * opt.sample_rate);
+    const uint64_t cap_frames  = uint64_t(opt.max_seconds * opt.sample_rate);
+
+    std::vector<float>    left(opt.block_size);
+    std::vector<float>    right(opt.block_size);
+    std::vector<uint32_t> block_ns;
+    std::vector<uint32_t> fx_block_ns;
+    float*                out[2] = {left.data(), right.data()};
+    const float*          in[2]  = {left.data(), right.data()};
+
+    app_state.transport_playing = true;
+    uint64_t song_end    = looping ? loop_frames * uint64_t(opt.loops) : UINT64_MAX;
+    int      peak_voices = 0;
+    uint64_t voice_frames = 0;
+    std::vector<std::pair<uint64_t, SynthGovernorEvent>> governor_log;
+    double   control_s  = 0.0;
+    bool     capped     = false;
+    SynthGovernorStats timing;
+    SynthGetGovernorStats(timing);
+    uint64_t fx_ns = timing.fx_ns;
+    const Clock::time_point render_start = Clock::now();
+    while(true)
+    {
+        const uint64_t now = transport.SampleClock();
+        if(song_end != UINT64_MAX && now >= song_end + tail_frames)
+            break;
+        if(now >= cap_frames)
+        {
+            capped = true;
+            break;
+        }
+
+        // The main loop's share: keep the parser ahead of the audio.
+        const Clock::time_point control_start = Clock::now();
+        if(now < song_end)
+            transport.Update(app_state);
+        SynthStreamService();
+        SynthGovernorService();
+        control_s += std::chrono::duration<double>(Clock::now() - control_start).count();
+        if(!looping && song_end == UINT64_MAX && !transport.IsPlaying())
+        {
+            // Everything is queued; let it play out from the last event.
+            app_state.transport_playing = false;
+            song_end = std::max(now, smf_player.SampleForTick(smf_player.TotalTicks()));
+        }
+
+        voice_frames += uint64_t(SynthActiveVoiceCount()) * opt.block_size;
+        const Clock::time_point block_start = Clock::now();
+        SynthBeginCallback();
+        transport.ProcessAudio(in, out, opt.block_size);
+        SynthEndCallback(opt.block_size);
+        block_ns.push_back(uint32_t(
+            std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - block_start).count()));
+        SynthGetGovernorStats(timing);
+        fx_block_ns.push_back(uint32_t(timing.fx_ns - fx_ns));
+        fx_ns = timing.fx_ns;
+
+        peak_voices = std::max(peak_voices, SynthActiveVoiceCount());
+        // Stamped with audio time, which is what matters here
+        SynthGovernorEvent event;
+        while(SynthPopGovernorEvent(event))
+            governor_log.emplace_back(now, event);
+        if(!wav.Write(left.data(), right.data(), opt.block_size))
+        {
+            say("%s: write failed\n", out_path.c_str());
+            return 1;
+        }
+    }
+    const double render_s = std::chrono::duration<double>(Clock::now() - render_start).count();
+    if(!wav.Close())
+    {
+        say("%s: write failed\n", out_path.c_str());
+        return 1;
+    }
+
+    const uint64_t frames  = transport.SampleClock();
+    const double   audio_s = double(frames) / opt.sample_rate;
+    const double   budget_ns = 1e9 * double(opt.block_size) / opt.sample_rate;
+    uint64_t       buckets[kBudgetBuckets]{};
+    uint64_t       total_ns = 0;
+    for(uint32_t ns : block_ns)
+    {
+        int b = 0;
+        while(b < kBudgetBuckets - 1 && ns * 100.0 >= kBudgetEdges[b] * budget_ns)
+            b++;
+        buckets[b]++;
+        total_ns += ns;
+    }
+    std::vector<uint32_t> sorted = block_ns;
+    std::sort(sorted.begin(), sorted.end());
+    const size_t   count = sorted.size();
+    const uint32_t p50   = count ? sorted[count / 2] : 0;
+    const uint32_t p99   = count ? sorted[std::min(count - 1, count * 99 / 100)] : 0;
+    const uint32_t worst = count ? sorted.back() : 0;
+
+    say("%s -> %s\n", midi_path, out_path.c_str());
+    say("  load: midi %.1f ms, %s, %u events, %u sysex%s%s\n",
+        open_ms,
+        smf_player.IsPredecoded() ? "predecoded" : "streaming",
+        smf_player.DecodedEventCount(),
+        smf_player.SysExCount(),
+        cfg_path.empty() ? "" : ", cfg ",
+        cfg_path.c_str());
+    say("  audio: %.2f s, %llu frames, %zu blocks of %zu%s%s\n",
+        audio_s,
+        static_cast<unsigned long long>(frames),
+        count,
+        opt.block_size,
+        looping ? ", looped" : "",
+        capped ? ", hit -m cap" : "");
+    say("  render: %.3f s wall, %.1fx realtime, control %.3f s\n",
+        render_s,
+        render_s > 0.0 ? audio_s / render_s : 0.0,
+        control_s);
+    // Whole-block time over voice-frames, so it includes the block's FX
+    // share; then the synth's own voice time (no FX) over its voice-frames.
+    SynthGovernorStats governor;
+    SynthGetGovernorStats(governor);
+    say("  voices: peak %d of %d, mean %.1f, %.1f ns per voice-sample, %.1f without FX\n",
+        peak_voices,
+        voices,
+        frames ? double(voice_frames) / double(frames) : 0.0,
+        voice_frames ? double(total_ns) / double(voice_frames) : 0.0,
+        governor.voice_frames ? double(governor.voice_ns) / double(governor.voice_frames) : 0.0);
+    SynthStreamStats stream;
+    SynthGetStreamStats(stream);
+    if(stream.active && opt.selective)
+        say("  presets: %zu requested, %lu resident, %lu paged in, %lu failed%s, %lu KB, %.1f ms\n",
+            uses.size(),
+            static_cast<unsigned long>(stream.resident_presets),
+            static_cast<unsigned long>(stream.page_ins),
+            static_cast<unsigned long>(stream.page_in_failures),
+            presets_ok ? "" : " (arena full)",
+            static_cast<unsigned long>(stream.resident_bytes / 1024),
+            presets_ms);
+    if(stream.active)
+        say("  stream: %lu refills, %lu KB read, %lu errors, %lu starved voices, %lu starved reads\n",
+            static_cast<unsigned long>(stream.refills),
+            static_cast<unsigned long>(stream.bytes_read / 1024),
+            static_cast<unsigned long>(stream.read_errors),
+            static_cast<unsigned long>(stream.starve_events),
+            static_cast<unsigned long>(stream.starved_reads));
+    if(governor.enabled)
+    {
+        say("  governor: callback us mean %.1f, load %.0f%%, peak %.0f%%, %lu over budget, "
+            "%lu transitions, %lu stolen voices\n",
+            governor.callbacks ? governor.callback_ns / 1000.0 / governor.callbacks : 0.0,
+            governor.load * 100.0f,
+            governor.peak_load * 100.0f,
+            static_cast<unsigned long>(governor.over_budget),
+            static_cast<unsigned long>(governor.transitions),
+            static_cast<unsigned long>(governor.stolen_voices));
+        say("  governor blocks:");
+        for(int tier = 0; tier < 4; tier++)
+            say(" %s %lu",
+                SynthQualityName(SynthQuality(tier)),
+                static_cast<unsigned long>(governor.tier_blocks[tier]));
+        say("\n");
+        for(const auto& entry : governor_log)
+            say("    %.3f s: %s -> %s at %u%%, %u voices\n",
+                double(entry.first) / opt.sample_rate,
+                SynthQualityName(entry.second.from),
+                SynthQualityName(entry.second.to),
+                entry.second.load_pct,
+                entry.second.voices);
+    }
+    // The synth's own clock: microseconds on the host
+    std::sort(fx_block_ns.begin(), fx_block_ns.end());
+    say("  fx: %.1f%% of voice time, block us mean %.1f, p99 %.1f, max %.1f, reverb idle blocks %lu\n",
+        governor.voice_ns ? 100.0 * double(governor.fx_ns) / double(governor.voice_ns) : 0.0,
+        count ? double(governor.fx_ns) / 1000.0 / count : 0.0,
+        count ? fx_block_ns[std::min(count - 1, count * 99 / 100)] / 1000.0 : 0.0,
+        count ? fx_block_ns.back() / 1000.0 : 0.0,
+        static_cast<unsigned long>(governor.reverb_idle_blocks));
+    say("  block us: mean %.1f, p50 %.1f, p99 %.1f, max %.1f, budget %.1f\n",
+        count ? total_ns / 1000.0 / count : 0.0,
+        p50 / 1000.0,
+        p99 / 1000.0,
+        worst / 1000.0,
+        budget_ns / 1000.0);
+    report += "  budget:";
+    for(int b = 0; b < kBudgetBuckets; b++)
+    {
+        if(b < kBudgetBuckets - 1)
+            say(" <%d%% %llu", kBudgetEdges[b], static_cast<unsigned long long>(buckets[b]));
+        else
+            say(" >=100%% %llu", static_cast<unsigned long long>(buckets[b]));
+    }
+    report += "\n";
+    return 0;
+}
+
+int RenderInWorker(const Options& opt, const char* midi_path)
+{
+    std::string report;
+    const int   rc = RenderSong(opt, midi_path, report);
+    // One write per song so parallel workers do not interleave.
+    std::fwrite(report.data(), 1, report.size(), stdout);
+    std::fflush(stdout);
+    return rc;
+}
+} // namespace
+
+int main(int argc, char** argv)
+{
+    Options opt;
+    if(!ParseOptions(argc, argv, opt))
+    {
+        Usage();
+        return 2;
+    }
+
+    SynthInit();
+    if(opt.stream_ms >= 0)
+        SynthSetSampleStreaming(uint32_t(opt.stream_ms), true);
+    SynthSetSelectiveLoading(opt.selective);
+    SynthSetSf2Cache(opt.sf2_cache);
+    const Clock::time_point sf2_start = Clock::now();
+    if(!SynthLoadSf2(opt.sf2, opt.sample_rate, 16))
+    {
+        std::fprintf(stderr, "render_wav: cannot load %s\n", opt.sf2);
+        return 1;
+    }
+    SynthLoadStats load;
+    SynthGetLoadStats(load);
+    std::printf("%s: loaded in %.1f ms, %zu KB synth arena, %zu KB samples%s\n",
+                opt.sf2,
+                std::chrono::duration<double, std::milli>(Clock::now() - sf2_start).count(),
+                SynthArenaUsed() / 1024,
+                SynthSampleBytes() / 1024,
+                load.from_cache ? ", from cache" : load.cache_written ? ", cache written" : "");
+    std::printf("  load ms: open %.1f, cache %.1f, parse %.1f, read %.1f, convert %.1f, fx %.1f\n",
+                load.open_us / 1000.0,
+                load.cache_us / 1000.0,
+                load.parse_us / 1000.0,
+                load.read_us / 1000.0,
+                load.convert_us / 1000.0,
+                load.fx_us / 1000.0);
+    SynthArenaStats arena;
+    SynthGetArenaStats(arena);
+    std::printf("  arena KB: %zu used, %zu free, %u reclaimed, %u reused; reallocs %u in place, %u moved\n",
+                arena.used / 1024,
+                arena.free_bytes / 1024,
+                arena.reclaimed_bytes / 1024,
+                arena.reused_bytes / 1024,
+                arena.in_place,
+                arena.moved);
+    std::printf("  fx KB (outside the arena): %u\n", arena.fx_bytes / 1024);
+    std::printf("  arena sites KB (live/peak, allocs):");
+    SynthArenaSite site;
+    for(size_t i = 0; SynthGetArenaSite(i, site); i++)
+        std::printf("%s %s %u/%u (%u)",
+                    i ? "," : "",
+                    site.name,
+                    site.live_bytes / 1024,
+                    site.peak_bytes / 1024,
+                    site.allocs);
+    std::printf("\n");
+    std::fflush(stdout);
+
+    smf_player.SetWorkMemory(smf_work_mem, sizeof(smf_work_mem));
+    smf_player.SetSampleRate(opt.sample_rate);
+    smf_player.SetLookaheadSamples(opt.block_size * 256);
+    transport.Init(opt.sample_rate, smf_player);
+
+    if(opt.songs.size() == 1)
+        return RenderInWorker(opt, opt.songs[0]);
+
+    // The loaded SoundFont is shared copy-on-write; each worker starts from
+    // the same clean synth and FX state.
+    const Clock::time_point batch_start = Clock::now();
+    size_t next    = 0;
+    int    running = 0;
+    int    failed  = 0;
+    while(next < opt.songs.size() || running > 0)
+    {
+        if(next < opt.songs.size() && running < opt.jobs)
+        {
+            const pid_t pid = fork();
+            if(pid == 0)
+                _exit(RenderInWorker(opt, opt.songs[next]));
+            if(pid < 0)
+            {
+                std::fprintf(stderr, "render_wav: fork failed\n");
+                failed++;
+            }
+            else
+            {
+                running++;
+            }
+            next++;
+            continue;
+        }
+
+        int status = 0;
+        if(wait(&status) < 0)
+            break;
+        running--;
+        if(!WIFEXITED(status) || WEXITSTATUS(status) != 0)
+            failed++;
+    }
+
+    std::printf("%zu songs, %d failed, %.2f s wall, %d jobs\n",
+                opt.songs.size(),
+                failed,
+                std::chrono::duration<double>(Clock::now() - batch_start).count(),
+                opt.jobs);
+    return failed ? 1 : 0;
+}
@@ -0,0 +1,31 @@
+// Host stand-in for the parts of libDaisy the playback core touches: the
+// audio buffer types, the system clock and the SDRAM section attributes.
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+#define DSY_SDRAM_BSS
+#define DSY_SDRAM_DATA
+
+namespace daisy
+{
+
+class AudioHandle
+{
+  public:
+    typedef const float* const* InputBuffer;
+    typedef float**             OutputBuffer;
+};
+
+class System
+{
+  public:
+    // Milliseconds / microseconds since first use, wrapping like the
+    // hardware counters.
+    static uint32_t GetNow();
+    static uint32_t GetUs();
+    static void     Delay(uint32_t delay_ms);
+};
+
+} // namespace daisy
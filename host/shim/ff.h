@@ -0,0 +1,99 @@
+/* Host stand-in for the FatFs API the playback core uses, backed by POSIX files.
+ *
+ * Drive-prefixed paths ("0:/midi/song.mid") resolve under the root set with
+ * ff_host_set_root (default "."); anything else is used as a plain host path.
+ * Types, result codes and mode flags keep their FatFs names and values.
+ */
+#pragma once
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+typedef unsigned int UINT;
+typedef uint8_t      BYTE;
+typedef uint16_t     WORD;
+typedef uint32_t     DWORD;
+typedef DWORD        FSIZE_t; /* no exFAT on the module */
+
+typedef enum
+{
+    FR_OK = 0,
+    FR_DISK_ERR,
+    FR_INT_ERR,
+    FR_NOT_READY,
+    FR_NO_FILE,
+    FR_NO_PATH,
+    FR_INVALID_NAME,
+    FR_DENIED,
+    FR_EXIST,
+    FR_INVALID_OBJECT,
+    FR_WRITE_PROTECTED,
+    FR_INVALID_DRIVE,
+    FR_NOT_ENABLED,
+    FR_NO_FILESYSTEM,
+    FR_MKFS_ABORTED,
+    FR_TIMEOUT,
+    FR_LOCKED,
+    FR_NOT_ENOUGH_CORE,
+    FR_TOO_MANY_OPEN_FILES,
+    FR_INVALID_PARAMETER
+} FRESULT;
+
+#define FA_READ 0x01
+#define FA_WRITE 0x02
+#define FA_OPEN_EXISTING 0x00
+#define FA_CREATE_NEW 0x04
+#define FA_CREATE_ALWAYS 0x08
+#define FA_OPEN_ALWAYS 0x10
+#define FA_OPEN_APPEND 0x30
+
+#define AM_RDO 0x01
+#define AM_DIR 0x10
+
+typedef struct
+{
+    FSIZE_t objsize;
+} FFOBJID;
+
+typedef struct
+{
+    FFOBJID obj;
+    BYTE    flag;
+    FSIZE_t fptr;
+    int     host_fd; /* descriptor + 1; 0 when closed */
+} FIL;
+
+typedef struct
+{
+    FSIZE_t fsize;
+    WORD    fdate;
+    WORD    ftime;
+    BYTE    fattrib;
+    char    fname[256];
+} FILINFO;
+
+FRESULT f_open(FIL* fp, const char* path, BYTE mode);
+FRESULT f_close(FIL* fp);
+FRESULT f_read(FIL* fp, void* buff, UINT btr, UINT* br);
+FRESULT f_write(FIL* fp, const void* buff, UINT btw, UINT* bw);
+FRESULT f_lseek(FIL* fp, FSIZE_t ofs);
+FRESULT f_sync(FIL* fp);
+FRESULT f_stat(const char* path, FILINFO* fno);
+FRESULT f_unlink(const char* path);
+FRESULT f_rename(const char* path_old, const char* path_new);
+FRESULT f_mkdir(const char* path);
+
+#define f_eof(fp) ((int)((fp)->fptr == (fp)->obj.objsize))
+#define f_tell(fp) ((fp)->fptr)
+#define f_size(fp) ((fp)->obj.objsize)
+
+/* Host-only: directory that "N:/" paths resolve under. */
+void ff_host_set_root(const char* dir);
+
+#ifdef __cplusplus
+}
+#endif
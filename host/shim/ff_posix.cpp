@@ -0,0 +1,248 @@
+#include "ff.h"
+
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <ctime>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace
+{
+char g_root[512] = ".";
+
+// "0:/midi/a.mid" -> "<root>/midi/a.mid"; other paths pass through.
+const char* HostPath(const char* path, char* out, size_t out_size)
+{
+    if(path == nullptr)
+        return nullptr;
+    if(path[0] >= '0' && path[0] <= '9' && path[1] == ':')
+    {
+        const char* rest = path + 2;
+        while(*rest == '/')
+            rest++;
+        std::snprintf(out, out_size, "%s/%s", g_root, rest);
+        return out;
+    }
+    return path;
+}
+
+FRESULT ErrnoResult()
+{
+    switch(errno)
+    {
+        case ENOENT: return FR_NO_FILE;
+        case ENOTDIR: return FR_NO_PATH;
+        case EACCES:
+        case EPERM: return FR_DENIED;
+        case EEXIST: return FR_EXIST;
+        case EROFS: return FR_WRITE_PROTECTED;
+        case EMFILE:
+        case ENFILE: return FR_TOO_MANY_OPEN_FILES;
+        default: return FR_DISK_ERR;
+    }
+}
+
+// Reads and writes go through pread/pwrite at fptr, so a descriptor shared
+// with forked processes (render_wav workers) never races on a file offset.
+int HostFd(FIL* fp)
+{
+    return (fp && fp->host_fd > 0) ? fp->host_fd - 1 : -1;
+}
+} // namespace
+
+extern "C"
+{
+void ff_host_set_root(const char* dir)
+{
+    std::snprintf(g_root, sizeof(g_root), "%s", (dir && dir[0]) ? dir : ".");
+}
+
+FRESULT f_open(FIL* fp, const char* path, BYTE mode)
+{
+    if(fp == nullptr)
+        return FR_INVALID_OBJECT;
+    std::memset(fp, 0, sizeof(*fp));
+
+    char        buf[1024];
+    const char* host = HostPath(path, buf, sizeof(buf));
+    if(host == nullptr)
+        return FR_INVALID_NAME;
+
+    struct stat st;
+    const bool  exists = ::stat(host, &st) == 0;
+    if(exists && (mode & FA_CREATE_NEW))
+        return FR_EXIST;
+    if(exists && S_ISDIR(st.st_mode))
+        return FR_DENIED;
+
+    int flags = O_RDONLY;
+    if(mode & FA_WRITE)
+    {
+        flags = (mode & FA_READ) ? O_RDWR : O_WRONLY;
+        if(mode & (FA_CREATE_ALWAYS | FA_CREATE_NEW))
+            flags |= O_CREAT | O_TRUNC;
+        else if(mode & FA_OPEN_ALWAYS)
+            flags |= O_CREAT;
+        else if(!exists)
+            return FR_NO_FILE;
+    }
+    else if(!exists)
+    {
+        return FR_NO_FILE;
+    }
+
+    const int fd = ::open(host, flags, 0644);
+    if(fd < 0)
+        return ErrnoResult();
+
+    struct stat opened;
+    fp->obj.objsize = ::fstat(fd, &opened) == 0 ? FSIZE_t(opened.st_size) : 0;
+    fp->flag    = mode;
+    fp->host_fd = fd + 1;
+    if((mode & FA_OPEN_APPEND) == FA_OPEN_APPEND)
+        return f_lseek(fp, fp->obj.objsize);
+    return FR_OK;
+}
+
+FRESULT f_close(FIL* fp)
+{
+    const int fd = HostFd(fp);
+    if(fd < 0)
+        return FR_INVALID_OBJECT;
+    fp->host_fd = 0;
+    return ::close(fd) == 0 ? FR_OK : FR_DISK_ERR;
+}
+
+FRESULT f_read(FIL* fp, void* buff, UINT btr, UINT* br)
+{
+    if(br)
+        *br = 0;
+    const int fd = HostFd(fp);
+    if(fd < 0)
+        return FR_INVALID_OBJECT;
+    if(!(fp->flag & FA_READ))
+        return FR_DENIED;
+
+    size_t n = 0;
+    while(n < btr)
+    {
+        const ssize_t got = ::pread(fd, static_cast<char*>(buff) + n, btr - n, off_t(fp->fptr + n));
+        if(got < 0 && errno == EINTR)
+            continue;
+        if(got < 0)
+            return FR_DISK_ERR;
+        if(got == 0)
+            break;
+        n += size_t(got);
+    }
+    fp->fptr += FSIZE_t(n);
+    if(br)
+        *br = UINT(n);
+    return FR_OK;
+}
+
+FRESULT f_write(FIL* fp, const void* buff, UINT btw, UINT* bw)
+{
+    if(bw)
+        *bw = 0;
+    const int fd = HostFd(fp);
+    if(fd < 0)
+        return FR_INVALID_OBJECT;
+    if(!(fp->flag & FA_WRITE))
+        return FR_DENIED;
+
+    size_t n = 0;
+    while(n < btw)
+    {
+        const ssize_t put
+            = ::pwrite(fd, static_cast<const char*>(buff) + n, btw - n, off_t(fp->fptr + n));
+        if(put < 0 && errno == EINTR)
+            continue;
+        if(put <= 0)
+            break;
+        n += size_t(put);
+    }
+    fp->fptr += FSIZE_t(n);
+    if(fp->fptr > fp->obj.objsize)
+        fp->obj.objsize = fp->fptr;
+    if(bw)
+        *bw = UINT(n);
+    return n == btw ? FR_OK : FR_DISK_ERR;
+}
+
+FRESULT f_lseek(FIL* fp, FSIZE_t ofs)
+{
+    if(HostFd(fp) < 0)
+        return FR_INVALID_OBJECT;
+    // Like FatFs, a read-only file cannot be seeked past its end.
+    if(!(fp->flag & FA_WRITE) && ofs > fp->obj.objsize)
+        ofs = fp->obj.objsize;
+    fp->fptr = ofs;
+    return FR_OK;
+}
+
+FRESULT f_sync(FIL* fp)
+{
+    const int fd = HostFd(fp);
+    if(fd < 0)
+        return FR_INVALID_OBJECT;
+    return ::fsync(fd) == 0 ? FR_OK : FR_DISK_ERR;
+}
+
+FRESULT f_stat(const char* path, FILINFO* fno)
+{
+    char        buf[1024];
+    const char* host = HostPath(path, buf, sizeof(buf));
+    struct stat st;
+    if(host == nullptr || ::stat(host, &st) != 0)
+        return FR_NO_FILE;
+    if(fno != nullptr)
+    {
+        std::memset(fno, 0, sizeof(*fno));
+        fno->fsize   = FSIZE_t(st.st_size);
+        fno->fattrib = S_ISDIR(st.st_mode) ? AM_DIR : 0;
+        // FAT timestamps: date 7/4/5 bits year-1980/month/day, time 5/6/5
+        // bits hour/minute/second/2.
+        struct tm mtime;
+        if(::localtime_r(&st.st_mtime, &mtime) != nullptr && mtime.tm_year >= 80)
+        {
+            fno->fdate = WORD(((mtime.tm_year - 80) << 9) | ((mtime.tm_mon + 1) << 5) | mtime.tm_mday);
+            fno->ftime = WORD((mtime.tm_hour << 11) | (mtime.tm_min << 5) | (mtime.tm_sec / 2));
+        }
+        const char* name = std::strrchr(host, '/');
+        std::snprintf(fno->fname, sizeof(fno->fname), "%.255s", name ? name + 1 : host);
+    }
+    return FR_OK;
+}
+
+FRESULT f_unlink(const char* path)
+{
+    char        buf[1024];
+    const char* host = HostPath(path, buf, sizeof(buf));
+    if(host == nullptr)
+        return FR_INVALID_NAME;
+    return std::remove(host) == 0 ? FR_OK : ErrnoResult();
+}
+
+FRESULT f_rename(const char* path_old, const char* path_new)
+{
+    char        buf_old[1024];
+    char        buf_new[1024];
+    const char* host_old = HostPath(path_old, buf_old, sizeof(buf_old));
+    const char* host_new = HostPath(path_new, buf_new, sizeof(buf_new));
+    if(host_old == nullptr || host_new == nullptr)
+        return FR_INVALID_NAME;
+    return std::rename(host_old, host_new) == 0 ? FR_OK : ErrnoResult();
+}
+
+FRESULT f_mkdir(const char* path)
+{
+    char        buf[1024];
+    const char* host = HostPath(path, buf, sizeof(buf));
+    if(host == nullptr)
+        return FR_INVALID_NAME;
+    return ::mkdir(host, 0755) == 0 ? FR_OK : ErrnoResult();
+}
+}
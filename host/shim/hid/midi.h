@@ -0,0 +1,96 @@
+// Host stand-in for libDaisy's parsed MIDI message, covering the channel
+// messages MixerTransport::HandleMidiMessage reads. Names and layouts follow
+// libDaisy so code written against one builds against the other.
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+namespace daisy
+{
+
+enum class MidiMessageType
+{
+    NoteOff,
+    NoteOn,
+    PolyphonicKeyPressure,
+    ControlChange,
+    ProgramChange,
+    ChannelPressure,
+    PitchBend,
+    SystemCommon,
+    SystemRealTime,
+    ChannelMode,
+    MessageLast,
+};
+
+enum class ChannelModeType
+{
+    AllSoundOff,
+    ResetAllControllers,
+    LocalControl,
+    AllNotesOff,
+    OmniModeOff,
+    OmniModeOn,
+    MonoModeOn,
+    PolyModeOn,
+    ChannelModeLast,
+};
+
+struct NoteOffEvent
+{
+    int     channel;
+    uint8_t note;
+    uint8_t velocity;
+};
+
+struct NoteOnEvent
+{
+    int     channel;
+    uint8_t note;
+    uint8_t velocity;
+};
+
+struct ControlChangeEvent
+{
+    int     channel;
+    uint8_t control_number;
+    uint8_t value;
+};
+
+struct ProgramChangeEvent
+{
+    int     channel;
+    uint8_t program;
+};
+
+struct ChannelModeEvent
+{
+    int             channel;
+    ChannelModeType event_type;
+    uint8_t         value;
+};
+
+struct MidiEvent
+{
+    MidiMessageType type    = MidiMessageType::MessageLast;
+    int             channel = 0;
+    uint8_t         data[2]{};
+
+    NoteOffEvent AsNoteOff() const { return NoteOffEvent{channel, data[0], data[1]}; }
+    NoteOnEvent  AsNoteOn() const { return NoteOnEvent{channel, data[0], data[1]}; }
+    ControlChangeEvent AsControlChange() const
+    {
+        return ControlChangeEvent{channel, data[0], data[1]};
+    }
+    ProgramChangeEvent AsProgramChange() const { return ProgramChangeEvent{channel, data[0]}; }
+    ChannelModeEvent   AsChannelMode() const
+    {
+        ChannelModeEvent m{channel, ChannelModeType::ChannelModeLast, data[1]};
+        if(data[0] >= 120 && data[0] <= 127)
+            m.event_type = static_cast<ChannelModeType>(data[0] - 120);
+        return m;
+    }
+};
+
+} // namespace daisy
@@ -0,0 +1,37 @@
+#include "daisy_patch_sm.h"
+
+#include <chrono>
+#include <thread>
+
+namespace daisy
+{
+
+namespace
+{
+using Clock = std::chrono::steady_clock;
+
+Clock::time_point Epoch()
+{
+    static const Clock::time_point epoch = Clock::now();
+    return epoch;
+}
+} // namespace
+
+uint32_t System::GetNow()
+{
+    return uint32_t(
+        std::chrono::duration_cast<std::chrono::milliseconds>(Clock::now() - Epoch()).count());
+}
+
+uint32_t System::GetUs()
+{
+    return uint32_t(
+        std::chrono::duration_cast<std::chrono::microseconds>(Clock::now() - Epoch()).count());
+}
+
+void System::Delay(uint32_t delay_ms)
+{
+    std::this_thread::sleep_for(std::chrono::milliseconds(delay_ms));
+}
+
+} // namespace daisy
@@ -0,0 +1,18 @@
+// Host stand-in: the host render loop calls the audio path from the same
+// thread as the control code, so there is nothing to block.
+#pragma once
+
+namespace daisy
+{
+
+class ScopedIrqBlocker
+{
+  public:
+    ScopedIrqBlocker() {}
+    ~ScopedIrqBlocker() {}
+
+    ScopedIrqBlocker(const ScopedIrqBlocker&)            = delete;
+    ScopedIrqBlocker& operator=(const ScopedIrqBlocker&) = delete;
+};
+
+} // namespace daisy
@@ -0,0 +1,293 @@
+// SF2 cache images (SynthSetSf2Cache) through the synth itself, on the
+// POSIX FatFs shim: a cached load renders like the parse that wrote it, and
+// a cache file that is truncated, padded, stamped for another bank or has a
+// damaged image is turned down before any of it is rebased. The bank is then
+// parsed again, renders the same and the cache is rewritten. A cache load
+// also takes over the arena's sites and free list as the parse left them.
+// Run for both a resident and a streamed bank, whose images differ.
+
+#include "test_common.h"
+
+#include <cstdlib>
+#include <cstring>
+#include <unistd.h>
+
+#include "ff.h"
+#include "synth_tsf.h"
+
+using namespace tsf_test;
+
+namespace
+{
+constexpr float  kSampleRate = 48000.0f;
+constexpr int    kVoices     = 8;
+constexpr size_t kBlock      = 32;
+constexpr size_t kBlocks     = 64;
+
+std::string g_dir;
+
+std::string HostFile(const char* name)
+{
+    return g_dir + "/" + name;
+}
+
+bool WriteFile(const std::string& path, const std::vector<uint8_t>& bytes)
+{
+    FILE* f = std::fopen(path.c_str(), "wb");
+    if(!f)
+        return false;
+    const bool ok = std::fwrite(bytes.data(), 1, bytes.size(), f) == bytes.size();
+    return std::fclose(f) == 0 && ok;
+}
+
+std::vector<uint8_t> ReadFile(const std::string& path)
+{
+    std::vector<uint8_t> bytes;
+    FILE*                f = std::fopen(path.c_str(), "rb");
+    if(!f)
+        return bytes;
+    uint8_t buf[4096];
+    size_t  n;
+    while((n = std::fread(buf, 1, sizeof(buf), f)) > 0)
+        bytes.insert(bytes.end(), buf, buf + n);
+    std::fclose(f);
+    return bytes;
+}
+
+// Two melodic presets and a drum kit, looped and one-shot samples
+std::vector<uint8_t> BuildTestBank()
+{
+    Sample tone;
+    tone.data       = Sine(4000, 100.0);
+    tone.loop_start = 1000;
+    tone.loop_end   = 3900;
+    Sample hit;
+    hit.data = Sine(3000, 37.0, 9000.0);
+
+    Preset piano;
+    piano.name    = "Piano";
+    piano.regions = {Region{0, 0, 63}, Region{1, 64, 127}};
+    Preset organ;
+    organ.name    = "Organ";
+    organ.program = 16;
+    organ.regions = {Region{0}};
+    Preset kit;
+    kit.name    = "Kit";
+    kit.bank    = 128;
+    kit.regions = {Region{1, 0, 127, 0, 127, false}};
+    return BuildSf2({tone, hit}, {piano, organ, kit});
+}
+
+struct Load
+{
+    bool ok;
+    bool from_cache;
+    bool cache_written;
+};
+
+Load LoadBank()
+{
+    const bool     ok = SynthLoadSf2("0:/test.sf2", kSampleRate, kVoices);
+    SynthLoadStats stats;
+    SynthGetLoadStats(stats);
+    return Load{ok, stats.from_cache, stats.cache_written};
+}
+
+// Arena counters and per-site use, which a cache load carries over
+std::string ArenaSummary()
+{
+    SynthArenaStats stats;
+    SynthGetArenaStats(stats);
+    char line[160];
+    std::snprintf(line,
+                  sizeof(line),
+                  "used %zu free %zu reclaimed %lu reused %lu lost %lu in place %lu moved %lu\n",
+                  stats.used,
+                  stats.free_bytes,
+                  static_cast<unsigned long>(stats.reclaimed_bytes),
+                  static_cast<unsigned long>(stats.reused_bytes),
+                  static_cast<unsigned long>(stats.lost_bytes),
+                  static_cast<unsigned long>(stats.in_place),
+                  static_cast<unsigned long>(stats.moved));
+    std::string summary = line;
+    for(size_t i = 0; i < SynthArenaSiteCount(); i++)
+    {
+        SynthArenaSite site;
+        SynthGetArenaSite(i, site);
+        std::snprintf(line,
+                      sizeof(line),
+                      "%s: %lu allocs, %lu live, %lu peak\n",
+                      site.name,
+                      static_cast<unsigned long>(site.allocs),
+                      static_cast<unsigned long>(site.live_bytes),
+                      static_cast<unsigned long>(site.peak_bytes));
+        summary += line;
+    }
+    return summary;
+}
+
+// Dry notes only: with both sends at zero the chorus and reverb only ever
+// see silence, so renders after separate loads compare exactly.
+std::vector<float> Render()
+{
+    std::vector<float> out(2 * kBlock * kBlocks);
+    for(uint8_t ch : {0, 1, 9})
+    {
+        SynthControlChange(ch, 91, 0);
+        SynthControlChange(ch, 93, 0);
+    }
+    SynthProgramChange(1, 16);
+    SynthNoteOn(0, 48, 100);
+    SynthNoteOn(0, 72, 90);
+    SynthNoteOn(1, 60, 110);
+    SynthNoteOn(9, 38, 127);
+    for(size_t b = 0; b < kBlocks; b++)
+    {
+        if(b == kBlocks / 2)
+            SynthNoteOff(0, 72);
+        SynthRender(&out[2 * b * kBlock], &out[(2 * b + 1) * kBlock], kBlock);
+    }
+    SynthPanic();
+    return out;
+}
+
+// A damaged cache must fall back to the SF2 and replace the file
+void CheckRejected(const char*                 what,
+                   const std::vector<uint8_t>& cache,
+                   const std::vector<float>&   reference)
+{
+    const std::string path = HostFile(".cache/test.tsfc");
+    TEST_CHECK(WriteFile(path, cache), "%s: cannot write the cache", what);
+    const Load load = LoadBank();
+    TEST_CHECK(load.ok, "%s: load failed", what);
+    TEST_CHECK(!load.from_cache, "%s: damaged cache accepted", what);
+    TEST_CHECK(load.cache_written, "%s: cache not rewritten", what);
+    TEST_CHECK(Render() == reference, "%s: render differs from the parse", what);
+}
+
+void TestCache(const char* mode)
+{
+    std::printf("%s bank\n", mode);
+    unlink(HostFile(".cache/test.tsfc").c_str());
+
+    const Load parsed = LoadBank();
+    TEST_CHECK(parsed.ok && !parsed.from_cache && parsed.cache_written,
+               "first load: ok %d, from cache %d, written %d",
+               parsed.ok,
+               parsed.from_cache,
+               parsed.cache_written);
+    const std::string        arena     = ArenaSummary();
+    const std::vector<float> reference = Render();
+    float                    peak      = 0.0f;
+    for(float v : reference)
+        peak = std::fmax(peak, std::fabs(v));
+    TEST_CHECK(peak > 0.01f, "reference render is silent (peak %g)", peak);
+
+    const Load cached = LoadBank();
+    TEST_CHECK(cached.ok && cached.from_cache, "clean cache not used");
+    TEST_CHECK(ArenaSummary() == arena,
+               "arena after a cache load:\n%s\nafter the parse:\n%s",
+               ArenaSummary().c_str(),
+               arena.c_str());
+    TEST_CHECK(Render() == reference, "cached render differs from the parse");
+
+    const std::vector<uint8_t> good = ReadFile(HostFile(".cache/test.tsfc"));
+    SynthLoadStats             stats;
+    SynthGetLoadStats(stats);
+    TEST_CHECK(good.size() > stats.image_bytes, "cache of %zu bytes for a %lu byte image",
+               good.size(),
+               static_cast<unsigned long>(stats.image_bytes));
+    if(good.size() <= stats.image_bytes)
+        return;
+    // The image is the tail of the file
+    const size_t image = good.size() - stats.image_bytes;
+
+    std::vector<uint8_t> bad = good;
+    bad.pop_back();
+    CheckRejected("one byte short", bad, reference);
+
+    bad.assign(good.begin(), good.begin() + image / 2);
+    CheckRejected("header cut", bad, reference);
+
+    bad = good;
+    bad.push_back(0);
+    CheckRejected("one byte over", bad, reference);
+
+    bad    = good;
+    bad[0] = 'X';
+    CheckRejected("bad magic", bad, reference);
+
+    bad = good;
+    std::fill(bad.begin() + image, bad.end(), 0xFF);
+    CheckRejected("image of 0xFF", bad, reference);
+
+    bad = good;
+    std::fill(bad.begin() + image, bad.end(), 0x00);
+    CheckRejected("zeroed image", bad, reference);
+
+    // Each pointer-sized word that could be an image offset, pointed past
+    // the image in turn. Real pointers must get the image turned down; any
+    // other word may be taken, and then the bank must still load. Every
+    // 4-byte step is tried.
+    int candidates = 0;
+    int rejected   = 0;
+    for(size_t at = 0; at + sizeof(void*) <= stats.image_bytes; at += 4)
+    {
+        uintptr_t word;
+        std::memcpy(&word, &good[image + at], sizeof(word));
+        if(word == 0 || word >= stats.image_bytes)
+            continue;
+        candidates++;
+        bad                 = good;
+        const uintptr_t far = uintptr_t(stats.image_bytes) + 64;
+        std::memcpy(&bad[image + at], &far, sizeof(far));
+        TEST_CHECK(WriteFile(HostFile(".cache/test.tsfc"), bad), "cannot write the cache");
+        const Load load = LoadBank();
+        TEST_CHECK(load.ok, "offset %zu: load failed", at);
+        if(!load.from_cache)
+        {
+            rejected++;
+            TEST_CHECK(Render() == reference, "offset %zu: render differs from the parse", at);
+        }
+        else
+        {
+            Render();
+        }
+    }
+    std::printf("  %d of %d offset-like words turned the image down\n", rejected, candidates);
+    TEST_CHECK(rejected > 0, "no damaged image turned down");
+
+    TEST_CHECK(WriteFile(HostFile(".cache/test.tsfc"), good), "cannot write the cache");
+    const Load again = LoadBank();
+    TEST_CHECK(again.ok && again.from_cache, "restored cache not used");
+    TEST_CHECK(Render() == reference, "restored cache renders differently");
+}
+} // namespace
+
+int main()
+{
+    char dir[] = "/tmp/synth_cache_test.XXXXXX";
+    if(!mkdtemp(dir))
+    {
+        std::printf("synth_cache_test: no temp dir\n");
+        return 1;
+    }
+    g_dir = dir;
+    ff_host_set_root(dir);
+    TEST_CHECK(WriteFile(HostFile("test.sf2"), BuildTestBank()), "cannot write the SF2");
+
+    SynthInit();
+    SynthSetSf2Cache(true);
+    TestCache("resident");
+#ifndef SYNTH_SF2_FLOAT_SAMPLES
+    SynthSetSampleStreaming(20, true);
+    TestCache("streamed");
+#endif
+    SynthUnloadSf2();
+
+    unlink(HostFile(".cache/test.tsfc").c_str());
+    rmdir(HostFile(".cache").c_str());
+    unlink(HostFile("test.sf2").c_str());
+    rmdir(dir);
+    return Finish("synth_cache_test");
+}
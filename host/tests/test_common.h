@@ -0,0 +1,236 @@
+#pragma once
+// Shared by the host tests: checks that report and keep going, and an
+// in-memory SoundFont writer, so each test builds exactly the bank it needs.
+
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace tsf_test
+{
+// -----------------------------
+// Checks: report and count, keep going
+// -----------------------------
+static int g_failures = 0;
+
+#define TEST_CHECK(cond, ...)                                     \
+    do                                                            \
+    {                                                             \
+        if(!(cond))                                               \
+        {                                                         \
+            std::printf("%s:%d: FAIL: ", __FILE__, __LINE__);     \
+            std::printf(__VA_ARGS__);                             \
+            std::printf("\n");                                    \
+            tsf_test::g_failures++;                               \
+        }                                                         \
+    } while(0)
+
+inline int Finish(const char* name)
+{
+    if(g_failures)
+        std::printf("%s: %d failure(s)\n", name, g_failures);
+    else
+        std::printf("%s: ok\n", name);
+    return g_failures ? 1 : 0;
+}
+
+// -----------------------------
+// In-memory SoundFont: one instrument per preset, one zone per region
+// -----------------------------
+enum Gen : uint16_t
+{
+    kGenChorusSend  = 15,
+    kGenReverbSend  = 16,
+    kGenPan         = 17,
+    kGenInstrument  = 41,
+    kGenKeyRange    = 43,
+    kGenVelRange    = 44,
+    kGenSampleId    = 53,
+    kGenSampleModes = 54,
+};
+
+struct Sample
+{
+    std::vector<int16_t> data;
+    uint32_t             loop_start = 0, loop_end = 0; // in data
+    uint32_t             rate       = 44100;
+    uint8_t              root       = 60;
+};
+
+struct Region
+{
+    int     sample = 0;
+    uint8_t lokey = 0, hikey = 127, lovel = 0, hivel = 127;
+    bool    loop  = true;
+    std::vector<std::pair<uint16_t, int16_t>> gens; // extra generators
+};
+
+struct Preset
+{
+    std::string         name    = "Test";
+    uint16_t            bank    = 0;
+    uint16_t            program = 0;
+    std::vector<Region> regions;
+};
+
+inline void Put16(std::vector<uint8_t>& b, uint32_t v)
+{
+    b.push_back(uint8_t(v));
+    b.push_back(uint8_t(v >> 8));
+}
+
+inline void Put32(std::vector<uint8_t>& b, uint32_t v)
+{
+    Put16(b, v & 0xFFFF);
+    Put16(b, v >> 16);
+}
+
+inline void PutName(std::vector<uint8_t>& b, const std::string& s)
+{
+    for(size_t i = 0; i < 20; i++)
+        b.push_back(i < s.size() && i < 19 ? uint8_t(s[i]) : 0);
+}
+
+inline void PutChunk(std::vector<uint8_t>&       b,
+                     const char*                 id,
+                     const std::vector<uint8_t>& data)
+{
+    b.insert(b.end(), id, id + 4);
+    Put32(b, uint32_t(data.size()));
+    b.insert(b.end(), data.begin(), data.end());
+    if(data.size() & 1)
+        b.push_back(0);
+}
+
+inline void PutGen(std::vector<uint8_t>& b, uint16_t gen, uint16_t amount)
+{
+    Put16(b, gen);
+    Put16(b, amount);
+}
+
+// Samples are stored back to back, each followed by the 46 zero samples the
+// specification asks for.
+inline std::vector<uint8_t> BuildSf2(const std::vector<Sample>& samples,
+                                     const std::vector<Preset>& presets)
+{
+    std::vector<uint8_t> info, ifil, isng, inam;
+    Put16(ifil, 2);
+    Put16(ifil, 1);
+    const char eng[] = "EMU8000";
+    isng.assign(eng, eng + sizeof(eng));
+    inam.assign(eng, eng + sizeof(eng));
+    info.insert(info.end(), {'I', 'N', 'F', 'O'});
+    PutChunk(info, "ifil", ifil);
+    PutChunk(info, "isng", isng);
+    PutChunk(info, "INAM", inam);
+
+    std::vector<uint8_t>  smpl, shdr;
+    for(const Sample& s : samples)
+    {
+        const uint32_t start = uint32_t(smpl.size() / 2);
+        for(int16_t v : s.data)
+            Put16(smpl, uint16_t(v));
+        for(int i = 0; i < 46; i++)
+            Put16(smpl, 0);
+        PutName(shdr, "smp");
+        Put32(shdr, start);
+        Put32(shdr, start + uint32_t(s.data.size()));
+        Put32(shdr, start + s.loop_start);
+        Put32(shdr, start + s.loop_end);
+        Put32(shdr, s.rate);
+        shdr.push_back(s.root);
+        shdr.push_back(0); // correction
+        Put16(shdr, 0);    // link
+        Put16(shdr, 1);    // mono
+    }
+    PutName(shdr, "EOS");
+    shdr.resize(shdr.size() + 26, 0);
+
+    std::vector<uint8_t> phdr, pbag, pgen, inst, ibag, igen;
+    uint16_t             ibagIndex = 0, igenIndex = 0;
+    for(size_t p = 0; p < presets.size(); p++)
+    {
+        PutName(phdr, presets[p].name);
+        Put16(phdr, presets[p].program);
+        Put16(phdr, presets[p].bank);
+        Put16(phdr, uint16_t(p)); // preset bag
+        Put32(phdr, 0);
+        Put32(phdr, 0);
+        Put32(phdr, 0);
+        Put16(pbag, uint16_t(p)); // one generator each
+        Put16(pbag, 0);
+        PutGen(pgen, kGenInstrument, uint16_t(p));
+
+        PutName(inst, presets[p].name);
+        Put16(inst, ibagIndex);
+        for(const Region& r : presets[p].regions)
+        {
+            Put16(ibag, igenIndex);
+            Put16(ibag, 0);
+            ibagIndex++;
+            PutGen(igen, kGenKeyRange, uint16_t(r.lokey | (r.hikey << 8)));
+            PutGen(igen, kGenVelRange, uint16_t(r.lovel | (r.hivel << 8)));
+            for(const auto& g : r.gens)
+                PutGen(igen, g.first, uint16_t(g.second));
+            PutGen(igen, kGenSampleModes, r.loop ? 1 : 0);
+            PutGen(igen, kGenSampleId, uint16_t(r.sample));
+            igenIndex += uint16_t(4 + r.gens.size());
+        }
+    }
+    PutName(phdr, "EOP");
+    Put16(phdr, 0);
+    Put16(phdr, 0);
+    Put16(phdr, uint16_t(presets.size()));
+    Put32(phdr, 0);
+    Put32(phdr, 0);
+    Put32(phdr, 0);
+    Put16(pbag, uint16_t(presets.size()));
+    Put16(pbag, 0);
+    PutGen(pgen, 0, 0);
+    PutName(inst, "EOI");
+    Put16(inst, ibagIndex);
+    Put16(ibag, igenIndex);
+    Put16(ibag, 0);
+    PutGen(igen, 0, 0);
+    const std::vector<uint8_t> mod(10, 0);
+
+    std::vector<uint8_t> sdta = {'s', 'd', 't', 'a'}, pdta = {'p', 'd', 't', 'a'};
+    PutChunk(sdta, "smpl", smpl);
+    PutChunk(pdta, "phdr", phdr);
+    PutChunk(pdta, "pbag", pbag);
+    PutChunk(pdta, "pmod", mod);
+    PutChunk(pdta, "pgen", pgen);
+    PutChunk(pdta, "inst", inst);
+    PutChunk(pdta, "ibag", ibag);
+    PutChunk(pdta, "imod", mod);
+    PutChunk(pdta, "igen", igen);
+    PutChunk(pdta, "shdr", shdr);
+
+    std::vector<uint8_t> body = {'s', 'f', 'b', 'k'}, file;
+    PutChunk(body, "LIST", info);
+    PutChunk(body, "LIST", sdta);
+    PutChunk(body, "LIST", pdta);
+    PutChunk(file, "RIFF", body);
+    return file;
+}
+
+inline float MaxAbsDiff(const float* a, const float* b, size_t n)
+{
+    float worst = 0.0f;
+    for(size_t i = 0; i < n; i++)
+        worst = std::fmax(worst, std::fabs(a[i] - b[i]));
+    return worst;
+}
+
+// One cycle of a sine every `period` samples
+inline std::vector<int16_t> Sine(size_t n, double period, double amp = 12000.0)
+{
+    std::vector<int16_t> s(n);
+    for(size_t i = 0; i < n; i++)
+        s[i] = int16_t(std::lrint(amp * std::sin(2.0 * M_PI * i / period)));
+    return s;
+}
+} // namespace tsf_test
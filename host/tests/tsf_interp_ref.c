@@ -0,0 +1,34 @@
+/* Reference side of tsf_interp_test: the same TSF build with float samples,
+   so the gather interpolates in float from the same fixed-point phase. C,
+   so its struct tsf does not clash with the test's int16 one. */
+
+#ifndef SYNTH_SF2_FLOAT_SAMPLES
+#define SYNTH_SF2_FLOAT_SAMPLES
+#endif
+#include "tsf_config.h"
+#define TSF_STATIC
+#define TSF_IMPLEMENTATION
+/* TSF is C++-first here: keep the C build quiet about what it never uses
+   and about the initializer style of its modulator table. */
+#pragma GCC diagnostic ignored "-Wunused-function"
+#pragma GCC diagnostic ignored "-Wmissing-braces"
+#include "tsf.h"
+
+#include "tsf_interp_ref.h"
+
+int tsf_interp_ref_render(const void* sf2,
+                          int         size,
+                          int         key,
+                          float*      out,
+                          int         samples)
+{
+    tsf* f = tsf_load_memory(sf2, size);
+    if(!f)
+        return 0;
+    tsf_set_output(f, TSF_MONO, 44100, 0.0f);
+    tsf_set_max_voices(f, 4);
+    tsf_note_on(f, 0, key, 1.0f);
+    tsf_render_float(f, out, samples, 0);
+    tsf_close(f);
+    return 1;
+}
@@ -0,0 +1,18 @@
+#pragma once
+// Float-sample TSF render of one note on preset 0, mono at 44.1 kHz, from
+// tsf_interp_ref.c. Returns 0 if the SoundFont does not load.
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+    int tsf_interp_ref_render(const void* sf2,
+                              int         size,
+                              int         key,
+                              float*      out,
+                              int         samples);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,230 @@
+// Q14 sample interpolation (TSF_INTERP_Q14): tsf_smuad against exact
+// integer math, tsf_interp_q14 against float interpolation at the edge
+// weights, and whole renders against a float-sample build of TSF
+// (tsf_interp_ref.c) across loop wraps and streamed ring boundaries.
+//
+// The target's __SMUAD is not exercised here; these tests pin down the C
+// fallback, which the module build replaces with the instruction.
+
+#include "tsf_test.h"
+#include "tsf_interp_ref.h"
+
+using namespace tsf_test;
+
+#ifdef TSF_INTERP_Q14
+namespace
+{
+uint32_t Pack(int lo, int hi)
+{
+    return uint32_t(uint16_t(lo)) | (uint32_t(uint16_t(hi)) << 16);
+}
+
+uint32_t g_rand = 12345;
+
+uint32_t Rand()
+{
+    g_rand = g_rand * 1664525u + 1013904223u;
+    return g_rand;
+}
+
+void TestSmuad()
+{
+    // Extremes of the operands the gather uses: full-range samples against
+    // weights that sum to 16384.
+    const int samples[] = {-32768, -32767, -1, 0, 1, 12345, 32767};
+    const int weights[] = {0, 1, 8191, 8192, 8193, 16383, 16384};
+    for(int s0 : samples)
+        for(int s1 : samples)
+            for(int a : weights)
+            {
+                const int64_t want = int64_t(s0) * (16384 - a) + int64_t(s1) * a;
+                const int     got  = tsf_smuad(Pack(s0, s1), Pack(16384 - a, a));
+                TEST_CHECK(got == want,
+                           "smuad(%d, %d; a %d) = %d, want %lld",
+                           s0,
+                           s1,
+                           a,
+                           got,
+                           (long long)want);
+            }
+    for(int i = 0; i < 100000; i++)
+    {
+        const int     s0   = int16_t(Rand() >> 16), s1 = int16_t(Rand() >> 16);
+        const int     a    = int(Rand() % 16385);
+        const int64_t want = int64_t(s0) * (16384 - a) + int64_t(s1) * a;
+        TEST_CHECK(tsf_smuad(Pack(s0, s1), Pack(16384 - a, a)) == want,
+                   "smuad(%d, %d; a %d)",
+                   s0,
+                   s1,
+                   a);
+    }
+}
+
+void TestInterpWeights()
+{
+    // a == 0 and a == 16384 must return the end samples exactly
+    const int pairs[][2] = {{-32768, 32767}, {32767, -32768}, {0, 0}, {-5, 7}};
+    for(const auto& p : pairs)
+    {
+        const uint32_t pair = Pack(p[0], p[1]);
+        TEST_CHECK(tsf_interp_q14(pair, 0) == p[0] * 16384,
+                   "frac 0 of (%d, %d)",
+                   p[0],
+                   p[1]);
+        TEST_CHECK(tsf_interp_q14(pair, 0x1FFFFu) == p[0] * 16384,
+                   "frac just above 0 of (%d, %d)",
+                   p[0],
+                   p[1]);
+        TEST_CHECK(tsf_interp_q14(pair, 0xFFFFFFFFu) == p[1] * 16384,
+                   "frac just below 1 of (%d, %d)",
+                   p[0],
+                   p[1]);
+        TEST_CHECK(tsf_interp_q14(pair, 0x80000000u) == (p[0] + p[1]) * 8192,
+                   "frac 1/2 of (%d, %d)",
+                   p[0],
+                   p[1]);
+    }
+
+    // Anywhere else the weight is off by at most half a Q14 step
+    double worst = 0.0;
+    for(int i = 0; i < 200000; i++)
+    {
+        const int      s0 = int16_t(Rand() >> 16), s1 = int16_t(Rand() >> 16);
+        const uint32_t frac  = (i & 1 ? Rand() : Rand() & 0x3FFFFu);
+        const double   exact = s0 + (s1 - s0) * (frac / 4294967296.0);
+        const double   err
+            = std::fabs(tsf_interp_q14(Pack(s0, s1), frac) / 16384.0 - exact);
+        const double bound = std::fabs(double(s1 - s0)) / 32768.0 + 1e-9;
+        TEST_CHECK(err <= bound,
+                   "interp (%d, %d) at %08x off by %g, bound %g",
+                   s0,
+                   s1,
+                   unsigned(frac),
+                   err,
+                   bound);
+        if(s1 != s0)
+            worst = std::fmax(worst, err / std::fabs(double(s1 - s0)));
+    }
+    std::printf("  interp weight error: %.3g of a sample step (bound %.3g)\n",
+                worst,
+                1.0 / 32768.0);
+}
+
+// A looped sine whose loop holds whole periods, so the wrap is seamless and
+// the largest step between neighbours is known.
+struct Case
+{
+    const char* what;
+    int         key;
+    int16_t     fine_tune; // cents
+};
+
+constexpr int    kPeriod  = 40;
+constexpr double kAmp     = 12000.0;
+constexpr int    kSamples = 11025; // 0.25 s
+
+std::vector<uint8_t> MakeSf2(const Case& c)
+{
+    Sample s;
+    s.data       = Sine(1600, kPeriod, kAmp);
+    s.loop_start = 100;
+    s.loop_end   = 1500;
+    s.rate       = 32000;
+    s.root       = 60;
+    Preset p;
+    Region r;
+    if(c.fine_tune)
+        r.gens = {{52, c.fine_tune}};
+    p.regions.push_back(r);
+    return BuildSf2({s}, {p});
+}
+
+std::vector<float> RenderQ14(const std::vector<uint8_t>& sf2, const Case& c, bool streamed)
+{
+    std::vector<float> out(kSamples, 0.0f);
+    tsf*               f = Load(sf2, streamed);
+    TEST_CHECK(f, "%s: load failed", c.what);
+    if(!f)
+        return out;
+    tsf_set_output(f, TSF_MONO, 44100, 0.0f);
+    tsf_set_max_voices(f, 4);
+    tsf_note_on(f, 0, c.key, 1.0f);
+    tsf_render_float(f, out.data(), kSamples, 0);
+    tsf_close(f);
+    return out;
+}
+
+void TestRenders()
+{
+    // 32 kHz source at 44.1 kHz output: no case steps by whole samples, and
+    // 1.25 s of source at the highest pitch wraps the 1400-sample loop
+    // several times. -1 cent keeps the fraction just below 1 for long runs,
+    // where the weight rounds to a == 16384.
+    const Case cases[] = {
+        {"root", 60, 0},
+        {"root -1 cent", 60, -1},
+        {"octave up", 72, 0},
+        {"fifth down", 53, 0},
+        {"octave up +1 cent", 72, 1},
+    };
+    const double maxStep = 2.0 * kAmp * std::sin(M_PI / kPeriod) / 32767.0;
+    for(const Case& c : cases)
+    {
+        const std::vector<uint8_t> sf2 = MakeSf2(c);
+        std::vector<float>         ref(kSamples, 0.0f);
+        TEST_CHECK(tsf_interp_ref_render(sf2.data(), int(sf2.size()), c.key, ref.data(), kSamples),
+                   "%s: reference load failed",
+                   c.what);
+        const std::vector<float> q14 = RenderQ14(sf2, c, false);
+
+        // Weight rounding bounds the difference to half a Q14 step of the
+        // largest neighbour difference, plus float rounding of the output.
+        // The voice lowpass stays on at Fc 13500 cents (0.45 of 44.1 kHz);
+        // the L1 norm of its impulse response, about 2.05, bounds how much
+        // it can grow a per-sample error.
+        float peak = 0.0f;
+        for(float x : ref)
+            peak = std::fmax(peak, std::fabs(x));
+        const float worst = MaxAbsDiff(q14.data(), ref.data(), kSamples);
+        const float bound = float(2.1 * maxStep / 32768.0 + peak * 1e-6);
+        TEST_CHECK(peak > 0.1f, "%s: no signal", c.what);
+        TEST_CHECK(worst <= bound,
+                   "%s: Q14 vs float %g, bound %g",
+                   c.what,
+                   worst,
+                   bound);
+        std::printf("  %-18s Q14 vs float %.3g (bound %.3g)\n", c.what, worst, bound);
+
+#ifdef TSF_SAMPLE_STREAMING
+        // Streamed through runs of 1 (every pair by the slow path), 2, 7
+        // and 64 samples: the same integer math, so the same output.
+        for(uint32_t ring : {1u, 2u, 7u, 64u})
+        {
+            g_ring_frames                   = ring;
+            g_window_reads                  = 0;
+            const std::vector<float> stream = RenderQ14(sf2, c, true);
+            TEST_CHECK(MaxAbsDiff(stream.data(), q14.data(), kSamples) == 0.0f,
+                       "%s: streamed with %u-sample runs differs from resident",
+                       c.what,
+                       unsigned(ring));
+            TEST_CHECK(g_window_reads > 0, "%s: nothing streamed", c.what);
+        }
+#endif
+    }
+}
+} // namespace
+
+int main()
+{
+    TestSmuad();
+    TestInterpWeights();
+    TestRenders();
+    return Finish("tsf_interp_test");
+}
+#else
+int main()
+{
+    std::printf("tsf_interp_test: skipped, no TSF_INTERP_Q14 in this build\n");
+    return 0;
+}
+#endif
@@ -0,0 +1,135 @@
+// The bank/program table (presetLookup) against the linear preset search it
+// short-cuts: tsf_get_presetindex and tsf_get_presetindex_fallback must give
+// the same index for every bank and program, in and out of the table's
+// range, including duplicate presets (the first one wins).
+
+#include <cstdlib>
+
+#include "tsf_test.h"
+
+using namespace tsf_test;
+
+namespace
+{
+uint32_t g_rand = 4242;
+
+int Rand(int n)
+{
+    g_rand = g_rand * 1664525u + 1013904223u;
+    return int((g_rand >> 8) % uint32_t(n));
+}
+
+// `f` as it answers with the table and `linear` as it answers without
+int Compare(const tsf* f, const char* what)
+{
+    tsf linear          = *f;
+    linear.presetLookup = TSF_NULL;
+    int failures        = 0;
+    for(int bank = -2; bank < 400 && failures < 5; bank++)
+        for(int program = -2; program < 130; program++)
+        {
+            const int got  = tsf_get_presetindex(f, bank, program);
+            const int want = tsf_get_presetindex(&linear, bank, program);
+            if(got != want)
+            {
+                TEST_CHECK(got == want,
+                           "%s: bank %d program %d -> %d, linear %d",
+                           what,
+                           bank,
+                           program,
+                           got,
+                           want);
+                failures++;
+            }
+            if(bank < 0 || program < 0)
+                continue;
+            for(int drums = 0; drums < 2; drums++)
+            {
+                const int gotF  = tsf_get_presetindex_fallback(f, bank, program, drums);
+                const int wantF = tsf_get_presetindex_fallback(&linear, bank, program, drums);
+                TEST_CHECK(gotF == wantF,
+                           "%s: fallback bank %d program %d drums %d -> %d, linear %d",
+                           what,
+                           bank,
+                           program,
+                           drums,
+                           gotF,
+                           wantF);
+            }
+        }
+    return failures;
+}
+
+// A font as the loader leaves it, with presets in banks the table covers,
+// the drum bank and beyond it, and one preset listed twice.
+void TestLoaded()
+{
+    Sample s;
+    s.data       = Sine(500, 50.0);
+    s.loop_start = 50;
+    s.loop_end   = 450;
+    std::vector<Preset> presets;
+    const int           banks[] = {0, 0, 0, 1, 8, 127, 128, 128, 129, 300};
+    for(int i = 0; i < 40; i++)
+    {
+        Preset p;
+        p.name    = "P" + std::to_string(i);
+        p.bank    = uint16_t(banks[i % 10]);
+        p.program = uint16_t(i == 39 ? presets[3].program : Rand(128));
+        if(i == 39)
+            p.bank = presets[3].bank;
+        p.regions.push_back(Region());
+        presets.push_back(p);
+    }
+    const std::vector<uint8_t> sf2 = BuildSf2({s}, presets);
+    tsf*                       f   = Load(sf2, false);
+    TEST_CHECK(f && f->presetLookup, "load failed or no table");
+    if(!f || !f->presetLookup)
+        return;
+    Compare(f, "loaded");
+
+    // A copy shares the presets; it must answer the same way
+    tsf* copy = tsf_copy(f);
+    TEST_CHECK(copy, "copy failed");
+    if(copy)
+    {
+        Compare(copy, "copy");
+        tsf_close(copy);
+    }
+    tsf_close(f);
+}
+
+// Random tables built directly, unsorted and with many duplicates
+void TestRandom()
+{
+    for(int trial = 0; trial < 200; trial++)
+    {
+        tsf f;
+        std::memset(&f, 0, sizeof(f));
+        f.presetNum = 1 + Rand(400);
+        f.presets   = (struct tsf_preset*)std::calloc(f.presetNum, sizeof(struct tsf_preset));
+        for(int i = 0; i < f.presetNum; i++)
+        {
+            const int r        = Rand(10);
+            f.presets[i].bank  = uint16_t(r < 6   ? Rand(3)
+                                          : r < 8 ? 128
+                                          : r < 9 ? Rand(129)
+                                                  : 129 + Rand(2000));
+            f.presets[i].preset = uint16_t(Rand(r == 9 ? 200 : 128));
+        }
+        tsf_build_presetlookup(&f);
+        TEST_CHECK(f.presetLookup, "trial %d: no table", trial);
+        if(f.presetLookup && Compare(&f, "random"))
+            std::printf("  trial %d, %d presets\n", trial, f.presetNum);
+        std::free(f.presetLookup);
+        std::free(f.presets);
+    }
+}
+} // namespace
+
+int main()
+{
+    TestLoaded();
+    TestRandom();
+    return Finish("tsf_presets_test");
+}
@@ -0,0 +1,257 @@
+// The per-preset key and velocity index (keyIndex) against a full region
+// scan: for every key and velocity, the regions it lists that pass the range
+// test must be exactly the regions a scan of all of them finds, in region
+// order. Random presets cover inverted and out-of-range ranges and the
+// fallbacks for lists too long for 16-bit offsets; a layered piano and drum
+// kit go through tsf_note_on and report how many regions each note tests.
+
+#include <cstdlib>
+
+#include "tsf_test.h"
+
+using namespace tsf_test;
+
+namespace
+{
+uint32_t g_rand = 99;
+
+int Rand(int n)
+{
+    g_rand = g_rand * 1664525u + 1013904223u;
+    return int((g_rand >> 8) % uint32_t(n));
+}
+
+bool Matches(const struct tsf_region* r, int key, int vel)
+{
+    return !(key < r->lokey || key > r->hikey || vel < r->lovel || vel > r->hivel);
+}
+
+struct Tally
+{
+    long notes = 0, scanned = 0, candidates = 0;
+    int  worst = 0;
+};
+
+// Checks one preset at every key and velocity, including a step past each
+// end; the notes that play a region add to `tally`
+void CheckPreset(const struct tsf_preset* p, const char* what, Tally& tally)
+{
+    for(int key = -1; key <= 128; key++)
+        for(int vel = -1; vel <= 130; vel++)
+        {
+            std::vector<int> want, got;
+            for(int r = 0; r < p->regionNum; r++)
+                if(Matches(&p->regions[r], key, vel))
+                    want.push_back(r);
+            const unsigned short* c = nullptr;
+            const int             n = tsf_preset_candidates(p, key, vel, &c);
+            for(int i = 0; i < n; i++)
+            {
+                const int r = (c ? c[i] : i);
+                if(Matches(&p->regions[r], key, vel))
+                    got.push_back(r);
+            }
+            if(got != want)
+            {
+                TEST_CHECK(got == want,
+                           "%s: key %d vel %d: index finds %zu regions, scan %zu",
+                           what,
+                           key,
+                           vel,
+                           got.size(),
+                           want.size());
+                return;
+            }
+            // Counted over notes that sound; out of range is a full scan
+            if(want.empty() || key < 0 || key > 127 || vel < 0 || vel > 127)
+                continue;
+            tally.notes++;
+            tally.scanned += p->regionNum;
+            tally.candidates += n;
+            tally.worst = std::max(tally.worst, n);
+        }
+}
+
+void TestRandom()
+{
+    Tally tally;
+    int   split = 0, keysOnly = 0, none = 0;
+    for(int trial = 0; trial < 150; trial++)
+    {
+        struct tsf_preset p;
+        std::memset(&p, 0, sizeof(p));
+        const int shape = Rand(5);
+        p.regionNum     = (shape == 0 || shape == 4 ? 600 + Rand(300) : Rand(300));
+        p.regions       = (struct tsf_region*)std::calloc(p.regionNum + 1, sizeof(struct tsf_region));
+        for(int r = 0; r < p.regionNum; r++)
+        {
+            struct tsf_region* g = &p.regions[r];
+            // Mostly narrow key ranges, some wide or inverted, some past 127
+            const int keyWidth = (Rand(4) == 0 ? Rand(256) : Rand(4));
+            g->lokey           = uint8_t(Rand(256) & (Rand(8) ? 127 : 255));
+            g->hikey           = uint8_t((g->lokey + keyWidth) & 255);
+            if(shape == 4)
+            {
+                // Too many full-keyboard regions for 16-bit offsets
+                g->lokey = 0;
+                g->hikey = 127;
+                g->lovel = 0;
+                g->hivel = 127;
+            }
+            else if(shape == 1)
+            {
+                // Velocity layers
+                const int layer = Rand(8);
+                g->lovel        = uint8_t(layer * 16);
+                g->hivel        = uint8_t(layer * 16 + 15);
+            }
+            else
+            {
+                g->lovel = uint8_t(Rand(Rand(8) ? 128 : 256));
+                g->hivel = uint8_t(Rand(Rand(8) ? 128 : 256));
+            }
+        }
+        tsf f;
+        std::memset(&f, 0, sizeof(f));
+        f.presets   = &p;
+        f.presetNum = 1;
+        tsf_build_keyindex(&f);
+        split += (p.keyIndex && p.keyBands > 1);
+        keysOnly += (p.keyIndex && p.keyBands == 1);
+        none += !p.keyIndex;
+        CheckPreset(&p, "random", tally);
+        std::free(p.keyIndex);
+        std::free(p.regions);
+    }
+    std::printf("  random: %d split by velocity, %d by key only, %d unindexed; "
+                "%.1f region tests per sounding note against %.1f\n",
+                split,
+                keysOnly,
+                none,
+                double(tally.candidates) / tally.notes,
+                double(tally.scanned) / tally.notes);
+    TEST_CHECK(split && keysOnly && none, "a fallback was never taken");
+}
+
+// The same preset indexed by key only, to show what the bands save
+Tally KeyOnlyTally(const struct tsf_preset* p)
+{
+    struct tsf_preset copy = *p;
+    unsigned char     edges[128] = {1};
+    Tally             tally;
+    copy.keyIndex = nullptr;
+    if(tsf_build_keyindex_bands(&copy, edges))
+        CheckPreset(&copy, "key only", tally);
+    std::free(copy.keyIndex);
+    return tally;
+}
+
+// Every key and velocity through tsf_note_on; the voices started must be
+// the scan's regions, in order.
+void CheckNoteOn(tsf* f, int preset, const char* what)
+{
+    const struct tsf_preset* p = &f->presets[preset];
+    for(int key = 0; key < 128; key++)
+        for(int vel = 1; vel < 128; vel++)
+        {
+            std::vector<const struct tsf_region*> want, got;
+            for(int r = 0; r < p->regionNum; r++)
+                if(Matches(&p->regions[r], key, vel))
+                    want.push_back(&p->regions[r]);
+            tsf_note_on(f, preset, key, (vel + 0.5f) / 127.0f);
+            struct tsf_voice* v;
+            int               next;
+            for(next = 0; (v = tsf_voice_next_active(f, &next));)
+            {
+                got.push_back(v->region);
+                tsf_voice_kill(f, v);
+            }
+            if(got != want)
+            {
+                TEST_CHECK(got == want,
+                           "%s: note on %d vel %d started %zu voices, scan %zu",
+                           what,
+                           key,
+                           vel,
+                           got.size(),
+                           want.size());
+                return;
+            }
+        }
+}
+
+void TestLayered()
+{
+    Sample s;
+    s.data       = Sine(600, 60.0);
+    s.loop_start = 60;
+    s.loop_end   = 540;
+
+    // Piano: 88 keys in 3-key zones, 4 velocity layers each
+    Preset piano;
+    piano.name = "Piano";
+    for(int lo = 21; lo <= 108; lo += 3)
+        for(int layer = 0; layer < 4; layer++)
+        {
+            Region r;
+            r.lokey = uint8_t(lo);
+            r.hikey = uint8_t(std::min(lo + 2, 108));
+            r.lovel = uint8_t(layer * 32);
+            r.hivel = uint8_t(layer * 32 + 31);
+            piano.regions.push_back(r);
+        }
+
+    // Kit: 47 GM drum keys, 8 velocity layers each, every cell two layered
+    // regions (shell and room)
+    Preset kit;
+    kit.name = "Kit";
+    kit.bank = 128;
+    for(int key = 35; key <= 81; key++)
+        for(int layer = 0; layer < 8; layer++)
+            for(int part = 0; part < 2; part++)
+            {
+                Region r;
+                r.lokey = r.hikey = uint8_t(key);
+                r.lovel           = uint8_t(layer * 16);
+                r.hivel           = uint8_t(layer * 16 + 15);
+                r.loop            = false;
+                kit.regions.push_back(r);
+            }
+
+    const std::vector<uint8_t> sf2 = BuildSf2({s}, {piano, kit});
+    tsf*                       f   = Load(sf2, false);
+    TEST_CHECK(f, "load failed");
+    if(!f)
+        return;
+    tsf_set_output(f, TSF_MONO, 44100, 0.0f);
+    tsf_set_max_voices(f, 8);
+
+    for(int i = 0; i < f->presetNum; i++)
+    {
+        const struct tsf_preset* p = &f->presets[i];
+        TEST_CHECK(p->keyIndex && p->keyBands > 1, "%s not split by velocity", p->presetName);
+        Tally split;
+        CheckPreset(p, p->presetName, split);
+        CheckNoteOn(f, i, p->presetName);
+        const Tally keys = KeyOnlyTally(p);
+        std::printf("  %-5s %4d regions, %d bands: region tests per sounding note %.2f "
+                    "(max %d), by key only %.2f (max %d)\n",
+                    p->presetName,
+                    p->regionNum,
+                    p->keyBands,
+                    double(split.candidates) / split.notes,
+                    split.worst,
+                    double(keys.candidates) / keys.notes,
+                    keys.worst);
+        TEST_CHECK(split.worst <= 2, "%s: %d candidates for one note", p->presetName, split.worst);
+    }
+    tsf_close(f);
+}
+} // namespace
+
+int main()
+{
+    TestRandom();
+    TestLayered();
+    return Finish("tsf_regions_test");
+}
@@ -0,0 +1,148 @@
+// TSF_CONTROL_TABLES: the interpolated exp2 and tan(pi * x) tables, and the
+// per-block conversions built on them, against double-precision math. The
+// bounds come from linear interpolation, h^2 / 8 * max|f''| over a table
+// step h, plus a few float roundings; none is fitted to the measured error.
+
+#include <cfloat>
+
+#include "tsf_test.h"
+
+using namespace tsf_test;
+
+#ifdef TSF_CONTROL_TABLES
+namespace
+{
+// Relative error of exp2 between table points: (h ln2)^2 / 8 with
+// h = 1/256, times 2^h for the larger end of the step, plus the rounding of
+// the table entry, the interpolation and the exponent scaling.
+const double kExp2Rel = std::pow(M_LN2 / TSF_EXP2_STEPS, 2.0) / 8.0
+                            * std::pow(2.0, 1.0 / TSF_EXP2_STEPS)
+                        + 4.0 * FLT_EPSILON;
+
+// Worst relative error of a table result for exponent x, including the
+// float rounding of x itself in the conversions below.
+double Exp2Bound(double x)
+{
+    return kExp2Rel + M_LN2 * std::fabs(x) * FLT_EPSILON;
+}
+
+double RelErr(double got, double want)
+{
+    return std::fabs(got - want) / std::fabs(want);
+}
+
+void TestExp2()
+{
+    double worst = 0.0;
+    for(int i = -126 * 1024; i < 128 * 1024; i += 7)
+    {
+        const float  x   = i / 1024.0f + 0.000137f;
+        const double err = RelErr(tsf_exp2(x), std::exp2(double(x)));
+        worst            = std::fmax(worst, err);
+        TEST_CHECK(err <= kExp2Rel, "exp2(%g) off by %g, bound %g", x, err, kExp2Rel);
+    }
+    std::printf("  exp2:   %.3g relative (bound %.3g)\n", worst, kExp2Rel);
+
+    // Whole octaves hit a table end and an exact power of two
+    for(int k = -126; k < 128; k++)
+        TEST_CHECK(tsf_exp2(float(k)) == std::ldexp(1.0f, k), "exp2(%d) inexact", k);
+
+    // Outside the float exponent range it falls back to powf
+    for(float x : {-126.5f, -150.0f, 128.0f, 200.0f})
+        TEST_CHECK(tsf_exp2(x) == TSF_POWF(2.0f, x), "exp2(%g) not powf", x);
+}
+
+void TestConversions()
+{
+    // Envelope times: -12000 (1 ms) up to 8000 timecents (100 s)
+    double worst = 0.0;
+    for(int tc = -12000; tc <= 8000; tc += 3)
+    {
+        const double x     = tc / 1200.0;
+        const double err   = RelErr(tsf_render_timecents2Secs(tc), std::exp2(x));
+        const double bound = Exp2Bound(x);
+        worst              = std::fmax(worst, err / bound);
+        TEST_CHECK(err <= bound, "timecents %d off by %g, bound %g", tc, err, bound);
+    }
+    std::printf("  time:   %.2f of bound\n", worst);
+
+    // Filter cutoff: 1500 to 13500 cents, as clamped in tsf_voice_render
+    worst = 0.0;
+    for(float cents = 1500.0f; cents <= 13500.0f; cents += 0.37f)
+    {
+        const double want  = 8.176 * std::exp2(cents / 1200.0);
+        const double err   = RelErr(tsf_render_cents2Hertz(cents), want);
+        const double bound = Exp2Bound(cents / 1200.0) + 2.0 * FLT_EPSILON;
+        worst              = std::fmax(worst, err / bound);
+        TEST_CHECK(err <= bound, "cents %g off by %g, bound %g", cents, err, bound);
+    }
+    std::printf("  cutoff: %.2f of bound\n", worst);
+
+    // Note gain: -100 dB (silence) to +20 dB
+    worst = 0.0;
+    for(float db = -99.99f; db <= 20.0f; db += 0.013f)
+    {
+        const double x     = db * 0.166096404744;
+        const double want  = std::pow(10.0, db / 20.0);
+        const double err   = RelErr(tsf_render_decibelsToGain(db), want);
+        const double bound = Exp2Bound(x) + 2.0 * FLT_EPSILON;
+        worst              = std::fmax(worst, err / bound);
+        TEST_CHECK(err <= bound, "%g dB off by %g, bound %g", db, err, bound);
+    }
+    std::printf("  gain:   %.2f of bound\n", worst);
+    TEST_CHECK(tsf_render_decibelsToGain(-100.0f) == 0.0f, "-100 dB not silent");
+}
+
+// f(x) = tan(pi x), f''(x) = 2 pi^2 tan(pi x) / cos^2(pi x), increasing on
+// [0, 0.5); h = 1 / (2 * TSF_TAN_PI_STEPS). The float table position adds
+// up to f'(x) * x * FLT_EPSILON.
+double TanPiBound(double x)
+{
+    const double h   = 1.0 / (2 * TSF_TAN_PI_STEPS);
+    const double end = (std::floor(x / h) + 1.0) * h;
+    const double c   = std::cos(M_PI * end);
+    const double f2  = 2.0 * M_PI * M_PI * std::tan(M_PI * end) / (c * c);
+    const double f1  = M_PI / (c * c);
+    return h * h / 8.0 * f2 + 4.0 * FLT_EPSILON * std::tan(M_PI * end)
+           + f1 * x * FLT_EPSILON;
+}
+
+void TestTanPi()
+{
+    double worst = 0.0, worstRel = 0.0;
+    for(int i = 0; i < 450000; i += 3)
+    {
+        const float x = i / 1000000.0f;
+        if(x >= TSF_TAN_PI_TABLE_MAX)
+            break;
+        const double want  = std::tan(M_PI * double(x));
+        const double err   = std::fabs(tsf_tan_pi(x) - want);
+        const double bound = TanPiBound(x);
+        worst              = std::fmax(worst, err / bound);
+        if(x > 0.0f)
+            worstRel = std::fmax(worstRel, err / want);
+        TEST_CHECK(err <= bound, "tan_pi(%g) off by %g, bound %g", x, err, bound);
+    }
+    std::printf("  tan_pi: %.2f of bound, %.3g relative\n", worst, worstRel);
+
+    // From TSF_TAN_PI_TABLE_MAX up it is tan() itself
+    for(float x : {TSF_TAN_PI_TABLE_MAX, 0.47f, 0.499f})
+        TEST_CHECK(tsf_tan_pi(x) == TSF_TAN(TSF_PI * x), "tan_pi(%g) not tan", x);
+}
+} // namespace
+
+int main()
+{
+    tsf_control_tables_init();
+    TestExp2();
+    TestConversions();
+    TestTanPi();
+    return Finish("tsf_tables_test");
+}
+#else
+int main()
+{
+    std::printf("tsf_tables_test: skipped, no TSF_CONTROL_TABLES in this build\n");
+    return 0;
+}
+#endif
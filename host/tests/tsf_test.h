@@ -0,0 +1,102 @@
+#pragma once
+// Shared by the host TSF tests: each test is one translation unit that
+// builds TinySoundFont with the firmware's feature set (tsf_config.h),
+// writes its SoundFont in memory and loads it either resident or streamed
+// through a ring-like window, the way the module serves samples from SD.
+
+#include <algorithm>
+#include <cstring>
+
+#include "test_common.h"
+#include "tsf_config.h"
+#define TSF_IMPLEMENTATION
+#include "tsf.h"
+
+namespace tsf_test
+{
+// -----------------------------
+// Loading: resident, or with the sample chunk left "on disk" and served
+// through tsf_stream_window in runs that end at a ring boundary every
+// g_ring_frames samples, like the firmware's per-voice rings.
+// -----------------------------
+struct MemoryStream
+{
+    const std::vector<uint8_t>* file;
+    uint32_t                    pos;
+};
+
+inline int StreamRead(void* data, void* ptr, unsigned int size)
+{
+    auto* m = static_cast<MemoryStream*>(data);
+    if(size > m->file->size() - m->pos)
+        size = unsigned(m->file->size() - m->pos);
+    std::memcpy(ptr, m->file->data() + m->pos, size);
+    m->pos += size;
+    return int(size);
+}
+
+inline int StreamSkip(void* data, unsigned int count)
+{
+    auto* m = static_cast<MemoryStream*>(data);
+    if(count > m->file->size() - m->pos)
+        return 0;
+    m->pos += count;
+    return 1;
+}
+
+#ifdef TSF_SAMPLE_STREAMING
+static const int16_t* g_disk_samples = nullptr;
+static uint32_t       g_disk_count   = 0;
+static uint32_t       g_ring_frames  = 7;
+static uint32_t       g_window_reads = 0;
+
+inline int StreamSkipSamples(void* data, unsigned int size)
+{
+    auto* m        = static_cast<MemoryStream*>(data);
+    g_disk_samples = reinterpret_cast<const int16_t*>(m->file->data() + m->pos);
+    g_disk_count   = size / 2;
+    return 1;
+}
+#endif
+
+// The file must outlive the tsf when streamed.
+inline tsf* Load(const std::vector<uint8_t>& file, bool streamed)
+{
+    MemoryStream      m      = {&file, 0};
+    struct tsf_stream stream = {&m,
+                                &StreamRead,
+                                &StreamSkip
+#ifdef TSF_SAMPLE_STREAMING
+                                ,
+                                streamed ? &StreamSkipSamples : TSF_NULL
+#endif
+    };
+    return tsf_load(&stream);
+}
+} // namespace tsf_test
+
+#ifdef TSF_SAMPLE_STREAMING
+const tsf_sample* tsf_stream_window(tsf*              f,
+                                    struct tsf_voice* v,
+                                    unsigned int      pos,
+                                    unsigned int*     first,
+                                    unsigned int*     count)
+{
+    using namespace tsf_test;
+    (void)f;
+    (void)v;
+    g_window_reads++;
+    if(pos >= g_disk_count)
+        return nullptr;
+    const uint32_t slot = pos % g_ring_frames;
+    *first              = pos;
+    *count              = std::min(g_ring_frames - slot, g_disk_count - pos);
+    return g_disk_samples + pos;
+}
+
+void tsf_stream_voice_start(tsf* f, struct tsf_voice* v)
+{
+    (void)f;
+    (void)v;
+}
+#endif
@@ -0,0 +1,156 @@
+// Timed events (tsf_set_event_offset) against the same events applied
+// between two untimed renders split at the event frame. A voice's internal
+// effect blocks start where its render starts either way, so the two must
+// match sample for sample, dry and sends, in every stereo layout.
+
+#include "tsf_test.h"
+
+using namespace tsf_test;
+
+namespace
+{
+constexpr int kBlock = 256; // kSynthMaxBlockFrames
+
+struct Out
+{
+    std::vector<float> dry, chorus, reverb;
+};
+
+// Layout-aware view of channel `ch`, frame `i` of a `frames` long buffer
+float At(const std::vector<float>& b,
+         TSFOutputMode             mode,
+         int                       frames,
+         int                       ch,
+         int                       i)
+{
+    return mode == TSF_STEREO_INTERLEAVED ? b[i * 2 + ch] : b[ch * frames + i];
+}
+
+Out Render(tsf* f, int frames)
+{
+    Out o;
+    o.dry.assign(frames * 2, 0.0f);
+    o.chorus.assign(frames * 2, 0.0f);
+    o.reverb.assign(frames * 2, 0.0f);
+    tsf_render_float_fx(f, o.dry.data(), o.chorus.data(), o.reverb.data(), frames);
+    return o;
+}
+
+// Frames [0, split) of `a` followed by [0, frames - split) of `b`, per
+// channel, against one timed render of `frames`.
+void CompareSplit(const char*   what,
+                  TSFOutputMode mode,
+                  const Out&    timed,
+                  const Out&    a,
+                  const Out&    b,
+                  int           frames,
+                  int           split)
+{
+    const std::vector<float> Out::*bufs[]  = {&Out::dry, &Out::chorus, &Out::reverb};
+    const char*                     names[] = {"dry", "chorus", "reverb"};
+    for(int k = 0; k < 3; k++)
+    {
+        float worst = 0.0f, peak = 0.0f;
+        for(int ch = 0; ch < 2; ch++)
+            for(int i = 0; i < frames; i++)
+            {
+                const float t   = At(timed.*bufs[k], mode, frames, ch, i);
+                const float ref = (i < split ? At(a.*bufs[k], mode, split, ch, i)
+                                             : At(b.*bufs[k],
+                                                  mode,
+                                                  frames - split,
+                                                  ch,
+                                                  i - split));
+                worst = std::fmax(worst, std::fabs(t - ref));
+                peak  = std::fmax(peak, std::fabs(ref));
+            }
+        TEST_CHECK(worst == 0.0f,
+                   "%s, %s, mode %d: timed differs by %g (peak %g)",
+                   what,
+                   names[k],
+                   int(mode),
+                   worst,
+                   peak);
+        TEST_CHECK(peak > 1e-3f, "%s, %s: no signal", what, names[k]);
+    }
+}
+
+void Run(const std::vector<uint8_t>& sf2, TSFOutputMode mode, bool streamed)
+{
+    tsf* timed = Load(sf2, streamed);
+    tsf* split = Load(sf2, streamed);
+    TEST_CHECK(timed && split, "load failed (streamed %d)", int(streamed));
+    if(!timed || !split)
+        return;
+    for(tsf* f : {timed, split})
+    {
+        tsf_set_output(f, mode, 44100, 0.0f);
+        tsf_set_max_voices(f, 8);
+    }
+
+    // Note on inside the first block, off the 64-sample effect grid
+    const int on = 100;
+    tsf_set_event_offset(timed, on);
+    tsf_note_on(timed, 0, 69, 0.8f);
+    Out t0 = Render(timed, kBlock);
+    Out a0 = Render(split, on);
+    tsf_note_on(split, 0, 69, 0.8f);
+    Out b0 = Render(split, kBlock - on);
+    CompareSplit("note on", mode, t0, a0, b0, kBlock, on);
+
+    // A release in the next block
+    const int off = 37;
+    tsf_set_event_offset(timed, off);
+    tsf_note_off(timed, 0, 69);
+    Out t1 = Render(timed, kBlock);
+    Out a1 = Render(split, off);
+    tsf_note_off(split, 0, 69);
+    Out b1 = Render(split, kBlock - off);
+    CompareSplit("release", mode, t1, a1, b1, kBlock, off);
+
+    // A note on late in the next block
+    // A block later the released voice is gone from both
+    Render(timed, kBlock);
+    Render(split, kBlock);
+    TEST_CHECK(tsf_active_voice_count(timed) == 0
+                   && tsf_active_voice_count(split) == 0,
+               "released voice still playing");
+
+    const int on2 = 200;
+    tsf_set_event_offset(timed, on2);
+    tsf_note_on(timed, 0, 76, 0.6f);
+    Out t2 = Render(timed, kBlock);
+    Out a2 = Render(split, on2);
+    tsf_note_on(split, 0, 76, 0.6f);
+    Out b2 = Render(split, kBlock - on2);
+    CompareSplit("second note on", mode, t2, a2, b2, kBlock, on2);
+
+    tsf_close(timed);
+    tsf_close(split);
+}
+} // namespace
+
+int main()
+{
+    Sample s;
+    s.data       = Sine(2000, 100.0);
+    s.loop_start = 100;
+    s.loop_end   = 1900;
+    s.root       = 69;
+
+    // Panned off centre so the left and right channels differ
+    Preset p;
+    Region r;
+    r.gens = {{kGenChorusSend, 500}, {kGenReverbSend, 700}, {kGenPan, -200}};
+    p.regions.push_back(r);
+    const std::vector<uint8_t> sf2 = BuildSf2({s}, {p});
+
+    for(TSFOutputMode mode : {TSF_STEREO_UNWEAVED, TSF_STEREO_INTERLEAVED})
+    {
+        Run(sf2, mode, false);
+#ifdef TSF_SAMPLE_STREAMING
+        Run(sf2, mode, true);
+#endif
+    }
+    return Finish("tsf_timed_test");
+}
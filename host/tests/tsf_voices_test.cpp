@@ -0,0 +1,173 @@
+// The active-voice bitmask against a linear scan of f->voices: after every
+// note on, release, steal, render, resize and copy, the bits, the count,
+// the order tsf_voice_next_active visits voices in and the voice
+// tsf_voice_find_free picks must match a scan of playingPreset. Voices are
+// mixed in visiting order, so this also pins the order they are summed in.
+
+#include "tsf_test.h"
+
+using namespace tsf_test;
+
+namespace
+{
+uint32_t g_rand = 777;
+
+uint32_t Rand(uint32_t n)
+{
+    g_rand = g_rand * 1664525u + 1013904223u;
+    return (g_rand >> 8) % n;
+}
+
+void CheckAgainstScan(tsf* f, const char* after, int step)
+{
+    std::vector<int> scan, bits;
+    for(int i = 0; i < f->voiceNum; i++)
+        if(f->voices[i].playingPreset != -1)
+            scan.push_back(i);
+
+    struct tsf_voice* v;
+    int               next;
+    for(next = 0; (v = tsf_voice_next_active(f, &next));)
+        bits.push_back(int(v - f->voices));
+
+    TEST_CHECK(bits == scan,
+               "step %d (%s): bitmask visits %zu voices, scan finds %zu",
+               step,
+               after,
+               bits.size(),
+               scan.size());
+    TEST_CHECK(f->activeVoiceNum == int(scan.size())
+                   && tsf_active_voice_count(f) == int(scan.size()),
+               "step %d (%s): count %d, scan %zu",
+               step,
+               after,
+               f->activeVoiceNum,
+               scan.size());
+
+    // No stray bits past the last voice
+    const int words = TSF_VOICE_WORDS(f->voiceNum);
+    if(words && (f->voiceNum & 31))
+        TEST_CHECK(!(f->voiceActive[words - 1] >> (f->voiceNum & 31)),
+                   "step %d (%s): bits set past voice %d",
+                   step,
+                   after,
+                   f->voiceNum);
+
+    int firstIdle = -1;
+    for(int i = 0; i < f->voiceNum && firstIdle < 0; i++)
+        if(f->voices[i].playingPreset == -1)
+            firstIdle = i;
+    struct tsf_voice* free = tsf_voice_find_free(f);
+    TEST_CHECK((free ? int(free - f->voices) : -1) == firstIdle,
+               "step %d (%s): free voice %d, scan %d",
+               step,
+               after,
+               free ? int(free - f->voices) : -1,
+               firstIdle);
+}
+
+void Run(tsf* f, int steps)
+{
+    tsf_set_max_voices(f, 70); // three words, the last one partial
+    for(int ch = 0; ch < 4; ch++)
+        tsf_channel_set_presetnumber(f, ch, ch & 1, 0);
+    CheckAgainstScan(f, "setup", -1);
+
+    std::vector<float> out(2 * 256);
+    int                peak = 0, beyondWord = 0;
+    for(int step = 0; step < steps; step++)
+    {
+        const uint32_t op = Rand(100);
+        const char*    what;
+        if(op < 45)
+        {
+            what = "note on";
+            tsf_channel_note_on(f, int(Rand(4)), 36 + int(Rand(48)), 0.2f + Rand(80) / 100.0f);
+        }
+        else if(op < 70)
+        {
+            what = "note off";
+            tsf_channel_note_off(f, int(Rand(4)), 36 + int(Rand(48)));
+        }
+        else if(op < 75)
+        {
+            what = "quietest off";
+            tsf_note_off_quietest(f);
+        }
+        else if(op < 95)
+        {
+            what = "render";
+            tsf_render_float(f, out.data(), 64 + int(Rand(193)), 0);
+        }
+        else if(op < 97)
+        {
+            what = "sounds off";
+            tsf_channel_sounds_off_all(f, int(Rand(4)));
+        }
+        else if(op < 99)
+        {
+            // Across word boundaries and past the voices playing
+            what = "resize";
+            tsf_set_max_voices(f, 1 + int(Rand(96)));
+        }
+        else
+        {
+            what = "note off all";
+            tsf_note_off_all(f);
+        }
+        CheckAgainstScan(f, what, step);
+        peak = std::max(peak, f->activeVoiceNum);
+        beyondWord += (f->activeVoiceNum > 32);
+    }
+    std::printf("  %d steps: up to %d voices, %d steps with more than 32\n",
+                steps,
+                peak,
+                beyondWord);
+    TEST_CHECK(beyondWord > 0, "never used a second mask word");
+}
+} // namespace
+
+int main()
+{
+    // Program 0 sustains, program 1 is a short one-shot that ends by itself
+    Sample looped;
+    looped.data       = Sine(2000, 100.0);
+    looped.loop_start = 100;
+    looped.loop_end   = 1900;
+    Sample shot;
+    shot.data = Sine(300, 50.0);
+
+    Preset sustained, oneShot;
+    sustained.regions.push_back(Region());
+    oneShot.program = 1;
+    Region r;
+    r.sample = 1;
+    r.loop   = false;
+    oneShot.regions.push_back(r);
+    // A layered key range, so one note on can start two voices
+    Region layer;
+    layer.lokey = 60;
+    layer.hikey = 72;
+    sustained.regions.push_back(layer);
+    const std::vector<uint8_t> sf2 = BuildSf2({looped, shot}, {sustained, oneShot});
+
+    tsf* f = Load(sf2, false);
+    TEST_CHECK(f, "load failed");
+    if(!f)
+        return Finish("tsf_voices_test");
+    tsf_set_output(f, TSF_STEREO_INTERLEAVED, 48000, 0.0f);
+    Run(f, 20000);
+
+    // A copy shares the SoundFont but keeps its own voices and mask
+    tsf* copy = tsf_copy(f);
+    TEST_CHECK(copy, "copy failed");
+    if(copy)
+    {
+        CheckAgainstScan(copy, "copy", -1);
+        tsf_set_output(copy, TSF_STEREO_INTERLEAVED, 48000, 0.0f);
+        Run(copy, 5000);
+        tsf_close(copy);
+    }
+    tsf_close(f);
+    return Finish("tsf_voices_test");
+}
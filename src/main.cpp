@@ -41,6 +41,9 @@ static constexpr bool kEnableUsbLog = true;
 
 namespace
 {
+// Decoded event stream and other per-song tables for the MIDI player.
+uint8_t DSY_SDRAM_BSS smf_work_mem[4 * 1024 * 1024];
+
 DaisyPatchSM      hw;
 SmfPlayer         smf_player;
 MixerTransport    transport;
@@ -71,6 +74,16 @@ constexpr uint32_t kRenderIntervalUiActiveMs   = 100;
 constexpr uint32_t kUiActiveHoldMs             = 1200;
 constexpr uint64_t kScheduledMidiLeadSamples   = 512;
 constexpr uint32_t kMidiTxTimerRateHz          = 2000;
+// Attack kept in SDRAM per region when an SF2 streams; it has to cover the
+// longest main loop pass (OLED refresh) so new notes never wait on the card.
+constexpr uint32_t kSf2StreamPreloadMs         = 150;
+// Song program uses plus one override per channel
+constexpr size_t   kSongPresetUsesMax          = 160;
+// The synth's CPU governor trades FX rate, interpolation and then voices for
+// time as a callback nears its deadline. Off until it has been tried on the
+// module; its half-rate FX take about 400 KB of the SF2 arena once used.
+constexpr bool     kSynthGovernor              = false;
+constexpr float    kSynthGovernorBudget        = 0.85f;
 enum class MidiOutputKind : uint8_t
 {
     Notes,
@@ -78,6 +91,7 @@ enum class MidiOutputKind : uint8_t
     Programs,
     Transport,
     Clock,
+    SysEx,
 };
 
 void UpdateMidiMonitor(const MidiEvent& msg);
@@ -92,6 +106,8 @@ bool MidiOutputEnabled(const MidiOutputRouting& routing, MidiOutputKind kind)
         case MidiOutputKind::Programs: return routing.programs;
         case MidiOutputKind::Transport: return routing.transport;
         case MidiOutputKind::Clock: return routing.clock;
+        // Song SysEx sets up programs and drum parts, so it follows them.
+        case MidiOutputKind::SysEx: return routing.programs;
     }
     return false;
 }
@@ -201,6 +217,12 @@ void ResetSongScopedSettings()
 template <typename Handler>
 void SendRawMidi(Handler& handler, const uint8_t* bytes, size_t size)
 {
+    // SysEx goes out straight from the song's arena.
+    if(size > 3)
+    {
+        handler.SendMessage(const_cast<uint8_t*>(bytes), size);
+        return;
+    }
     uint8_t data[3]{};
     for(size_t i = 0; i < size && i < 3; i++)
         data[i] = bytes[i];
@@ -376,7 +398,8 @@ bool ScheduledMidiOutputBlocked(const MidiEv& ev)
         case EvType::ControlChange:
         case EvType::PitchBend: return true;
         case EvType::AllSoundOff:
-        case EvType::AllNotesOff: return false;
+        case EvType::AllNotesOff:
+        case EvType::SysEx: return false;
     }
     return false;
 }
@@ -411,6 +434,15 @@ void FlushScheduledMidiOut()
         if(ScheduledMidiOutputBlocked(ev))
             continue;
 
+        if(ev.type == EvType::SysEx)
+        {
+            const uint8_t* data   = nullptr;
+            uint32_t       length = 0;
+            if(smf_player.GetSysEx(ev, data, length))
+                SendToConfiguredOutputs(MidiOutputKind::SysEx, data, length);
+            continue;
+        }
+
         MidiEv actual = PrepareScheduledMidiOutput(ev);
         uint8_t        bytes[3]{};
         size_t         size = 0;
@@ -610,6 +642,66 @@ void SyncSongStateFromPlayer()
     }
 }
 
+// Starvation means kSf2StreamPreloadMs is too short for this bank.
+void LogStreamStarvation()
+{
+    static uint32_t logged_events = 0;
+    static uint32_t logged_ms     = 0;
+    SynthStreamStats stream{};
+    SynthGetStreamStats(stream);
+    const uint32_t now = System::GetNow();
+    if(!stream.active || stream.starve_events == logged_events || now - logged_ms < 1000)
+        return;
+    logged_events = stream.starve_events;
+    logged_ms     = now;
+    LOG("SF2 stream: %lu starved voices, %lu silent reads, %lu errors, %lu KB read",
+        static_cast<unsigned long>(stream.starve_events),
+        static_cast<unsigned long>(stream.starved_reads),
+        static_cast<unsigned long>(stream.read_errors),
+        static_cast<unsigned long>(stream.bytes_read / 1024));
+}
+
+// Quality tier changes of the synth's CPU governor
+void LogGovernorTransitions()
+{
+    SynthGovernorEvent event;
+    while(SynthPopGovernorEvent(event))
+        LOG("Synth quality: %s -> %s at %u%% load, %u voices, %lu ms",
+            SynthQualityName(event.from),
+            SynthQualityName(event.to),
+            static_cast<unsigned>(event.load_pct),
+            static_cast<unsigned>(event.voices),
+            static_cast<unsigned long>(event.time_ms));
+}
+
+// Voice render cost on the module, in core cycles per voice-sample over the
+// last few seconds of playback. Voice time includes the block's events.
+void LogVoiceCost()
+{
+    static uint64_t logged_frames = 0;
+    static uint64_t logged_cycles = 0;
+    static uint32_t logged_ms     = 0;
+    SynthGovernorStats stats{};
+    SynthGetGovernorStats(stats);
+    const uint32_t now = System::GetNow();
+    if(now - logged_ms < 10000)
+        return;
+    if(stats.voice_frames < logged_frames)
+        logged_frames = logged_cycles = 0; // stats were reset
+    const uint64_t frames = stats.voice_frames - logged_frames;
+    const uint64_t cycles = stats.voice_cycles - logged_cycles;
+    logged_frames         = stats.voice_frames;
+    logged_cycles         = stats.voice_cycles;
+    logged_ms             = now;
+    if(frames < 48000 || cycles == 0)
+        return;
+    const uint64_t centi = cycles * 100 / frames;
+    LOG("Synth voices: %lu.%02lu cycles per voice-sample over %lu K voice-samples",
+        static_cast<unsigned long>(centi / 100),
+        static_cast<unsigned long>(centi % 100),
+        static_cast<unsigned long>(frames / 1000));
+}
+
 void ApplyAppSettings()
 {
     if(!app_state.settings_dirty)
@@ -760,6 +852,7 @@ bool EnsureAudioRunning()
         hw.StartAudio([](AudioHandle::InputBuffer  in,
                          AudioHandle::OutputBuffer out,
                          size_t                    size) {
+            SynthBeginCallback();
             hw.ProcessAnalogControls();
             ui_input.ControlRateTick();
             ServiceIncomingMidi();
@@ -783,6 +876,7 @@ bool EnsureAudioRunning()
             sync_sample_counter += size;
             transport.ProcessAudio(in, out, size);
             cv_gate_engine.Update(app_state, transport);
+            SynthEndCallback(size);
         });
         audio_started = true;
     }
@@ -798,6 +892,91 @@ void StopAudioIfRunning()
     }
 }
 
+// Where the SF2 arena went, by allocation site
+void LogArenaUse()
+{
+    SynthArenaStats arena{};
+    SynthGetArenaStats(arena);
+    LOG("SF2 arena: %lu KB free list, %lu KB reclaimed, %lu KB reused, %lu in place, %lu moved",
+        static_cast<unsigned long>(arena.free_bytes / 1024),
+        static_cast<unsigned long>(arena.reclaimed_bytes / 1024),
+        static_cast<unsigned long>(arena.reused_bytes / 1024),
+        static_cast<unsigned long>(arena.in_place),
+        static_cast<unsigned long>(arena.moved));
+    LOG("SDRAM FX: %lu KB chorus and reverb outside the arena",
+        static_cast<unsigned long>(arena.fx_bytes / 1024));
+    SynthArenaSite site{};
+    for(size_t i = 0; SynthGetArenaSite(i, site); i++)
+        LOG("SF2 arena: %s %lu KB live, %lu KB peak, %lu allocs",
+            site.name,
+            static_cast<unsigned long>(site.live_bytes / 1024),
+            static_cast<unsigned long>(site.peak_bytes / 1024),
+            static_cast<unsigned long>(site.allocs));
+}
+
+// Loads the presets the song and the channel overrides select. A bank that
+// filled up with earlier songs' presets is reloaded once to make room;
+// sf2_loaded turns false if that reload fails. Returns whether all of them
+// are resident; the others stream from the card.
+bool LoadSongPresets(const char* sf2_path, bool sf2_fresh, bool& sf2_loaded)
+{
+    SynthStreamStats stream{};
+    SynthGetStreamStats(stream);
+    if(!stream.active)
+        return true; // whole bank resident, or none loaded
+
+    static SynthPresetUse uses[kSongPresetUsesMax];
+    size_t                count = 0;
+    for(uint16_t i = 0; i < smf_player.ProgramUseCount() && count < kSongPresetUsesMax; i++)
+    {
+        const SmfPlayer::ProgramUse& use = smf_player.GetProgramUse(i);
+        uses[count++] = SynthPresetUse{use.bank, use.program, use.drums};
+    }
+    // An override replaces the program under whichever banks the channel
+    // selects; a channel that never selects one plays from bank 0.
+    for(uint8_t ch = 0; ch < 16; ch++)
+    {
+        if(app_state.channels[ch].program_override < 0)
+            continue;
+        const uint8_t  program  = static_cast<uint8_t>(app_state.channels[ch].program_override);
+        const uint16_t bit      = static_cast<uint16_t>(1u << ch);
+        bool           has_bank = false;
+        for(uint16_t i = 0; i < smf_player.ProgramUseCount() && count < kSongPresetUsesMax; i++)
+        {
+            const SmfPlayer::ProgramUse& use = smf_player.GetProgramUse(i);
+            if(use.channels & bit)
+            {
+                uses[count++] = SynthPresetUse{use.bank, program, ch == 9};
+                has_bank      = true;
+            }
+        }
+        if(!has_bank && count < kSongPresetUsesMax)
+            uses[count++] = SynthPresetUse{0, program, ch == 9};
+    }
+
+    const uint32_t start_ms = System::GetNow();
+    bool           ok       = SynthRequirePresets(uses, count);
+    if(!ok && !sf2_fresh && sf2_path[0] != '\0')
+    {
+        SynthUnloadSf2();
+        if(!SynthLoadSf2(sf2_path, hw.AudioSampleRate(), static_cast<int>(app_state.sf2_max_voices)))
+        {
+            sf2_loaded = false;
+            return false;
+        }
+        SyncFxStateFromSynth();
+        ok = SynthRequirePresets(uses, count);
+    }
+    SynthGetStreamStats(stream);
+    LOG("SF2 presets: %u requested, %lu resident, %lu failed, %lu KB, %lu ms",
+        static_cast<unsigned>(count),
+        static_cast<unsigned long>(stream.resident_presets),
+        static_cast<unsigned long>(stream.page_in_failures),
+        static_cast<unsigned long>(stream.resident_bytes / 1024),
+        static_cast<unsigned long>(System::GetNow() - start_ms));
+    return ok;
+}
+
 bool LoadSelectedMedia(bool reload_midi, bool reload_sf2, uint32_t now_ms)
 {
     char midi_path[MediaLibrary::kNameMax * 2]{};
@@ -819,8 +998,11 @@ bool LoadSelectedMedia(bool reload_midi, bool reload_sf2, uint32_t now_ms)
     StopAudioIfRunning();
     transport.Reset(app_state);
 
-    bool sf_ok   = true;
-    bool midi_ok = true;
+    bool     sf_ok        = true;
+    bool     midi_ok      = true;
+    bool     presets_ok   = true;
+    uint32_t midi_open_ms = 0;
+    uint32_t sf2_load_ms  = 0;
 
     if(reload_sf2)
     {
@@ -831,6 +1013,31 @@ bool LoadSelectedMedia(bool reload_midi, bool reload_sf2, uint32_t now_ms)
                                 static_cast<int>(app_state.sf2_max_voices));
         if(sf_ok)
         {
+            SynthLoadStats load{};
+            SynthGetLoadStats(load);
+            LOG("SF2 load: %lu ms, %lu of %lu KB arena, %lu KB samples, %s",
+                static_cast<unsigned long>(load.total_us / 1000),
+                static_cast<unsigned long>(SynthArenaUsed() / 1024),
+                static_cast<unsigned long>(SynthArenaCap() / 1024),
+                static_cast<unsigned long>(SynthSampleBytes() / 1024),
+                load.from_cache      ? "from cache"
+                : load.cache_written ? "cache written"
+                                     : "not cached");
+            LOG("SF2 load ms: open %lu, cache %lu, parse %lu, read %lu, convert %lu, fx %lu",
+                static_cast<unsigned long>(load.open_us / 1000),
+                static_cast<unsigned long>(load.cache_us / 1000),
+                static_cast<unsigned long>(load.parse_us / 1000),
+                static_cast<unsigned long>(load.read_us / 1000),
+                static_cast<unsigned long>(load.convert_us / 1000),
+                static_cast<unsigned long>(load.fx_us / 1000));
+            sf2_load_ms = load.total_us / 1000;
+            LogArenaUse();
+            SynthStreamStats stream{};
+            SynthGetStreamStats(stream);
+            if(stream.active)
+                LOG("SF2 streaming: %lu ms preload, %lu resident runs",
+                    static_cast<unsigned long>(kSf2StreamPreloadMs),
+                    static_cast<unsigned long>(stream.resident_runs));
             applied_sf2_max_voices = app_state.sf2_max_voices;
             SyncFxStateFromSynth();
         }
@@ -844,9 +1051,30 @@ bool LoadSelectedMedia(bool reload_midi, bool reload_sf2, uint32_t now_ms)
     {
         ResetSongScopedSettings();
         smf_player.Close();
+        const uint32_t open_start_ms = System::GetNow();
         midi_ok = midi_path[0] != '\0' && smf_player.Open(midi_path);
+        midi_open_ms = System::GetNow() - open_start_ms;
         if(midi_ok)
         {
+            LOG("MIDI open: %lu ms, %lu refills, %lu bytes read, %s %lu events, %lu checkpoints",
+                static_cast<unsigned long>(midi_open_ms),
+                static_cast<unsigned long>(smf_player.ReadRefills()),
+                static_cast<unsigned long>(smf_player.ReadBytes()),
+                smf_player.IsPredecoded() ? "predecoded" : "streaming",
+                static_cast<unsigned long>(smf_player.DecodedEventCount()),
+                static_cast<unsigned long>(smf_player.CheckpointCount()));
+            LOG("MIDI tempo map: %lu points, %lu dropped",
+                static_cast<unsigned long>(smf_player.TempoPointCount()),
+                static_cast<unsigned long>(smf_player.TempoPointsDropped()));
+            LOG("MIDI index: %lu ticks, %u/%u time, %lu changes, %u programs",
+                static_cast<unsigned long>(smf_player.TotalTicks()),
+                smf_player.TimeSigNumerator(),
+                smf_player.TimeSigDenominator(),
+                static_cast<unsigned long>(smf_player.TimeSigChanges()),
+                smf_player.ProgramUseCount());
+            LOG("MIDI sysex: %lu messages, %lu dropped",
+                static_cast<unsigned long>(smf_player.SysExCount()),
+                static_cast<unsigned long>(smf_player.SysExDropped()));
             app_state.bpm = TempoUsecToBpm(smf_player.TempoUsecPerQuarter());
             transport.SetFileBpm(static_cast<float>(app_state.bpm));
             SyncSongStateFromPlayer();
@@ -857,13 +1085,37 @@ bool LoadSelectedMedia(bool reload_midi, bool reload_sf2, uint32_t now_ms)
         }
     }
 
+    if(sf_ok)
+    {
+        if(!reload_sf2)
+            media_library.BuildSoundFontPath(
+                app_state.selected_sf2_index, sf2_path, sizeof(sf2_path));
+        presets_ok = LoadSongPresets(sf2_path, reload_sf2, sf_ok);
+        if(!sf_ok)
+            applied_sf2_max_voices = 0;
+    }
     if(sf_ok)
         EnsureAudioRunning();
 
-    if(reload_midi)
-        SetOverlay(app_state, midi_ok ? "MIDI Loaded" : "MIDI Load Fail", now_ms);
+    // Presets that did not fit stream from the card and may starve
+    if(sf_ok && !presets_ok)
+        SetOverlay(app_state, "SF2 Full: Streaming", now_ms);
+    else if(reload_midi && midi_ok)
+    {
+        char text[24];
+        std::snprintf(text, sizeof(text), "MIDI Loaded %lums", static_cast<unsigned long>(midi_open_ms));
+        SetOverlay(app_state, text, now_ms);
+    }
+    else if(reload_midi)
+        SetOverlay(app_state, "MIDI Load Fail", now_ms);
+    else if(reload_sf2 && sf_ok)
+    {
+        char text[24];
+        std::snprintf(text, sizeof(text), "SF2 Loaded %lums", static_cast<unsigned long>(sf2_load_ms));
+        SetOverlay(app_state, text, now_ms);
+    }
     else if(reload_sf2)
-        SetOverlay(app_state, sf_ok ? "SF2 Loaded" : "SF2 Load Fail", now_ms);
+        SetOverlay(app_state, "SF2 Load Fail", now_ms);
 
     app_state.pending_midi_load = false;
     app_state.pending_sf2_load  = false;
@@ -989,6 +1241,16 @@ int main(void)
     media_library.Scan();
 
     SynthInit();
+    SynthGovernorStats governor{};
+    SynthGetGovernorStats(governor);
+    LOG("Synth governor: %s, clock %s",
+        kSynthGovernor ? "on" : "off",
+        governor.cycle_clock ? "DWT cycle counter" : "System::GetUs, cycle counter not running");
+    SynthSetGovernor(kSynthGovernor, kSynthGovernorBudget);
+    SynthSetSampleStreaming(kSf2StreamPreloadMs, false);
+    SynthSetSelectiveLoading(true);
+    SynthSetSf2Cache(true);
+    smf_player.SetWorkMemory(smf_work_mem, sizeof(smf_work_mem));
     smf_player.SetSampleRate(hw.AudioSampleRate());
     smf_player.SetLookaheadSamples(hw.AudioBlockSize() * 256);
     smf_player.SetTempoScale(1.0f);
@@ -1145,6 +1407,11 @@ int main(void)
 
         if(audio_started)
             transport.Update(effective_state);
+        SynthStreamService();
+        LogStreamStarvation();
+        SynthGovernorService();
+        LogGovernorTransitions();
+        LogVoiceCost();
 
         if(audio_started && effective_state.transport_playing && !transport.IsPlaying())
         {
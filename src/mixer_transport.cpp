@@ -1,4 +1,5 @@
 #include "mixer_transport.h"
+#include <algorithm>
 #include <cstring>
 #include "synth_tsf.h"
 #include "util/scopedirqblocker.h"
@@ -54,6 +55,7 @@ void MixerTransport::Reset(const AppState& state)
     SynthResetChannels();
     has_applied_state_ = false;
     applied_bpm_       = -1;
+    max_seek_us_       = 0;
     ApplyMixerState(state, true);
 }
 
@@ -109,7 +111,7 @@ bool MixerTransport::PopDueMidiOutputEvent(uint64_t due_sample, MidiEv& ev)
     MidiEv next{};
     if(!midi_output_.Peek(next))
         return false;
-    if(next.atSample > due_sample)
+    if(EventSample(next, output_tempo_cursor_) > due_sample)
         return false;
     return midi_output_.Pop(ev);
 }
@@ -166,7 +168,8 @@ bool MixerTransport::ChannelEventBlockedByMute(const MidiEv& ev, const AppState&
         case EvType::ControlChange:
         case EvType::PitchBend: return true;
         case EvType::AllSoundOff:
-        case EvType::AllNotesOff: return false;
+        case EvType::AllNotesOff:
+        case EvType::SysEx: return false;
     }
     return false;
 }
@@ -220,7 +223,14 @@ uint64_t MixerTransport::CurrentSongTick() const
 {
     if(player_ == nullptr)
         return 0;
-    return play_start_ticks_ + player_->TicksFromSamples(CurrentCycleSample());
+
+    // A loop wrap publishes its timeline up to one lookahead early; until
+    // the restart sample the previous pass is the one being heard.
+    const uint64_t now  = sample_clock_;
+    size_t         slot = timeline_index_;
+    if(now < timeline_start_[slot])
+        slot = (slot + kTimelineSlots - 1) % kTimelineSlots;
+    return player_->TickForPosition(timelines_[slot].PosAt(now));
 }
 
 uint8_t MixerTransport::ScaleController(uint8_t value, uint8_t max_value) const
@@ -337,7 +347,8 @@ void MixerTransport::UpdateNoteState(const MidiEv& ev)
             break;
 
         case EvType::Program:
-        case EvType::PitchBend: break;
+        case EvType::PitchBend:
+        case EvType::SysEx: break;
     }
 }
 
@@ -372,7 +383,8 @@ void MixerTransport::DispatchEvent(const MidiEv& ev, bool scheduled_source)
             case EvType::ControlChange: channel_activity_[ev.ch] |= kActivityCc; break;
             case EvType::PitchBend: channel_activity_[ev.ch] |= kActivityPitch; break;
             case EvType::AllSoundOff:
-            case EvType::AllNotesOff: break;
+            case EvType::AllNotesOff:
+            case EvType::SysEx: break;
         }
     }
 
@@ -394,41 +406,37 @@ void MixerTransport::DispatchEvent(const MidiEv& ev, bool scheduled_source)
         break;
         case EvType::AllSoundOff: SynthAllSoundOff(actual.ch); break;
         case EvType::AllNotesOff: SynthAllNotesOff(actual.ch); break;
+        case EvType::SysEx:
+        {
+            const uint8_t* data   = nullptr;
+            uint32_t       length = 0;
+            if(player_ != nullptr && player_->GetSysEx(actual, data, length)
+               && SynthSysEx(data, length))
+            {
+                // A reset puts every channel back on program 0.
+                for(uint8_t ch = 0; ch < 16; ch++)
+                {
+                    if(has_program_override_[ch])
+                        SynthProgramChange(ch, static_cast<uint8_t>(program_override_[ch]));
+                }
+            }
+        }
+        break;
     }
 
     if(scheduled_source && midi_output_callback_ != nullptr)
         midi_output_callback_(actual, midi_output_context_);
 }
 
-void MixerTransport::RenderFrames(AudioHandle::OutputBuffer out,
-                                  size_t                    offset,
-                                  size_t                    frames)
-{
-    static float lbuf[256];
-    static float rbuf[256];
-
-    while(frames > 0)
-    {
-        const size_t chunk = frames > 256 ? 256 : frames;
-        SynthRender(lbuf, rbuf, chunk);
-        for(size_t i = 0; i < chunk; i++)
-        {
-            out[0][offset + i] = lbuf[i];
-            out[1][offset + i] = rbuf[i];
-        }
-        offset += chunk;
-        frames -= chunk;
-    }
-}
-
 void MixerTransport::TransferScheduledFromParser(const AppState& state)
 {
     MidiEv ev;
     const uint64_t loop_boundary_sample = LoopBoundarySample(state);
     while(parsed_.Peek(ev))
     {
-        if(LoopActive(state) && ev.atSample >= loop_boundary_sample)
+        if(LoopActive(state) && player_->SampleForTick(ev.atTick) >= loop_boundary_sample)
             break;
+        ev.timeline = timeline_index_;
         if(!EnqueueScheduled(ev))
             break;
         {
@@ -472,7 +480,7 @@ bool MixerTransport::MaybeWrapLoopParser(const AppState& state, uint64_t sample_
         return false;
 
     MidiEv ev;
-    if(parsed_.Peek(ev) && ev.atSample < loop_boundary_sample)
+    if(parsed_.Peek(ev) && player_->SampleForTick(ev.atTick) < loop_boundary_sample)
         return false;
 
     const uint64_t loop_start_ticks   = LoopStartTicks(state);
@@ -483,31 +491,47 @@ bool MixerTransport::MaybeWrapLoopParser(const AppState& state, uint64_t sample_
 
     FlushLoopBoundaryNotes();
     parsed_.Clear();
-    player_->SeekToSample(loop_start_samples, restart_sample);
+    SeekPlayer(loop_start_samples, restart_sample);
+    PublishTimeline(restart_sample);
     play_start_sample_ = restart_sample;
-    play_start_ticks_  = loop_start_ticks;
     loop_end_sample_   = LoopBoundarySample(state);
     return true;
 }
 
-void MixerTransport::RemapQueuedEventTimes(uint64_t sample_now, double ratio)
+void MixerTransport::SeekPlayer(uint64_t target_sample, uint64_t now_sample)
 {
-    if(ratio <= 0.0)
-        return;
+    const uint32_t start_us = System::GetUs();
+    player_->SeekToSample(target_sample, now_sample);
+    const uint32_t elapsed_us = System::GetUs() - start_us;
+    if(elapsed_us > max_seek_us_)
+        max_seek_us_ = elapsed_us;
+}
 
+void MixerTransport::PublishTimeline(uint64_t start_sample)
+{
     ScopedIrqBlocker lock;
-    auto remap = [&](MidiEv& ev) {
-        if(ev.atSample <= sample_now)
-            return;
-        const double delta      = double(ev.atSample - sample_now);
-        const double remapped   = delta * ratio;
-        const uint64_t new_time = sample_now + static_cast<uint64_t>(llround(remapped));
-        ev.atSample             = new_time;
-    };
+    timeline_index_                  = (timeline_index_ + 1) % kTimelineSlots;
+    timelines_[timeline_index_]      = player_->Timeline();
+    timeline_start_[timeline_index_] = start_sample;
+}
+
+void MixerTransport::RebaseTimelines(uint64_t sample_now)
+{
+    // Queued events keep their ticks; each timeline just bends at the
+    // current sample, the same way the player's own one did.
+    const double samples_per_pos = player_->Timeline().samplesPerPos;
+    ScopedIrqBlocker lock;
+    for(size_t i = 0; i < kTimelineSlots; i++)
+    {
+        timelines_[i].Rebase(sample_now);
+        timelines_[i].samplesPerPos = samples_per_pos;
+    }
+}
 
-    scheduled_.Transform(remap);
-    parsed_.Transform(remap);
-    midi_output_.Transform(remap);
+uint64_t MixerTransport::EventSample(const MidiEv& ev, uint32_t& tempo_cursor)
+{
+    const SongTimeline& timeline = timelines_[ev.timeline % kTimelineSlots];
+    return timeline.SampleAt(player_->PositionForTick(ev.atTick, tempo_cursor));
 }
 
 void MixerTransport::ProcessAudio(AudioHandle::InputBuffer  in,
@@ -516,43 +540,35 @@ void MixerTransport::ProcessAudio(AudioHandle::InputBuffer  in,
 {
     (void)in;
 
-    MidiEv ev;
-    while(DequeueImmediate(ev))
-        DispatchEvent(ev, false);
-
-    uint64_t block_sample = sample_clock_;
-    size_t   offset       = 0;
-    while(offset < size)
+    // Timelines only change with IRQs masked, so they hold still for the
+    // whole block; ticks are converted against them as events come due.
+    // Events are timed into one synth render per block instead of splitting
+    // the render at each of them.
+    const uint64_t block_sample = sample_clock_;
+    for(size_t offset = 0; offset < size; offset += kSynthMaxBlockFrames)
     {
-        MidiEv next_ev{};
-        if(!PeekScheduled(next_ev))
-        {
-            RenderFrames(out, offset, size - offset);
-            offset = size;
-            break;
-        }
+        const size_t   frames = std::min(size - offset, kSynthMaxBlockFrames);
+        const uint64_t start  = block_sample + offset;
+        SynthBeginBlock(out[0] + offset, out[1] + offset, frames);
 
-        const uint64_t current_sample = block_sample + offset;
-        if(next_ev.atSample > current_sample)
-        {
-            uint64_t frames_to_event = next_ev.atSample - current_sample;
-            if(frames_to_event > (size - offset))
-                frames_to_event = size - offset;
-            RenderFrames(out, offset, static_cast<size_t>(frames_to_event));
-            offset += static_cast<size_t>(frames_to_event);
-            continue;
-        }
+        MidiEv ev;
+        if(offset == 0)
+            while(DequeueImmediate(ev))
+                DispatchEvent(ev, false);
 
-        do
+        while(PeekScheduled(ev))
         {
-            if(!PopScheduled(next_ev))
+            const uint64_t event_sample = EventSample(ev, dispatch_tempo_cursor_);
+            if(event_sample >= start + frames || !PopScheduled(ev))
                 break;
-            if(!(next_ev.ch < 16 && applied_channels_[next_ev.ch].muted
-                 && (next_ev.type == EvType::NoteOn || next_ev.type == EvType::NoteOff
-                     || next_ev.type == EvType::Program || next_ev.type == EvType::ControlChange
-                     || next_ev.type == EvType::PitchBend)))
-                DispatchEvent(next_ev, true);
-        } while(PeekScheduled(next_ev) && next_ev.atSample <= current_sample);
+            SynthSetEventFrame(event_sample > start ? static_cast<size_t>(event_sample - start) : 0);
+            if(!(ev.ch < 16 && applied_channels_[ev.ch].muted
+                 && (ev.type == EvType::NoteOn || ev.type == EvType::NoteOff
+                     || ev.type == EvType::Program || ev.type == EvType::ControlChange
+                     || ev.type == EvType::PitchBend)))
+                DispatchEvent(ev, true);
+        }
+        SynthEndBlock();
     }
 
     sample_clock_ = block_sample + size;
@@ -580,10 +596,12 @@ void MixerTransport::StartPlayback(const AppState& state)
         uint64_t       loop_start_samples = player_->SamplesFromTicks(loop_start_ticks);
         if(loop_start_samples > 0)
             loop_start_samples -= 1;
-        player_->SeekToSample(loop_start_samples, sample_now);
+        SeekPlayer(loop_start_samples, sample_now);
         play_start_sample_ = sample_now;
-        play_start_ticks_  = loop_start_ticks;
 
+        // SysEx first: a reset in the skipped part must not undo the programs.
+        for(uint16_t i = 0; i < player_->SeekSysExCount(); i++)
+            EnqueueImmediate(player_->GetSeekSysEx(i));
         for(uint8_t ch = 0; ch < 16; ch++)
         {
             if(player_->HasSeekProgramState(ch))
@@ -600,8 +618,8 @@ void MixerTransport::StartPlayback(const AppState& state)
     {
         player_->Start(sample_now);
         play_start_sample_ = sample_now;
-        play_start_ticks_  = 0;
     }
+    PublishTimeline(sample_now);
 
     ApplyMixerState(state, true);
 }
@@ -783,25 +801,12 @@ void MixerTransport::Update(const AppState& state)
 
     if(state.bpm != applied_bpm_)
     {
-        const bool     had_applied_bpm = applied_bpm_ > 0;
-        const uint64_t current_cycle   = CurrentCycleSample();
-        const uint64_t current_tick    = CurrentSongTick();
-        const double   old_bpm         = had_applied_bpm ? static_cast<double>(applied_bpm_)
-                                                         : static_cast<double>(state.bpm);
-        const double   new_bpm         = state.bpm > 0 ? static_cast<double>(state.bpm)
-                                                       : old_bpm;
-        const double   ratio           = (new_bpm > 0.0) ? (old_bpm / new_bpm) : 1.0;
+        // O(1): queued events are timed by tick, so only the timelines move.
+        const uint64_t sample_now = sample_clock_;
         const float scale = file_bpm_ > 0.0f ? static_cast<float>(state.bpm) / file_bpm_
                                              : 1.0f;
-        player_->SetTempoScale(scale, sample_clock_);
-        if(player_->IsPlaying() && had_applied_bpm)
-        {
-            RemapQueuedEventTimes(sample_clock_, ratio);
-            const uint64_t new_ticks_into_cycle = player_->TicksFromSamples(current_cycle);
-            play_start_ticks_ = current_tick >= new_ticks_into_cycle
-                                    ? (current_tick - new_ticks_into_cycle)
-                                    : 0;
-        }
+        player_->SetTempoScale(scale, sample_now);
+        RebaseTimelines(sample_now);
         applied_bpm_ = state.bpm;
     }
 
@@ -12,6 +12,9 @@ namespace major_midi
 static constexpr size_t kScheduledQueueSize = 1024;
 static constexpr size_t kParsedQueueSize    = 1024;
 static constexpr size_t kImmediateQueueSize = 256;
+// Every start, seek and loop wrap places the following events on a fresh
+// timeline; the ring only has to outlive the events still queued on it.
+static constexpr size_t kTimelineSlots      = 8;
 
 class MixerTransport
 {
@@ -41,6 +44,8 @@ class MixerTransport
     bool PopDueMidiOutputEvent(uint64_t due_sample, MidiEv& ev);
 
     uint64_t SampleClock() const { return sample_clock_; }
+    // Longest SeekToSample (start, loop wrap) since the last Reset.
+    uint32_t MaxSeekUs() const { return max_seek_us_; }
 
   private:
     bool ChannelEventBlockedByMute(const MidiEv& ev, const AppState& state) const;
@@ -61,13 +66,13 @@ class MixerTransport
     uint8_t EffectivePan(uint8_t ch, const AppState& state) const;
     uint8_t EffectiveReverb(uint8_t ch, const AppState& state) const;
     uint8_t EffectiveChorus(uint8_t ch, const AppState& state) const;
-    void RenderFrames(daisy::AudioHandle::OutputBuffer out,
-                      size_t                           offset,
-                      size_t                           frames);
     void TransferScheduledFromParser(const AppState& state);
     void FlushLoopBoundaryNotes();
     bool MaybeWrapLoopParser(const AppState& state, uint64_t sample_now);
-    void RemapQueuedEventTimes(uint64_t sample_now, double ratio);
+    void PublishTimeline(uint64_t start_sample);
+    void RebaseTimelines(uint64_t sample_now);
+    uint64_t EventSample(const MidiEv& ev, uint32_t& tempo_cursor);
+    void SeekPlayer(uint64_t target_sample, uint64_t now_sample);
 
     void StartPlayback(const AppState& state);
     void StopPlayback(const AppState& state);
@@ -92,7 +97,6 @@ class MixerTransport
     bool               applied_mute_all_ = false;
     bool               has_applied_state_ = false;
     uint64_t           play_start_sample_ = 0;
-    uint64_t           play_start_ticks_  = 0;
     float              file_bpm_          = 120.0f;
     int                applied_bpm_       = -1;
     volatile uint8_t   channel_activity_[16]{};
@@ -118,8 +122,14 @@ class MixerTransport
     uint8_t            active_note_count_[16]{};
     int8_t             highest_note_[16]{};
     int8_t             lowest_note_[16]{};
+    SongTimeline       timelines_[kTimelineSlots]{};
+    uint64_t           timeline_start_[kTimelineSlots]{};
+    uint8_t            timeline_index_         = 0;
+    uint32_t           dispatch_tempo_cursor_  = 0;
+    uint32_t           output_tempo_cursor_    = 0;
     volatile uint64_t  loop_end_sample_   = UINT64_MAX;
     volatile bool      loop_active_       = false;
+    uint32_t           max_seek_us_       = 0;
     MidiOutputCallback midi_output_callback_ = nullptr;
     void*              midi_output_context_  = nullptr;
 };
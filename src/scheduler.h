@@ -1,4 +1,5 @@
 #pragma once
+#include <cmath>
 #include <cstdint>
 #include <cstddef>
 
@@ -11,15 +12,51 @@ enum class EvType : uint8_t
     PitchBend,
     AllSoundOff,
     AllNotesOff,
+    SysEx, // payload lives in the player's per-song arena, see SmfPlayer::GetSysEx
 };
 
+// File events are stamped with their song tick and only turned into a
+// sample time when they are due, so tempo changes never touch queued events.
 struct MidiEv
 {
-    uint64_t atSample = 0;
+    uint32_t atTick   = 0;
     EvType   type     = EvType::NoteOn;
     uint8_t  ch       = 0;
-    uint8_t  a        = 0; // note/program
-    uint8_t  b        = 0; // velocity
+    uint8_t  a        = 0; // note/program; SysEx: arena ref high byte
+    uint8_t  b        = 0; // velocity; SysEx: arena ref low byte
+    uint8_t  timeline = 0; // transport timeline slot atTick is placed on
+};
+
+// Straight-line map between output samples and song position. Positions are
+// ticks weighted by usec-per-quarter (the tempo map's running sum), which do
+// not depend on tempo scale: a tempo change re-anchors the line at the
+// current sample and swaps the slope.
+struct SongTimeline
+{
+    uint64_t anchorSample  = 0;
+    double   anchorPos     = 0.0;
+    double   samplesPerPos = 0.0;
+
+    uint64_t SampleAt(uint64_t pos) const
+    {
+        const int64_t delta = llround((double(pos) - anchorPos) * samplesPerPos);
+        if(delta < 0 && uint64_t(-delta) > anchorSample)
+            return 0;
+        return anchorSample + delta;
+    }
+
+    double PosAt(uint64_t sample) const
+    {
+        if(samplesPerPos <= 0.0)
+            return anchorPos;
+        return anchorPos + (double(sample) - double(anchorSample)) / samplesPerPos;
+    }
+
+    void Rebase(uint64_t sample)
+    {
+        anchorPos    = PosAt(sample);
+        anchorSample = sample;
+    }
 };
 
 template <size_t N>
@@ -1,7 +1,9 @@
 #include "smf_player.h"
 
+#include <algorithm>
 #include <cmath>
 #include <cstring>
+#include <new>
 
 extern "C"
 {
@@ -28,8 +30,54 @@ uint16_t ReadUint16BE(FIL& f)
         return 0;
     return (uint16_t(buf[0]) << 8) | uint16_t(buf[1]);
 }
+
+// Arena footprint of a SysEx entry holding `length` bytes.
+uint32_t SysExEntryBytes(uint32_t headerBytes, uint32_t length)
+{
+    return (headerBytes + length + 3u) & ~3u;
+}
+
+// Index min-heap helpers shared by the track merges. `less` orders two track
+// indices; the return value counts comparisons for the Pump diagnostics.
+template <typename Less>
+uint32_t HeapSiftDown(uint16_t* heap, uint32_t count, uint32_t pos, Less less)
+{
+    uint32_t steps = 0;
+    while(true)
+    {
+        const uint32_t left = 2 * pos + 1;
+        if(left >= count)
+            break;
+        uint32_t child = left;
+        if(left + 1 < count && less(heap[left + 1], heap[left]))
+            child = left + 1;
+        steps++;
+        if(!less(heap[child], heap[pos]))
+            break;
+        const uint16_t tmp = heap[pos];
+        heap[pos]          = heap[child];
+        heap[child]        = tmp;
+        pos                = child;
+    }
+    return steps;
+}
+
+template <typename Less>
+void HeapMake(uint16_t* heap, uint32_t count, Less less)
+{
+    for(uint32_t i = count / 2; i-- > 0;)
+        HeapSiftDown(heap, count, i, less);
+}
 } // namespace
 
+void SmfPlayer::SetWorkMemory(void* mem, size_t bytes)
+{
+    Close();
+    work_     = static_cast<uint8_t*>(mem);
+    workSize_ = mem ? bytes : 0;
+    workUsed_ = 0;
+}
+
 bool SmfPlayer::Open(const char* path)
 {
     Close();
@@ -68,7 +116,7 @@ bool SmfPlayer::Open(const char* path)
         f_lseek(&file_, pos + (headerLen - 6));
     }
 
-    if(tracks == 0 || tracks > kMaxTracks)
+    if(tracks == 0 || !AllocTracks(tracks))
     {
         Close();
         return false;
@@ -83,9 +131,9 @@ bool SmfPlayer::Open(const char* path)
     ts_den_        = 4;
     for(uint16_t i = 0; i < trackCount_; i++)
     {
-        trackNames_[i][0]  = '\0';
-        trackHasName_[i]   = false;
-        trackChannel_[i]   = -1;
+        tracks_[i].name[0] = '\0';
+        tracks_[i].hasName = false;
+        tracks_[i].channel = -1;
 
         uint32_t len = 0;
         if(!SeekTrackHeader(len))
@@ -93,25 +141,22 @@ bool SmfPlayer::Open(const char* path)
             Close();
             return false;
         }
-        tracks_[i].start        = f_tell(&file_);
-        tracks_[i].pos          = tracks_[i].start;
-        tracks_[i].length       = len;
-        tracks_[i].remaining    = len;
-        tracks_[i].running      = 0;
-        tracks_[i].sampleFrac   = 0.0;
-        tracks_[i].tickOffset   = 0;
-        tracks_[i].sampleOffset = 0;
-        tracks_[i].finished     = false;
-        tracks_[i].hasEvent     = false;
+        tracks_[i].start   = f_tell(&file_);
+        tracks_[i].length  = len;
+        tracks_[i].winBase = 0;
+        tracks_[i].winFill = 0;
+        ResetTrack(tracks_[i]);
 
         f_lseek(&file_, tracks_[i].start + len);
     }
 
-    playing_ = false;
-    open_    = true;
+    playing_       = false;
+    open_          = true;
+    pumpEvents_    = 0;
+    pumpHeapSteps_ = 0;
+    ResetReadStats();
 
-    LoadMajorMidiSettings();
-    BuildTempoMap();
+    IndexTracks();
     UpdateSamplesPerTick();
     return true;
 }
@@ -123,10 +168,35 @@ void SmfPlayer::Close()
         f_close(&file_);
     }
 
-    open_       = false;
-    playing_    = false;
-    trackCount_ = 0;
-    path_[0]    = '\0';
+    open_        = false;
+    playing_     = false;
+    trackCount_  = 0;
+    tracks_      = trackFallback_;
+    heap_        = heapFallback_;
+    heapCount_   = 0;
+    path_[0]     = '\0';
+    workUsed_    = 0;
+    predecoded_  = false;
+    events_      = nullptr;
+    eventCount_  = 0;
+    cursor_      = 0;
+    stateIdx_    = nullptr;
+    stateCount_  = 0;
+    checkpoints_     = nullptr;
+    checkpointTrks_  = nullptr;
+    checkpointCount_ = 0;
+    maxSeekEvents_   = 0;
+    programUseCount_ = 0;
+    timeSigChanges_  = 0;
+    sysEx_           = nullptr;
+    sysExUsed_       = 0;
+    sysExCap_        = 0;
+    sysExIndex_      = nullptr;
+    sysExCount_      = 0;
+    sysExDropped_    = 0;
+    seekSysExCount_  = 0;
+    indexing_        = false;
+    settingsFound_   = false;
     settings_.Reset();
 }
 
@@ -156,63 +226,34 @@ void SmfPlayer::SetTempoScale(float scale, uint64_t sampleNow)
     if(scale == tempo_scale_)
         return;
 
-    const double old_spt = samplesPerTick_;
-    tempo_scale_          = scale;
+    // Pending events are timed by tick, so nothing is rewritten: the
+    // timeline is re-anchored at the current sample and takes the new slope.
+    timeline_.Rebase(sampleNow);
+    tempo_scale_ = scale;
     UpdateSamplesPerTick();
-    const double new_spt = samplesPerTick_;
-
-    if(!playing_ || old_spt <= 0.0 || new_spt <= 0.0)
-        return;
-
-    const uint64_t play_pos
-        = seekSample_ + ((sampleNow >= startSample_) ? (sampleNow - startSample_) : 0);
-    const double   ratio    = new_spt / old_spt;
-
-    for(uint16_t i = 0; i < trackCount_; i++)
-    {
-        if(!tracks_[i].hasEvent)
-            continue;
-
-        uint64_t next_offset = tracks_[i].sampleOffset;
-        if(next_offset < play_pos)
-            next_offset = play_pos;
-
-        const double rem = double(next_offset - play_pos);
-        const double adj = rem * ratio;
-        const uint64_t new_offset = play_pos + (uint64_t)llround(adj);
-
-        tracks_[i].sampleOffset   = new_offset;
-        tracks_[i].sampleFrac     = 0.0;
-        const uint64_t rel_sample = (tracks_[i].sampleOffset >= seekSample_)
-                                        ? (tracks_[i].sampleOffset - seekSample_)
-                                        : 0;
-        tracks_[i].nextEv.atSample = startSample_ + rel_sample;
-    }
 }
 
 void SmfPlayer::Start(uint64_t sampleNow)
 {
     if(open_)
     {
-        playing_     = true;
-        startSample_ = sampleNow;
-        seekSample_  = 0;
+        playing_               = true;
+        timeline_.anchorSample = sampleNow;
+        timeline_.anchorPos    = 0.0;
         std::memset(seek_program_valid_, 0, sizeof(seek_program_valid_));
-        for(uint16_t i = 0; i < trackCount_; i++)
+        seekSysExCount_        = 0;
+        if(predecoded_)
         {
-            tracks_[i].pos          = tracks_[i].start;
-            tracks_[i].remaining    = tracks_[i].length;
-            tracks_[i].running      = 0;
-            tracks_[i].sampleFrac   = 0.0;
-            tracks_[i].tickOffset   = 0;
-            tracks_[i].sampleOffset = 0;
-            tracks_[i].finished     = false;
-            tracks_[i].hasEvent     = false;
-            trackChannel_[i]        = -1;
+            cursor_ = 0;
+            return;
         }
 
+        for(uint16_t i = 0; i < trackCount_; i++)
+            ResetTrack(tracks_[i]);
+
         for(uint16_t i = 0; i < trackCount_; i++)
             PrepareNextEvent(i, tracks_[i]);
+        RebuildHeap();
     }
 }
 
@@ -236,29 +277,38 @@ void SmfPlayer::SeekToSample(uint64_t targetSample, uint64_t nowSample)
     if(!open_)
         return;
 
-    playing_     = true;
-    startSample_ = nowSample;
-    seekSample_  = targetSample;
+    playing_               = true;
+    timeline_.anchorSample = nowSample;
+    timeline_.anchorPos    = samplesPerTickUsec_ > 0.0
+                                 ? double(targetSample) / samplesPerTickUsec_
+                                 : 0.0;
     std::memset(seek_program_valid_, 0, sizeof(seek_program_valid_));
+    CollectSeekSysEx(targetSample);
 
-    for(uint16_t i = 0; i < trackCount_; i++)
+    if(predecoded_)
+    {
+        SeekDecoded(targetSample);
+        return;
+    }
+
+    const Checkpoint* cp = FindCheckpoint(targetSample);
+    if(cp != nullptr)
+    {
+        RestoreCheckpoint(*cp);
+    }
+    else
     {
-        tracks_[i].pos          = tracks_[i].start;
-        tracks_[i].remaining    = tracks_[i].length;
-        tracks_[i].running      = 0;
-        tracks_[i].sampleFrac   = 0.0;
-        tracks_[i].tickOffset   = 0;
-        tracks_[i].sampleOffset = 0;
-        tracks_[i].finished     = false;
-        tracks_[i].hasEvent     = false;
-        trackChannel_[i]        = -1;
+        for(uint16_t i = 0; i < trackCount_; i++)
+            ResetTrack(tracks_[i]);
     }
 
+    uint32_t parsed = 0;
     for(uint16_t i = 0; i < trackCount_; i++)
     {
         MidiEv ev{};
         while(true)
         {
+            parsed++;
             if(!ParseNextEvent(i, tracks_[i], ev))
             {
                 tracks_[i].hasEvent = false;
@@ -269,7 +319,7 @@ void SmfPlayer::SeekToSample(uint64_t targetSample, uint64_t nowSample)
                 seek_program_valid_[ev.ch] = true;
                 seek_program_[ev.ch]       = ev.a;
             }
-            if(tracks_[i].sampleOffset >= targetSample)
+            if(SamplesFromTicks(tracks_[i].tickOffset) >= targetSample)
             {
                 tracks_[i].nextEv  = ev;
                 tracks_[i].hasEvent = true;
@@ -277,6 +327,50 @@ void SmfPlayer::SeekToSample(uint64_t targetSample, uint64_t nowSample)
             }
         }
     }
+    if(parsed > maxSeekEvents_)
+        maxSeekEvents_ = parsed;
+    RebuildHeap();
+}
+
+const SmfPlayer::Checkpoint* SmfPlayer::FindCheckpoint(uint64_t targetSample) const
+{
+    // Last checkpoint strictly before the target, so every record it skips
+    // would also have been skipped by a seek from the top of the file.
+    uint32_t lo = 0;
+    uint32_t hi = checkpointCount_;
+    while(lo < hi)
+    {
+        const uint32_t mid = lo + (hi - lo) / 2;
+        if(SamplesFromTicks(checkpoints_[mid].tick) < targetSample)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    return lo > 0 ? &checkpoints_[lo - 1] : nullptr;
+}
+
+void SmfPlayer::RestoreCheckpoint(const Checkpoint& cp)
+{
+    const size_t           index = size_t(&cp - checkpoints_);
+    const CheckpointTrack* saved = &checkpointTrks_[index * trackCount_];
+    for(uint16_t i = 0; i < trackCount_; i++)
+    {
+        TrackState& trk = tracks_[i];
+        ResetTrack(trk);
+        trk.pos          = saved[i].pos;
+        trk.remaining    = saved[i].remaining;
+        trk.tickOffset   = saved[i].tick;
+        trk.running      = saved[i].running;
+        trk.finished     = saved[i].finished;
+    }
+
+    for(uint8_t ch = 0; ch < 16; ch++)
+    {
+        seek_program_valid_[ch] = (cp.programValid >> ch) & 1u;
+        seek_program_[ch]       = cp.program[ch];
+    }
+    ts_num_ = cp.tsNum;
+    ts_den_ = cp.tsDen;
 }
 
 bool SmfPlayer::IsPlaying() const
@@ -289,46 +383,161 @@ void SmfPlayer::Pump(EventQueue<1024>& queue, uint64_t sampleNow)
     if(!open_ || !playing_)
         return;
 
+    // Everything up to the last tick that starts inside the lookahead window
+    // is due; comparing ticks keeps per-event conversions out of the loop.
+    const double limitPos = timeline_.PosAt(sampleNow + lookahead_);
+    if(limitPos < 0.0)
+        return;
+    const uint64_t limitTick = TickForPosition(limitPos);
+
+    if(predecoded_)
+    {
+        PumpDecoded(queue, limitTick);
+        return;
+    }
+
+    const TrackState* tracks = tracks_;
+    auto earlier = [tracks](uint16_t a, uint16_t b) {
+        const uint32_t ta = tracks[a].nextEv.atTick;
+        const uint32_t tb = tracks[b].nextEv.atTick;
+        return ta < tb || (ta == tb && a < b);
+    };
+
     while(!queue.IsFull())
     {
-        const uint64_t limitSample = sampleNow + lookahead_;
-        uint16_t nextIdx    = kMaxTracks;
-        uint64_t nextSample = UINT64_MAX;
-        for(uint16_t i = 0; i < trackCount_; i++)
+        if(heapCount_ == 0)
         {
-            if(tracks_[i].hasEvent && tracks_[i].nextEv.atSample < nextSample)
-            {
-                nextSample = tracks_[i].nextEv.atSample;
-                nextIdx    = i;
-            }
+            playing_ = false;
+            return;
         }
 
-        if(nextIdx == kMaxTracks)
+        const uint16_t nextIdx = heap_[0];
+        TrackState&    trk     = tracks_[nextIdx];
+        if(trk.nextEv.atTick > limitTick)
+            return;
+
+        queue.Push(trk.nextEv);
+        trk.hasEvent = false;
+        if(!PrepareNextEvent(nextIdx, trk))
+            heap_[0] = heap_[--heapCount_];
+        pumpEvents_++;
+        pumpHeapSteps_ += HeapSiftDown(heap_, heapCount_, 0, earlier);
+    }
+}
+
+void SmfPlayer::RebuildHeap()
+{
+    heapCount_ = 0;
+    for(uint16_t i = 0; i < trackCount_; i++)
+    {
+        if(tracks_[i].hasEvent)
+            heap_[heapCount_++] = i;
+    }
+
+    const TrackState* tracks = tracks_;
+    HeapMake(heap_, heapCount_, [tracks](uint16_t a, uint16_t b) {
+        const uint32_t ta = tracks[a].nextEv.atTick;
+        const uint32_t tb = tracks[b].nextEv.atTick;
+        return ta < tb || (ta == tb && a < b);
+    });
+}
+
+bool SmfPlayer::AllocTracks(uint16_t count)
+{
+    tracks_ = trackFallback_;
+    heap_   = heapFallback_;
+    if(work_ != nullptr && count <= kMaxWorkTracks)
+    {
+        const size_t mark = workUsed_;
+        void* trackMem = WorkAlloc(count * sizeof(TrackState), alignof(TrackState));
+        void* heapMem  = WorkAlloc(count * sizeof(uint16_t), alignof(uint16_t));
+        if(trackMem != nullptr && heapMem != nullptr)
+        {
+            tracks_ = static_cast<TrackState*>(trackMem);
+            for(uint16_t i = 0; i < count; i++)
+                new(&tracks_[i]) TrackState();
+            heap_ = static_cast<uint16_t*>(heapMem);
+            return true;
+        }
+        workUsed_ = mark;
+    }
+
+    if(count > kMaxTracks)
+        return false;
+    for(uint16_t i = 0; i < count; i++)
+        tracks_[i] = TrackState();
+    return true;
+}
+
+void SmfPlayer::PumpDecoded(EventQueue<1024>& queue, uint64_t limitTick)
+{
+    while(!queue.IsFull())
+    {
+        if(cursor_ >= eventCount_)
         {
             playing_ = false;
             return;
         }
 
-        if(nextSample > limitSample)
+        const SmfEvent& rec = events_[cursor_];
+        if(rec.tick > limitTick)
             return;
 
-        queue.Push(tracks_[nextIdx].nextEv);
-        tracks_[nextIdx].hasEvent = false;
-        PrepareNextEvent(nextIdx, tracks_[nextIdx]);
+        cursor_++;
+        MidiEv ev{};
+        if(!RecordToEvent(rec, ev))
+            continue;
+        ev.atTick = rec.tick;
+        queue.Push(ev);
+    }
+}
+
+void SmfPlayer::SeekDecoded(uint64_t targetSample)
+{
+    // First event at or after the target; sample time is monotonic in tick.
+    uint32_t lo = 0;
+    uint32_t hi = eventCount_;
+    while(lo < hi)
+    {
+        const uint32_t mid = lo + (hi - lo) / 2;
+        if(SamplesFromTicks(events_[mid].tick) < targetSample)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    cursor_ = lo;
+
+    for(uint32_t i = 0; i < stateCount_ && stateIdx_[i] < cursor_; i++)
+    {
+        const SmfEvent& rec = events_[stateIdx_[i]];
+        MidiEv          ev{};
+        if(RecordToEvent(rec, ev) && ev.type == EvType::Program && ev.ch < 16)
+        {
+            seek_program_valid_[ev.ch] = true;
+            seek_program_[ev.ch]       = ev.a;
+        }
     }
 }
 
 bool SmfPlayer::ParseNextEvent(uint16_t trackIndex, TrackState& trk, MidiEv& out)
 {
-    while(true)
+    SmfEvent rec{};
+    while(DecodeTrackEvent(trackIndex, trk, rec))
     {
-        if(trk.remaining == 0)
+        if(RecordToEvent(rec, out))
         {
-            trk.finished = true;
-            return false;
+            out.atTick = rec.tick;
+            return true;
         }
+    }
+    return false;
+}
 
-        if(f_lseek(&file_, trk.pos) != FR_OK)
+bool SmfPlayer::DecodeTrackEvent(uint16_t trackIndex, TrackState& trk, SmfEvent& out)
+{
+    while(true)
+    {
+        if(trk.finished || trk.remaining == 0)
         {
             trk.finished = true;
             return false;
@@ -342,11 +551,10 @@ bool SmfPlayer::ParseNextEvent(uint16_t trackIndex, TrackState& trk, MidiEv& out
         }
 
         trk.tickOffset += deltaTicks;
-        trk.sampleOffset = SamplesFromTicks(trk.tickOffset);
-        trk.sampleFrac = 0.0;
-        const uint64_t relSample
-            = (trk.sampleOffset >= seekSample_) ? (trk.sampleOffset - seekSample_) : 0;
-        const uint64_t eventSample = startSample_ + relSample;
+        out.tick = (uint32_t)trk.tickOffset;
+        out.d0   = 0;
+        out.d1   = 0;
+        out.d2   = 0;
 
         uint8_t statusByte = 0;
         if(!ReadTrackByte(trk, statusByte))
@@ -369,28 +577,10 @@ bool SmfPlayer::ParseNextEvent(uint16_t trackIndex, TrackState& trk, MidiEv& out
                 trk.finished = true;
                 return false;
             }
-            if(type == 0x51 && length == 3)
-            {
-                uint8_t buf[3];
-                for(uint32_t i = 0; i < 3; i++)
-                {
-                    if(!ReadTrackByte(trk, buf[i]))
-                    {
-                        trk.finished = true;
-                        return false;
-                    }
-                }
-                if(!HasBpmOverride())
-                {
-                    tempo_ = (uint32_t(buf[0]) << 16) | (uint32_t(buf[1]) << 8)
-                             | uint32_t(buf[2]);
-                    UpdateSamplesPerTick();
-                }
-            }
-            else if(type == 0x58 && length == 4)
+            if((type == 0x51 && length == 3) || (type == 0x58 && length == 4))
             {
                 uint8_t buf[4];
-                for(uint32_t i = 0; i < 4; i++)
+                for(uint32_t i = 0; i < length; i++)
                 {
                     if(!ReadTrackByte(trk, buf[i]))
                     {
@@ -398,8 +588,11 @@ bool SmfPlayer::ParseNextEvent(uint16_t trackIndex, TrackState& trk, MidiEv& out
                         return false;
                     }
                 }
-                ts_num_ = buf[0];
-                ts_den_ = 1 << buf[1];
+                out.status = (type == 0x51) ? kEvTempo : kEvTimeSig;
+                out.d0     = buf[0];
+                out.d1     = buf[1];
+                out.d2     = buf[2];
+                return true;
             }
             else if(type == 0x03) // Track name
             {
@@ -414,10 +607,10 @@ bool SmfPlayer::ParseNextEvent(uint16_t trackIndex, TrackState& trk, MidiEv& out
                         trk.finished = true;
                         return false;
                     }
-                    trackNames_[trackIndex][i] = (char)b;
+                    tracks_[trackIndex].name[i] = (char)b;
                 }
-                trackNames_[trackIndex][copy] = '\0';
-                trackHasName_[trackIndex]     = true;
+                tracks_[trackIndex].name[copy] = '\0';
+                tracks_[trackIndex].hasName     = true;
                 if(length > copy)
                 {
                     if(!SkipBytes(trk, length - copy))
@@ -427,6 +620,26 @@ bool SmfPlayer::ParseNextEvent(uint16_t trackIndex, TrackState& trk, MidiEv& out
                     }
                 }
             }
+            else if(type == 0x7F && indexing_ && trackIndex == 0 && !settingsFound_
+                    && length <= kMajorMidiMetaMax)
+            {
+                // Major MIDI settings: the first valid payload in track 0.
+                uint8_t payload[kMajorMidiMetaMax];
+                for(uint32_t i = 0; i < length; i++)
+                {
+                    if(!ReadTrackByte(trk, payload[i]))
+                    {
+                        trk.finished = true;
+                        return false;
+                    }
+                }
+                major_midi::MajorMidiSettings parsed;
+                if(major_midi::ParseMajorMidiPayload(payload, length, parsed))
+                {
+                    settings_      = parsed;
+                    settingsFound_ = true;
+                }
+            }
             else
             {
                 if(!SkipBytes(trk, length))
@@ -438,11 +651,8 @@ bool SmfPlayer::ParseNextEvent(uint16_t trackIndex, TrackState& trk, MidiEv& out
 
             if(type == 0x2F)
             {
-                MidiEv ev{};
-                ev.type     = EvType::AllNotesOff;
-                ev.atSample = eventSample;
+                out.status   = kEvEndOfTrack;
                 trk.finished = true;
-                out = ev;
                 return true;
             }
             continue;
@@ -451,12 +661,45 @@ bool SmfPlayer::ParseNextEvent(uint16_t trackIndex, TrackState& trk, MidiEv& out
         if(statusByte == 0xF0 || statusByte == 0xF7)
         {
             uint32_t length = 0;
-            if(!ReadVarLen(trk, length) || !SkipBytes(trk, length))
+            if(!ReadVarLen(trk, length))
             {
                 trk.finished = true;
                 return false;
             }
-            continue;
+
+            // The payload is only read while indexing; later passes skip it
+            // and look the arena copy up by file position.
+            const uint32_t pos   = uint32_t(trk.pos);
+            uint16_t       ref   = 0;
+            uint8_t*       dst   = nullptr;
+            bool           found = false;
+            if(indexing_ && ReserveSysEx(statusByte, length, pos, out.tick, ref, dst))
+            {
+                if(!ReadTrackBytes(trk, dst, length))
+                {
+                    sysExUsed_ = uint32_t(ref) * 4u;
+                    sysExCount_--;
+                    trk.finished = true;
+                    return false;
+                }
+                found = true;
+            }
+            else
+            {
+                if(!SkipBytes(trk, length))
+                {
+                    trk.finished = true;
+                    return false;
+                }
+                found = !indexing_ && FindSysEx(pos, ref);
+            }
+            if(!found)
+                continue;
+
+            out.status = kEvSysEx;
+            out.d0     = uint8_t(ref >> 8);
+            out.d1     = uint8_t(ref & 0xFF);
+            return true;
         }
 
         uint8_t status = statusByte;
@@ -486,6 +729,7 @@ bool SmfPlayer::ParseNextEvent(uint16_t trackIndex, TrackState& trk, MidiEv& out
         {
             case 0x80:
             case 0x90:
+            case 0xA0:
             case 0xB0:
             case 0xE0:
                 if(!ReadTrackByte(trk, data2))
@@ -498,59 +742,107 @@ bool SmfPlayer::ParseNextEvent(uint16_t trackIndex, TrackState& trk, MidiEv& out
                 break;
         }
 
-        MidiEv ev{};
-        ev.atSample = eventSample;
-        ev.ch       = status & 0x0F;
-        if(trackChannel_[trackIndex] < 0)
-            trackChannel_[trackIndex] = (int8_t)ev.ch;
+        if(tracks_[trackIndex].channel < 0)
+            tracks_[trackIndex].channel = (int8_t)(status & 0x0F);
 
         switch(status & 0xF0)
         {
-            case 0x80: // Note off
+            case 0x80:
+            case 0x90:
+            case 0xB0:
+            case 0xC0:
+            case 0xE0:
+                out.status = status;
+                out.d0     = data1;
+                out.d1     = data2;
+                return true;
+            default:
+                continue;
+        }
+    }
+}
+
+bool SmfPlayer::RecordToEvent(const SmfEvent& rec, MidiEv& out)
+{
+    MidiEv ev{};
+    switch(rec.status)
+    {
+        case kEvTempo:
+            if(!HasBpmOverride())
+            {
+                tempo_ = (uint32_t(rec.d0) << 16) | (uint32_t(rec.d1) << 8) | uint32_t(rec.d2);
+                UpdateSamplesPerTick();
+            }
+            return false;
+        case kEvTimeSig:
+            ts_num_ = rec.d0;
+            ts_den_ = 1 << rec.d1;
+            return false;
+        case kEvEndOfTrack:
+            ev.type = EvType::AllNotesOff;
+            out     = ev;
+            return true;
+        case kEvSysEx:
+            ev.type = EvType::SysEx;
+            ev.ch   = 0xFF;
+            ev.a    = rec.d0;
+            ev.b    = rec.d1;
+            out     = ev;
+            return true;
+        default:
+            break;
+    }
+
+    const uint8_t data1 = rec.d0;
+    const uint8_t data2 = rec.d1;
+    ev.ch               = rec.status & 0x0F;
+
+    switch(rec.status & 0xF0)
+    {
+        case 0x80: // Note off
+            ev.type = EvType::NoteOff;
+            ev.a    = data1;
+            break;
+        case 0x90: // Note on
+            if(data2 == 0)
+            {
                 ev.type = EvType::NoteOff;
                 ev.a    = data1;
-                break;
-            case 0x90: // Note on
-                if(data2 == 0)
-                {
-                    ev.type = EvType::NoteOff;
-                    ev.a    = data1;
-                }
-                else
-                {
-                    ev.type = EvType::NoteOn;
-                    ev.a    = data1;
-                    ev.b    = data2;
-                }
-                break;
-            case 0xB0: // Control change - handle All Notes Off (0x7B)
-                if(data1 == 0x7B || data1 == 0x78)
-                {
-                    ev.type = EvType::AllNotesOff;
-                }
-                else
-                {
-                    ev.type = EvType::ControlChange;
-                    ev.a    = data1;
-                    ev.b    = data2;
-                }
-                break;
-            case 0xC0: // Program change
-                ev.type = EvType::Program;
+            }
+            else
+            {
+                ev.type = EvType::NoteOn;
                 ev.a    = data1;
-                break;
-            case 0xE0: // Pitch bend
-                ev.type = EvType::PitchBend;
+                ev.b    = data2;
+            }
+            break;
+        case 0xB0: // Control change - handle All Notes Off (0x7B)
+            if(data1 == 0x7B || data1 == 0x78)
+            {
+                ev.type = EvType::AllNotesOff;
+            }
+            else
+            {
+                ev.type = EvType::ControlChange;
                 ev.a    = data1;
                 ev.b    = data2;
-                break;
-            default:
-                continue;
-        }
-
-        out = ev;
-        return true;
+            }
+            break;
+        case 0xC0: // Program change
+            ev.type = EvType::Program;
+            ev.a    = data1;
+            break;
+        case 0xE0: // Pitch bend
+            ev.type = EvType::PitchBend;
+            ev.a    = data1;
+            ev.b    = data2;
+            break;
+        default:
+            return false;
     }
+
+    out = ev;
+    return true;
 }
 
 bool SmfPlayer::PrepareNextEvent(uint16_t trackIndex, TrackState& trk)
@@ -573,8 +865,8 @@ const char* SmfPlayer::GetTrackNameForChannel(uint8_t ch) const
 {
     for(uint16_t i = 0; i < trackCount_; i++)
     {
-        if(trackChannel_[i] == (int8_t)ch && trackHasName_[i])
-            return trackNames_[i];
+        if(tracks_[i].channel == (int8_t)ch && tracks_[i].hasName)
+            return tracks_[i].name;
     }
     return "";
 }
@@ -592,15 +884,56 @@ uint64_t SmfPlayer::SamplesPerQuarter() const
     return static_cast<uint64_t>(samplesPerTick_ * double(divisions_));
 }
 
-bool SmfPlayer::ReadTrackByte(TrackState& trk, uint8_t& b)
+void SmfPlayer::ResetTrack(TrackState& trk)
 {
-    if(trk.remaining == 0)
+    // The window is left alone: rewinding to a position it still covers
+    // (loop restarts, seeks near the start) costs no SD read.
+    trk.pos          = trk.start;
+    trk.remaining    = trk.length;
+    trk.running      = 0;
+    trk.tickOffset   = 0;
+    trk.finished     = false;
+    trk.hasEvent     = false;
+}
+
+bool SmfPlayer::FillWindow(TrackState& trk)
+{
+    // The window lives in the track state: work memory (SDRAM) once the
+    // player has some, else the player's fallback tracks (AXI SRAM). Never
+    // the DTCM stack, which the SD card's DMA cannot reach, because a
+    // whole-sector f_read DMAs straight into it. That is cache-safe: the
+    // disk driver cleans and invalidates the D-cache over the buffer around
+    // each transfer, and the window is 32-byte aligned and a whole number of
+    // cache lines, so the invalidate cannot drop a neighbouring field's
+    // dirty line.
+    const FSIZE_t base = trk.pos - (trk.pos % kTrackWindowBytes);
+    trk.winBase        = base;
+    trk.winFill        = 0;
+    if(f_lseek(&file_, base) != FR_OK)
         return false;
 
     UINT read = 0;
-    if(f_read(&file_, &b, 1, &read) != FR_OK || read != 1)
+    if(f_read(&file_, trk.window, kTrackWindowBytes, &read) != FR_OK)
+        return false;
+
+    readRefills_++;
+    readBytes_ += read;
+    trk.winFill = read;
+    return trk.pos < trk.winBase + trk.winFill;
+}
+
+bool SmfPlayer::ReadTrackByte(TrackState& trk, uint8_t& b)
+{
+    if(trk.remaining == 0)
         return false;
 
+    if(trk.pos < trk.winBase || trk.pos >= trk.winBase + trk.winFill)
+    {
+        if(!FillWindow(trk))
+            return false;
+    }
+
+    b = trk.window[trk.pos - trk.winBase];
     trk.pos++;
     trk.remaining--;
     return true;
@@ -621,11 +954,42 @@ bool SmfPlayer::ReadVarLen(TrackState& trk, uint32_t& value)
 
 bool SmfPlayer::SkipBytes(TrackState& trk, uint32_t count)
 {
-    while(count--)
+    // Skipped payloads are never read; the window refills lazily on the
+    // next byte actually consumed.
+    if(count > trk.remaining)
     {
-        uint8_t tmp = 0;
-        if(!ReadTrackByte(trk, tmp))
+        trk.pos += trk.remaining;
+        trk.remaining = 0;
+        return false;
+    }
+    trk.pos += count;
+    trk.remaining -= count;
+    return true;
+}
+
+bool SmfPlayer::ReadTrackBytes(TrackState& trk, uint8_t* dst, uint32_t count)
+{
+    // Copies straight out of the window a sector at a time.
+    while(count > 0)
+    {
+        if(trk.remaining == 0)
             return false;
+        if(trk.pos < trk.winBase || trk.pos >= trk.winBase + trk.winFill)
+        {
+            if(!FillWindow(trk))
+                return false;
+        }
+
+        uint32_t chunk = uint32_t(trk.winBase + trk.winFill - trk.pos);
+        if(chunk > count)
+            chunk = count;
+        if(chunk > trk.remaining)
+            chunk = trk.remaining;
+        std::memcpy(dst, &trk.window[trk.pos - trk.winBase], chunk);
+        dst += chunk;
+        trk.pos += chunk;
+        trk.remaining -= chunk;
+        count -= chunk;
     }
     return true;
 }
@@ -649,42 +1013,94 @@ void SmfPlayer::UpdateSamplesPerTick()
     tempo_ = EffectiveTempoUsec();
     if(divisions_ == 0)
     {
-        samplesPerTick_ = 0.0;
+        samplesPerTick_         = 0.0;
+        samplesPerTickUsec_     = 0.0;
+        timeline_.samplesPerPos = 0.0;
         return;
     }
 
-    samplesPerTick_
-        = ((tempo_ / double(tempo_scale_)) * sr_) / (double(divisions_) * 1000000.0);
+    samplesPerTickUsec_ = sr_ / (double(tempo_scale_) * double(divisions_) * 1000000.0);
+    samplesPerTick_     = tempo_ * samplesPerTickUsec_;
+    // Only the slope; callers that change it mid-song re-anchor first.
+    timeline_.samplesPerPos = samplesPerTickUsec_;
 }
 
-uint64_t SmfPlayer::SamplesFromTicks(uint64_t ticks) const
+uint32_t SmfPlayer::TempoSegmentForTick(uint64_t ticks, uint32_t& cursor) const
 {
-    if(divisions_ == 0)
-        return 0;
-
-    const uint16_t count = (tempoCount_ == 0) ? 1 : tempoCount_;
-    const uint32_t defaultTempo = (tempoCount_ == 0) ? tempo_ : tempoUsec_[0];
+    // Playback asks for steadily increasing positions, so try the segment
+    // used last time and its successor before searching.
+    const TempoPoint* map = tempoMap_;
+    uint32_t          i   = cursor < tempoCount_ ? cursor : 0;
+    for(uint32_t step = 0; step < 2 && i < tempoCount_; step++, i++)
+    {
+        if(map[i].tick <= ticks && (i + 1 == tempoCount_ || map[i + 1].tick > ticks))
+        {
+            cursor = i;
+            return i;
+        }
+    }
 
-    uint64_t curTick = 0;
-    double   samples = 0.0;
+    uint32_t lo = 0;
+    uint32_t hi = tempoCount_;
+    while(lo < hi)
+    {
+        const uint32_t mid = lo + (hi - lo) / 2;
+        if(map[mid].tick <= ticks)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    cursor = lo > 0 ? lo - 1 : 0;
+    return cursor;
+}
 
-    for(uint16_t i = 0; i < count; i++)
+uint32_t SmfPlayer::TempoSegmentForUsecTicks(double usecTicks) const
+{
+    const TempoPoint* map = tempoMap_;
+    uint32_t          i   = sampleCursor_ < tempoCount_ ? sampleCursor_ : 0;
+    for(uint32_t step = 0; step < 2 && i < tempoCount_; step++, i++)
     {
-        const uint32_t tempo = (tempoCount_ == 0) ? defaultTempo : tempoUsec_[i];
-        const uint64_t nextTick = (i + 1 < count) ? tempoTicks_[i + 1] : ticks;
-        const uint64_t segEnd = (ticks < nextTick) ? ticks : nextTick;
-        if(segEnd <= curTick)
-            break;
+        if(double(map[i].cum) <= usecTicks
+           && (i + 1 == tempoCount_ || double(map[i + 1].cum) > usecTicks))
+        {
+            sampleCursor_ = i;
+            return i;
+        }
+    }
 
-        const double samplesPerTick
-            = ((tempo / double(tempo_scale_)) * sr_) / (double(divisions_) * 1000000.0);
-        samples += double(segEnd - curTick) * samplesPerTick;
-        curTick = segEnd;
-        if(curTick >= ticks)
-            break;
+    uint32_t lo = 0;
+    uint32_t hi = tempoCount_;
+    while(lo < hi)
+    {
+        const uint32_t mid = lo + (hi - lo) / 2;
+        if(double(map[mid].cum) <= usecTicks)
+            lo = mid + 1;
+        else
+            hi = mid;
     }
+    sampleCursor_ = lo > 0 ? lo - 1 : 0;
+    return sampleCursor_;
+}
+
+uint64_t SmfPlayer::PositionForTick(uint64_t ticks, uint32_t& cursor) const
+{
+    if(tempoCount_ == 0)
+        return ticks * tempo_;
 
-    return (uint64_t)llround(samples);
+    const TempoPoint& seg = tempoMap_[TempoSegmentForTick(ticks, cursor)];
+    return seg.cum + (ticks - seg.tick) * uint64_t(seg.usec);
+}
+
+uint64_t SmfPlayer::SamplesFromTicks(uint64_t ticks) const
+{
+    if(divisions_ == 0)
+        return 0;
+    return (uint64_t)llround(double(PositionForTick(ticks, tickCursor_)) * samplesPerTickUsec_);
+}
+
+uint64_t SmfPlayer::SampleForTick(uint64_t ticks) const
+{
+    return timeline_.SampleAt(PositionForTick(ticks, tickCursor_));
 }
 
 uint64_t SmfPlayer::SamplesFromTicksRange(uint64_t startTicks, uint64_t lengthTicks) const
@@ -698,227 +1114,413 @@ uint64_t SmfPlayer::SamplesFromTicksRange(uint64_t startTicks, uint64_t lengthTi
 
 void SmfPlayer::InsertTempoPoint(uint32_t tick, uint32_t tempo)
 {
-    if(tempoCount_ >= kMaxTempoPoints)
+    // Points arrive in tick order; a second change on the same tick wins.
+    if(tempoCount_ > 0 && tempoMap_[tempoCount_ - 1].tick == tick)
+    {
+        tempoMap_[tempoCount_ - 1].usec = tempo;
+        return;
+    }
+    if(tempoCount_ >= tempoCap_)
+    {
+        tempoDropped_++;
         return;
-    tempoTicks_[tempoCount_] = tick;
-    tempoUsec_[tempoCount_]  = tempo;
+    }
+    tempoMap_[tempoCount_].tick = tick;
+    tempoMap_[tempoCount_].usec = tempo;
+    tempoMap_[tempoCount_].cum  = 0;
     tempoCount_++;
 }
 
 uint64_t SmfPlayer::TicksFromSamples(uint64_t samples) const
 {
-    if(divisions_ == 0)
+    if(divisions_ == 0 || samplesPerTickUsec_ <= 0.0)
         return 0;
 
-    const uint16_t count = (tempoCount_ == 0) ? 1 : tempoCount_;
-    const uint32_t defaultTempo = (tempoCount_ == 0) ? tempo_ : tempoUsec_[0];
-
-    uint64_t curTick = 0;
-    double   remSamples = (double)samples;
-
-    for(uint16_t i = 0; i < count; i++)
-    {
-        const uint32_t tempo = (tempoCount_ == 0) ? defaultTempo : tempoUsec_[i];
-        const uint64_t nextTick = (i + 1 < count) ? tempoTicks_[i + 1] : UINT64_MAX;
-
-        const double spt
-            = ((tempo / double(tempo_scale_)) * sr_) / (double(divisions_) * 1000000.0);
-        if(spt <= 0.0)
-            break;
-
-        if(nextTick == UINT64_MAX)
-        {
-            curTick += (uint64_t)floor(remSamples / spt);
-            return curTick;
-        }
-
-        const uint64_t segTicks = (nextTick > curTick) ? (nextTick - curTick) : 0;
-        const double   segSamples = (double)segTicks * spt;
-
-        if(remSamples < segSamples)
-        {
-            curTick += (uint64_t)floor(remSamples / spt);
-            return curTick;
-        }
+    return TickForPosition(double(samples) / samplesPerTickUsec_);
+}
 
-        remSamples -= segSamples;
-        curTick = nextTick;
-        if(remSamples <= 0.0)
-            return curTick;
-    }
+uint64_t SmfPlayer::TickForPosition(double pos) const
+{
+    if(pos <= 0.0)
+        return 0;
+    if(tempoCount_ == 0)
+        return tempo_ > 0 ? (uint64_t)floor(pos / tempo_) : 0;
 
-    return curTick;
+    const TempoPoint& seg = tempoMap_[TempoSegmentForUsecTicks(pos)];
+    if(seg.usec == 0)
+        return seg.tick;
+    return seg.tick + (uint64_t)floor((pos - double(seg.cum)) / seg.usec);
 }
 
-void SmfPlayer::BuildTempoMap()
+void SmfPlayer::IndexTracks()
 {
-    tempoCount_ = 0;
+    tempoCount_      = 0;
+    tempoDropped_    = 0;
+    tickCursor_      = 0;
+    sampleCursor_    = 0;
+    tempoMap_        = tempoFallback_;
+    tempoCap_        = kMaxTempoPoints;
+    predecoded_      = false;
+    events_          = nullptr;
+    eventCount_      = 0;
+    stateIdx_        = nullptr;
+    stateCount_      = 0;
+    checkpoints_     = nullptr;
+    checkpointTrks_  = nullptr;
+    checkpointCount_ = 0;
+    programUseCount_ = 0;
+    timeSigChanges_  = 0;
+    sysEx_           = nullptr;
+    sysExUsed_       = 0;
+    sysExCap_        = 0;
+    sysExIndex_      = nullptr;
+    sysExCount_      = 0;
+    sysExDropped_    = 0;
+    seekSysExCount_  = 0;
+    total_ticks_     = 0;
     if(trackCount_ == 0)
         return;
 
-    if(HasBpmOverride())
+    // While indexing, the decoded stream grows up from the bottom of the
+    // free work memory. Per-track scratch, the checkpoint table, the SysEx
+    // arena and the tempo map take fixed slices from the top. Everything that is kept is
+    // packed down behind the stream once the pass is over.
+    uint8_t*  bottom = work_ ? work_ + workUsed_ : nullptr;
+    uint8_t*  top    = work_ ? work_ + workSize_ : nullptr;
+    auto      takeTop = [&](size_t bytes, size_t align) -> uint8_t* {
+        if(top == nullptr)
+            return nullptr;
+        uintptr_t at = reinterpret_cast<uintptr_t>(top);
+        if(at < bytes + reinterpret_cast<uintptr_t>(bottom))
+            return nullptr;
+        at = (at - bytes) & ~uintptr_t(align - 1);
+        if(at < reinterpret_cast<uintptr_t>(bottom))
+            return nullptr;
+        top = reinterpret_cast<uint8_t*>(at);
+        return top;
+    };
+    const size_t slice = work_ ? (workSize_ - workUsed_) / 8 : 0;
+
+    TempoPoint* tempoTop = nullptr;
+    uint32_t    tempoCap = uint32_t(slice / sizeof(TempoPoint));
+    if(tempoCap > kMaxWorkTempoPoints)
+        tempoCap = kMaxWorkTempoPoints;
+    if(tempoCap > kMaxTempoPoints)
+        tempoTop = reinterpret_cast<TempoPoint*>(
+            takeTop(tempoCap * sizeof(TempoPoint), alignof(TempoPoint)));
+    if(tempoTop != nullptr)
     {
-        InsertTempoPoint(0, EffectiveTempoUsec());
-        tempo_ = EffectiveTempoUsec();
-        return;
+        tempoMap_ = tempoTop;
+        tempoCap_ = tempoCap;
     }
 
-    InsertTempoPoint(0, fileTempoUsec_);
-
-    for(uint16_t ti = 0; ti < trackCount_; ti++)
+    const size_t sysExBytes = (slice < kMaxSysExArena ? slice : kMaxSysExArena) & ~size_t(3);
+    if(sysExBytes > 0)
+        sysEx_ = takeTop(sysExBytes, 4);
+    if(sysEx_ != nullptr)
+        sysExCap_ = uint32_t(sysExBytes);
+
+    const size_t cpStride = sizeof(Checkpoint) + trackCount_ * sizeof(CheckpointTrack);
+    uint32_t     cpCap    = uint32_t(slice / cpStride);
+    if(cpCap > kMaxCheckpoints)
+        cpCap = kMaxCheckpoints;
+    cpCap &= ~1u;
+    Checkpoint*      cpTop    = nullptr;
+    CheckpointTrack* cpTrkTop = nullptr;
+    if(cpCap >= 2)
     {
-        TrackState trk{};
-        trk.start     = tracks_[ti].start;
-        trk.pos       = tracks_[ti].start;
-        trk.length    = tracks_[ti].length;
-        trk.remaining = tracks_[ti].length;
-        trk.running   = 0;
+        cpTop    = reinterpret_cast<Checkpoint*>(
+            takeTop(cpCap * sizeof(Checkpoint), alignof(Checkpoint)));
+        cpTrkTop = reinterpret_cast<CheckpointTrack*>(
+            takeTop(size_t(cpCap) * trackCount_ * sizeof(CheckpointTrack),
+                    alignof(CheckpointTrack)));
+    }
+    if(cpTrkTop == nullptr)
+        cpCap = 0;
 
-        uint64_t absTicks = 0;
+    InsertTempoPoint(0, fileTempoUsec_);
 
-        while(trk.remaining > 0)
+    SmfEvent* pending = reinterpret_cast<SmfEvent*>(
+        takeTop(trackCount_ * sizeof(SmfEvent), alignof(SmfEvent)));
+    CheckpointTrack* before = reinterpret_cast<CheckpointTrack*>(
+        takeTop(trackCount_ * sizeof(CheckpointTrack), alignof(CheckpointTrack)));
+    SmfEvent         pendingFallback[kMaxTracks];
+    CheckpointTrack  beforeFallback[kMaxTracks];
+    if(pending == nullptr || before == nullptr)
+    {
+        if(trackCount_ > kMaxTracks)
         {
-            if(f_lseek(&file_, trk.pos) != FR_OK)
-                break;
-            uint32_t deltaTicks = 0;
-            if(!ReadVarLen(trk, deltaTicks))
-                break;
-            absTicks += deltaTicks;
-            if(absTicks > total_ticks_)
-                total_ticks_ = absTicks;
+            tempoMap_   = tempoFallback_;
+            tempoCap_   = kMaxTempoPoints;
+            tempoCount_ = 0;
+            sysEx_      = nullptr;
+            sysExCap_   = 0;
+            InsertTempoPoint(0, fileTempoUsec_);
+            return;
+        }
+        pending = pendingFallback;
+        before  = beforeFallback;
+        cpCap   = 0;
+    }
 
-            uint8_t statusByte = 0;
-            if(!ReadTrackByte(trk, statusByte))
-                break;
+    SmfEvent* stream    = nullptr;
+    uint32_t  streamCap = 0;
+    if(work_ != nullptr)
+    {
+        const uintptr_t at = (reinterpret_cast<uintptr_t>(bottom) + alignof(SmfEvent) - 1)
+                             & ~uintptr_t(alignof(SmfEvent) - 1);
+        stream = reinterpret_cast<SmfEvent*>(at);
+        if(at < reinterpret_cast<uintptr_t>(top))
+        {
+            const size_t room = reinterpret_cast<uintptr_t>(top) - at;
+            streamCap = uint32_t((room < predecodeBudget_ ? room : predecodeBudget_)
+                                 / sizeof(SmfEvent));
+        }
+    }
+    bool     storing = streamCap > 0;
+    uint32_t states  = 0;
+
+    // Walk all tracks in tick order, holding each track's next record and
+    // the parser state from just before it was decoded. When the earliest
+    // pending record reaches a checkpoint tick, those states are exactly
+    // where a seek to that tick has to resume.
+    uint16_t* heap      = heap_;
+    uint32_t  heapCount = 0;
+    auto      earlier   = [pending](uint16_t a, uint16_t b) {
+        return pending[a].tick < pending[b].tick
+               || (pending[a].tick == pending[b].tick && a < b);
+    };
+    auto advance = [&](uint16_t i) -> bool {
+        TrackState& trk     = tracks_[i];
+        before[i].pos       = trk.pos;
+        before[i].remaining = trk.remaining;
+        before[i].tick      = uint32_t(trk.tickOffset);
+        before[i].running   = trk.running;
+        before[i].finished  = trk.finished;
+        if(DecodeTrackEvent(i, trk, pending[i]))
+            return true;
+        before[i].pos       = trk.pos;
+        before[i].remaining = trk.remaining;
+        before[i].finished  = true;
+        if(trk.tickOffset > total_ticks_)
+            total_ticks_ = trk.tickOffset;
+        return false;
+    };
 
-            if(statusByte == 0xFF)
+    indexing_ = true;
+    for(uint16_t i = 0; i < trackCount_; i++)
+    {
+        ResetTrack(tracks_[i]);
+        if(advance(i))
+            heap[heapCount++] = i;
+    }
+    HeapMake(heap, heapCount, earlier);
+
+    uint64_t   interval = uint64_t(divisions_) * 4;
+    Checkpoint state{};
+    state.tsNum = ts_num_;
+    state.tsDen = ts_den_;
+    uint16_t bank[16]{};
+    uint16_t hasProgram = 0;
+    while(true)
+    {
+        // One checkpoint per 4/4 bar; when the table fills up every other
+        // entry is dropped and the spacing doubles.
+        const uint64_t cpTick = uint64_t(checkpointCount_) * interval;
+        if(cpCap > 0
+           && (heapCount > 0 ? pending[heap[0]].tick >= cpTick : cpTick <= total_ticks_))
+        {
+            if(checkpointCount_ == cpCap)
             {
-                uint8_t type = 0;
-                if(!ReadTrackByte(trk, type))
-                    break;
-                uint32_t length = 0;
-                if(!ReadVarLen(trk, length))
-                    break;
-
-                if(type == 0x51 && length == 3)
+                for(uint32_t j = 1; j < cpCap / 2; j++)
                 {
-                    uint8_t buf[3];
-                    for(uint32_t i = 0; i < 3; i++)
-                    {
-                        if(!ReadTrackByte(trk, buf[i]))
-                            return;
-                    }
-                    const uint32_t tempo
-                        = (uint32_t(buf[0]) << 16) | (uint32_t(buf[1]) << 8)
-                          | uint32_t(buf[2]);
-                    if(tempoCount_ == 1 && absTicks == 0)
-                        fileTempoUsec_ = tempo;
-                    InsertTempoPoint((uint32_t)absTicks, tempo);
+                    cpTop[j] = cpTop[2 * j];
+                    std::memcpy(&cpTrkTop[size_t(j) * trackCount_],
+                                &cpTrkTop[size_t(2 * j) * trackCount_],
+                                trackCount_ * sizeof(CheckpointTrack));
                 }
-                else
-                {
-                    if(!SkipBytes(trk, length))
-                        break;
-                }
-                if(type == 0x2F)
-                    break;
-                continue;
-            }
-
-            if(statusByte == 0xF0 || statusByte == 0xF7)
-            {
-                uint32_t length = 0;
-                if(!ReadVarLen(trk, length) || !SkipBytes(trk, length))
-                    break;
+                checkpointCount_ = cpCap / 2;
+                interval *= 2;
                 continue;
             }
+            Checkpoint& cp = cpTop[checkpointCount_];
+            cp             = state;
+            cp.tick        = uint32_t(cpTick);
+            std::memcpy(&cpTrkTop[size_t(checkpointCount_) * trackCount_],
+                        before,
+                        trackCount_ * sizeof(CheckpointTrack));
+            checkpointCount_++;
+            continue;
+        }
+        if(heapCount == 0)
+            break;
 
-            uint8_t status = statusByte;
-            uint8_t data1  = 0;
-            if(status < 0x80)
+        const uint16_t  next = heap[0];
+        const SmfEvent& rec  = pending[next];
+        const uint8_t   ch   = rec.status & 0x0F;
+        switch(rec.status & 0xF0)
+        {
+            case 0x90:
+                if(rec.d1 > 0 && !((hasProgram >> ch) & 1u))
+                {
+                    AddProgramUse(bank[ch], 0, ch);
+                    hasProgram |= uint16_t(1u << ch);
+                }
+                break;
+            case 0xB0:
+                // Same bank arithmetic as tsf_channel_midi_control.
+                if(rec.d0 == 0)
+                    bank[ch] = uint16_t(0x8000 | rec.d1);
+                else if(rec.d0 == 32)
+                    bank[ch] = uint16_t(((bank[ch] & 0x8000) ? ((bank[ch] & 0x7F) << 7) : 0)
+                                        | rec.d1);
+                break;
+            case 0xC0:
+                AddProgramUse(bank[ch], rec.d0, ch);
+                hasProgram |= uint16_t(1u << ch);
+                state.program[ch] = rec.d0;
+                state.programValid |= uint16_t(1u << ch);
+                break;
+            default: break;
+        }
+        if(rec.status == kEvTempo)
+        {
+            InsertTempoPoint(rec.tick,
+                             (uint32_t(rec.d0) << 16) | (uint32_t(rec.d1) << 8)
+                                 | uint32_t(rec.d2));
+        }
+        else if(rec.status == kEvTimeSig)
+        {
+            state.tsNum = rec.d0;
+            state.tsDen = uint8_t(1 << rec.d1);
+            if(rec.tick == 0)
             {
-                if(trk.running == 0)
-                    break;
-                data1  = status;
-                status = trk.running;
+                ts_num_ = state.tsNum;
+                ts_den_ = state.tsDen;
             }
             else
             {
-                trk.running = status;
-                if(!ReadTrackByte(trk, data1))
-                    break;
+                timeSigChanges_++;
             }
+        }
 
-            switch(status & 0xF0)
+        if(storing)
+        {
+            if(eventCount_ < streamCap)
             {
-                case 0x80:
-                case 0x90:
-                case 0xA0:
-                case 0xB0:
-                case 0xE0:
-                {
-                    uint8_t data2 = 0;
-                    if(!ReadTrackByte(trk, data2))
-                        return;
-                }
-                break;
-                case 0xC0:
-                case 0xD0:
-                    break;
-                default:
-                    break;
+                stream[eventCount_++] = rec;
+                if(rec.status == kEvTempo || rec.status == kEvTimeSig
+                   || (rec.status & 0xF0) == 0xC0)
+                    states++;
+            }
+            else
+            {
+                storing     = false;
+                eventCount_ = 0;
             }
         }
+
+        if(!advance(next))
+            heap[0] = heap[--heapCount];
+        HeapSiftDown(heap, heapCount, 0, earlier);
     }
+    indexing_ = false;
 
-    if(tempoCount_ == 0)
-        return;
+    for(uint16_t i = 0; i < trackCount_; i++)
+        ResetTrack(tracks_[i]);
 
-    for(uint16_t i = 1; i < tempoCount_; i++)
+    // Pack what is kept down behind the stream, lowest source first so no
+    // move overwrites a table that has not been moved yet.
+    if(storing)
+    {
+        events_     = static_cast<SmfEvent*>(
+            WorkAlloc(eventCount_ * sizeof(SmfEvent), alignof(SmfEvent)));
+        predecoded_ = true;
+        cursor_     = 0;
+    }
+    else
     {
-        const uint32_t keyTick  = tempoTicks_[i];
-        const uint32_t keyTempo = tempoUsec_[i];
-        int            j        = (int)i - 1;
-        while(j >= 0 && tempoTicks_[j] > keyTick)
+        eventCount_ = 0;
+        if(checkpointCount_ > 0)
         {
-            tempoTicks_[j + 1] = tempoTicks_[j];
-            tempoUsec_[j + 1]  = tempoUsec_[j];
-            j--;
+            checkpointTrks_ = static_cast<CheckpointTrack*>(
+                WorkAlloc(size_t(checkpointCount_) * trackCount_ * sizeof(CheckpointTrack),
+                          alignof(CheckpointTrack)));
+            std::memmove(checkpointTrks_,
+                         cpTrkTop,
+                         size_t(checkpointCount_) * trackCount_ * sizeof(CheckpointTrack));
+            checkpoints_ = static_cast<Checkpoint*>(
+                WorkAlloc(checkpointCount_ * sizeof(Checkpoint), alignof(Checkpoint)));
+            std::memmove(checkpoints_, cpTop, checkpointCount_ * sizeof(Checkpoint));
         }
-        tempoTicks_[j + 1] = keyTick;
-        tempoUsec_[j + 1]  = keyTempo;
+    }
+    if(checkpointTrks_ == nullptr)
+        checkpointCount_ = 0;
+    if(sysEx_ != nullptr)
+    {
+        uint8_t* arena = static_cast<uint8_t*>(WorkAlloc(sysExUsed_, 4));
+        std::memmove(arena, sysEx_, sysExUsed_);
+        sysEx_    = arena;
+        sysExCap_ = sysExUsed_;
     }
 
-    uint16_t out = 0;
-    for(uint16_t i = 0; i < tempoCount_; i++)
+    // The file's own opening tempo is kept even under a BPM override so the
+    // override can be switched off again without reopening.
+    fileTempoUsec_ = tempoMap_[0].usec;
+    if(HasBpmOverride())
     {
-        if(out == 0 || tempoTicks_[i] != tempoTicks_[out - 1])
-        {
-            tempoTicks_[out] = tempoTicks_[i];
-            tempoUsec_[out]  = tempoUsec_[i];
-            out++;
-        }
-        else
+        tempoMap_   = tempoFallback_;
+        tempoCap_   = kMaxTempoPoints;
+        tempoCount_ = 0;
+        InsertTempoPoint(0, EffectiveTempoUsec());
+    }
+    else if(tempoMap_ != tempoFallback_)
+    {
+        TempoPoint* map = static_cast<TempoPoint*>(
+            WorkAlloc(tempoCount_ * sizeof(TempoPoint), alignof(TempoPoint)));
+        std::memmove(map, tempoMap_, tempoCount_ * sizeof(TempoPoint));
+        tempoMap_ = map;
+    }
+
+    TempoPoint* map = tempoMap_;
+    map[0].cum      = 0;
+    for(uint32_t i = 1; i < tempoCount_; i++)
+    {
+        map[i].cum = map[i - 1].cum
+                     + uint64_t(map[i].tick - map[i - 1].tick) * map[i - 1].usec;
+    }
+    tempo_ = EffectiveTempoUsec();
+
+    if(predecoded_)
+    {
+        stateIdx_ = static_cast<uint32_t*>(
+            WorkAlloc(states * sizeof(uint32_t), alignof(uint32_t)));
+        for(uint32_t n = 0; n < eventCount_; n++)
         {
-            tempoUsec_[out - 1] = tempoUsec_[i];
+            const uint8_t status = events_[n].status;
+            if(status == kEvTempo || status == kEvTimeSig || (status & 0xF0) == 0xC0)
+                stateIdx_[stateCount_++] = n;
         }
     }
-    tempoCount_ = out;
-    if(tempoCount_ > 0)
+    else if(sysExCount_ > 0)
     {
-        fileTempoUsec_ = tempoUsec_[0];
-        tempo_         = tempoUsec_[0];
+        sysExIndex_ = static_cast<uint32_t*>(
+            WorkAlloc(sysExCount_ * sizeof(uint32_t), alignof(uint32_t)));
+        uint32_t off = 0;
+        for(uint32_t n = 0; n < sysExCount_; n++)
+        {
+            sysExIndex_[n] = off;
+            off += SysExEntryBytes(sizeof(SysExHeader),
+                                   reinterpret_cast<const SysExHeader*>(sysEx_ + off)->length);
+        }
+        const uint8_t* arena = sysEx_;
+        std::sort(sysExIndex_, sysExIndex_ + sysExCount_, [arena](uint32_t a, uint32_t b) {
+            return reinterpret_cast<const SysExHeader*>(arena + a)->pos
+                   < reinterpret_cast<const SysExHeader*>(arena + b)->pos;
+        });
     }
 }
 
-void SmfPlayer::LoadMajorMidiSettings()
-{
-    settings_.Reset();
-    if(!open_ || path_[0] == '\0')
-        return;
-    major_midi::ReadMajorMidiMetaEvent(path_, settings_, nullptr);
-}
-
 bool SmfPlayer::HasBpmOverride() const
 {
     return major_midi::HasMajorMidiBpmOverride(settings_);
@@ -931,6 +1533,140 @@ uint32_t SmfPlayer::EffectiveTempoUsec() const
     return fileTempoUsec_;
 }
 
+void* SmfPlayer::WorkAlloc(size_t bytes, size_t align)
+{
+    if(work_ == nullptr)
+        return nullptr;
+
+    const uintptr_t base  = reinterpret_cast<uintptr_t>(work_);
+    const uintptr_t start = (base + workUsed_ + align - 1) & ~uintptr_t(align - 1);
+    const size_t    used  = size_t(start - base) + bytes;
+    if(used > workSize_)
+        return nullptr;
+
+    workUsed_ = used;
+    return reinterpret_cast<void*>(start);
+}
+
+bool SmfPlayer::ReserveSysEx(uint8_t   status,
+                             uint32_t  length,
+                             uint32_t  pos,
+                             uint32_t  tick,
+                             uint16_t& ref,
+                             uint8_t*& dst)
+{
+    const uint32_t lead = (status == 0xF0) ? 1u : 0u;
+    if(sysEx_ == nullptr || length >= sysExCap_)
+    {
+        sysExDropped_++;
+        return false;
+    }
+    const uint32_t need = SysExEntryBytes(sizeof(SysExHeader), lead + length);
+    if(need > sysExCap_ - sysExUsed_)
+    {
+        sysExDropped_++;
+        return false;
+    }
+
+    SysExHeader* hdr = reinterpret_cast<SysExHeader*>(sysEx_ + sysExUsed_);
+    hdr->pos         = pos;
+    hdr->tick        = tick;
+    hdr->length      = lead + length;
+    dst              = sysEx_ + sysExUsed_ + sizeof(SysExHeader);
+    if(lead)
+        *dst++ = 0xF0;
+    ref = uint16_t(sysExUsed_ / 4u);
+    sysExUsed_ += need;
+    sysExCount_++;
+    return true;
+}
+
+bool SmfPlayer::FindSysEx(uint32_t pos, uint16_t& ref) const
+{
+    if(sysExIndex_ == nullptr)
+        return false;
+
+    uint32_t lo = 0;
+    uint32_t hi = sysExCount_;
+    while(lo < hi)
+    {
+        const uint32_t mid = lo + (hi - lo) / 2;
+        if(reinterpret_cast<const SysExHeader*>(sysEx_ + sysExIndex_[mid])->pos < pos)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    if(lo == sysExCount_
+       || reinterpret_cast<const SysExHeader*>(sysEx_ + sysExIndex_[lo])->pos != pos)
+        return false;
+    ref = uint16_t(sysExIndex_[lo] / 4u);
+    return true;
+}
+
+bool SmfPlayer::GetSysEx(const MidiEv& ev, const uint8_t*& data, uint32_t& length) const
+{
+    if(ev.type != EvType::SysEx || sysEx_ == nullptr)
+        return false;
+    const uint32_t off = ((uint32_t(ev.a) << 8) | ev.b) * 4u;
+    if(off + sizeof(SysExHeader) > sysExUsed_)
+        return false;
+    const SysExHeader* hdr = reinterpret_cast<const SysExHeader*>(sysEx_ + off);
+    data                   = sysEx_ + off + sizeof(SysExHeader);
+    length                 = hdr->length;
+    return true;
+}
+
+void SmfPlayer::CollectSeekSysEx(uint64_t targetSample)
+{
+    // Arena entries are in decode order, which only roughly follows the
+    // song across tracks, so the kept ones are insertion-sorted by tick.
+    seekSysExCount_ = 0;
+    for(uint32_t off = 0; off < sysExUsed_;)
+    {
+        const SysExHeader* hdr = reinterpret_cast<const SysExHeader*>(sysEx_ + off);
+        if(seekSysExCount_ < kMaxSeekSysEx && SamplesFromTicks(hdr->tick) < targetSample)
+        {
+            MidiEv ev{};
+            ev.atTick  = hdr->tick;
+            ev.type    = EvType::SysEx;
+            ev.ch      = 0xFF;
+            ev.a       = uint8_t((off / 4u) >> 8);
+            ev.b       = uint8_t((off / 4u) & 0xFF);
+            uint16_t i = seekSysExCount_++;
+            while(i > 0 && seekSysEx_[i - 1].atTick > ev.atTick)
+            {
+                seekSysEx_[i] = seekSysEx_[i - 1];
+                i--;
+            }
+            seekSysEx_[i] = ev;
+        }
+        off += SysExEntryBytes(sizeof(SysExHeader), hdr->length);
+    }
+}
+
+void SmfPlayer::AddProgramUse(uint16_t bank, uint8_t program, uint8_t ch)
+{
+    const bool     drums = ch == 9;
+    const uint16_t bit   = uint16_t(1u << ch);
+    for(uint16_t i = 0; i < programUseCount_; i++)
+    {
+        ProgramUse& use = programUse_[i];
+        if(use.bank == bank && use.program == program && use.drums == drums)
+        {
+            use.channels |= bit;
+            return;
+        }
+    }
+    if(programUseCount_ < kMaxProgramUses)
+        programUse_[programUseCount_++] = ProgramUse{bank, program, drums, bit};
+}
+
+void SmfPlayer::ResetReadStats()
+{
+    readRefills_ = 0;
+    readBytes_   = 0;
+}
+
 bool SmfPlayer::SaveSettings()
 {
     if(path_[0] == '\0')
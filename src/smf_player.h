@@ -1,4 +1,5 @@
 #pragma once
+#include <cstddef>
 #include <cstdint>
 #include "scheduler.h"
 #include "major_midi_settings.h"
@@ -14,6 +15,22 @@ class SmfPlayer
     bool Open(const char* path);
     void Close();
 
+    // Per-song tables are carved out of caller-owned memory (SDRAM on the
+    // module). Without it the player always streams from the file.
+    void SetWorkMemory(void* mem, size_t bytes);
+    // Files whose decoded event stream exceeds this many bytes are streamed.
+    void SetPredecodeBudget(size_t bytes) { predecodeBudget_ = bytes; }
+    bool IsPredecoded() const { return predecoded_; }
+    uint32_t DecodedEventCount() const { return eventCount_; }
+    // Streaming-mode seek index and the worst seek seen since Open, in
+    // events parsed past the starting checkpoint.
+    uint32_t CheckpointCount() const { return checkpointCount_; }
+    uint32_t MaxSeekEvents() const { return maxSeekEvents_; }
+    // Streaming merge cost: events pushed by Pump and the heap comparisons
+    // spent on them. Steps per event grow with log2(track count).
+    uint32_t PumpEvents() const { return pumpEvents_; }
+    uint32_t PumpHeapSteps() const { return pumpHeapSteps_; }
+
     void SetSampleRate(float sr);
     void SetLookaheadSamples(uint64_t samples);
     void SetTempoScale(float scale);
@@ -32,9 +49,22 @@ class SmfPlayer
     uint64_t SamplesFromTicks(uint64_t ticks) const;
     uint64_t SamplesFromTicksRange(uint64_t startTicks, uint64_t lengthTicks) const;
     uint64_t TicksFromSamples(uint64_t samples) const;
+    // Sample/position map of the pass being parsed; queued events are
+    // timed against a copy of it. PositionForTick takes the caller's own
+    // segment cursor so the audio callback can convert without touching
+    // the player's cache.
+    const SongTimeline& Timeline() const { return timeline_; }
+    uint64_t PositionForTick(uint64_t ticks, uint32_t& cursor) const;
+    uint64_t TickForPosition(double pos) const;
+    uint64_t SampleForTick(uint64_t ticks) const;
     uint64_t TotalTicks() const { return total_ticks_; }
+    uint32_t TempoPointCount() const { return tempoCount_; }
+    uint32_t TempoPointsDropped() const { return tempoDropped_; }
     uint8_t TimeSigNumerator() const { return ts_num_; }
     uint8_t TimeSigDenominator() const { return ts_den_; }
+    // Time signature changes after tick 0; the signature in force at the
+    // start is what TimeSigNumerator/Denominator report after Open.
+    uint32_t TimeSigChanges() const { return timeSigChanges_; }
     const char* GetTrackNameForChannel(uint8_t ch) const;
     bool    HasSeekProgramState(uint8_t ch) const;
     uint8_t GetSeekProgramState(uint8_t ch) const;
@@ -42,10 +72,105 @@ class SmfPlayer
     major_midi::MajorMidiSettings& MutableSettings() { return settings_; }
     bool SaveSettings();
 
+    // SD read diagnostics for the per-track windows
+    uint32_t ReadRefills() const { return readRefills_; }
+    uint32_t ReadBytes() const { return readBytes_; }
+    void     ResetReadStats();
+
+    // Programs the song selects, gathered at Open so presets can be prepared
+    // before playback. Channels that play notes without a program change
+    // list program 0. Bank uses the same encoding as TinySoundFont;
+    // channels has a bit for each channel that selects it.
+    struct ProgramUse
+    {
+        uint16_t bank;
+        uint8_t  program;
+        bool     drums;
+        uint16_t channels;
+    };
+    uint16_t          ProgramUseCount() const { return programUseCount_; }
+    const ProgramUse& GetProgramUse(uint16_t i) const { return programUse_[i]; }
+
+    // SysEx payloads are copied once, at Open, into a per-song arena in work
+    // memory; queued SysEx events only carry a reference into it. The bytes
+    // are ready to send: F0 messages include the leading 0xF0. Messages that
+    // do not fit the arena are dropped and counted.
+    bool     GetSysEx(const MidiEv& ev, const uint8_t*& data, uint32_t& length) const;
+    uint32_t SysExCount() const { return sysExCount_; }
+    uint32_t SysExDropped() const { return sysExDropped_; }
+    // SysEx messages that fall before the last seek target, in song order,
+    // for the transport to replay into the synth alongside the programs.
+    uint16_t      SeekSysExCount() const { return seekSysExCount_; }
+    const MidiEv& GetSeekSysEx(uint16_t i) const { return seekSysEx_[i]; }
+
     // Parses ahead and pushes timestamped events
     void Pump(EventQueue<1024>& queue, uint64_t sampleNow);
 
   private:
+    // Each track parses out of its own window of the file. Windows start on a
+    // 512-byte file offset so every refill is a whole-sector f_read.
+    static constexpr uint32_t kTrackWindowBytes = 512;
+    static constexpr uint16_t kTrackNameMax     = 24;
+    // Track state lives in work memory when there is some; otherwise only
+    // the small in-object table is available.
+    static constexpr uint16_t kMaxTracks     = 16;
+    static constexpr uint16_t kMaxWorkTracks = 256;
+    static constexpr size_t   kDefaultPredecodeBudget = 1024 * 1024;
+
+    // Compact decoded event. Channel events keep their raw status byte; the
+    // few meta events playback cares about use the otherwise unused
+    // system-common codes below.
+    struct SmfEvent
+    {
+        uint32_t tick;
+        uint8_t  status;
+        uint8_t  d0;
+        uint8_t  d1;
+        uint8_t  d2;
+    };
+    // Streaming seeks restart every track from the last checkpoint before
+    // the target instead of from the top of the file.
+    static constexpr uint32_t kMaxCheckpoints = 2048;
+
+    struct CheckpointTrack
+    {
+        FSIZE_t  pos;
+        uint32_t remaining;
+        uint32_t tick;
+        uint8_t  running;
+        bool     finished;
+    };
+
+    struct Checkpoint
+    {
+        uint32_t tick;
+        uint16_t programValid;
+        uint8_t  program[16];
+        uint8_t  tsNum;
+        uint8_t  tsDen;
+    };
+
+    static constexpr uint8_t kEvTempo      = 0xF1;
+    static constexpr uint8_t kEvTimeSig    = 0xF2;
+    static constexpr uint8_t kEvEndOfTrack = 0xF3;
+    // d0/d1 hold the arena reference (entry offset / 4, big-endian)
+    static constexpr uint8_t kEvSysEx      = 0xF0;
+
+    // Arena entries are 4-byte aligned so a 16-bit reference covers 256K.
+    struct SysExHeader
+    {
+        uint32_t pos; // file offset of the payload, to match re-decoded events
+        uint32_t tick;
+        uint32_t length;
+    };
+    static constexpr size_t   kMaxSysExArena = 256 * 1024;
+    static constexpr uint16_t kMaxSeekSysEx  = 32;
+
+    static constexpr uint16_t kMaxProgramUses = 128;
+    // Largest Major MIDI payload read while indexing; current payloads are
+    // well under 128 bytes.
+    static constexpr uint32_t kMajorMidiMetaMax = 128;
+
     struct TrackState
     {
         FSIZE_t  start = 0;
@@ -53,43 +178,66 @@ class SmfPlayer
         uint32_t length = 0;
         uint32_t remaining = 0;
         uint8_t  running = 0;
-        double   sampleFrac = 0.0;
         uint64_t tickOffset = 0;
-        uint64_t sampleOffset = 0;
         bool     finished = false;
         bool     hasEvent = false;
         MidiEv   nextEv{};
+        FSIZE_t  winBase = 0;
+        uint32_t winFill = 0;
+        int8_t   channel = -1;
+        bool     hasName = false;
+        char     name[kTrackNameMax]{};
+        alignas(32) uint8_t window[kTrackWindowBytes]{};
     };
 
     bool ParseNextEvent(uint16_t trackIndex, TrackState& trk, MidiEv& out);
+    bool DecodeTrackEvent(uint16_t trackIndex, TrackState& trk, SmfEvent& out);
+    bool RecordToEvent(const SmfEvent& rec, MidiEv& out);
+    void* WorkAlloc(size_t bytes, size_t align);
+    void IndexTracks();
+    void AddProgramUse(uint16_t bank, uint8_t program, uint8_t ch);
+    void PumpDecoded(EventQueue<1024>& queue, uint64_t limitTick);
+    void SeekDecoded(uint64_t targetSample);
+    const Checkpoint* FindCheckpoint(uint64_t targetSample) const;
+    void RestoreCheckpoint(const Checkpoint& cp);
     bool PrepareNextEvent(uint16_t trackIndex, TrackState& trk);
+    bool AllocTracks(uint16_t count);
+    void RebuildHeap();
+    void ResetTrack(TrackState& trk);
+    bool FillWindow(TrackState& trk);
     bool ReadTrackByte(TrackState& trk, uint8_t& b);
     bool ReadVarLen(TrackState& trk, uint32_t& value);
     bool SkipBytes(TrackState& trk, uint32_t count);
+    bool ReadTrackBytes(TrackState& trk, uint8_t* dst, uint32_t count);
+    bool ReserveSysEx(uint8_t status, uint32_t length, uint32_t pos, uint32_t tick,
+                      uint16_t& ref, uint8_t*& dst);
+    bool FindSysEx(uint32_t pos, uint16_t& ref) const;
+    void CollectSeekSysEx(uint64_t targetSample);
     bool SeekTrackHeader(uint32_t& length);
-    void LoadMajorMidiSettings();
     bool HasBpmOverride() const;
     uint32_t EffectiveTempoUsec() const;
     void UpdateSamplesPerTick();
-    void BuildTempoMap();
     void InsertTempoPoint(uint32_t tick, uint32_t tempo);
+    uint32_t TempoSegmentForTick(uint64_t ticks, uint32_t& cursor) const;
+    uint32_t TempoSegmentForUsecTicks(double usecTicks) const;
 
     FIL      file_;
     char     path_[64]{};
     bool     open_            = false;
     bool     playing_         = false;
     uint16_t trackCount_      = 0;
-    static constexpr uint16_t kMaxTracks = 16;
-    static constexpr uint16_t kTrackNameMax = 24;
-    TrackState tracks_[kMaxTracks]{};
-    char     trackNames_[kMaxTracks][kTrackNameMax]{};
-    bool     trackHasName_[kMaxTracks]{};
-    int8_t   trackChannel_[kMaxTracks]{};
+    TrackState* tracks_       = trackFallback_;
+    // Min-heap of track indices with a pending event, keyed on event time.
+    uint16_t*   heap_         = heapFallback_;
+    uint16_t    heapCount_    = 0;
+    TrackState  trackFallback_[kMaxTracks]{};
+    uint16_t    heapFallback_[kMaxTracks]{};
+    uint32_t    pumpEvents_    = 0;
+    uint32_t    pumpHeapSteps_ = 0;
 
     float    sr_              = 48000.0f;
     uint64_t lookahead_       = 0;
-    uint64_t startSample_     = 0;
-    uint64_t seekSample_      = 0;
+    SongTimeline timeline_{};
     float    tempo_scale_     = 1.0f;
 
     uint16_t divisions_       = 480;
@@ -100,10 +248,61 @@ class SmfPlayer
     uint8_t  ts_den_          = 4;
     bool     seek_program_valid_[16]{};
     uint8_t  seek_program_[16]{};
-    static constexpr uint16_t kMaxTempoPoints = 256;
-    uint16_t tempoCount_      = 0;
-    uint32_t tempoTicks_[kMaxTempoPoints]{};
-    uint32_t tempoUsec_[kMaxTempoPoints]{};
+    // Tempo segments carry the running sum of ticks x usec-per-quarter up
+    // to their start. The sums do not depend on sample rate or tempo scale,
+    // so a scale change only updates samplesPerTickUsec_.
+    struct TempoPoint
+    {
+        uint32_t tick;
+        uint32_t usec;
+        uint64_t cum;
+    };
+    static constexpr uint32_t kMaxTempoPoints     = 256;
+    static constexpr uint32_t kMaxWorkTempoPoints = 65536;
+    TempoPoint* tempoMap_     = tempoFallback_;
+    uint32_t    tempoCount_   = 0;
+    uint32_t    tempoCap_     = kMaxTempoPoints;
+    uint32_t    tempoDropped_ = 0;
+    TempoPoint  tempoFallback_[kMaxTempoPoints]{};
+    double      samplesPerTickUsec_ = 0.0;
+    mutable uint32_t tickCursor_    = 0;
+    mutable uint32_t sampleCursor_  = 0;
     uint64_t total_ticks_      = 0;
+    uint32_t readRefills_      = 0;
+    uint32_t readBytes_        = 0;
+
+    uint8_t*  work_            = nullptr;
+    size_t    workSize_        = 0;
+    size_t    workUsed_        = 0;
+    size_t    predecodeBudget_ = kDefaultPredecodeBudget;
+    bool      predecoded_      = false;
+    SmfEvent* events_          = nullptr;
+    uint32_t  eventCount_      = 0;
+    uint32_t  cursor_          = 0;
+    // Indices into events_ of program/tempo/time-signature records, so a
+    // seek can rebuild that state without walking the whole stream.
+    uint32_t* stateIdx_        = nullptr;
+    uint32_t  stateCount_      = 0;
+    Checkpoint*      checkpoints_     = nullptr;
+    CheckpointTrack* checkpointTrks_  = nullptr;
+    uint32_t         checkpointCount_ = 0;
+    uint32_t         maxSeekEvents_   = 0;
+    ProgramUse       programUse_[kMaxProgramUses]{};
+    uint16_t         programUseCount_ = 0;
+    uint32_t         timeSigChanges_  = 0;
+    uint8_t*         sysEx_           = nullptr;
+    uint32_t         sysExUsed_       = 0;
+    uint32_t         sysExCap_        = 0;
+    // Streaming mode re-decodes SysEx from the file; entry offsets sorted by
+    // file position map it back to the arena.
+    uint32_t*        sysExIndex_      = nullptr;
+    uint32_t         sysExCount_      = 0;
+    uint32_t         sysExDropped_    = 0;
+    MidiEv           seekSysEx_[kMaxSeekSysEx]{};
+    uint16_t         seekSysExCount_  = 0;
+    // Set during the Open pass so DecodeTrackEvent also picks up the Major
+    // MIDI payload from track 0.
+    bool             indexing_        = false;
+    bool             settingsFound_   = false;
     major_midi::MajorMidiSettings settings_{};
 };
@@ -0,0 +1,186 @@
+#include "synth_arena.h"
+
+#include "daisy_patch_sm.h"
+
+static SdramArena g_arena;
+static bool       g_arena_oom      = false;
+static uint32_t   g_arena_in_place = 0; // reallocs served without a copy
+static uint32_t   g_arena_moved    = 0;
+
+// Put arena in SDRAM
+static uint8_t DSY_SDRAM_BSS sdram_arena_buf[56 * 1024 * 1024];
+
+void ArenaInit()
+{
+    g_arena.Init(sdram_arena_buf, sizeof(sdram_arena_buf));
+}
+
+SdramArena& Arena()
+{
+    return g_arena;
+}
+
+uint8_t* ArenaBase()
+{
+    return sdram_arena_buf;
+}
+
+void ArenaReset()
+{
+    // No clearing: the arena only hands out memory that TSF (like any malloc
+    // user) initializes before use.
+    g_arena.Reset();
+    g_arena_oom      = false;
+    g_arena_in_place = 0;
+    g_arena_moved    = 0;
+}
+
+void ArenaSetOom()
+{
+    g_arena_oom = true;
+}
+
+// -----------------------------
+// TSF allocator
+// -----------------------------
+
+// Precedes every TSF block; keeps the payload 8-byte aligned
+struct ArenaHdr
+{
+    uint32_t sz; // usable bytes
+    uint16_t site;
+    uint16_t reserved;
+};
+
+static inline size_t ArenaBlockBytes(size_t bytes)
+{
+    return SdramArena::RoundUp(sizeof(ArenaHdr) + bytes, 8);
+}
+
+void* ArenaMalloc(size_t bytes, const char* site)
+{
+    const uint16_t index = g_arena.SiteIndex(site);
+    const size_t   total = ArenaBlockBytes(bytes);
+    void*          raw   = g_arena.Alloc(total, 8, index);
+    if(!raw)
+    {
+        g_arena_oom = true;
+        return nullptr;
+    }
+    auto* h = (ArenaHdr*)raw;
+    h->sz   = uint32_t(total - sizeof(ArenaHdr));
+    h->site = index;
+    return (void*)(h + 1);
+}
+
+void ArenaFree(void* ptr)
+{
+    if(!ptr)
+        return;
+    auto* h = ((ArenaHdr*)ptr) - 1;
+    g_arena.Release(h, sizeof(ArenaHdr) + h->sz, h->site);
+}
+
+void* ArenaRealloc(void* ptr, size_t newBytes, const char* site)
+{
+    if(!ptr)
+        return ArenaMalloc(newBytes, site);
+    auto*        h        = ((ArenaHdr*)ptr) - 1;
+    const size_t oldBytes = h->sz;
+
+    const size_t oldBlock = sizeof(ArenaHdr) + oldBytes;
+    const size_t newBlock = ArenaBlockBytes(newBytes);
+    if(g_arena.Resize(h, oldBlock, newBlock, h->site))
+    {
+        h->sz = uint32_t(newBlock - sizeof(ArenaHdr));
+        g_arena_in_place++;
+        return ptr;
+    }
+    // Anywhere else a shrink keeps the block (and its capacity) as it is.
+    if(newBlock <= oldBlock)
+    {
+        g_arena_in_place++;
+        return ptr;
+    }
+
+    void* np = ArenaMalloc(newBytes, site);
+    if(!np)
+        return nullptr;
+    __builtin_memcpy(np, ptr, oldBytes);
+    ArenaFree(ptr);
+    g_arena_moved++;
+    return np;
+}
+
+// -----------------------------
+// Cache images
+// -----------------------------
+
+void ArenaSave(ArenaSnapshot& snapshot)
+{
+    g_arena.SaveState(snapshot.state);
+    snapshot.in_place = g_arena_in_place;
+    snapshot.moved    = g_arena_moved;
+}
+
+uint32_t ArenaOffset(const void* p)
+{
+    return p ? uint32_t((const uint8_t*)p - sdram_arena_buf) : 0;
+}
+
+bool ArenaRestore(const ArenaSnapshot& snapshot)
+{
+    if(!g_arena.RestoreState(snapshot.state))
+        return false;
+    g_arena_in_place = snapshot.in_place;
+    g_arena_moved    = snapshot.moved;
+    return true;
+}
+
+// -----------------------------
+// Arena API
+// -----------------------------
+
+void ArenaGetStats(SynthArenaStats& stats)
+{
+    stats.used            = g_arena.Used();
+    stats.cap             = g_arena.Cap();
+    stats.free_bytes      = g_arena.FreeBytes();
+    stats.reclaimed_bytes = g_arena.ReclaimedBytes();
+    stats.reused_bytes    = g_arena.ReusedBytes();
+    stats.lost_bytes      = g_arena.LostBytes();
+    stats.in_place        = g_arena_in_place;
+    stats.moved           = g_arena_moved;
+}
+
+size_t SynthArenaUsed()
+{
+    return g_arena.Used();
+}
+
+size_t SynthArenaCap()
+{
+    return g_arena.Cap();
+}
+
+size_t SynthArenaSiteCount()
+{
+    return g_arena.SiteCount();
+}
+
+bool SynthGetArenaSite(size_t index, SynthArenaSite& site)
+{
+    if(index >= g_arena.SiteCount())
+        return false;
+    const SdramArena::Site& s = g_arena.GetSite(index);
+    site.name                 = s.name;
+    site.allocs               = s.allocs;
+    site.live_bytes           = s.live_bytes;
+    site.peak_bytes           = s.peak_bytes;
+    return true;
+}
+
+bool SynthArenaOom()
+{
+    return g_arena_oom;
+}
@@ -0,0 +1,391 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+#include "synth_tsf.h"
+
+// -----------------------------
+// Deterministic SDRAM arena for TSF. Allocation bumps the top; blocks freed
+// at the top lower it again, others go to a small free list that later
+// allocations are fitted into. Everything is dropped at the next SF2 load.
+// Each allocation is charged to a named site (a TSF function or a loader
+// table) for diagnostics.
+// -----------------------------
+class SdramArena
+{
+  public:
+    static constexpr size_t kMaxSites    = 24;
+    static constexpr size_t kMaxFree     = 64;
+    static constexpr size_t kSiteNameMax = 32;
+
+    struct Site
+    {
+        const char* name;
+        uint32_t    allocs;
+        uint32_t    live_bytes;
+        uint32_t    peak_bytes;
+    };
+
+    // Sorted by offset, never adjacent (merged on insert)
+    struct FreeBlock
+    {
+        uint32_t offset;
+        uint32_t bytes;
+    };
+
+    // The bookkeeping of [base, base + used), stored beside a cache image so
+    // a cache load carries on with the sites and free list of the parse.
+    struct State
+    {
+        uint32_t used;
+        uint32_t site_count;
+        uint32_t free_count;
+        uint32_t reclaimed;
+        uint32_t reused;
+        uint32_t lost;
+        struct
+        {
+            char     name[kSiteNameMax];
+            uint32_t allocs;
+            uint32_t live_bytes;
+            uint32_t peak_bytes;
+        } sites[kMaxSites];
+        FreeBlock free[kMaxFree];
+    };
+
+    void Init(void* mem, size_t bytes)
+    {
+        base_ = (uint8_t*)mem;
+        cap_  = bytes;
+        Reset();
+    }
+    void Reset()
+    {
+        // Offset 0 is never handed out, so a cache image can store null
+        // pointers as 0.
+        used_       = kGrain;
+        free_count_ = 0;
+        site_count_ = 0;
+        reclaimed_  = 0;
+        reused_     = 0;
+        lost_       = 0;
+    }
+
+    // Site index for name, registering it on first use. The last slot is
+    // shared by everything past the table.
+    uint16_t SiteIndex(const char* name)
+    {
+        for(size_t i = 0; i < site_count_; i++)
+            if(sites_[i].name == name || std::strcmp(sites_[i].name, name) == 0)
+                return uint16_t(i);
+        if(site_count_ == kMaxSites)
+        {
+            sites_[kMaxSites - 1].name = "other";
+            return uint16_t(kMaxSites - 1);
+        }
+        sites_[site_count_] = Site{name, 0, 0, 0};
+        return uint16_t(site_count_++);
+    }
+
+    void* Alloc(size_t bytes, size_t align, uint16_t site)
+    {
+        if(!base_)
+            return nullptr;
+        bytes          = RoundUp(bytes, kGrain);
+        uint8_t* block = FitFree(bytes, align);
+        if(!block)
+        {
+            const size_t start = RoundUp(used_, align);
+            const size_t end   = start + bytes;
+            if(end > cap_)
+                return nullptr;
+            used_ = end;
+            block = base_ + start;
+        }
+        Charge(site, int64_t(bytes));
+        sites_[site].allocs++;
+        return block;
+    }
+    void* Alloc(size_t bytes, size_t align, const char* site)
+    {
+        return Alloc(bytes, align, SiteIndex(site));
+    }
+
+    // Gives [p, p + bytes) back: lowers the top when it is the top block,
+    // otherwise keeps it for reuse.
+    void Release(void* p, size_t bytes, uint16_t site)
+    {
+        if(!p)
+            return;
+        bytes = RoundUp(bytes, kGrain);
+        Charge(site, -int64_t(bytes));
+        reclaimed_ += bytes;
+        const size_t offset = size_t((uint8_t*)p - base_);
+        if(offset + bytes == used_)
+        {
+            used_ = offset;
+            // Free blocks that now end at the top go with it
+            while(free_count_ > 0
+                  && free_[free_count_ - 1].offset + free_[free_count_ - 1].bytes == used_)
+                used_ = free_[--free_count_].offset;
+            return;
+        }
+        AddFree(uint32_t(offset), uint32_t(bytes));
+    }
+
+    // Grows or shrinks [p, p + old_bytes) in place; only the top block can.
+    bool Resize(void* p, size_t old_bytes, size_t new_bytes, uint16_t site)
+    {
+        old_bytes           = RoundUp(old_bytes, kGrain);
+        new_bytes           = RoundUp(new_bytes, kGrain);
+        const size_t offset = size_t((uint8_t*)p - base_);
+        if(offset + old_bytes != used_ || offset + new_bytes > cap_)
+            return false;
+        used_ = offset + new_bytes;
+        Charge(site, int64_t(new_bytes) - int64_t(old_bytes));
+        return true;
+    }
+
+    size_t      Used() const { return used_; }
+    size_t      Cap() const { return cap_; }
+    size_t      SiteCount() const { return site_count_; }
+    const Site& GetSite(size_t i) const { return sites_[i]; }
+    size_t      FreeBytes() const
+    {
+        size_t bytes = 0;
+        for(size_t i = 0; i < free_count_; i++)
+            bytes += free_[i].bytes;
+        return bytes;
+    }
+    uint32_t ReclaimedBytes() const { return reclaimed_; }
+    uint32_t ReusedBytes() const { return reused_; }
+    uint32_t LostBytes() const { return lost_; }
+
+    void SaveState(State& state) const
+    {
+        __builtin_memset(&state, 0, sizeof(state));
+        state.used       = uint32_t(used_);
+        state.site_count = uint32_t(site_count_);
+        state.free_count = uint32_t(free_count_);
+        state.reclaimed  = reclaimed_;
+        state.reused     = reused_;
+        state.lost       = lost_;
+        for(size_t i = 0; i < site_count_; i++)
+        {
+            std::strncpy(state.sites[i].name, sites_[i].name, kSiteNameMax - 1);
+            state.sites[i].allocs     = sites_[i].allocs;
+            state.sites[i].live_bytes = sites_[i].live_bytes;
+            state.sites[i].peak_bytes = sites_[i].peak_bytes;
+        }
+        for(size_t i = 0; i < free_count_; i++)
+            state.free[i] = free_[i];
+    }
+
+    // Takes over a saved state once its memory is in place. A state that
+    // does not describe a valid arena leaves it reset and returns false.
+    bool RestoreState(const State& state)
+    {
+        Reset();
+        if(state.used < kGrain || state.used > cap_ || state.site_count > kMaxSites
+           || state.free_count > kMaxFree)
+            return false;
+        uint64_t accounted = state.lost;
+        for(size_t i = 0; i < state.site_count; i++)
+        {
+            const char* name = state.sites[i].name;
+            size_t      len  = 0;
+            while(len < kSiteNameMax && name[len] >= ' ' && name[len] <= '~')
+                len++;
+            if(len == 0 || len == kSiteNameMax || name[len] != '\0'
+               || state.sites[i].live_bytes > state.sites[i].peak_bytes)
+                return false;
+            accounted += state.sites[i].live_bytes;
+        }
+        uint64_t end = 0;
+        for(size_t i = 0; i < state.free_count; i++)
+        {
+            const FreeBlock& fb = state.free[i];
+            if(fb.bytes == 0 || fb.offset < kGrain || fb.offset % kGrain != 0
+               || fb.bytes % kGrain != 0 || (i > 0 && fb.offset <= end)
+               || uint64_t(fb.offset) + fb.bytes > state.used)
+                return false;
+            end = uint64_t(fb.offset) + fb.bytes;
+            accounted += fb.bytes;
+        }
+        if(accounted > state.used)
+            return false;
+
+        used_       = state.used;
+        site_count_ = state.site_count;
+        free_count_ = state.free_count;
+        reclaimed_  = state.reclaimed;
+        reused_     = state.reused;
+        lost_       = state.lost;
+        for(size_t i = 0; i < site_count_; i++)
+        {
+            std::memcpy(names_[i], state.sites[i].name, kSiteNameMax);
+            sites_[i] = Site{names_[i],
+                             state.sites[i].allocs,
+                             state.sites[i].live_bytes,
+                             state.sites[i].peak_bytes};
+        }
+        for(size_t i = 0; i < free_count_; i++)
+            free_[i] = state.free[i];
+        return true;
+    }
+
+    static constexpr size_t RoundUp(size_t v, size_t align)
+    {
+        return (v + (align - 1)) & ~(align - 1);
+    }
+
+  private:
+    static constexpr size_t kGrain = 8;
+
+    void Charge(uint16_t site, int64_t bytes)
+    {
+        Site& s      = sites_[site];
+        s.live_bytes = uint32_t(int64_t(s.live_bytes) + bytes);
+        if(s.live_bytes > s.peak_bytes)
+            s.peak_bytes = s.live_bytes;
+    }
+
+    uint8_t* FitFree(size_t bytes, size_t align)
+    {
+        for(size_t i = 0; i < free_count_; i++)
+        {
+            FreeBlock& fb = free_[i];
+            if(fb.bytes < bytes || (fb.offset & (align - 1)) != 0)
+                continue;
+            uint8_t* block = base_ + fb.offset;
+            fb.offset += uint32_t(bytes);
+            fb.bytes -= uint32_t(bytes);
+            if(fb.bytes == 0)
+            {
+                for(size_t j = i + 1; j < free_count_; j++)
+                    free_[j - 1] = free_[j];
+                free_count_--;
+            }
+            reused_ += bytes;
+            return block;
+        }
+        return nullptr;
+    }
+
+    void AddFree(uint32_t offset, uint32_t bytes)
+    {
+        size_t i = 0;
+        while(i < free_count_ && free_[i].offset < offset)
+            i++;
+        const bool join_prev = i > 0 && free_[i - 1].offset + free_[i - 1].bytes == offset;
+        const bool join_next = i < free_count_ && offset + bytes == free_[i].offset;
+        if(join_prev && join_next)
+        {
+            free_[i - 1].bytes += bytes + free_[i].bytes;
+            for(size_t j = i + 1; j < free_count_; j++)
+                free_[j - 1] = free_[j];
+            free_count_--;
+        }
+        else if(join_prev)
+        {
+            free_[i - 1].bytes += bytes;
+        }
+        else if(join_next)
+        {
+            free_[i].offset = offset;
+            free_[i].bytes += bytes;
+        }
+        else if(free_count_ < kMaxFree)
+        {
+            for(size_t j = free_count_; j > i; j--)
+                free_[j] = free_[j - 1];
+            free_[i] = FreeBlock{offset, bytes};
+            free_count_++;
+        }
+        else
+        {
+            lost_ += bytes; // stays allocated until the next load
+        }
+    }
+
+    uint8_t*  base_ = nullptr;
+    size_t    cap_  = 0;
+    size_t    used_ = 0;
+    FreeBlock free_[kMaxFree];
+    size_t    free_count_ = 0;
+    Site      sites_[kMaxSites];
+    size_t    site_count_ = 0;
+    char      names_[kMaxSites][kSiteNameMax]; // of restored sites
+    uint32_t  reclaimed_  = 0;
+    uint32_t  reused_     = 0;
+    uint32_t  lost_       = 0;
+};
+
+// -----------------------------
+// The synth's arena, over a fixed SDRAM buffer. TSF allocates through
+// ArenaMalloc/ArenaRealloc/ArenaFree; the loader, streaming and FX tables
+// take their blocks from Arena() directly.
+// -----------------------------
+void        ArenaInit();
+SdramArena& Arena();
+uint8_t*    ArenaBase();
+// Empties the arena and clears its counters, at the start of every load
+void ArenaReset();
+// A table the load needs did not fit
+void ArenaSetOom();
+void ArenaGetStats(SynthArenaStats& stats);
+
+// TSF's allocator: a header ahead of each block records its size and site,
+// so blocks can be freed and grown in place.
+void* ArenaMalloc(size_t bytes, const char* site);
+void  ArenaFree(void* ptr);
+void* ArenaRealloc(void* ptr, size_t newBytes, const char* site);
+
+// The arena's bookkeeping as a cache image stores it, with the realloc
+// counters of the parse that wrote it
+struct ArenaSnapshot
+{
+    SdramArena::State state;
+    uint32_t          in_place;
+    uint32_t          moved;
+};
+void ArenaSave(ArenaSnapshot& snapshot);
+// Takes over a snapshot once the image is back in place; false leaves the
+// arena reset
+bool ArenaRestore(const ArenaSnapshot& snapshot);
+
+// -----------------------------
+// Cache images: the start of the arena written out with every pointer as
+// its arena offset. Offset 0 is never handed out, so it stands for null.
+// -----------------------------
+uint32_t ArenaOffset(const void* p);
+
+// [offset, offset + count) of T lies in an image of image_bytes, aligned for
+// T; offset 0 is a null pointer and never valid.
+template <typename T>
+inline bool ImageSpan(uint64_t image_bytes, uint64_t offset, uint64_t count)
+{
+    return offset != 0 && offset % alignof(T) == 0 && count <= image_bytes
+           && offset + count * sizeof(T) <= image_bytes;
+}
+
+// Image pointers are still offsets
+template <typename T>
+inline uint64_t ImageOffset(const T* p)
+{
+    return uint64_t((uintptr_t)p);
+}
+
+template <typename T>
+inline const T* ImageAt(const T* p)
+{
+    return (const T*)(ArenaBase() + (uintptr_t)p);
+}
+
+template <typename T>
+inline void RebasePtr(T*& p, uintptr_t from, uintptr_t to)
+{
+    if(p)
+        p = (T*)((uintptr_t)p - from + to);
+}
@@ -0,0 +1,278 @@
+#include "synth_cache.h"
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+
+#include "synth_arena.h"
+#include "synth_stream.h"
+#include "synth_tsf.h"
+#define TSF_INTERNALS
+#include "tsf.h"
+
+static bool g_sf2_cache = false;
+static FIL  g_cache_file;
+
+namespace
+{
+constexpr uint8_t  kSf2CacheMagic[4] = {'T', 'S', 'F', 'C'};
+constexpr uint16_t kSf2CacheVersion  = 4;
+constexpr size_t   kSf2CachePathMax  = 256;
+
+struct Sf2CacheHeader
+{
+    uint8_t  magic[4];
+    uint16_t version;
+    uint8_t  pointer_bytes;
+    uint8_t  sample_bytes;
+    uint16_t tsf_bytes;
+    uint16_t region_bytes;
+    // Source bank
+    uint32_t sf2_size;
+    uint16_t sf2_date;
+    uint16_t sf2_time;
+    // Loader settings the image depends on
+    uint32_t preload_ms;
+    uint8_t  stream_force;
+    uint8_t  selective;
+    uint8_t  stream_active;
+    uint8_t  reserved;
+    // Image layout, offsets into the arena
+    uint32_t    image_bytes;
+    uint32_t    tsf_offset;
+    StreamImage stream;
+};
+
+} // namespace
+
+// "0:/soundfonts/piano.sf2" -> "0:/soundfonts/.cache[/piano.tsfc]"
+static void BuildCachePath(const char* sf2_path, char* out, size_t size, bool dir_only)
+{
+    const char* slash = std::strrchr(sf2_path, '/');
+    const char* name  = slash ? slash + 1 : sf2_path;
+    const int   dir   = int(name - sf2_path);
+    const char* dot   = std::strrchr(name, '.');
+    const int   stem  = dot ? int(dot - name) : int(std::strlen(name));
+    if(dir_only)
+        std::snprintf(out, size, "%.*s.cache", dir, sf2_path);
+    else
+        std::snprintf(out, size, "%.*s.cache/%.*s.tsfc", dir, sf2_path, stem, name);
+}
+
+static void FillCacheHeader(Sf2CacheHeader& hdr, const FILINFO& sf2)
+{
+    hdr = Sf2CacheHeader{};
+    __builtin_memcpy(hdr.magic, kSf2CacheMagic, sizeof(hdr.magic));
+    hdr.version       = kSf2CacheVersion;
+    hdr.pointer_bytes = sizeof(void*);
+    hdr.sample_bytes  = sizeof(tsf_sample);
+    hdr.tsf_bytes     = sizeof(tsf);
+    hdr.region_bytes  = sizeof(tsf_region);
+    hdr.sf2_size      = uint32_t(sf2.fsize);
+    hdr.sf2_date      = sf2.fdate;
+    hdr.sf2_time      = sf2.ftime;
+    const StreamSettings stream = StreamGetSettings();
+    hdr.preload_ms              = stream.preload_ms;
+    hdr.stream_force            = stream.force;
+    hdr.selective               = stream.selective;
+}
+
+template <typename T>
+static T* ImagePtr(T* p, uintptr_t from)
+{
+    return p ? (T*)((uintptr_t)p - from + (uintptr_t)ArenaBase()) : nullptr;
+}
+
+// Moves every pointer in the image from base from to base to; base 0 stores
+// them as arena offsets (the arena never hands out offset 0). Voices and
+// channels are allocated after the image is taken.
+static void RebaseImage(tsf* f, uintptr_t from, uintptr_t to)
+{
+    tsf_preset* presets = ImagePtr(f->presets, from);
+    for(int p = 0; p < f->presetNum; p++)
+    {
+        tsf_region* regions = ImagePtr(presets[p].regions, from);
+        for(int r = 0; r < presets[p].regionNum; r++)
+            RebasePtr(regions[r].modulators, from, to);
+        RebasePtr(presets[p].regions, from, to);
+        RebasePtr(presets[p].keyIndex, from, to);
+    }
+    RebasePtr(f->presets, from, to);
+    RebasePtr(f->presetLookup, from, to);
+    RebasePtr(f->fontSamples, from, to);
+    RebasePtr(f->refCount, from, to);
+#ifdef TSF_SAMPLE_STREAMING
+    if(StreamActive())
+        StreamRebaseImage(from, to);
+#endif
+}
+
+// A preset's key index as tsf_preset_candidates walks it: velocity bands,
+// ascending slot offsets that stay in the image, and region numbers
+static bool ValidKeyIndex(const Sf2CacheHeader& hdr, const tsf_preset& preset)
+{
+    if(preset.keyBands < 1 || preset.keyBands > 128)
+        return false;
+    const uint32_t slots = 128 * uint32_t(preset.keyBands);
+    if(!ImageSpan<unsigned short>(hdr.image_bytes, ImageOffset(preset.keyIndex), 128 + slots + 1))
+        return false;
+    const unsigned short* index = ImageAt(preset.keyIndex);
+    for(int v = 0; v < 128; v++)
+        if(index[v] >= preset.keyBands)
+            return false;
+    if(index[128] != 128 + slots + 1)
+        return false;
+    for(uint32_t i = 0; i < slots; i++)
+        if(index[128 + i + 1] < index[128 + i])
+            return false;
+    const uint32_t total = index[128 + slots];
+    if(!ImageSpan<unsigned short>(hdr.image_bytes, ImageOffset(preset.keyIndex), total))
+        return false;
+    for(uint32_t i = 128 + slots + 1; i < total; i++)
+        if(index[i] >= preset.regionNum)
+            return false;
+    return true;
+}
+
+// The image as read, before RebaseImage trusts any of it
+static bool ValidImage(const Sf2CacheHeader& hdr)
+{
+    if(!ImageSpan<tsf>(hdr.image_bytes, hdr.tsf_offset, 1))
+        return false;
+    const tsf* f = (const tsf*)(ArenaBase() + hdr.tsf_offset);
+    // Voices and channels are allocated after the image is taken
+    if(f->voices || f->voiceActive || f->channels || f->voiceNum != 0 || f->presetNum < 0
+       || (f->presetNum > 0 && !ImageSpan<tsf_preset>(hdr.image_bytes, ImageOffset(f->presets), f->presetNum))
+       || (f->fontSamples && !ImageSpan<tsf_sample>(hdr.image_bytes, ImageOffset(f->fontSamples), f->fontSampleNum))
+       || (!f->fontSamples && !hdr.stream_active)
+       || (f->refCount && !ImageSpan<int>(hdr.image_bytes, ImageOffset(f->refCount), 1)))
+        return false;
+
+    const tsf_preset* presets = f->presetNum > 0 ? ImageAt(f->presets) : nullptr;
+    for(int p = 0; p < f->presetNum; p++)
+    {
+        const tsf_preset& preset = presets[p];
+        if(preset.regionNum < 0
+           || (preset.regionNum > 0 && !ImageSpan<tsf_region>(hdr.image_bytes, ImageOffset(preset.regions), preset.regionNum))
+           || (preset.keyIndex && !ValidKeyIndex(hdr, preset)))
+            return false;
+        const tsf_region* regions = preset.regionNum > 0 ? ImageAt(preset.regions) : nullptr;
+        for(int r = 0; r < preset.regionNum; r++)
+        {
+            const tsf_region& region = regions[r];
+            if(region.modulatorNum < 0
+               || (region.modulatorNum > 0 && !ImageSpan<tsf_modulator>(hdr.image_bytes, ImageOffset(region.modulators), region.modulatorNum))
+               || region.offset > region.end || region.end > f->fontSampleNum
+               || region.loop_end > f->fontSampleNum)
+                return false;
+        }
+    }
+
+    // A null table falls back to the preset search
+    if(f->presetLookup)
+    {
+        if(!ImageSpan<short>(hdr.image_bytes, ImageOffset(f->presetLookup), 129 * 128))
+            return false;
+        const short* lookup = ImageAt(f->presetLookup);
+        for(int i = 0; i < 129 * 128; i++)
+            if(lookup[i] < -1 || lookup[i] >= f->presetNum)
+                return false;
+    }
+
+#ifdef TSF_SAMPLE_STREAMING
+    if(hdr.stream_active && !StreamValidImage(hdr.stream, hdr.image_bytes, hdr.sf2_size, f))
+        return false;
+#endif
+    return true;
+}
+
+bool CacheSave(const char* sf2_path, const FILINFO& sf2, tsf* f, size_t image_bytes)
+{
+    char path[kSf2CachePathMax];
+    BuildCachePath(sf2_path, path, sizeof(path), true);
+    const FRESULT mkdir_result = f_mkdir(path);
+    if(mkdir_result != FR_OK && mkdir_result != FR_EXIST)
+        return false;
+    BuildCachePath(sf2_path, path, sizeof(path), false);
+
+    Sf2CacheHeader hdr;
+    FillCacheHeader(hdr, sf2);
+    hdr.image_bytes   = uint32_t(image_bytes);
+    hdr.tsf_offset    = ArenaOffset(f);
+    hdr.stream_active = StreamActive();
+#ifdef TSF_SAMPLE_STREAMING
+    if(hdr.stream_active)
+        StreamSaveImage(hdr.stream);
+#endif
+
+    // Follows the header; the image follows it
+    static ArenaSnapshot arena;
+    ArenaSave(arena);
+
+    if(f_open(&g_cache_file, path, FA_CREATE_ALWAYS | FA_WRITE) != FR_OK)
+        return false;
+    // The header goes in last, so a partly written image never validates.
+    const Sf2CacheHeader blank{};
+    const uintptr_t      base = (uintptr_t)ArenaBase();
+    UINT                 bw   = 0;
+    bool ok = f_write(&g_cache_file, &blank, sizeof(blank), &bw) == FR_OK && bw == sizeof(blank);
+    ok = ok && f_write(&g_cache_file, &arena, sizeof(arena), &bw) == FR_OK && bw == sizeof(arena);
+    RebaseImage(f, base, 0);
+    ok = ok && f_write(&g_cache_file, ArenaBase(), UINT(image_bytes), &bw) == FR_OK
+         && bw == image_bytes;
+    RebaseImage(f, 0, base);
+    ok = ok && f_lseek(&g_cache_file, 0) == FR_OK
+         && f_write(&g_cache_file, &hdr, sizeof(hdr), &bw) == FR_OK && bw == sizeof(hdr);
+    ok = f_close(&g_cache_file) == FR_OK && ok;
+    if(!ok)
+        f_unlink(path);
+    return ok;
+}
+
+tsf* CacheLoad(const char* sf2_path, const FILINFO& sf2)
+{
+    char path[kSf2CachePathMax];
+    BuildCachePath(sf2_path, path, sizeof(path), false);
+    if(f_open(&g_cache_file, path, FA_READ) != FR_OK)
+        return nullptr;
+
+    Sf2CacheHeader       hdr;
+    Sf2CacheHeader       expect;
+    static ArenaSnapshot arena;
+    FillCacheHeader(expect, sf2);
+    UINT br = 0;
+    bool ok = f_read(&g_cache_file, &hdr, sizeof(hdr), &br) == FR_OK && br == sizeof(hdr)
+              && __builtin_memcmp(&hdr, &expect, offsetof(Sf2CacheHeader, stream_active)) == 0
+              && hdr.image_bytes <= Arena().Cap()
+              && f_size(&g_cache_file) == sizeof(hdr) + sizeof(arena) + uint64_t(hdr.image_bytes);
+#ifndef TSF_SAMPLE_STREAMING
+    ok = ok && !hdr.stream_active;
+#endif
+    ok = ok && f_read(&g_cache_file, &arena, sizeof(arena), &br) == FR_OK && br == sizeof(arena)
+         && arena.state.used == hdr.image_bytes
+         && f_read(&g_cache_file, ArenaBase(), hdr.image_bytes, &br) == FR_OK
+         && br == hdr.image_bytes;
+    f_close(&g_cache_file);
+    // The arena is empty here; it takes over the image's blocks, sites and
+    // free list only once all of it checks out.
+    if(!ok || !ValidImage(hdr) || !ArenaRestore(arena))
+        return nullptr;
+
+    tsf* f = (tsf*)(ArenaBase() + hdr.tsf_offset);
+#ifdef TSF_SAMPLE_STREAMING
+    if(hdr.stream_active)
+        StreamRestoreImage(hdr.stream);
+#endif
+    RebaseImage(f, 0, (uintptr_t)ArenaBase());
+    return f;
+}
+
+bool CacheEnabled()
+{
+    return g_sf2_cache;
+}
+
+void SynthSetSf2Cache(bool enable)
+{
+    g_sf2_cache = enable;
+}
@@ -0,0 +1,30 @@
+#pragma once
+#include <cstddef>
+
+extern "C"
+{
+#include "ff.h"
+}
+
+struct tsf;
+
+// -----------------------------
+// SF2 cache image: the arena as tsf_load() and the resident sample load left
+// it, with pointers stored as arena offsets, after the arena's own
+// bookkeeping. Written next to the bank on its first load
+// (0:/soundfonts/.cache/<name>.tsfc) and read back in one pass while the
+// bank's size and date still match. Every offset and count is checked
+// against the image before it is rebased; anything off and the bank is
+// parsed again.
+// -----------------------------
+
+// Set by SynthSetSf2Cache
+bool CacheEnabled();
+
+// Writes the first image_bytes of the arena, holding bank f parsed from
+// sf2_path (sf2 is its directory entry).
+bool CacheSave(const char* sf2_path, const FILINFO& sf2, tsf* f, size_t image_bytes);
+// Takes the arena over from sf2_path's image and returns the bank in it, or
+// nullptr when there is no image or it does not check out; the arena and the
+// streaming state may then hold part of it and must be reset.
+tsf* CacheLoad(const char* sf2_path, const FILINFO& sf2);
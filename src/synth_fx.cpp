@@ -0,0 +1,566 @@
+#include "synth_fx.h"
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <new>
+
+#include "daisy_patch_sm.h"
+#include "util/scopedirqblocker.h"
+#include "daisysp.h"
+#include "daisysp-lgpl.h"
+#include "synth_arena.h"
+#include "synth_tsf.h"
+
+using namespace daisy;
+using namespace daisysp;
+
+namespace
+{
+constexpr uint32_t kFxCrossfadeMs    = 5;
+constexpr char     kHalfRateFxSite[] = "half-rate FX";
+// The reverb is skipped once its send and return have both stayed under
+// kFxSilence for kFxIdleMs, longer than its delay lines.
+constexpr float    kFxSilence = 3.1623e-5f; // -90 dBFS
+constexpr uint32_t kFxIdleMs  = 100;
+} // namespace
+
+static Chorus   DSY_SDRAM_BSS g_chorus;
+static ReverbSc DSY_SDRAM_BSS g_reverb;
+static Limiter  DSY_SDRAM_BSS g_limiter_l;
+static Limiter  DSY_SDRAM_BSS g_limiter_r;
+static bool    g_fx_init = false;
+static float   g_fx_sample_rate = 48000.0f;
+static float   g_sample_rate = 48000.0f; // of the loaded bank
+static float   g_chorus_wet = 1.0f;
+static float   g_chorus_dry = 0.0f;
+static float   g_chorus_gain = 1.5f;
+static float   g_reverb_wet = 1.0f;
+static float   g_reverb_dry = 0.0f;
+static float   g_reverb_hp_a = 0.0f;
+static float   g_reverb_hp_zl = 0.0f;
+static float   g_reverb_hp_zr = 0.0f;
+static float   g_reverb_hp_xl = 0.0f;
+static float   g_reverb_hp_xr = 0.0f;
+static float   g_reverb_time = 0.85f;
+static float   g_reverb_lpf_hz = 8000.0f;
+static float   g_reverb_hpf_hz = 80.0f;
+static float   g_chorus_depth = 0.35f;
+static float   g_chorus_speed_hz = 0.25f;
+
+// FX engine 0 runs at the sample rate, engine 1 at half of it. ready marks
+// an engine that is initialized and holds no old signal. Engine 1 lives in
+// the arena, so a load drops it; null until the governor first wants it, or
+// when the arena had no room for it (the tier then saves nothing).
+static Chorus*       g_chorus_half    = nullptr;
+static ReverbSc*     g_reverb_half    = nullptr;
+static bool          g_fx_half_failed = false;
+static int           g_fx_engine      = 0;
+static int           g_fx_fading_from = -1;
+static float         g_fx_fade        = 0.0f;
+static volatile bool g_fx_ready[2]    = {false, false};
+
+// Half-rate engine: each frame pair is averaged into one tick and the output
+// interpolated back up, a frame and a half late. A pair can span blocks.
+struct HalfRateFx
+{
+    bool  ch_odd, rv_odd;
+    float ch_in, rv_in_l, rv_in_r;
+    float ch_l, ch_r, rv_l, rv_r;
+};
+static HalfRateFx g_fx_half{};
+
+// Silence tracking for the reverb; idle skips it until its send comes back.
+// The chorus always runs: skipping it would stop its LFO, which DaisySP
+// gives no way to set back to where it would have been.
+struct FxTail
+{
+    uint32_t quiet_frames;
+    bool     idle;
+};
+static FxTail g_reverb_tail{};
+
+static uint32_t MsToFrames(uint32_t ms)
+{
+    return uint32_t(float(ms) * g_sample_rate * 0.001f);
+}
+
+static void InitFxEngine(int engine)
+{
+    Chorus&   chorus = engine ? *g_chorus_half : g_chorus;
+    ReverbSc& reverb = engine ? *g_reverb_half : g_reverb;
+    chorus.Init(engine ? 0.5f * g_fx_sample_rate : g_fx_sample_rate);
+    chorus.SetLfoFreq(g_chorus_speed_hz);
+    chorus.SetLfoDepth(g_chorus_depth);
+    chorus.SetDelay(0.2f);
+    chorus.SetFeedback(0.05f);
+    chorus.SetPan(0.25f, 0.75f);
+
+    reverb.Init(engine ? 0.5f * g_fx_sample_rate : g_fx_sample_rate);
+    reverb.SetFeedback(g_reverb_time);
+    reverb.SetLpFreq(g_reverb_lpf_hz);
+}
+
+// DaisySP's Chorus and ReverbSc only process a sample at a time, so these
+// loop their Process calls over the block. They add one block of chorus or
+// reverb return to wet (chorus L/R, reverb L/R per frame), scaled by a gain
+// ramping from g0 to g1.
+static void ChorusBlockFull(const float* chorus, float* wet, size_t frames, float g0, float g1)
+{
+    const float dg = (g1 - g0) / float(frames);
+    for(size_t i = 0; i < frames; i++)
+    {
+        const float g = g0 + dg * float(i);
+        g_chorus.Process(chorus[2 * i + 0] + chorus[2 * i + 1]);
+        wet[4 * i + 0] += g_chorus.GetLeft() * g;
+        wet[4 * i + 1] += g_chorus.GetRight() * g;
+    }
+}
+
+// The one-pole HPF on the reverb return, over a block in the filter state
+// hp; returns the peak going into the filter, which is what the tail
+// tracking measures.
+struct ReverbHp
+{
+    float a, zl, zr, xl, xr, peak;
+
+    ReverbHp()
+    : a(g_reverb_hp_a),
+      zl(g_reverb_hp_zl),
+      zr(g_reverb_hp_zr),
+      xl(g_reverb_hp_xl),
+      xr(g_reverb_hp_xr),
+      peak(0.0f)
+    {
+    }
+
+    void Step(float& l, float& r)
+    {
+        peak          = std::max(peak, std::max(fabsf(l), fabsf(r)));
+        const float y = a * (zl + l - xl);
+        const float z = a * (zr + r - xr);
+        zl            = y;
+        zr            = z;
+        xl            = l;
+        xr            = r;
+        l             = y;
+        r             = z;
+    }
+
+    float Store()
+    {
+        g_reverb_hp_zl = zl;
+        g_reverb_hp_zr = zr;
+        g_reverb_hp_xl = xl;
+        g_reverb_hp_xr = xr;
+        return peak;
+    }
+};
+
+// kHighPass runs the HPF on the sum in wet as each frame is written and
+// returns its input peak; the block must then be the only reverb return.
+// Without it the return is only added and 0 is returned.
+template <bool kHighPass>
+static float ReverbBlockFull(const float* reverb, float* wet, size_t frames, float g0, float g1)
+{
+    ReverbHp    hp;
+    const float dg = (g1 - g0) / float(frames);
+    for(size_t i = 0; i < frames; i++)
+    {
+        const float g   = g0 + dg * float(i);
+        float       rvL = 0.0f;
+        float       rvR = 0.0f;
+        g_reverb.Process(reverb[2 * i + 0], reverb[2 * i + 1], &rvL, &rvR);
+        float l = wet[4 * i + 2] + rvL * g;
+        float r = wet[4 * i + 3] + rvR * g;
+        if(kHighPass)
+            hp.Step(l, r);
+        wet[4 * i + 2] = l;
+        wet[4 * i + 3] = r;
+    }
+    return kHighPass ? hp.Store() : 0.0f;
+}
+
+static void ChorusBlockHalf(const float* chorus, float* wet, size_t frames, float g0, float g1)
+{
+    HalfRateFx& h  = g_fx_half;
+    const float dg = (g1 - g0) / float(frames);
+    for(size_t i = 0; i < frames; i++)
+    {
+        const float g   = g0 + dg * float(i);
+        const float ch  = chorus[2 * i + 0] + chorus[2 * i + 1];
+        float       chL = h.ch_l;
+        float       chR = h.ch_r;
+        if(!h.ch_odd)
+        {
+            h.ch_in = ch;
+        }
+        else
+        {
+            g_chorus_half->Process(0.5f * (h.ch_in + ch));
+            chL    = 0.5f * (h.ch_l + g_chorus_half->GetLeft());
+            chR    = 0.5f * (h.ch_r + g_chorus_half->GetRight());
+            h.ch_l = g_chorus_half->GetLeft();
+            h.ch_r = g_chorus_half->GetRight();
+        }
+        h.ch_odd = !h.ch_odd;
+        wet[4 * i + 0] += chL * g;
+        wet[4 * i + 1] += chR * g;
+    }
+}
+
+template <bool kHighPass>
+static float ReverbBlockHalf(const float* reverb, float* wet, size_t frames, float g0, float g1)
+{
+    HalfRateFx& h = g_fx_half;
+    ReverbHp    hp;
+    const float dg = (g1 - g0) / float(frames);
+    for(size_t i = 0; i < frames; i++)
+    {
+        const float g   = g0 + dg * float(i);
+        float       rvL = h.rv_l;
+        float       rvR = h.rv_r;
+        if(!h.rv_odd)
+        {
+            h.rv_in_l = reverb[2 * i + 0];
+            h.rv_in_r = reverb[2 * i + 1];
+        }
+        else
+        {
+            float l = 0.0f;
+            float r = 0.0f;
+            g_reverb_half->Process(0.5f * (h.rv_in_l + reverb[2 * i + 0]),
+                                   0.5f * (h.rv_in_r + reverb[2 * i + 1]),
+                                   &l,
+                                   &r);
+            rvL    = 0.5f * (h.rv_l + l);
+            rvR    = 0.5f * (h.rv_r + r);
+            h.rv_l = l;
+            h.rv_r = r;
+        }
+        h.rv_odd = !h.rv_odd;
+        float l  = wet[4 * i + 2] + rvL * g;
+        float r  = wet[4 * i + 3] + rvR * g;
+        if(kHighPass)
+            hp.Step(l, r);
+        wet[4 * i + 2] = l;
+        wet[4 * i + 3] = r;
+    }
+    return kHighPass ? hp.Store() : 0.0f;
+}
+
+// Runs one engine over the block. With highPass the reverb return is
+// filtered in the same loop and its pre-filter peak returned.
+static float FxProcess(int          engine,
+                       bool         runReverb,
+                       bool         highPass,
+                       const float* chorus,
+                       const float* reverb,
+                       float*       wet,
+                       size_t       frames,
+                       float        g0,
+                       float        g1)
+{
+    if(engine)
+        ChorusBlockHalf(chorus, wet, frames, g0, g1);
+    else
+        ChorusBlockFull(chorus, wet, frames, g0, g1);
+    if(!runReverb)
+        return 0.0f;
+    if(highPass)
+        return engine ? ReverbBlockHalf<true>(reverb, wet, frames, g0, g1)
+                      : ReverbBlockFull<true>(reverb, wet, frames, g0, g1);
+    return engine ? ReverbBlockHalf<false>(reverb, wet, frames, g0, g1)
+                  : ReverbBlockFull<false>(reverb, wet, frames, g0, g1);
+}
+
+// The HPF as a pass of its own, for a crossfade where both engines add to
+// the return first.
+static float ReverbHighPass(float* wet, size_t frames)
+{
+    ReverbHp hp;
+    for(size_t i = 0; i < frames; i++)
+        hp.Step(wet[4 * i + 2], wet[4 * i + 3]);
+    return hp.Store();
+}
+
+static float PeakAbs(const float* x, size_t n)
+{
+    float peak = 0.0f;
+    for(size_t i = 0; i < n; i++)
+        peak = std::max(peak, fabsf(x[i]));
+    return peak;
+}
+
+// Whether an effect has to run this block, given its send peak.
+static bool FxTailRun(FxTail& tail, float sendPeak)
+{
+    if(sendPeak >= kFxSilence)
+    {
+        tail.idle         = false;
+        tail.quiet_frames = 0;
+    }
+    return !tail.idle;
+}
+
+// Update the silence tracking after a block that ran.
+static void FxTailUpdate(FxTail& tail, float sendPeak, float returnPeak, size_t frames)
+{
+    if(sendPeak >= kFxSilence || returnPeak >= kFxSilence)
+    {
+        tail.quiet_frames = 0;
+        return;
+    }
+    tail.quiet_frames += frames;
+    if(tail.quiet_frames >= MsToFrames(kFxIdleMs))
+        tail.idle = true;
+}
+
+bool FxRender(bool halfRate, const float* chorus, const float* reverb, float* wet, size_t frames)
+{
+    const int want = halfRate ? 1 : 0;
+    if(g_fx_fading_from < 0 && want != g_fx_engine && g_fx_ready[want])
+    {
+        if(want)
+            g_fx_half = HalfRateFx{};
+        g_fx_fading_from = g_fx_engine;
+        g_fx_engine      = want;
+        g_fx_fade        = 0.0f;
+    }
+    const float reverbSend = PeakAbs(reverb, 2 * frames);
+    const bool  runReverb  = FxTailRun(g_reverb_tail, reverbSend);
+    memset(wet, 0, 4 * frames * sizeof(float));
+    float reverbPeak = 0.0f;
+    if(g_fx_fading_from < 0)
+    {
+        reverbPeak
+            = FxProcess(g_fx_engine, runReverb, true, chorus, reverb, wet, frames, 1.0f, 1.0f);
+    }
+    else
+    {
+        const float g0 = g_fx_fade;
+        const float g1 = std::min(1.0f, g0 + float(frames) / float(MsToFrames(kFxCrossfadeMs)));
+        FxProcess(
+            g_fx_fading_from, runReverb, false, chorus, reverb, wet, frames, 1.0f - g0, 1.0f - g1);
+        FxProcess(g_fx_engine, runReverb, false, chorus, reverb, wet, frames, g0, g1);
+        if(runReverb)
+            reverbPeak = ReverbHighPass(wet, frames);
+        g_fx_fade = g1;
+        if(g1 >= 1.0f)
+        {
+            g_fx_ready[g_fx_fading_from] = false;
+            g_fx_fading_from             = -1;
+        }
+    }
+
+    if(!runReverb)
+    {
+        g_reverb_hp_zl = g_reverb_hp_zr = g_reverb_hp_xl = g_reverb_hp_xr = 0.0f;
+        return false;
+    }
+    FxTailUpdate(g_reverb_tail, reverbSend, reverbPeak, frames);
+    return true;
+}
+
+void FxMix(const float* dry,
+           const float* chorus,
+           const float* reverb,
+           const float* wet,
+           float*       outL,
+           float*       outR,
+           size_t       frames,
+           float        gain)
+{
+    for(size_t i = 0; i < frames; i++)
+    {
+        const float dryL = dry[2 * i + 0];
+        const float dryR = dry[2 * i + 1];
+
+        const float chInL = chorus[2 * i + 0];
+        const float chInR = chorus[2 * i + 1];
+        const float chL = wet[4 * i + 0] * g_chorus_gain * g_chorus_wet;
+        const float chR = wet[4 * i + 1] * g_chorus_gain * g_chorus_wet;
+
+        // Reverb return, high-passed by FxRender
+        const float yL = wet[4 * i + 2];
+        const float yR = wet[4 * i + 3];
+
+        // Send amounts already scale per-voice contributions.
+        outL[i] = (dryL + chInL * g_chorus_dry + chL + reverb[2 * i + 0] * g_reverb_dry
+                   + yL * g_reverb_wet)
+                  * gain;
+        outR[i] = (dryR + chInR * g_chorus_dry + chR + reverb[2 * i + 1] * g_reverb_dry
+                   + yR * g_reverb_wet)
+                  * gain;
+    }
+
+    g_limiter_l.ProcessBlock(outL, frames, 1.0f);
+    g_limiter_r.ProcessBlock(outR, frames, 1.0f);
+}
+
+// The arena is about to start over: forget the half-rate engine in it and go
+// back to the full-rate one, cleared if it was left behind.
+void FxBeginLoad(float sampleRate)
+{
+    g_sample_rate    = sampleRate;
+    g_chorus_half    = nullptr;
+    g_reverb_half    = nullptr;
+    g_fx_half_failed = false;
+    g_fx_ready[1]    = false;
+    g_fx_engine      = 0;
+    g_fx_fading_from = -1;
+    if(g_fx_init && !g_fx_ready[0])
+    {
+        InitFxEngine(0);
+        g_fx_ready[0] = true;
+    }
+}
+
+// Takes the half-rate engine from the arena, not ready until FxService
+// initializes it; false if there is no room.
+static bool AllocHalfRateFx()
+{
+    const uint16_t site   = Arena().SiteIndex(kHalfRateFxSite);
+    void*          chorus = Arena().Alloc(sizeof(Chorus), alignof(Chorus), site);
+    if(!chorus)
+        return false;
+    void* reverb = Arena().Alloc(sizeof(ReverbSc), alignof(ReverbSc), site);
+    if(!reverb)
+    {
+        Arena().Release(chorus, sizeof(Chorus), site);
+        return false;
+    }
+    g_chorus_half = new(chorus) Chorus;
+    g_reverb_half = new(reverb) ReverbSc;
+    return true;
+}
+
+void FxEndLoad()
+{
+    if(g_fx_init)
+        return;
+    g_fx_sample_rate = g_sample_rate;
+    InitFxEngine(0);
+    g_fx_ready[0] = true;
+    SynthSetReverbHpFreq(80.0f);
+    g_limiter_l.Init();
+    g_limiter_r.Init();
+
+    g_fx_init = true;
+}
+
+bool FxReady()
+{
+    return g_fx_init;
+}
+
+void FxService(bool halfRate)
+{
+    if(!g_chorus_half && !g_fx_half_failed && halfRate)
+        g_fx_half_failed = !AllocHalfRateFx();
+    for(int engine = 0; engine < 2; engine++)
+    {
+        bool idle;
+        {
+            ScopedIrqBlocker lock;
+            idle = !g_fx_ready[engine] && engine != g_fx_engine && engine != g_fx_fading_from;
+        }
+        if(!idle || (engine && !g_chorus_half))
+            continue;
+        // FxRender does not touch an engine that is not ready.
+        InitFxEngine(engine);
+        ScopedIrqBlocker lock;
+        g_fx_ready[engine] = true;
+    }
+}
+
+size_t FxBytes()
+{
+    return sizeof(g_chorus) + sizeof(g_reverb);
+}
+
+// -----------------------------
+// FX API
+// -----------------------------
+void SynthSetReverbTime(float t01)
+{
+    if(t01 < 0.0f)
+        t01 = 0.0f;
+    if(t01 > 1.0f)
+        t01 = 1.0f;
+    g_reverb_time = t01;
+    g_reverb.SetFeedback(t01);
+    if(g_reverb_half)
+        g_reverb_half->SetFeedback(t01);
+}
+
+void SynthSetReverbLpFreq(float hz)
+{
+    if(hz < 20.0f)
+        hz = 20.0f;
+    g_reverb_lpf_hz = hz;
+    g_reverb.SetLpFreq(hz);
+    if(g_reverb_half)
+        g_reverb_half->SetLpFreq(hz);
+}
+
+void SynthSetReverbHpFreq(float hz)
+{
+    if(hz < 20.0f)
+        hz = 20.0f;
+    if(hz > 1000.0f)
+        hz = 1000.0f;
+    g_reverb_hpf_hz = hz;
+    // one-pole HPF coefficient
+    const float x  = expf(-2.0f * 3.14159265f * hz / g_sample_rate);
+    g_reverb_hp_a = x;
+}
+void SynthSetChorusDepth(float d01)
+{
+    if(d01 < 0.0f)
+        d01 = 0.0f;
+    if(d01 > 1.0f)
+        d01 = 1.0f;
+    g_chorus_depth = d01;
+    g_chorus.SetLfoDepth(d01);
+    if(g_chorus_half)
+        g_chorus_half->SetLfoDepth(d01);
+}
+
+
+void SynthSetChorusSpeed(float hz)
+{
+    if(hz < 0.05f)
+        hz = 0.05f;
+    if(hz > 5.0f)
+        hz = 5.0f;
+    g_chorus_speed_hz = hz;
+    g_chorus.SetLfoFreq(hz);
+    if(g_chorus_half)
+        g_chorus_half->SetLfoFreq(hz);
+}
+
+float SynthGetReverbTime()
+{
+    return g_reverb_time;
+}
+
+float SynthGetReverbLpFreq()
+{
+    return g_reverb_lpf_hz;
+}
+
+float SynthGetReverbHpFreq()
+{
+    return g_reverb_hpf_hz;
+}
+
+float SynthGetChorusDepth()
+{
+    return g_chorus_depth;
+}
+
+float SynthGetChorusSpeed()
+{
+    return g_chorus_speed_hz;
+}
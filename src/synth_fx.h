@@ -0,0 +1,40 @@
+#pragma once
+#include <cstddef>
+
+// -----------------------------
+// Chorus and reverb on the synth's FX sends, and the output limiters. The
+// FX have a second engine initialized at half the sample rate, for the
+// governor's FxHalfRate tier; switching crossfades between the two, and the
+// engine left behind is cleared by FxService before it is used again so an
+// old tail never replays.
+// -----------------------------
+
+// At the start of a load, before the arena is reset: forgets the half-rate
+// engine in it. Audio is stopped.
+void FxBeginLoad(float sampleRate);
+// After a load; the first one sets the engines and limiters up
+void FxEndLoad();
+bool FxReady();
+
+// Main loop: takes the half-rate engine from the arena the first time
+// halfRate asks for it, and initializes an engine left behind.
+void FxService(bool halfRate);
+
+// Renders the returns of the engine halfRate selects into wet (chorus L/R,
+// reverb L/R per frame), crossfading when that changes, and high-passes the
+// reverb return. A reverb whose send and tail are silent is skipped and
+// returns nothing; the result is then false.
+bool FxRender(bool halfRate, const float* chorus, const float* reverb, float* wet, size_t frames);
+// Mixes the dry signal, the returns FxRender left in wet and the sends'
+// dry share into out, scaled by gain, and limits it.
+void FxMix(const float* dry,
+           const float* chorus,
+           const float* reverb,
+           const float* wet,
+           float*       outL,
+           float*       outR,
+           size_t       frames,
+           float        gain);
+
+// SDRAM taken by the full-rate engine (the half-rate one is in the arena)
+size_t FxBytes();
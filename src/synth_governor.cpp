@@ -0,0 +1,267 @@
+#include "synth_governor.h"
+#include <algorithm>
+
+#include "daisy_patch_sm.h"
+#include "util/scopedirqblocker.h"
+#include "tsf_config.h"
+#include "tsf.h"
+
+using namespace daisy;
+
+namespace
+{
+// Loads are render time over the budgeted share of the block.
+constexpr float    kGovernorUpLoad        = 0.80f; // kGovernorHotBlocks in a row
+constexpr float    kGovernorPanicLoad     = 0.95f; // a single block
+constexpr float    kGovernorDownLoad      = 0.55f; // smoothed, for kGovernorCoolMs
+constexpr float    kGovernorSmoothing     = 1.0f / 16.0f;
+constexpr int      kGovernorHotBlocks     = 3;
+constexpr uint32_t kGovernorSettleMs      = 20; // between steps to a lower tier
+constexpr uint32_t kGovernorCoolMs        = 2000;
+constexpr uint32_t kGovernorStealMs       = 10; // about one quick release
+constexpr int      kGovernorMinVoices     = 4;
+constexpr float    kGovernorDefaultBudget = 0.85f;
+constexpr uint32_t kGovernorLogSize       = 16;
+} // namespace
+
+#if defined(__ARM_ARCH_7EM__)
+// Set by GovernorInitClock once the cycle counter is seen running; System::GetUs
+// until then, or for good if it never does.
+static bool g_render_clock_cycles = false;
+uint32_t    RenderClock()
+{
+    return g_render_clock_cycles ? DWT->CYCCNT : System::GetUs();
+}
+static inline float RenderClockHz()
+{
+    return g_render_clock_cycles ? float(SystemCoreClock) : 1e6f;
+}
+#else
+static constexpr bool g_render_clock_cycles = false;
+uint32_t              RenderClock()
+{
+    return System::GetUs();
+}
+static inline float RenderClockHz()
+{
+    return 1e6f;
+}
+#endif
+
+static bool               g_gov_enabled       = false;
+static float              g_gov_budget        = kGovernorDefaultBudget;
+static SynthQuality       g_gov_quality       = SynthQuality::Full;
+static int                g_gov_hot_blocks    = 0;
+static uint32_t           g_gov_cool_frames   = 0;
+static uint32_t           g_gov_settle_frames = 0;
+static SynthGovernorStats g_gov_stats{};
+static SynthGovernorEvent g_gov_log[kGovernorLogSize];
+static bool               g_gov_callback_open  = false;
+static uint32_t           g_gov_callback_start = 0; // RenderClock()
+static volatile bool      g_gov_steal          = false; // for GovernorService
+static uint32_t           g_gov_log_head = 0; // written by SynthRender
+static uint32_t           g_gov_log_tail = 0; // read by the main loop
+
+static float g_sample_rate = 48000.0f; // of the loaded bank
+
+static uint32_t MsToFrames(uint32_t ms)
+{
+    return uint32_t(float(ms) * g_sample_rate * 0.001f);
+}
+
+static void GovernorStep(tsf* f, SynthQuality to, float load)
+{
+    const uint32_t head = g_gov_log_head;
+    if(head - g_gov_log_tail < kGovernorLogSize)
+    {
+        SynthGovernorEvent& event = g_gov_log[head % kGovernorLogSize];
+        event.time_ms  = System::GetNow();
+        event.from     = g_gov_quality;
+        event.to       = to;
+        event.load_pct = uint8_t(std::min(load * 100.0f, 255.0f));
+        event.voices   = uint8_t(tsf_active_voice_count(f));
+        g_gov_log_head = head + 1;
+    }
+    g_gov_stats.transitions++;
+    g_gov_quality       = to;
+    g_gov_hot_blocks    = 0;
+    g_gov_cool_frames   = 0;
+    g_gov_settle_frames = 0;
+    tsf_set_interpolation(f,
+                          to >= SynthQuality::NoInterpolation ? TSF_INTERPOLATION_NONE
+                                                              : TSF_INTERPOLATION_LINEAR);
+}
+
+static float GovernorBudget(size_t frames)
+{
+    return g_gov_budget * RenderClockHz() * float(frames) / g_sample_rate;
+}
+
+void GovernorAccount(uint32_t voices,
+                     uint32_t fx,
+                     size_t   frames,
+                     uint64_t voiceFrames,
+                     bool     reverbIdle)
+{
+    const float         budget = GovernorBudget(frames);
+    SynthGovernorStats& stats  = g_gov_stats;
+    stats.blocks++;
+    stats.voice_frames += voiceFrames;
+    if(reverbIdle)
+        stats.reverb_idle_blocks++;
+    stats.voice_ns += uint64_t(float(voices) * 1e9f / RenderClockHz());
+    stats.fx_ns += uint64_t(float(fx) * 1e9f / RenderClockHz());
+    if(g_render_clock_cycles)
+        stats.voice_cycles += voices;
+    stats.voice_load += (float(voices) / budget - stats.voice_load) * kGovernorSmoothing;
+    stats.fx_load += (float(fx) / budget - stats.fx_load) * kGovernorSmoothing;
+    stats.tier_blocks[int(g_gov_quality)]++;
+}
+
+// elapsed is the time taken by a callback, or a render outside one, that
+// filled frames.
+static void GovernorUpdate(tsf* f, uint32_t elapsed, size_t frames)
+{
+    const float         load  = float(elapsed) / GovernorBudget(frames);
+    SynthGovernorStats& stats = g_gov_stats;
+    stats.callbacks++;
+    stats.callback_ns += uint64_t(float(elapsed) * 1e9f / RenderClockHz());
+    if(load > 1.0f)
+        stats.over_budget++;
+    if(load > stats.peak_load)
+        stats.peak_load = load;
+    stats.load += (load - stats.load) * kGovernorSmoothing;
+    if(!g_gov_enabled)
+        return;
+
+    g_gov_hot_blocks  = load >= kGovernorUpLoad ? g_gov_hot_blocks + 1 : 0;
+    g_gov_cool_frames = stats.load <= kGovernorDownLoad ? g_gov_cool_frames + frames : 0;
+    g_gov_settle_frames += frames;
+
+    const int tier = int(g_gov_quality);
+    if(g_gov_quality != SynthQuality::StealVoices
+       && (load >= kGovernorPanicLoad || g_gov_hot_blocks >= kGovernorHotBlocks)
+       && g_gov_settle_frames >= MsToFrames(kGovernorSettleMs))
+    {
+        GovernorStep(f, SynthQuality(tier + 1), load);
+    }
+    else if(tier > 0 && g_gov_cool_frames >= MsToFrames(kGovernorCoolMs))
+    {
+        GovernorStep(f, SynthQuality(tier - 1), load);
+    }
+    else if(g_gov_quality == SynthQuality::StealVoices && load >= kGovernorUpLoad
+            && g_gov_settle_frames >= MsToFrames(kGovernorStealMs) && !g_gov_steal)
+    {
+        g_gov_steal         = true;
+        g_gov_settle_frames = 0;
+    }
+}
+
+void GovernorConfigure(bool enable, float budget)
+{
+    g_gov_enabled = enable;
+    g_gov_budget  = std::min(std::max(budget, 0.01f), 1.0f);
+}
+
+SynthQuality GovernorQuality()
+{
+    return g_gov_quality;
+}
+
+void GovernorReset(tsf* f, float sampleRate)
+{
+    g_sample_rate       = sampleRate;
+    g_gov_quality       = SynthQuality::Full;
+    g_gov_hot_blocks    = 0;
+    g_gov_cool_frames   = 0;
+    g_gov_settle_frames = 0;
+    g_gov_callback_open = false;
+    g_gov_steal         = false;
+    g_gov_stats         = SynthGovernorStats{};
+    if(f)
+        tsf_set_interpolation(f, TSF_INTERPOLATION_LINEAR);
+}
+
+void GovernorEndBlock(tsf* f, uint32_t start, size_t frames)
+{
+    if(!g_gov_callback_open)
+        GovernorUpdate(f, RenderClock() - start, frames);
+}
+
+void GovernorEndCallback(tsf* f, size_t frames)
+{
+    if(!g_gov_callback_open)
+        return;
+    g_gov_callback_open = false;
+    if(f && frames > 0)
+        GovernorUpdate(f, RenderClock() - g_gov_callback_start, frames);
+}
+
+void GovernorService(tsf* f)
+{
+    if(!g_gov_steal)
+        return;
+    ScopedIrqBlocker lock;
+    if(tsf_active_voice_count(f) > kGovernorMinVoices && tsf_note_off_quietest(f))
+        g_gov_stats.stolen_voices++;
+    g_gov_steal = false;
+}
+
+void GovernorInitClock()
+{
+#if defined(__ARM_ARCH_7EM__)
+    // Cycle counter for the governor's render timing, used only if it keeps
+    // pace with the microsecond timer over a short wait
+    CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA_Msk;
+    DWT->LAR    = 0xC5ACCE55;
+    DWT->CYCCNT = 0;
+    DWT->CTRL |= DWT_CTRL_CYCCNTENA_Msk;
+    const uint32_t cycles_start = DWT->CYCCNT;
+    const uint32_t us_start     = System::GetUs();
+    System::DelayUs(200);
+    const float cycles   = float(DWT->CYCCNT - cycles_start);
+    const float expected = float(System::GetUs() - us_start) * float(SystemCoreClock) * 1e-6f;
+    g_render_clock_cycles = expected > 0.0f && cycles > 0.5f * expected && cycles < 2.0f * expected;
+#endif
+}
+
+// -----------------------------
+// Governor API
+// -----------------------------
+void SynthBeginCallback()
+{
+    g_gov_callback_open  = true;
+    g_gov_callback_start = RenderClock();
+}
+
+const char* SynthQualityName(SynthQuality quality)
+{
+    switch(quality)
+    {
+        case SynthQuality::Full: return "full";
+        case SynthQuality::FxHalfRate: return "half-rate FX";
+        case SynthQuality::NoInterpolation: return "no interpolation";
+        case SynthQuality::StealVoices: return "steal voices";
+    }
+    return "?";
+}
+
+void SynthGetGovernorStats(SynthGovernorStats& stats)
+{
+    ScopedIrqBlocker lock;
+    stats             = g_gov_stats;
+    stats.enabled     = g_gov_enabled;
+    stats.quality     = g_gov_quality;
+    stats.cycle_clock = g_render_clock_cycles;
+}
+
+bool SynthPopGovernorEvent(SynthGovernorEvent& event)
+{
+    ScopedIrqBlocker lock;
+    if(g_gov_log_tail == g_gov_log_head)
+        return false;
+    event = g_gov_log[g_gov_log_tail % kGovernorLogSize];
+    g_gov_log_tail++;
+    return true;
+}
+
@@ -0,0 +1,44 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+
+#include "synth_tsf.h"
+
+struct tsf;
+
+// -----------------------------
+// CPU governor, off unless SynthSetGovernor turns it on. Every audio callback
+// between SynthBeginCallback and SynthEndCallback (every SynthRender without
+// them) is timed, with the DWT cycle counter on the module, against the
+// duration of the frames it fills. A few callbacks close to that deadline
+// step the quality down a tier, a long calm spell steps it back up.
+//
+// The audio interrupt only raises requests that need memory or touch voices
+// outside a render: GovernorService releases the voices it steals, and the
+// FX take their half-rate engine from the arena (FxService).
+// -----------------------------
+
+// Starts the cycle counter and checks it keeps pace, for SynthInit
+void GovernorInitClock();
+// Time stamp for render timing, in cycles or microseconds
+uint32_t RenderClock();
+
+void         GovernorConfigure(bool enable, float budget);
+SynthQuality GovernorQuality();
+// Back to full quality with the stats cleared, for a new bank (f) or new
+// settings. Audio is stopped or masked.
+void GovernorReset(tsf* f, float sampleRate);
+
+// Render time of one block: voices (with the block's events) and the FX;
+// voiceFrames sums the voices sounding over its frames.
+void GovernorAccount(uint32_t voices,
+                     uint32_t fx,
+                     size_t   frames,
+                     uint64_t voiceFrames,
+                     bool     reverbIdle);
+// A block rendered from start; outside a callback it is what the governor
+// steps on.
+void GovernorEndBlock(tsf* f, uint32_t start, size_t frames);
+void GovernorEndCallback(tsf* f, size_t frames);
+// Main loop: releases a voice the StealVoices tier asked for
+void GovernorService(tsf* f);
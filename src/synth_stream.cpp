@@ -0,0 +1,751 @@
+#include "synth_stream.h"
+#include <algorithm>
+
+#include "daisy_patch_sm.h"
+#include "util/scopedirqblocker.h"
+#include "synth_arena.h"
+#define TSF_INTERNALS
+#include "tsf.h"
+
+using namespace daisy;
+
+static uint32_t         g_stream_preload_ms = 100;
+static bool             g_stream_force      = false;
+static bool             g_selective_loading = false;
+static bool             g_stream_active     = false;
+static SynthStreamStats g_stream_stats;
+
+#ifdef TSF_SAMPLE_STREAMING
+namespace
+{
+constexpr size_t   kStreamMaxVoices       = 32;
+constexpr uint32_t kStreamRingFrames      = 8192; // per voice, power of two
+constexpr uint32_t kStreamMinReadFrames   = 1024;
+constexpr int      kStreamReadsPerService = 8;
+// Left for presets and regions when deciding whether the samples fit
+constexpr size_t   kStreamReserveBytes = 8 * 1024 * 1024;
+constexpr uint32_t kStreamLinkMapWords = 1024;
+constexpr uint32_t kPageInRangesMax    = 2048;
+// Bounds how long one main loop pass spends paging in a preset
+constexpr uint32_t kPageInBytesPerService = 64 * 1024;
+// Left free by page-ins for voice allocation
+constexpr size_t   kPageInReserveBytes = 1024 * 1024;
+constexpr char     kPageInSite[]       = "preset page-in";
+
+// Resident source positions [first, first + count), sorted and disjoint
+struct ResidentRun
+{
+    uint32_t          first;
+    uint32_t          count;
+    const tsf_sample* data;
+};
+
+// A voice's ring holds source positions [first, next). Audio reads it and
+// the main loop appends; gen changes whenever the voice starts a new note.
+struct VoiceStream
+{
+    uint32_t gen;
+    uint32_t first;
+    uint32_t next;
+    bool     starved;
+};
+
+struct StreamRefill
+{
+    uint32_t gen;
+    uint32_t from;
+    uint32_t to;
+    uint32_t ahead; // frames the voice can play before it needs this read
+    bool     reset;
+};
+
+struct SampleRange
+{
+    uint32_t first;
+    uint32_t end;
+};
+
+enum : uint8_t
+{
+    kPresetOnDisk = 0,
+    kPresetResident,
+    kPresetFailed, // did not fit; its voices stream
+};
+
+// A preset being paged in: the gaps its regions leave in the resident set,
+// read into one pool and published as runs once complete.
+struct PageIn
+{
+    int         preset = -1;
+    uint32_t    gap_count;
+    uint32_t    gap;
+    uint32_t    done;
+    tsf_sample* pool;
+    uint32_t    pool_used;
+    uint32_t    pool_frames;
+};
+} // namespace
+
+static FIL*         g_stream_file        = nullptr; // the SF2, open while streaming
+static FSIZE_t      g_stream_smpl_offset = 0;
+static uint32_t     g_stream_smpl_count  = 0;
+// Audio reads g_stream_runs; page-ins build the spare and swap them.
+static ResidentRun* g_stream_runs        = nullptr;
+static ResidentRun* g_stream_runs_spare  = nullptr;
+static uint32_t     g_stream_run_count   = 0;
+static uint32_t     g_stream_run_cap     = 0;
+static tsf_sample*  g_stream_rings       = nullptr;
+static VoiceStream  g_stream_voices[kStreamMaxVoices];
+static uint8_t*     g_preset_state       = nullptr;
+static PageIn       g_page_in;
+static SampleRange DSY_SDRAM_BSS g_page_ranges[kPageInRangesMax];
+static SampleRange DSY_SDRAM_BSS g_page_gaps[kPageInRangesMax];
+
+int StreamSkipSamples(void* data, unsigned int size)
+{
+    FIL*         f            = (FIL*)data;
+    const size_t sample_bytes = size / sizeof(short) * sizeof(tsf_sample);
+    const size_t free_bytes   = Arena().Cap() - Arena().Used();
+    g_stream_smpl_offset      = f_tell(f);
+    g_stream_smpl_count       = size / sizeof(short);
+    g_stream_active           = g_stream_force || g_selective_loading
+                      || sample_bytes + kStreamReserveBytes > free_bytes;
+    return g_stream_active ? 1 : 0;
+}
+
+// Index of the first run starting after pos
+static uint32_t UpperResidentRun(uint32_t pos)
+{
+    uint32_t lo = 0;
+    uint32_t hi = g_stream_run_count;
+    while(lo < hi)
+    {
+        const uint32_t mid = (lo + hi) / 2;
+        if(g_stream_runs[mid].first <= pos)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    return lo;
+}
+
+static const ResidentRun* FindResidentRun(uint32_t pos)
+{
+    const uint32_t upper = UpperResidentRun(pos);
+    if(upper == 0)
+        return nullptr;
+    const ResidentRun* run = &g_stream_runs[upper - 1];
+    return (pos - run->first < run->count) ? run : nullptr;
+}
+
+const tsf_sample* tsf_stream_window(tsf*              f,
+                                    struct tsf_voice* v,
+                                    unsigned int      pos,
+                                    unsigned int*     first,
+                                    unsigned int*     count)
+{
+    if(const ResidentRun* run = FindResidentRun(pos))
+    {
+        *first = run->first;
+        *count = run->count;
+        return run->data;
+    }
+
+    const size_t index = size_t(v - f->voices);
+    if(index < kStreamMaxVoices)
+    {
+        VoiceStream& vs = g_stream_voices[index];
+        if(pos >= vs.first && pos < vs.next)
+        {
+            const uint32_t slot = pos & (kStreamRingFrames - 1);
+            vs.starved          = false;
+            *first              = pos;
+            *count              = std::min(vs.next - pos, kStreamRingFrames - slot);
+            return g_stream_rings + index * kStreamRingFrames + slot;
+        }
+        if(!vs.starved)
+        {
+            vs.starved = true;
+            g_stream_stats.starve_events++;
+        }
+    }
+    g_stream_stats.starved_reads++;
+    return nullptr;
+}
+
+void tsf_stream_voice_start(tsf* f, struct tsf_voice* v)
+{
+    const size_t index = size_t(v - f->voices);
+    if(index >= kStreamMaxVoices)
+        return;
+    VoiceStream& vs = g_stream_voices[index];
+    vs.gen++;
+    vs.first   = 0;
+    vs.next    = 0;
+    vs.starved = false;
+}
+
+static bool ReadSamples(uint32_t first, uint32_t count, tsf_sample* out)
+{
+    const UINT bytes = count * sizeof(tsf_sample);
+    UINT       br    = 0;
+    return f_lseek(g_stream_file, g_stream_smpl_offset + FSIZE_t(first) * sizeof(tsf_sample)) == FR_OK
+           && f_read(g_stream_file, out, bytes, &br) == FR_OK && br == bytes;
+}
+
+static void AddResidentRun(uint32_t& count, uint32_t first, uint32_t end)
+{
+    end = std::min(end, g_stream_smpl_count);
+    if(first >= end)
+        return;
+    g_stream_runs[count].first = first;
+    g_stream_runs[count].count = end - first;
+    count++;
+}
+
+// The resident part of every region is its first preload_ms, its loop, and
+// for sustain loops the first preload_ms after the loop as well.
+bool StreamLoadResident(tsf* f, FIL* file)
+{
+    g_stream_file = file;
+    uint32_t region_count = 0;
+    for(int p = 0; p < f->presetNum; p++)
+        region_count += uint32_t(f->presets[p].regionNum);
+
+    // Headroom for the runs page-ins add; a preset that would overflow it
+    // keeps streaming.
+    g_stream_run_cap    = region_count * 6 + kPageInRangesMax;
+    g_stream_runs
+        = (ResidentRun*)Arena().Alloc(g_stream_run_cap * sizeof(ResidentRun), 8, "stream runs");
+    g_stream_runs_spare
+        = (ResidentRun*)Arena().Alloc(g_stream_run_cap * sizeof(ResidentRun), 8, "stream runs");
+    g_preset_state = (uint8_t*)Arena().Alloc(size_t(f->presetNum), 4, "preset state");
+    if(!g_stream_runs || !g_stream_runs_spare || !g_preset_state)
+    {
+        ArenaSetOom();
+        return false;
+    }
+    __builtin_memset(g_preset_state, kPresetOnDisk, size_t(f->presetNum));
+
+    uint32_t count = 0;
+    for(int p = 0; p < f->presetNum; p++)
+    {
+        for(int r = 0; r < f->presets[p].regionNum; r++)
+        {
+            const tsf_region& region = f->presets[p].regions[r];
+            const uint32_t    head
+                = uint32_t(uint64_t(g_stream_preload_ms) * region.sample_rate / 1000u) + 1;
+            // Voices read up to and including end (interpolation)
+            AddResidentRun(count, region.offset, std::min(region.offset + head, region.end + 1));
+            if(region.loop_mode != TSF_LOOPMODE_NONE && region.loop_start < region.loop_end)
+            {
+                AddResidentRun(count, region.loop_start, region.loop_end + 1);
+                if(region.loop_mode == TSF_LOOPMODE_SUSTAIN)
+                    AddResidentRun(count,
+                                   region.loop_end + 1,
+                                   std::min(region.loop_end + 1 + head, region.end + 1));
+            }
+        }
+    }
+
+    std::sort(g_stream_runs, g_stream_runs + count, [](const ResidentRun& a, const ResidentRun& b) {
+        return a.first < b.first;
+    });
+    uint32_t merged = 0;
+    uint32_t frames = 0;
+    for(uint32_t i = 0; i < count; i++)
+    {
+        const ResidentRun run = g_stream_runs[i];
+        if(merged > 0)
+        {
+            ResidentRun&   last     = g_stream_runs[merged - 1];
+            const uint32_t last_end = last.first + last.count;
+            if(run.first <= last_end)
+            {
+                last.count = std::max(last_end, run.first + run.count) - last.first;
+                continue;
+            }
+        }
+        g_stream_runs[merged++] = run;
+    }
+    for(uint32_t i = 0; i < merged; i++)
+        frames += g_stream_runs[i].count;
+    g_stream_run_count = merged;
+
+    tsf_sample* pool
+        = (tsf_sample*)Arena().Alloc(size_t(frames) * sizeof(tsf_sample), 8, "resident samples");
+    if(!pool)
+    {
+        ArenaSetOom();
+        return false;
+    }
+
+    // Runs are in file order, so this is one forward pass over the chunk.
+    for(uint32_t i = 0; i < merged; i++)
+    {
+        ResidentRun& run = g_stream_runs[i];
+        run.data         = pool;
+        if(!ReadSamples(run.first, run.count, pool))
+            return false;
+        pool += run.count;
+    }
+    g_stream_stats.resident_bytes = frames * sizeof(tsf_sample);
+    g_stream_stats.resident_runs  = merged;
+    return true;
+}
+
+bool StreamStart(FIL* file)
+{
+    g_stream_file  = file;
+    g_stream_rings = (tsf_sample*)Arena().Alloc(
+        kStreamMaxVoices * kStreamRingFrames * sizeof(tsf_sample), 8, "stream rings");
+    if(!g_stream_rings)
+    {
+        ArenaSetOom();
+        return false;
+    }
+
+#if(defined(FF_USE_FASTSEEK) && FF_USE_FASTSEEK) || (defined(_USE_FASTSEEK) && _USE_FASTSEEK)
+    // Note starts seek all over a large bank; a cluster link map makes
+    // backward seeks O(1) instead of a walk down the FAT chain.
+    DWORD* link_map = (DWORD*)Arena().Alloc(kStreamLinkMapWords * sizeof(DWORD), 4, "fat link map");
+    if(link_map)
+    {
+        link_map[0]     = kStreamLinkMapWords;
+        g_stream_file->cltbl = link_map;
+        if(f_lseek(g_stream_file, CREATE_LINKMAP) != FR_OK)
+            g_stream_file->cltbl = nullptr;
+    }
+#endif
+    return true;
+}
+
+// Works out which sample data preset still lacks and reserves room for it.
+static bool StartPageIn(tsf* f, int preset)
+{
+    const tsf_preset& p      = f->presets[preset];
+    uint32_t          ranges = 0;
+    if(uint32_t(p.regionNum) > kPageInRangesMax)
+        return false;
+    for(int r = 0; r < p.regionNum; r++)
+    {
+        const tsf_region& region = p.regions[r];
+        uint32_t          first  = region.offset;
+        uint32_t          end    = region.end + 1;
+        if(region.loop_mode != TSF_LOOPMODE_NONE && region.loop_start < region.loop_end)
+        {
+            first = std::min(first, region.loop_start);
+            end   = std::max(end, region.loop_end + 1);
+        }
+        end = std::min(end, g_stream_smpl_count);
+        if(first < end)
+            g_page_ranges[ranges++] = SampleRange{first, end};
+    }
+    std::sort(g_page_ranges, g_page_ranges + ranges, [](const SampleRange& a, const SampleRange& b) {
+        return a.first < b.first;
+    });
+
+    uint32_t gaps   = 0;
+    uint32_t frames = 0;
+    uint32_t cursor = 0;
+    for(uint32_t i = 0; i < ranges; i++)
+    {
+        cursor             = std::max(cursor, g_page_ranges[i].first);
+        const uint32_t end = g_page_ranges[i].end;
+        uint32_t       run = UpperResidentRun(cursor);
+        if(run > 0)
+            run--;
+        for(; cursor < end && run < g_stream_run_count; run++)
+        {
+            const ResidentRun& r = g_stream_runs[run];
+            if(r.first + r.count <= cursor)
+                continue;
+            if(r.first >= end)
+                break;
+            if(r.first > cursor)
+            {
+                if(gaps == kPageInRangesMax)
+                    return false;
+                g_page_gaps[gaps++] = SampleRange{cursor, r.first};
+                frames += r.first - cursor;
+            }
+            cursor = r.first + r.count;
+        }
+        if(cursor < end)
+        {
+            if(gaps == kPageInRangesMax)
+                return false;
+            g_page_gaps[gaps++] = SampleRange{cursor, end};
+            frames += end - cursor;
+            cursor = end;
+        }
+    }
+
+    if(g_stream_run_count + gaps > g_stream_run_cap)
+        return false;
+    const size_t pool_bytes = size_t(frames) * sizeof(tsf_sample);
+    if(pool_bytes + kPageInReserveBytes > Arena().Cap() - Arena().Used())
+        return false;
+    tsf_sample* pool = nullptr;
+    if(frames > 0)
+    {
+        pool = (tsf_sample*)Arena().Alloc(pool_bytes, 8, kPageInSite);
+        if(!pool)
+            return false;
+    }
+    g_page_in.preset    = preset;
+    g_page_in.gap_count = gaps;
+    g_page_in.gap       = 0;
+    g_page_in.done      = 0;
+    g_page_in.pool        = pool;
+    g_page_in.pool_used   = 0;
+    g_page_in.pool_frames = frames;
+    return true;
+}
+
+// Publishes the paged-in data as runs, merged in order into the spare array.
+static void FinishPageIn()
+{
+    const uint32_t gaps  = g_page_in.gap_count;
+    const uint32_t count = g_stream_run_count + gaps;
+    uint32_t       a = 0, b = 0, offset = 0;
+    for(uint32_t i = 0; i < count; i++)
+    {
+        if(b < gaps && (a == g_stream_run_count || g_page_gaps[b].first < g_stream_runs[a].first))
+        {
+            const SampleRange& gap = g_page_gaps[b++];
+            g_stream_runs_spare[i] = ResidentRun{gap.first, gap.end - gap.first, g_page_in.pool + offset};
+            offset += gap.end - gap.first;
+        }
+        else
+        {
+            g_stream_runs_spare[i] = g_stream_runs[a++];
+        }
+    }
+    {
+        ScopedIrqBlocker lock;
+        std::swap(g_stream_runs, g_stream_runs_spare);
+        g_stream_run_count = count;
+    }
+    g_preset_state[g_page_in.preset] = kPresetResident;
+    g_stream_stats.resident_bytes += offset * sizeof(tsf_sample);
+    g_stream_stats.resident_runs  = count;
+    g_stream_stats.resident_presets++;
+    g_page_in.preset = -1;
+}
+
+static void FailPageIn(int preset)
+{
+    g_preset_state[preset] = kPresetFailed;
+    g_page_in.preset       = -1;
+    g_stream_stats.page_in_failures++;
+}
+
+// Reads up to budget bytes of the preset being paged in and publishes it
+// once complete. A failed read leaves the preset streaming.
+static void StepPageIn(uint32_t budget)
+{
+    uint32_t spent = 0;
+    while(g_page_in.gap < g_page_in.gap_count && spent < budget)
+    {
+        const SampleRange& gap   = g_page_gaps[g_page_in.gap];
+        const uint32_t     first = gap.first + g_page_in.done;
+        const uint32_t     n
+            = std::min(gap.end - first, std::max(1u, (budget - spent) / uint32_t(sizeof(tsf_sample))));
+        if(!ReadSamples(first, n, g_page_in.pool + g_page_in.pool_used))
+        {
+            g_stream_stats.read_errors++;
+            Arena().Release(g_page_in.pool,
+                            g_page_in.pool_frames * sizeof(tsf_sample),
+                            Arena().SiteIndex(kPageInSite));
+            FailPageIn(g_page_in.preset);
+            return;
+        }
+        g_stream_stats.bytes_read += n * sizeof(tsf_sample);
+        spent += n * sizeof(tsf_sample);
+        g_page_in.pool_used += n;
+        g_page_in.done += n;
+        if(first + n == gap.end)
+        {
+            g_page_in.gap++;
+            g_page_in.done = 0;
+        }
+    }
+    if(g_page_in.gap == g_page_in.gap_count)
+    {
+        FinishPageIn();
+        g_stream_stats.page_ins++;
+    }
+}
+
+static bool PagePresetIn(tsf* f, int preset)
+{
+    if(g_page_in.preset != -1 && g_page_in.preset != preset)
+        StepPageIn(UINT32_MAX);
+    if(g_preset_state[preset] != kPresetOnDisk)
+        return g_preset_state[preset] == kPresetResident;
+    if(g_page_in.preset != preset && !StartPageIn(f, preset))
+    {
+        FailPageIn(preset);
+        return false;
+    }
+    StepPageIn(UINT32_MAX);
+    return g_preset_state[preset] == kPresetResident;
+}
+
+// Starts paging in the first channel preset that is not resident yet, so a
+// live program change plays from memory after a few main loop passes.
+static void StartChannelPageIn(tsf* f)
+{
+    for(int ch = 0; ch < 16; ch++)
+    {
+        const int preset = tsf_channel_get_preset_index(f, ch);
+        if(preset < 0 || preset >= f->presetNum || g_preset_state[preset] != kPresetOnDisk)
+            continue;
+        if(StartPageIn(f, preset))
+            return;
+        FailPageIn(preset);
+    }
+}
+
+// Works out the next read for a voice: the non-resident source ahead of it,
+// up to a ring's length past where it plays now.
+static bool PlanRefill(tsf* f, size_t index, StreamRefill& refill)
+{
+    uint32_t pos, loop_start, loop_end, end, first, next;
+    {
+        ScopedIrqBlocker lock;
+        const tsf_voice& v = f->voices[index];
+        if(v.playingPreset == -1 || v.region == nullptr)
+            return false;
+        pos        = uint32_t(v.sourceSamplePosition);
+        loop_start = v.loopStart;
+        loop_end   = v.loopEnd;
+        end        = v.region->end;
+        refill.gen = g_stream_voices[index].gen;
+        first      = g_stream_voices[index].first;
+        next       = g_stream_voices[index].next;
+    }
+
+    // A looping voice never gets past its (resident) loop.
+    const bool     looping = loop_start < loop_end;
+    const uint32_t stop    = std::min(looping ? loop_start : end + 1, g_stream_smpl_count);
+    uint32_t       start   = pos;
+    while(const ResidentRun* run = FindResidentRun(start))
+        start = run->first + run->count;
+    if(start >= stop)
+        return false;
+
+    const uint32_t upper    = UpperResidentRun(start);
+    const uint32_t run_stop = upper < g_stream_run_count ? std::min(stop, g_stream_runs[upper].first) : stop;
+
+    refill.reset = !(first <= start && start <= next);
+    refill.from  = refill.reset ? start : next;
+    refill.to    = std::min(run_stop, pos + kStreamRingFrames);
+    refill.ahead = refill.from - pos;
+    if(refill.to <= refill.from)
+        return false;
+    return refill.to - refill.from >= kStreamMinReadFrames || refill.to == run_stop;
+}
+
+static void ReadRefill(size_t index, const StreamRefill& refill)
+{
+    tsf_sample* ring = g_stream_rings + index * kStreamRingFrames;
+    uint32_t    at   = refill.from;
+    while(at < refill.to)
+    {
+        const uint32_t slot = at & (kStreamRingFrames - 1);
+        const uint32_t n    = std::min(refill.to - at, kStreamRingFrames - slot);
+        if(!ReadSamples(at, n, ring + slot))
+        {
+            g_stream_stats.read_errors++;
+            break;
+        }
+        g_stream_stats.bytes_read += n * sizeof(tsf_sample);
+        at += n;
+    }
+    if(at == refill.from)
+        return;
+
+    ScopedIrqBlocker lock;
+    VoiceStream&     vs = g_stream_voices[index];
+    if(vs.gen != refill.gen)
+        return; // the voice moved on to another note while we read
+    if(refill.reset)
+        vs.first = refill.from;
+    vs.next = at;
+    if(vs.next - vs.first > kStreamRingFrames)
+        vs.first = vs.next - kStreamRingFrames;
+    g_stream_stats.refills++;
+}
+
+// -----------------------------
+// Cache images
+// -----------------------------
+void StreamSaveImage(StreamImage& image)
+{
+    image.runs_offset         = ArenaOffset(g_stream_runs);
+    image.runs_spare_offset   = ArenaOffset(g_stream_runs_spare);
+    image.preset_state_offset = ArenaOffset(g_preset_state);
+    image.run_count           = g_stream_run_count;
+    image.run_cap             = g_stream_run_cap;
+    image.smpl_offset         = uint32_t(g_stream_smpl_offset);
+    image.smpl_count          = g_stream_smpl_count;
+    image.resident_bytes      = g_stream_stats.resident_bytes;
+}
+
+bool StreamValidImage(const StreamImage& image,
+                      uint64_t           image_bytes,
+                      uint32_t           sf2_size,
+                      const tsf*         f)
+{
+    if(image.run_count > image.run_cap || f->fontSampleNum != image.smpl_count
+       || uint64_t(image.smpl_offset) + uint64_t(image.smpl_count) * sizeof(short) > sf2_size
+       || !ImageSpan<ResidentRun>(image_bytes, image.runs_offset, image.run_cap)
+       || !ImageSpan<ResidentRun>(image_bytes, image.runs_spare_offset, image.run_cap)
+       || (f->presetNum > 0 && !ImageSpan<uint8_t>(image_bytes, image.preset_state_offset, f->presetNum)))
+        return false;
+    const ResidentRun* runs = (const ResidentRun*)(ArenaBase() + image.runs_offset);
+    uint64_t           end  = 0;
+    for(uint32_t i = 0; i < image.run_count; i++)
+    {
+        // Sorted and apart, as UpperResidentRun expects
+        if(runs[i].first < end
+           || uint64_t(runs[i].first) + runs[i].count > image.smpl_count
+           || !ImageSpan<tsf_sample>(image_bytes, ImageOffset(runs[i].data), runs[i].count))
+            return false;
+        end = uint64_t(runs[i].first) + runs[i].count;
+    }
+    const uint8_t* state = ArenaBase() + image.preset_state_offset;
+    for(int p = 0; p < f->presetNum; p++)
+        if(state[p] > kPresetFailed)
+            return false;
+    return true;
+}
+
+void StreamRestoreImage(const StreamImage& image)
+{
+    g_stream_active               = true;
+    g_stream_runs                 = (ResidentRun*)(ArenaBase() + image.runs_offset);
+    g_stream_runs_spare           = (ResidentRun*)(ArenaBase() + image.runs_spare_offset);
+    g_preset_state                = ArenaBase() + image.preset_state_offset;
+    g_stream_run_count            = image.run_count;
+    g_stream_run_cap              = image.run_cap;
+    g_stream_smpl_offset          = image.smpl_offset;
+    g_stream_smpl_count           = image.smpl_count;
+    g_stream_stats.resident_bytes = image.resident_bytes;
+    g_stream_stats.resident_runs  = image.run_count;
+}
+
+void StreamRebaseImage(uintptr_t from, uintptr_t to)
+{
+    for(uint32_t i = 0; i < g_stream_run_count; i++)
+        RebasePtr(g_stream_runs[i].data, from, to);
+}
+#endif // TSF_SAMPLE_STREAMING
+
+void StreamReset()
+{
+    g_stream_active = false;
+    g_stream_stats  = SynthStreamStats{};
+#ifdef TSF_SAMPLE_STREAMING
+    for(VoiceStream& vs : g_stream_voices)
+        vs = VoiceStream{};
+    g_page_in.preset = -1;
+#endif
+}
+
+void StreamStop()
+{
+    g_stream_active = false;
+}
+
+bool StreamActive()
+{
+    return g_stream_active;
+}
+
+size_t StreamResidentBytes()
+{
+    return g_stream_stats.resident_bytes;
+}
+
+StreamSettings StreamGetSettings()
+{
+    return StreamSettings{g_stream_preload_ms, g_stream_force, g_selective_loading};
+}
+
+// -----------------------------
+// Streaming API
+// -----------------------------
+
+void SynthSetSampleStreaming(uint32_t preload_ms, bool force)
+{
+    g_stream_preload_ms = preload_ms;
+    g_stream_force      = force;
+}
+
+void SynthSetSelectiveLoading(bool enable)
+{
+    g_selective_loading = enable;
+}
+
+bool StreamRequirePresets(tsf* f, const SynthPresetUse* uses, size_t count)
+{
+    if(!g_stream_active)
+        return true;
+    bool ok = true;
+#ifdef TSF_SAMPLE_STREAMING
+    for(size_t i = 0; i < count; i++)
+    {
+        const int preset = tsf_get_presetindex_fallback(f,
+                                                        uses[i].bank & 0x7FFF,
+                                                        uses[i].program,
+                                                        uses[i].drums ? 1 : 0);
+        if(preset >= 0 && !PagePresetIn(f, preset))
+            ok = false;
+    }
+#else
+    (void)uses;
+    (void)count;
+#endif
+    return ok;
+}
+
+void StreamService(tsf* f)
+{
+#ifdef TSF_SAMPLE_STREAMING
+    if(!g_stream_active)
+        return;
+    if(g_page_in.preset != -1)
+        StepPageIn(kPageInBytesPerService);
+    else if(g_selective_loading)
+        StartChannelPageIn(f);
+
+    const size_t voices = std::min(size_t(f->voiceNum), kStreamMaxVoices);
+    // Closest to running dry first
+    for(int i = 0; i < kStreamReadsPerService; i++)
+    {
+        size_t       best = voices;
+        StreamRefill best_refill{};
+        for(size_t v = 0; v < voices; v++)
+        {
+            StreamRefill refill;
+            if(PlanRefill(f, v, refill) && (best == voices || refill.ahead < best_refill.ahead))
+            {
+                best        = v;
+                best_refill = refill;
+            }
+        }
+        if(best == voices)
+            break;
+        ReadRefill(best, best_refill);
+    }
+#endif
+}
+
+void SynthGetStreamStats(SynthStreamStats& stats)
+{
+    stats        = g_stream_stats;
+    stats.active = g_stream_active;
+}
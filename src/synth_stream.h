@@ -0,0 +1,78 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+
+#include "synth_tsf.h"
+#include "tsf_config.h"
+
+extern "C"
+{
+#include "ff.h"
+}
+
+struct tsf;
+
+// -----------------------------
+// Partial sample residency. Samples stay on the card when they do not fit
+// the arena, or when selective loading is on. Every region then keeps its
+// attack (and its loop) resident, presets in use are paged in whole, and
+// anything else is read into per-voice rings by SynthStreamService() in the
+// main loop. The loader owns the SF2 file and the TSF instance and hands
+// them in.
+// -----------------------------
+
+// Forgets the last bank's streaming state, at the start of a load
+void StreamReset();
+// The samples are not read from the file any more (it is about to close)
+void StreamStop();
+bool StreamActive();
+// Sample bytes held in the arena while streaming
+size_t StreamResidentBytes();
+
+// Loader settings a cache image was taken with
+struct StreamSettings
+{
+    uint32_t preload_ms;
+    bool     force;
+    bool     selective;
+};
+StreamSettings StreamGetSettings();
+
+// SynthRequirePresets and SynthStreamService for the loaded bank f
+bool StreamRequirePresets(tsf* f, const SynthPresetUse* uses, size_t count);
+void StreamService(tsf* f);
+
+// Where a cache image keeps the stream tables: arena offsets and counts
+struct StreamImage
+{
+    uint32_t runs_offset;
+    uint32_t runs_spare_offset;
+    uint32_t preset_state_offset;
+    uint32_t run_count;
+    uint32_t run_cap;
+    uint32_t smpl_offset;
+    uint32_t smpl_count;
+    uint32_t resident_bytes;
+};
+
+#ifdef TSF_SAMPLE_STREAMING
+// tsf_stream.skip_samples for tsf_load(): leaves the sample chunk on the
+// card when it does not fit or selective loading is on.
+int StreamSkipSamples(void* data, unsigned int size);
+// Reads the resident part of every region of f from file, after a load
+// that left the samples on the card.
+bool StreamLoadResident(tsf* f, FIL* file);
+// Per-load buffers, allocated after the cacheable part of the arena; the
+// voices stream from file from then on.
+bool StreamStart(FIL* file);
+
+// Cache images of a streaming bank. StreamValidImage checks tables that
+// still hold arena offsets, before anything trusts them.
+void StreamSaveImage(StreamImage& image);
+bool StreamValidImage(const StreamImage& image,
+                      uint64_t           image_bytes,
+                      uint32_t           sf2_size,
+                      const tsf*         f);
+void StreamRestoreImage(const StreamImage& image);
+void StreamRebaseImage(uintptr_t from, uintptr_t to);
+#endif
@@ -1,11 +1,16 @@
 #include "synth_tsf.h"
+#include "synth_arena.h"
+#include "synth_cache.h"
+#include "synth_fx.h"
+#include "synth_governor.h"
+#include "synth_stream.h"
+#include <algorithm>
 #include <cstdint>
 #include <cstddef>
 #include <cmath>
 
 #include "daisy_patch_sm.h"
-#include "daisysp.h"
-#include "daisysp-lgpl.h"
+#include "util/scopedirqblocker.h"
 
 extern "C"
 {
@@ -13,105 +18,62 @@ extern "C"
 }
 
 using namespace daisy;
-using namespace daisysp;
 
 // -----------------------------
-// Deterministic SDRAM arena for TSF
+// TinySoundFont config (allocator + no stdio)
 // -----------------------------
-class SdramArena
-{
-  public:
-    void Init(void* mem, size_t bytes)
-    {
-        base_ = (uint8_t*)mem;
-        cap_  = bytes;
-        used_ = 0;
-    }
-    void  Reset() { used_ = 0; }
-    void* Alloc(size_t bytes, size_t align = 8)
-    {
-        if(!base_)
-            return nullptr;
-        size_t start = (used_ + (align - 1)) & ~(align - 1);
-        size_t end   = start + bytes;
-        if(end > cap_)
-            return nullptr;
-        used_ = end;
-        return base_ + start;
-    }
-    size_t Used() const { return used_; }
-    size_t Cap() const { return cap_; }
+#include "tsf_config.h"
 
-  private:
-    uint8_t* base_ = nullptr;
-    size_t   cap_  = 0;
-    size_t   used_ = 0;
-};
+// Charged to the TSF function that allocates
+#define TSF_MALLOC(sz) ArenaMalloc(sz, __func__)
+#define TSF_REALLOC(p, sz) ArenaRealloc(p, sz, __func__)
+#define TSF_FREE(p) ArenaFree(p)
 
-static SdramArena g_arena;
-static bool       g_arena_oom = false;
+static void TsfLoadPhase(int phase);
+#define TSF_LOAD_PHASE(phase) TsfLoadPhase(phase)
 
-// Put arena in SDRAM
-static uint8_t DSY_SDRAM_BSS sdram_arena_buf[56 * 1024 * 1024];
+#define TSF_IMPLEMENTATION
+#include "tsf.h"
 
 // -----------------------------
-// TinySoundFont config (allocator + no stdio)
+// Load profiling: tsf_load() reports its phases and TsfRead() the time spent
+// on the card, which splits the sample phase into reading and conversion.
 // -----------------------------
-#define TSF_NO_STDIO
+static SynthLoadStats g_load_stats;
+static int            g_load_phase    = -1;
+static uint32_t       g_load_phase_us = 0;
+static uint32_t       g_load_read_us  = 0; // card time since the phase began
 
-struct ArenaHdr
+// phase -1 ends profiling
+static void TsfLoadPhase(int phase)
 {
-    uint32_t sz;
-};
-
-static inline void* ArenaMalloc(size_t bytes)
-{
-    const size_t total = sizeof(ArenaHdr) + bytes;
-    void*        raw   = g_arena.Alloc(total, 8);
-    if(!raw)
+    const uint32_t now     = System::GetUs();
+    const uint32_t elapsed = now - g_load_phase_us;
+    if(g_load_phase == TSF_LOAD_SAMPLES)
     {
-        g_arena_oom = true;
-        return nullptr;
+        g_load_stats.read_us += g_load_read_us;
+        g_load_stats.convert_us += elapsed - std::min(elapsed, g_load_read_us);
     }
-    auto* h = (ArenaHdr*)raw;
-    h->sz   = (uint32_t)bytes;
-    return (void*)(h + 1);
-}
-
-static inline void* ArenaRealloc(void* ptr, size_t newBytes)
-{
-    if(!ptr)
-        return ArenaMalloc(newBytes);
-    auto*        h        = ((ArenaHdr*)ptr) - 1;
-    const size_t oldBytes = h->sz;
-
-    void* np = ArenaMalloc(newBytes);
-    if(!np)
-        return nullptr;
-
-    const size_t ncopy = (oldBytes < newBytes) ? oldBytes : newBytes;
-    if(ncopy)
-        __builtin_memcpy(np, ptr, ncopy);
-    return np;
+    else if(g_load_phase >= 0)
+    {
+        g_load_stats.parse_us += elapsed;
+    }
+    g_load_phase    = phase;
+    g_load_phase_us = now;
+    g_load_read_us  = 0;
 }
 
-static inline void ArenaFree(void*) {}
-
-#define TSF_MALLOC(sz) ArenaMalloc(sz)
-#define TSF_REALLOC(p, sz) ArenaRealloc(p, sz)
-#define TSF_FREE(p) ArenaFree(p)
-
-#define TSF_IMPLEMENTATION
-#include "tsf.h"
-
 // -----------------------------
 // TSF stream backed by FatFS FIL
 // -----------------------------
 static int TsfRead(void* data, void* ptr, unsigned int size)
 {
-    FIL* f  = (FIL*)data;
-    UINT br = 0;
-    if(f_read(f, ptr, size, &br) != FR_OK)
+    FIL*           f        = (FIL*)data;
+    UINT           br       = 0;
+    const uint32_t start_us = System::GetUs();
+    const FRESULT  result   = f_read(f, ptr, size, &br);
+    g_load_read_us += System::GetUs() - start_us;
+    if(result != FR_OK)
         return 0;
     return (int)br;
 }
@@ -131,97 +93,133 @@ static tsf* g_tsf = nullptr;
 static FIL  g_sf2file;
 static bool g_sf2file_open = false;
 static float g_sample_rate = 48000.0f;
-static Chorus   DSY_SDRAM_BSS g_chorus;
-static ReverbSc DSY_SDRAM_BSS g_reverb;
-static Limiter  DSY_SDRAM_BSS g_limiter_l;
-static Limiter  DSY_SDRAM_BSS g_limiter_r;
-static bool    g_fx_init = false;
-static float   g_chorus_wet = 1.0f;
-static float   g_chorus_dry = 0.0f;
-static float   g_chorus_gain = 1.5f;
-static float   g_reverb_wet = 1.0f;
-static float   g_reverb_dry = 0.0f;
-static float   g_reverb_hp_a = 0.0f;
-static float   g_reverb_hp_zl = 0.0f;
-static float   g_reverb_hp_zr = 0.0f;
-static float   g_reverb_hp_xl = 0.0f;
-static float   g_reverb_hp_xr = 0.0f;
-static float   g_reverb_time = 0.85f;
-static float   g_reverb_lpf_hz = 8000.0f;
-static float   g_reverb_hpf_hz = 80.0f;
-static float   g_chorus_depth = 0.35f;
-static float   g_chorus_speed_hz = 0.25f;
 static float   g_external_gain = 1.0f;
-static bool    g_fx_load_shed = false;
+// Channels whose program changes select drum kits; GS SysEx can move it.
+static uint16_t g_drum_channels = 1u << 9;
 
-namespace
+static inline bool IsDrumChannel(uint8_t ch)
 {
-constexpr int kFxLoadShedOnVoices  = 16;
-constexpr int kFxLoadShedOffVoices = 12;
+    return ch < 16 && ((g_drum_channels >> ch) & 1u);
+}
+
+void SynthGetLoadStats(SynthLoadStats& stats)
+{
+    stats = g_load_stats;
 }
 
 bool SynthInit()
 {
-    g_arena.Init(sdram_arena_buf, sizeof(sdram_arena_buf));
+    ArenaInit();
+    GovernorInitClock();
     return true;
 }
 
 bool SynthLoadSf2(const char* path, float sampleRate, int voices)
 {
     g_sample_rate = sampleRate;
-    g_arena.Reset();
-    g_arena_oom = false;
-    __builtin_memset(sdram_arena_buf, 0, sizeof(sdram_arena_buf));
-
-    if(f_open(&g_sf2file, path, FA_READ) != FR_OK)
-        return false;
-    g_sf2file_open = true;
-
-    tsf_stream s{};
-    s.data = &g_sf2file;
-    s.read = &TsfRead;
-    s.skip = &TsfSkip;
-
-    g_tsf = tsf_load(&s);
+    FxBeginLoad(sampleRate);
+    ArenaReset();
+    StreamReset();
+    g_load_stats = SynthLoadStats{};
+
+    const uint32_t load_start_us = System::GetUs();
+    uint32_t       lap_start_us  = load_start_us;
+    auto           lap           = [&lap_start_us]() {
+        const uint32_t now = System::GetUs();
+        const uint32_t us  = now - lap_start_us;
+        lap_start_us       = now;
+        return us;
+    };
+
+    FILINFO    sf2_info{};
+    const bool cacheable = CacheEnabled() && f_stat(path, &sf2_info) == FR_OK;
+    g_load_stats.open_us += lap();
+    g_tsf = cacheable ? CacheLoad(path, sf2_info) : nullptr;
+    if(g_tsf)
+    {
+        g_load_stats.from_cache = true;
+        g_load_stats.cache_us += lap();
+        // Streaming banks still read their samples from the SF2 itself
+        if(StreamActive())
+        {
+            if(f_open(&g_sf2file, path, FA_READ) != FR_OK)
+                g_tsf = nullptr;
+            else
+                g_sf2file_open = true;
+        }
+        g_load_stats.open_us += lap();
+    }
+    else
+    {
+        g_load_stats.cache_us += lap();
+        // A cache that failed validation part way may have left state behind
+        ArenaReset();
+        StreamStop();
+        g_tsf = nullptr;
+        if(f_open(&g_sf2file, path, FA_READ) != FR_OK)
+            return false;
+        g_sf2file_open = true;
+        g_load_stats.open_us += lap();
+
+        tsf_stream s{};
+        s.data = &g_sf2file;
+        s.read = &TsfRead;
+        s.skip = &TsfSkip;
+#ifdef TSF_SAMPLE_STREAMING
+        s.skip_samples = &StreamSkipSamples;
+#endif
+        TsfLoadPhase(TSF_LOAD_CHUNKS);
+        g_tsf = tsf_load(&s);
+        TsfLoadPhase(-1);
+        lap();
+#ifdef TSF_SAMPLE_STREAMING
+        if(g_tsf && StreamActive() && !StreamLoadResident(g_tsf, &g_sf2file))
+            g_tsf = nullptr;
+        g_load_stats.read_us += lap();
+#endif
+        if(g_tsf && cacheable && !SynthArenaOom())
+            g_load_stats.cache_written = CacheSave(path, sf2_info, g_tsf, Arena().Used());
+        g_load_stats.cache_us += lap();
+    }
+    g_load_stats.image_bytes = uint32_t(Arena().Used());
+#ifdef TSF_SAMPLE_STREAMING
+    if(g_tsf && StreamActive() && !StreamStart(&g_sf2file))
+        g_tsf = nullptr;
+    g_load_stats.open_us += lap();
+#endif
     if(!g_tsf)
     {
-        f_close(&g_sf2file);
+        if(g_sf2file_open)
+            f_close(&g_sf2file);
         g_sf2file_open = false;
+        StreamStop();
         return false;
     }
 
-    // tsf_load() consumes the file during load; keep only the parsed synth in memory.
-    f_close(&g_sf2file);
-    g_sf2file_open = false;
+    // tsf_load() consumes the file during load; keep only the parsed synth in
+    // memory unless samples stream from it.
+    if(!StreamActive() && g_sf2file_open)
+    {
+        f_close(&g_sf2file);
+        g_sf2file_open = false;
+    }
+    g_load_stats.open_us += lap();
 
     tsf_set_output(g_tsf, TSF_STEREO_INTERLEAVED, sampleRate, 0.0f);
     tsf_set_max_voices(g_tsf, voices);
-    if(!g_fx_init)
-    {
-        g_chorus.Init(sampleRate);
-        g_chorus.SetLfoFreq(0.25f);
-        g_chorus.SetLfoDepth(0.35f);
-        g_chorus.SetDelay(0.2f);
-        g_chorus.SetFeedback(0.05f);
-        g_chorus.SetPan(0.25f, 0.75f);
-
-        g_reverb.Init(sampleRate);
-        g_reverb.SetFeedback(0.85f);
-        g_reverb.SetLpFreq(8000.0f);
-        SynthSetReverbHpFreq(80.0f);
-        g_limiter_l.Init();
-        g_limiter_r.Init();
-
-        g_fx_init = true;
-    }
+    FxEndLoad();
+    GovernorReset(g_tsf, g_sample_rate);
     // Initialize default preset for channels (0-15), with drums on channel 10.
     for(int ch = 0; ch < 16; ch++)
         tsf_channel_set_presetnumber(g_tsf, ch, 0, ch == 9 ? 1 : 0);
+    g_load_stats.fx_us    = lap();
+    g_load_stats.total_us = System::GetUs() - load_start_us;
     return true;
 }
 
 void SynthUnloadSf2()
 {
+    StreamStop();
     if(g_tsf)
     {
         tsf_close(g_tsf);
@@ -234,6 +232,19 @@ void SynthUnloadSf2()
     }
 }
 
+bool SynthRequirePresets(const SynthPresetUse* uses, size_t count)
+{
+    if(!g_tsf)
+        return false;
+    return StreamRequirePresets(g_tsf, uses, count);
+}
+
+void SynthStreamService()
+{
+    if(g_tsf)
+        StreamService(g_tsf);
+}
+
 int SynthActiveVoiceCount()
 {
     return g_tsf ? tsf_active_voice_count(g_tsf) : 0;
@@ -247,6 +258,9 @@ void SynthSetMaxVoices(int maxVoices)
         maxVoices = 4;
     if(maxVoices > 32)
         maxVoices = 32;
+    // Called from the main loop: the voice array and its active bits are
+    // reallocated, so the audio callback must not render meanwhile.
+    ScopedIrqBlocker lock;
     tsf_reset(g_tsf);
     tsf_set_max_voices(g_tsf, maxVoices);
 }
@@ -260,25 +274,74 @@ void SynthSetExternalGain(float gain)
     g_external_gain = gain;
 }
 
-size_t SynthArenaUsed()
+size_t SynthSampleBytes()
 {
-    return g_arena.Used();
+    if(!g_tsf)
+        return 0;
+    return StreamActive() ? StreamResidentBytes() : g_tsf->fontSampleNum * sizeof(tsf_sample);
 }
 
-size_t SynthArenaCap()
+void SynthGetArenaStats(SynthArenaStats& stats)
 {
-    return g_arena.Cap();
+    ArenaGetStats(stats);
+    stats.fx_bytes = FxBytes();
 }
 
-bool SynthArenaOom()
+// -----------------------------
+// Block rendering with timed events. The voices of a block render in one
+// tsf_render_float_fx call and note events are timed into it with
+// tsf_set_event_offset; a call that changes voices already sounding renders
+// the block up to its frame first.
+// -----------------------------
+struct RenderBlock
+{
+    bool     open;
+    float*   out_l;
+    float*   out_r;
+    size_t   frames;
+    size_t   rendered;    // voices are rendered up to here
+    size_t   event_frame;  // of the calls being made
+    uint32_t start;        // RenderClock() at SynthBeginBlock
+    uint64_t voice_frames; // voices sounding, summed over frames rendered
+};
+static RenderBlock g_block{};
+// Fewer free voices than this and a note on may steal one (layered and
+// stereo presets start several)
+constexpr int      kTimedNoteOnFreeVoices = 4;
+static float       g_block_dry[2 * kSynthMaxBlockFrames];
+static float       g_block_chorus[2 * kSynthMaxBlockFrames];
+static float       g_block_reverb[2 * kSynthMaxBlockFrames];
+static float       g_block_wet[4 * kSynthMaxBlockFrames];
+
+static void RenderVoicesTo(size_t frame)
+{
+    const size_t from = g_block.rendered;
+    if(frame <= from)
+        return;
+    g_block.voice_frames += uint64_t(tsf_active_voice_count(g_tsf)) * (frame - from);
+    tsf_render_float_fx(g_tsf,
+                        g_block_dry + 2 * from,
+                        g_block_chorus + 2 * from,
+                        g_block_reverb + 2 * from,
+                        (int)(frame - from),
+                        0);
+    g_block.rendered = frame;
+}
+
+// Call before changing sounding voices so the change starts at the event's
+// frame.
+static void SplitBlockAtEvent()
 {
-    return g_arena_oom;
+    if(g_block.open)
+        RenderVoicesTo(g_block.event_frame);
 }
 
 void SynthPanic()
 {
-    if(g_tsf)
-        tsf_reset(g_tsf);
+    if(!g_tsf)
+        return;
+    SplitBlockAtEvent();
+    tsf_reset(g_tsf);
 }
 
 bool SynthNoteOn(uint8_t ch, uint8_t key, uint8_t vel)
@@ -286,6 +349,10 @@ bool SynthNoteOn(uint8_t ch, uint8_t key, uint8_t vel)
     if(!g_tsf)
         return false;
     const float v = (vel <= 1) ? 0.0f : (float)vel / 127.0f;
+    // A stolen voice stops where the render starts, so when one may be
+    // needed render up to the note first.
+    if(v > 0.0f && g_tsf->voiceNum - tsf_active_voice_count(g_tsf) < kTimedNoteOnFreeVoices)
+        SplitBlockAtEvent();
     return tsf_channel_note_on(g_tsf, (int)ch, (int)key, v) != 0;
 }
 
@@ -314,7 +381,7 @@ void SynthProgramChange(uint8_t ch, uint8_t program)
 {
     if(!g_tsf)
         return;
-    tsf_channel_set_presetnumber(g_tsf, (int)ch, (int)program, ch == 9 ? 1 : 0);
+    tsf_channel_set_presetnumber(g_tsf, (int)ch, (int)program, IsDrumChannel(ch) ? 1 : 0);
 }
 
 const char* SynthProgramName(uint8_t ch, uint8_t program)
@@ -322,14 +389,33 @@ const char* SynthProgramName(uint8_t ch, uint8_t program)
     if(!g_tsf)
         return nullptr;
 
-    const int bank = (ch == 9) ? 128 : 0;
-    return tsf_bank_get_presetname(g_tsf, bank, (int)program);
+    // The preset SynthProgramChange would select on this channel
+    return tsf_get_presetname(g_tsf,
+                              tsf_get_presetindex_fallback(g_tsf,
+                                                           tsf_channel_get_preset_bank(g_tsf, ch),
+                                                           (int)program,
+                                                           IsDrumChannel(ch) ? 1 : 0));
 }
 
 void SynthControlChange(uint8_t ch, uint8_t cc, uint8_t value)
 {
     if(!g_tsf)
         return;
+    // Bank select, RPN/NRPN selection, sustain and all notes/sound off leave
+    // sounding voices alone or end them with a timed call.
+    switch(cc)
+    {
+        case 0:
+        case 32:
+        case 64:
+        case 98:
+        case 99:
+        case 100:
+        case 101:
+        case 120:
+        case 123: break;
+        default: SplitBlockAtEvent(); break;
+    }
     tsf_channel_midi_control(g_tsf, (int)ch, (int)cc, (int)value);
 }
 
@@ -337,13 +423,16 @@ void SynthPitchBend(uint8_t ch, uint16_t value)
 {
     if(!g_tsf)
         return;
+    SplitBlockAtEvent();
     tsf_channel_set_pitchwheel(g_tsf, (int)ch, (int)value);
 }
 
 void SynthResetChannels()
 {
+    g_drum_channels = 1u << 9;
     if(!g_tsf)
         return;
+    SplitBlockAtEvent();
     for(int ch = 0; ch < 16; ch++)
     {
         tsf_channel_midi_control(g_tsf, ch, 121, 0);  // Reset All Controllers
@@ -355,153 +444,160 @@ void SynthResetChannels()
     }
 }
 
-void SynthRender(float* outL, float* outR, size_t frames)
+static void SysExResetChannels()
 {
-    if(!g_tsf)
+    // Not CC121: in TSF that also resets volume, pan and the FX sends.
+    g_drum_channels = 1u << 9;
+    for(int ch = 0; ch < 16; ch++)
     {
-        for(size_t i = 0; i < frames; i++)
-            outL[i] = outR[i] = 0.0f;
-        return;
+        tsf_channel_midi_control(g_tsf, ch, 1, 0);   // Modulation
+        tsf_channel_midi_control(g_tsf, ch, 33, 0);
+        tsf_channel_midi_control(g_tsf, ch, 11, 127); // Expression
+        tsf_channel_midi_control(g_tsf, ch, 64, 0);   // Sustain
+        tsf_channel_midi_control(g_tsf, ch, 71, 64);  // Resonance
+        tsf_channel_midi_control(g_tsf, ch, 74, 64);  // Brightness
+        tsf_channel_set_pitchwheel(g_tsf, ch, 8192);
+        tsf_channel_set_pitchrange(g_tsf, ch, 2.0f);
+        tsf_channel_set_tuning(g_tsf, ch, 0.0f);
+        tsf_channel_set_bank(g_tsf, ch, 0);
+        tsf_channel_set_presetnumber(g_tsf, ch, 0, ch == 9 ? 1 : 0);
     }
+}
 
-    static float tmp[2 * 256];
-    static float tmpChorus[2 * 256];
-    static float tmpReverb[2 * 256];
-    if(frames > 256)
-        frames = 256;
+bool SynthSysEx(const uint8_t* data, size_t size)
+{
+    if(!g_tsf || data == nullptr || size < 6 || data[0] != 0xF0 || data[size - 1] != 0xF7)
+        return false;
+    SplitBlockAtEvent();
 
-    const int active_voices = tsf_active_voice_count(g_tsf);
-    if(g_fx_load_shed)
+    // GM System On (7E dev 09 01) and GM2 System On (7E dev 09 03)
+    if(data[1] == 0x7E && data[3] == 0x09 && (data[4] == 0x01 || data[4] == 0x03))
     {
-        if(active_voices <= kFxLoadShedOffVoices)
-            g_fx_load_shed = false;
+        SysExResetChannels();
+        return true;
     }
-    else if(active_voices >= kFxLoadShedOnVoices)
+
+    // XG System On: 43 1n 4C 00 00 7E 00
+    if(size == 9 && data[1] == 0x43 && (data[2] & 0xF0) == 0x10 && data[3] == 0x4C
+       && data[4] == 0x00 && data[5] == 0x00 && data[6] == 0x7E && data[7] == 0x00)
     {
-        g_fx_load_shed = true;
+        SysExResetChannels();
+        return true;
     }
 
-    if(g_fx_load_shed)
+    // Roland GS DT1: 41 dev 42 12 aa aa aa dd.. sum
+    if(size < 11 || data[1] != 0x41 || data[3] != 0x42 || data[4] != 0x12)
+        return false;
+    uint8_t sum = 0;
+    for(size_t i = 5; i < size - 1; i++)
+        sum = uint8_t(sum + data[i]);
+    if((sum & 0x7F) != 0)
+        return false;
+
+    const uint8_t a0 = data[5];
+    const uint8_t a1 = data[6];
+    const uint8_t a2 = data[7];
+    if(a0 == 0x40 && a1 == 0x00 && a2 == 0x7F) // GS Reset
     {
-        tsf_render_float(g_tsf, tmp, (int)frames, 0);
-        for(size_t i = 0; i < frames; i++)
-        {
-            outL[i] = tmp[2 * i + 0] * g_external_gain;
-            outR[i] = tmp[2 * i + 1] * g_external_gain;
-        }
-        g_limiter_l.ProcessBlock(outL, frames, 1.0f);
-        g_limiter_r.ProcessBlock(outR, frames, 1.0f);
-        return;
+        SysExResetChannels();
+        return true;
     }
-
-    tsf_render_float_fx(g_tsf, tmp, tmpChorus, tmpReverb, (int)frames, 0);
-    for(size_t i = 0; i < frames; i++)
+    if(a0 == 0x40 && (a1 & 0xF0) == 0x10 && a2 == 0x15) // Use for rhythm part
     {
-        const float dryL = tmp[2 * i + 0];
-        const float dryR = tmp[2 * i + 1];
-
-        const float chInL = tmpChorus[2 * i + 0];
-        const float chInR = tmpChorus[2 * i + 1];
-        const float chIn = (chInL + chInR);
-        g_chorus.Process(chIn);
-        const float chL = g_chorus.GetLeft() * g_chorus_gain * g_chorus_wet;
-        const float chR = g_chorus.GetRight() * g_chorus_gain * g_chorus_wet;
-
-        float rvL = 0.0f;
-        float rvR = 0.0f;
-        g_reverb.Process(tmpReverb[2 * i + 0], tmpReverb[2 * i + 1], &rvL, &rvR);
-        // Simple one-pole HPF on reverb return
-        const float yL = g_reverb_hp_a * (g_reverb_hp_zl + rvL - g_reverb_hp_xl);
-        const float yR = g_reverb_hp_a * (g_reverb_hp_zr + rvR - g_reverb_hp_xr);
-        g_reverb_hp_zl = yL;
-        g_reverb_hp_zr = yR;
-        g_reverb_hp_xl = rvL;
-        g_reverb_hp_xr = rvR;
-
-        // Send amounts already scale per-voice contributions.
-        outL[i] = (dryL + chInL * g_chorus_dry + chL + tmpReverb[2 * i + 0] * g_reverb_dry
-                   + yL * g_reverb_wet)
-                  * g_external_gain;
-        outR[i] = (dryR + chInR * g_chorus_dry + chR + tmpReverb[2 * i + 1] * g_reverb_dry
-                   + yR * g_reverb_wet)
-                  * g_external_gain;
+        // Part blocks run 1-9, 0, A-F for MIDI channels 1-16.
+        const uint8_t block = a1 & 0x0F;
+        const uint8_t ch    = block == 0 ? 9 : (block <= 9 ? block - 1 : block);
+        if(data[8] == 0)
+            g_drum_channels &= uint16_t(~(1u << ch));
+        else
+            g_drum_channels |= uint16_t(1u << ch);
+        const int program = tsf_channel_get_preset_number(g_tsf, ch);
+        tsf_channel_set_presetnumber(g_tsf, ch, program, IsDrumChannel(ch) ? 1 : 0);
+        return true;
     }
-
-    g_limiter_l.ProcessBlock(outL, frames, 1.0f);
-    g_limiter_r.ProcessBlock(outR, frames, 1.0f);
-}
-
-void SynthSetReverbTime(float t01)
-{
-    if(t01 < 0.0f)
-        t01 = 0.0f;
-    if(t01 > 1.0f)
-        t01 = 1.0f;
-    g_reverb_time = t01;
-    g_reverb.SetFeedback(t01);
+    return false;
 }
 
-void SynthSetReverbLpFreq(float hz)
+void SynthRender(float* outL, float* outR, size_t frames)
 {
-    if(hz < 20.0f)
-        hz = 20.0f;
-    g_reverb_lpf_hz = hz;
-    g_reverb.SetLpFreq(hz);
+    SynthBeginBlock(outL, outR, frames);
+    SynthEndBlock();
 }
 
-void SynthSetReverbHpFreq(float hz)
-{
-    if(hz < 20.0f)
-        hz = 20.0f;
-    if(hz > 1000.0f)
-        hz = 1000.0f;
-    g_reverb_hpf_hz = hz;
-    // one-pole HPF coefficient
-    const float x  = expf(-2.0f * 3.14159265f * hz / g_sample_rate);
-    g_reverb_hp_a = x;
-}
-void SynthSetChorusDepth(float d01)
+void SynthBeginBlock(float* outL, float* outR, size_t frames)
 {
-    if(d01 < 0.0f)
-        d01 = 0.0f;
-    if(d01 > 1.0f)
-        d01 = 1.0f;
-    g_chorus_depth = d01;
-    g_chorus.SetLfoDepth(d01);
+    g_block        = RenderBlock{};
+    g_block.open   = true;
+    g_block.out_l  = outL;
+    g_block.out_r  = outR;
+    g_block.frames = std::min(frames, kSynthMaxBlockFrames);
+    g_block.start  = RenderClock();
+    if(g_tsf)
+        tsf_set_event_offset(g_tsf, 0);
 }
 
-
-void SynthSetChorusSpeed(float hz)
+void SynthSetEventFrame(size_t frame)
 {
-    if(hz < 0.05f)
-        hz = 0.05f;
-    if(hz > 5.0f)
-        hz = 5.0f;
-    g_chorus_speed_hz = hz;
-    g_chorus.SetLfoFreq(hz);
+    if(!g_block.open)
+        return;
+    g_block.event_frame = std::min(std::max(frame, g_block.event_frame), g_block.frames);
+    if(g_tsf)
+        tsf_set_event_offset(g_tsf, (int)(g_block.event_frame - g_block.rendered));
 }
 
-float SynthGetReverbTime()
+void SynthEndBlock()
 {
-    return g_reverb_time;
-}
+    if(!g_block.open)
+        return;
+    g_block.open = false;
+    float* const outL   = g_block.out_l;
+    float* const outR   = g_block.out_r;
+    const size_t frames = g_block.frames;
+    if(!g_tsf)
+    {
+        for(size_t i = 0; i < frames; i++)
+            outL[i] = outR[i] = 0.0f;
+        return;
+    }
 
-float SynthGetReverbLpFreq()
-{
-    return g_reverb_lpf_hz;
+    RenderVoicesTo(frames);
+    const uint32_t fxStart = RenderClock();
+    const bool     reverbRan
+        = FxRender(GovernorQuality() >= SynthQuality::FxHalfRate,
+                   g_block_chorus,
+                   g_block_reverb,
+                   g_block_wet,
+                   frames);
+    const uint32_t fxEnd = RenderClock();
+    FxMix(g_block_dry,
+          g_block_chorus,
+          g_block_reverb,
+          g_block_wet,
+          outL,
+          outR,
+          frames,
+          g_external_gain);
+    GovernorAccount(
+        fxStart - g_block.start, fxEnd - fxStart, frames, g_block.voice_frames, !reverbRan);
+    GovernorEndBlock(g_tsf, g_block.start, frames);
 }
 
-float SynthGetReverbHpFreq()
+void SynthEndCallback(size_t frames)
 {
-    return g_reverb_hpf_hz;
+    GovernorEndCallback(g_tsf, frames);
 }
 
-float SynthGetChorusDepth()
+void SynthSetGovernor(bool enable, float budget)
 {
-    return g_chorus_depth;
+    ScopedIrqBlocker lock;
+    GovernorConfigure(enable, budget);
+    GovernorReset(g_tsf, g_sample_rate);
 }
 
-float SynthGetChorusSpeed()
+void SynthGovernorService()
 {
-    return g_chorus_speed_hz;
+    if(!FxReady() || !g_tsf)
+        return;
+    GovernorService(g_tsf);
+    FxService(GovernorQuality() >= SynthQuality::FxHalfRate);
 }
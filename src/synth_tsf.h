@@ -14,8 +14,103 @@ void SynthSetMaxVoices(int maxVoices);
 // Arena diagnostics
 size_t SynthArenaUsed();
 size_t SynthArenaCap();
+// SoundFont sample data held in the arena (int16 unless built for float)
+size_t SynthSampleBytes();
 bool   SynthArenaOom();
 
+// Since the last SynthLoadSf2
+struct SynthArenaStats
+{
+    size_t   used;
+    size_t   cap;
+    size_t   free_bytes;      // freed below the top, waiting for reuse
+    uint32_t reclaimed_bytes; // freed in total
+    uint32_t reused_bytes;    // allocations fitted into freed blocks
+    uint32_t lost_bytes;      // freed with the free list full
+    uint32_t in_place;        // reallocs that did not move
+    uint32_t moved;           // reallocs that copied
+    // SDRAM outside the arena held by the chorus and reverb. The governor's
+    // half-rate pair comes from the arena ("half-rate FX" site) once needed.
+    uint32_t fx_bytes;
+};
+void SynthGetArenaStats(SynthArenaStats& stats);
+
+// Arena use by allocation site: the TSF function that allocated, or the
+// loader table ("stream rings", "preset page-in", ...)
+struct SynthArenaSite
+{
+    const char* name;
+    uint32_t    allocs;
+    uint32_t    live_bytes;
+    uint32_t    peak_bytes;
+};
+size_t SynthArenaSiteCount();
+bool   SynthGetArenaSite(size_t index, SynthArenaSite& site);
+
+// Sample streaming for SoundFonts whose samples do not fit the arena: the
+// first preload_ms of every region (and its loop) stays resident and the
+// rest is read from the card as voices reach it. force streams any SF2.
+// Takes effect at the next SynthLoadSf2; int16 sample builds only.
+void SynthSetSampleStreaming(uint32_t preload_ms, bool force);
+// Selective loading: samples always stay on the card (heads and loops
+// resident as above) and only the presets a song uses are loaded whole, by
+// SynthRequirePresets. Presets selected later (live program changes) are
+// paged in by SynthStreamService and stream until they are resident.
+// Takes effect at the next SynthLoadSf2.
+void SynthSetSelectiveLoading(bool enable);
+
+struct SynthPresetUse
+{
+    uint16_t bank; // as tsf keeps it: 0x8000 | MSB, or (MSB << 7) | LSB
+    uint8_t  program;
+    bool     drums;
+};
+// Load the samples of these presets now (blocking). Resolves bank and
+// program like a program change would. Returns false when one did not fit;
+// its voices stream instead. Always true when the whole SF2 is resident.
+bool SynthRequirePresets(const SynthPresetUse* uses, size_t count);
+
+// Refill voice stream buffers and page in presets from the card; call from
+// the main loop
+void SynthStreamService();
+
+struct SynthStreamStats
+{
+    bool     active;
+    uint32_t resident_bytes;
+    uint32_t resident_runs;
+    uint32_t refills;
+    uint32_t bytes_read;
+    uint32_t read_errors;
+    uint32_t starve_events; // voices that caught up with their stream
+    uint32_t starved_reads; // sample reads played as silence meanwhile
+    uint32_t resident_presets; // paged in whole
+    uint32_t page_ins;
+    uint32_t page_in_failures;
+};
+void SynthGetStreamStats(SynthStreamStats& stats);
+
+// Cache the parsed bank as an arena image in .cache/ next to the SF2 and load
+// from it while the SF2's size and date match. Takes effect at the next
+// SynthLoadSf2.
+void SynthSetSf2Cache(bool enable);
+
+// Breakdown of the last SynthLoadSf2, in microseconds
+struct SynthLoadStats
+{
+    bool     from_cache;
+    bool     cache_written;
+    uint32_t image_bytes; // arena taken by the parsed bank and resident samples
+    uint32_t open_us;     // stat, open and (streaming) the FAT link map
+    uint32_t cache_us;    // cache image read, check or write
+    uint32_t parse_us;    // RIFF chunks, hydra and preset/region build
+    uint32_t read_us;     // sample data read from the card
+    uint32_t convert_us;  // sample conversion while loading
+    uint32_t fx_us;       // voices, channels and FX init
+    uint32_t total_us;
+};
+void SynthGetLoadStats(SynthLoadStats& stats);
+
 // Immediately stop all notes
 void SynthPanic();
 
@@ -36,9 +131,97 @@ void SynthPitchBend(uint8_t ch, uint16_t value);
 // Reset channel controllers and default presets (program 0, drums on ch10)
 void SynthResetChannels();
 
+// Apply a complete SysEx message (F0 ... F7). GM/GM2/XG/GS resets restore
+// default programs and controllers except volume, pan and the FX sends,
+// which the mixer owns; GS "use for rhythm part" moves the drum kit to
+// another channel. Returns true when channel programs may have changed.
+bool SynthSysEx(const uint8_t* data, size_t size);
+
 // Render stereo block
+constexpr size_t kSynthMaxBlockFrames = 256;
 void SynthRender(float* outL, float* outR, size_t frames);
 
+// Render a block with sample-accurate events, in one pass over the voices.
+// SynthBeginBlock opens a block of up to kSynthMaxBlockFrames, each
+// SynthSetEventFrame times the Synth* calls after it at that frame (frames
+// never move backwards), and SynthEndBlock renders what is left. Note on/off,
+// all notes/sound off, sustain off and program changes take effect at their
+// frame inside the render; controllers that change sounding voices (volume,
+// pan, pitch bend, ...) render the block up to their frame first. Outside a
+// block, calls apply before the next render as before.
+void SynthBeginBlock(float* outL, float* outR, size_t frames);
+void SynthSetEventFrame(size_t frame);
+void SynthEndBlock();
+
+// Bracket the whole audio callback, renders included, so the governor
+// budgets on everything the callback does; frames is the callback's size.
+// Without them each render is timed on its own.
+void SynthBeginCallback();
+void SynthEndCallback(size_t frames);
+
+// CPU governor: each audio callback (or render) is timed against the
+// duration of the frames it fills and, when it runs close to that deadline,
+// the synth steps down through these tiers. Each tier keeps the savings of
+// the ones before it.
+enum class SynthQuality : uint8_t
+{
+    Full,
+    FxHalfRate,      // chorus and reverb run at half the sample rate
+    NoInterpolation, // voices read the nearest source sample
+    StealVoices,     // the quietest voices are released while still loaded
+};
+const char* SynthQualityName(SynthQuality quality);
+
+// Off by default. budget: share of the callback's duration it may use
+// (0..1]. When disabled the callback is measured but always runs at full
+// quality.
+void SynthSetGovernor(bool enable, float budget);
+
+struct SynthGovernorStats
+{
+    bool         enabled;
+    SynthQuality quality;
+    bool         cycle_clock; // timed with the DWT cycle counter, else System::GetUs
+    float        load;        // callback time over budget, smoothed
+    float        peak_load;   // single callback
+    uint32_t     callbacks;   // or renders outside a callback
+    uint64_t     callback_ns; // total
+    uint32_t     blocks;      // renders
+    uint32_t     over_budget; // callbacks that took longer than the budget
+    uint32_t     tier_blocks[4]; // blocks rendered in each tier
+    uint32_t     transitions;
+    uint32_t     stolen_voices;
+    // Split of the render time, measured with the governor on or off
+    float        voice_load; // voices and the block's events, smoothed
+    float        fx_load;    // chorus, reverb and the reverb HPF, smoothed
+    uint64_t     voice_ns;   // totals
+    uint64_t     fx_ns;
+    // Voices x frames rendered, and voice time in core cycles where the
+    // render clock is the DWT cycle counter (0 elsewhere): their ratio is
+    // the per-voice cost of a sample.
+    uint64_t     voice_frames;
+    uint64_t     voice_cycles;
+    uint32_t     reverb_idle_blocks; // skipped: send and tail under -90 dBFS
+};
+// Since the last SynthLoadSf2 or SynthSetGovernor
+void SynthGetGovernorStats(SynthGovernorStats& stats);
+
+struct SynthGovernorEvent
+{
+    uint32_t     time_ms;
+    SynthQuality from;
+    SynthQuality to;
+    uint8_t      load_pct; // of budget, callback that triggered it
+    uint8_t      voices;
+};
+// Oldest tier transition not read yet; false when there is none
+bool SynthPopGovernorEvent(SynthGovernorEvent& event);
+
+// Clear and re-arm the FX engine the governor switched away from, take the
+// half-rate one from the arena when first wanted and release the voices the
+// governor steals; call from the main loop
+void SynthGovernorService();
+
 // Global FX controls
 void SynthSetReverbTime(float t01);
 void SynthSetReverbLpFreq(float hz);
@@ -13,6 +13,12 @@
    [OPTIONAL] #define TSF_MALLOC, TSF_REALLOC, and TSF_FREE to avoid stdlib.h
    [OPTIONAL] #define TSF_MEMCPY, TSF_MEMSET to avoid string.h
    [OPTIONAL] #define TSF_POW, TSF_POWF, TSF_EXPF, TSF_LOG, TSF_TAN, TSF_LOG10, TSF_SQRT to avoid math.h
+   [OPTIONAL] #define TSF_SAMPLES_INT16 to keep SoundFont samples as 16-bit (half the memory of float)
+   [OPTIONAL] #define TSF_SAMPLE_STREAMING to let the host keep sample data on disk (see tsf_stream.skip_samples)
+   [OPTIONAL] #define TSF_LOAD_PHASE(phase) to be told which TSFLoadPhase tsf_load is in (load profiling)
+   [OPTIONAL] #define TSF_FIXED_POINT_PHASE to step voices with a 32.32 fixed-point phase instead of a double
+   [OPTIONAL] #define TSF_SMUAD(x, y) to the target's dual 16-bit multiply-add (int16 samples with fixed phase)
+   [OPTIONAL] #define TSF_CONTROL_TABLES to do per-block pitch, gain and filter math with lookup tables
 
    NOT YET IMPLEMENTED
      - Chorus/Reverb effects processing (generators are parsed/stored)
@@ -85,11 +91,26 @@ extern "C"
 
         // Function pointer will be called to skip ahead over 'count' bytes (returns 1 on success, 0 on error)
         int (*skip)(void* data, unsigned int count);
+
+#ifdef TSF_SAMPLE_STREAMING
+        // Optional. Called when the stream is at the start of the 'size' byte sample chunk;
+        // return nonzero to skip it and serve samples through tsf_stream_window instead.
+        int (*skip_samples)(void* data, unsigned int size);
+#endif
     };
 
     // Generic SoundFont loading method using the stream structure above
     TSFDEF tsf* tsf_load(struct tsf_stream* stream);
 
+    // Passed to TSF_LOAD_PHASE as tsf_load moves between reading RIFF chunks,
+    // reading (and converting) sample data and building presets/regions
+    enum TSFLoadPhase
+    {
+        TSF_LOAD_CHUNKS,
+        TSF_LOAD_SAMPLES,
+        TSF_LOAD_PRESETS
+    };
+
     // Copy a tsf instance from an existing one, use tsf_close to close it as well.
     // All copied tsf instances and their original instance are linked, and share the underlying soundfont.
     // This allows loading a soundfont only once, but using it for multiple independent playbacks.
@@ -105,6 +126,13 @@ extern "C"
     // Returns the preset index from a bank and preset number, or -1 if it does not exist in the loaded SoundFont
     TSFDEF int tsf_get_presetindex(const tsf* f, int bank, int preset_number);
 
+    // Returns the preset index a MIDI program change selects: the bank, then bank 0, then the first
+    // preset (drums try drum banks 128 | bank, 128 and 128:0 first), or -1 if there are no presets
+    TSFDEF int tsf_get_presetindex_fallback(const tsf* f,
+                                            int        bank,
+                                            int        preset_number,
+                                            int        flag_mididrums);
+
     // Returns the number of presets in the loaded SoundFont
     TSFDEF int tsf_get_presetcount(const tsf* f);
 
@@ -126,6 +154,14 @@ extern "C"
         TSF_MONO
     };
 
+    enum TSFInterpolation
+    {
+        // Linear interpolation between neighbouring source samples (default)
+        TSF_INTERPOLATION_LINEAR,
+        // Nearest earlier source sample only; cheaper, with audible aliasing
+        TSF_INTERPOLATION_NONE
+    };
+
     // Thread safety:
     //
     // 1. Rendering / voices:
@@ -162,6 +198,11 @@ extern "C"
     //   global_gain: the desired volume where 1.0 is 100%
     TSFDEF void tsf_set_volume(tsf* f, float global_gain);
 
+    // Set how voices read between source samples; can be changed while
+    // voices play
+    TSFDEF void tsf_set_interpolation(tsf*                  f,
+                                      enum TSFInterpolation interpolation);
+
     // Set the maximum number of voices to play simultaneously
     // Depending on the soundfond, one note can cause many new voices to be started,
     // so don't keep this number too low or otherwise sounds may not play.
@@ -189,9 +230,22 @@ extern "C"
     // Stop playing all notes (end with sustain and release)
     TSFDEF void tsf_note_off_all(tsf* f);
 
+    // Time the note on/off calls that follow at a sample offset into the next
+    // tsf_render_* call: their voices start, release or quickly end there
+    // instead of at the start of the buffer. Offsets must not decrease and
+    // are reset to 0 by rendering. Channel controller changes still apply to
+    // the whole next render. A voice stolen to make room for a timed note on
+    // stops at the start of the buffer.
+    //   offset: samples into the next render, up to its sample count
+    TSFDEF void tsf_set_event_offset(tsf* f, int offset);
+
     // Returns the number of active voices
     TSFDEF int tsf_active_voice_count(tsf* f);
 
+    // Quickly release the quietest playing voice that is not already in a
+    // quick release (returns 0 if there is none, otherwise 1)
+    TSFDEF int tsf_note_off_quietest(tsf* f);
+
     // Render output samples into a buffer
     // You can either render as signed 16-bit values (tsf_render_short) or
     // as 32-bit float values (tsf_render_float)
@@ -225,7 +279,8 @@ extern "C"
     //   pitch_range: range of the pitch wheel in semitones (default 2.0, total +/- 2 semitones)
     //   tuning: tuning of all playing voices in semitones (default 0.0, standard (A440) tuning)
     //   flag_sustain: 0 to end notes that were held sustained and disable holding sustain otherwise enable it
-    //   (tsf_set_preset_number and set_bank_preset return 0 if preset does not exist, otherwise 1)
+    //   (tsf_channel_set_presetnumber picks a preset as tsf_get_presetindex_fallback does and returns 0 if there is none)
+    //   (tsf_channel_set_bank_preset returns 0 if preset does not exist, otherwise 1)
     //   (tsf_channel_set_... return 0 if a new channel needed allocation and that failed, otherwise 1)
     TSFDEF int
     tsf_channel_set_presetindex(tsf* f, int channel, int preset_index);
@@ -285,6 +340,227 @@ extern "C"
 // ---------------------------------------------------------------------------------------------------------
 #endif //TSF_INCLUDE_TSF_INL
 
+// Types of a loaded font, for host code that works on it directly (sample
+// residency, cache images): define TSF_INTERNALS before including this file.
+// The implementation always has them.
+#if (defined(TSF_IMPLEMENTATION) || defined(TSF_INTERNALS)) \
+    && !defined(TSF_INCLUDE_TSF_INTERNALS)
+#define TSF_INCLUDE_TSF_INTERNALS
+
+// Sample storage. Float samples are converted once at load; 16-bit samples
+// are kept as stored in the SoundFont and scaled by the voice gain instead.
+#ifdef TSF_SAMPLES_INT16
+#ifdef STB_VORBIS_INCLUDE_STB_VORBIS_H
+#error "TSF_SAMPLES_INT16 does not support SF3/Vorbis sample data"
+#endif
+typedef short tsf_sample;
+#define TSF_SAMPLE_GAIN (1.0f / 32767.0f)
+#else
+typedef float tsf_sample;
+#define TSF_SAMPLE_GAIN 1.0f
+#endif
+
+// Voice phase. With TSF_FIXED_POINT_PHASE the render loop steps a 32.32
+// fixed-point position (sample index in the high word) instead of a double,
+// so the per-sample advance, loop wrap and end test are integer operations.
+// Voices still store their position as a double between render calls.
+#ifdef TSF_FIXED_POINT_PHASE
+typedef unsigned long long tsf_phase;
+#define TSF_PHASE_ONE 4294967296.0
+#endif
+
+#define TSF_TRUE 1
+#define TSF_FALSE 0
+#define TSF_BOOL unsigned char
+#define TSF_PI 3.14159265358979323846264338327950288
+#define TSF_NULL 0
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+    typedef char           tsf_fourcc[4];
+    typedef signed char    tsf_s8;
+    typedef unsigned char  tsf_u8;
+    typedef unsigned short tsf_u16;
+    typedef signed short   tsf_s16;
+    typedef unsigned int   tsf_u32;
+    typedef char           tsf_char20[20];
+
+    struct tsf
+    {
+        struct tsf_preset*   presets;
+        tsf_sample*          fontSamples;
+        unsigned int         fontSampleNum;
+        struct tsf_voice*    voices;
+        struct tsf_channels* channels;
+
+        int          presetNum;
+        short*       presetLookup; // 129 banks (128 is drums) x 128 programs, -1 when missing
+        int          voiceNum;
+        int          maxVoiceNum;
+        unsigned int voicePlayIndex;
+        tsf_u32*     voiceActive; // one bit per voice, set while it plays
+        int          activeVoiceNum;
+        int          eventOffset; // see tsf_set_event_offset
+
+        enum TSFOutputMode    outputmode;
+        enum TSFInterpolation interpolation;
+        float                 outSampleRate;
+        float                 globalGainDB;
+        int*                  refCount;
+    };
+
+    enum
+    {
+        TSF_LOOPMODE_NONE,
+        TSF_LOOPMODE_CONTINUOUS,
+        TSF_LOOPMODE_SUSTAIN
+    };
+
+    struct tsf_envelope
+    {
+        float delay, attack, hold, decay, sustain, release, keynumToHold,
+            keynumToDecay;
+    };
+    struct tsf_voice_envelope
+    {
+        unsigned char       segment, segmentIsExponential : 1, isAmpEnv : 1;
+        short               midiVelocity;
+        float               level, slope;
+        int                 samplesUntilNextSegment;
+        struct tsf_envelope parameters;
+        // slope^blockSamples for exponential segments, kept while slope and
+        // the block size stay the same
+        float               blockSlope, blockSlopeOf;
+        int                 blockSamples;
+    };
+    struct tsf_voice_lowpass
+    {
+        double   QInv, a0, a1, b1, b2, z1, z2;
+        TSF_BOOL active;
+    };
+    struct tsf_voice_lfo
+    {
+        int   samplesUntil;
+        float level, delta;
+    };
+    struct tsf_modoper
+    {
+        unsigned char index : 7;
+        unsigned char cc : 1;
+        unsigned char d : 1;
+        unsigned char p : 1;
+        unsigned char type : 6;
+    };
+    struct tsf_modulator
+    {
+        union
+        {
+            unsigned int       modSrcOper;
+            struct tsf_modoper modSrcOperDetails;
+        };
+        unsigned int modDestOper;
+        int          modAmount;
+        union
+        {
+            unsigned int       modAmtSrcOper;
+            struct tsf_modoper modAmtSrcOperDetails;
+        };
+        unsigned int modTransOper;
+    };
+
+    struct tsf_region
+    {
+        int                 loop_mode;
+        unsigned int        sample_rate;
+        unsigned char       lokey, hikey, lovel, hivel;
+        unsigned int        group, offset, end, loop_start, loop_end;
+        int                 transpose, tune, pitch_keycenter, pitch_keytrack;
+        float               attenuation, pan;
+        float               chorusSend, reverbSend;
+        struct tsf_envelope ampenv, modenv;
+        int                 initialFilterQ, initialFilterFc;
+        int   modEnvToPitch, modEnvToFilterFc, modLfoToFilterFc, modLfoToVolume;
+        float delayModLFO;
+        int   freqModLFO, modLfoToPitch;
+        float delayVibLFO;
+        int   freqVibLFO, vibLfoToPitch;
+        int   modulatorNum;
+        struct tsf_modulator* modulators;
+    };
+
+    struct tsf_preset
+    {
+        tsf_char20         presetName;
+        tsf_u16            preset, bank;
+        struct tsf_region* regions;
+        int                regionNum;
+        // Regions by key and velocity band: keyIndex[vel] (vel < 128) is the
+        // band of a velocity; keyIndex[128 + key * keyBands + band] up to the
+        // next entry are offsets into keyIndex of the (ascending) numbers of
+        // the regions covering key within the band; NULL to test every region
+        unsigned short* keyIndex;
+        int             keyBands;
+    };
+
+    struct tsf_voice
+    {
+        int   playingPreset, playingKey, playingChannel, heldSustain;
+        short playingVelocity;
+        struct tsf_region*        region;
+        double                    pitchInputTimecents, pitchOutputFactor;
+        double                    pitchBaseRatio; // unmodulated pitch ratio
+        double                    sourceSamplePosition;
+        float                     noteGainDB, panFactorLeft, panFactorRight;
+        float                     chorusSend, reverbSend;
+        int                       initialFilterQ, initialFilterFc;
+        int                       vibLfoToPitch, modLfoToVolume;
+        unsigned int              playIndex, loopStart, loopEnd;
+        // Sample offsets into the next render, 0 if none: start, release and
+        // quick release from timed calls
+        int                       startOffset, endOffset, endQuickOffset;
+        struct tsf_voice_envelope ampenv, modenv;
+        struct tsf_voice_lowpass  lowpass;
+        struct tsf_voice_lfo      modlfo, viblfo;
+    };
+
+#ifdef TSF_SAMPLE_STREAMING
+    // Supplied by the host when samples were left on disk. Returns sample data
+    // for the run of source positions [*first, *first + *count) containing pos,
+    // or NULL when pos is not available yet (the voice plays silence).
+    const tsf_sample* tsf_stream_window(tsf*              f,
+                                        struct tsf_voice* v,
+                                        unsigned int      pos,
+                                        unsigned int*     first,
+                                        unsigned int*     count);
+    // Called when a voice starts a new note from its region's offset.
+    void tsf_stream_voice_start(tsf* f, struct tsf_voice* v);
+#endif
+
+    struct tsf_channel
+    {
+        unsigned short presetIndex, bank, pitchWheel, midiPan, midiVolume,
+            midiExpression, midiRPN, midiData : 14, sustain : 1;
+        unsigned short modWheel, midiQ, midiFc;
+        float          panOffset, gainDB, pitchRange, tuning;
+        float          chorusSend, reverbSend;
+    };
+
+    struct tsf_channels
+    {
+        void (*setupVoice)(tsf* f, struct tsf_voice* voice);
+        int                channelNum, activeChannel;
+        struct tsf_channel channels[1];
+    };
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif //TSF_INCLUDE_TSF_INTERNALS
+
 #ifdef TSF_IMPLEMENTATION
 #undef TSF_IMPLEMENTATION
 
@@ -303,6 +579,23 @@ extern "C"
 #define TSF_RENDER_SHORTBUFFERBLOCK 256
 #endif
 
+// 16-bit samples with a fixed-point phase interpolate in integer math: each
+// output sample is one dual 16-bit multiply-accumulate of the two neighbouring
+// samples with Q14 weights. Define TSF_SMUAD to the target's SMUAD intrinsic
+// (e.g. CMSIS __SMUAD); the portable fallback computes the same result. The
+// 2^14 weight scale is folded into the voice gain.
+#if defined(TSF_SAMPLES_INT16) && defined(TSF_FIXED_POINT_PHASE)
+#define TSF_INTERP_Q14
+#define TSF_RENDER_GAIN (TSF_SAMPLE_GAIN / 16384.0f)
+#define TSF_NEAREST_SCALE 16384.0f
+#ifndef TSF_SMUAD
+#define TSF_SMUAD(x, y) tsf_smuad(x, y)
+#endif
+#else
+#define TSF_RENDER_GAIN TSF_SAMPLE_GAIN
+#define TSF_NEAREST_SCALE 1.0f
+#endif
+
 // Grace release time for quick voice off (avoid clicking noise)
 #define TSF_FASTRELEASETIME 0.01f
 
@@ -313,6 +606,10 @@ extern "C"
 #define TSF_REALLOC realloc
 #endif
 
+#ifndef TSF_LOAD_PHASE
+#define TSF_LOAD_PHASE(phase)
+#endif
+
 #if !defined(TSF_MEMCPY) || !defined(TSF_MEMSET)
 #include <string.h>
 #define TSF_MEMCPY memcpy
@@ -342,47 +639,15 @@ extern "C"
 #include <stdio.h>
 #endif
 
-#define TSF_TRUE 1
-#define TSF_FALSE 0
-#define TSF_BOOL unsigned char
-#define TSF_PI 3.14159265358979323846264338327950288
-#define TSF_NULL 0
-
 #ifdef __cplusplus
 extern "C"
 {
 #endif
 
-    typedef char           tsf_fourcc[4];
-    typedef signed char    tsf_s8;
-    typedef unsigned char  tsf_u8;
-    typedef unsigned short tsf_u16;
-    typedef signed short   tsf_s16;
-    typedef unsigned int   tsf_u32;
-    typedef char           tsf_char20[20];
-
 #define TSF_FourCCEquals(value1, value2)              \
     (value1[0] == value2[0] && value1[1] == value2[1] \
      && value1[2] == value2[2] && value1[3] == value2[3])
 
-    struct tsf
-    {
-        struct tsf_preset*   presets;
-        float*               fontSamples;
-        struct tsf_voice*    voices;
-        struct tsf_channels* channels;
-
-        int          presetNum;
-        int          voiceNum;
-        int          maxVoiceNum;
-        unsigned int voicePlayIndex;
-
-        enum TSFOutputMode outputmode;
-        float              outSampleRate;
-        float              globalGainDB;
-        int*               refCount;
-    };
-
 #ifndef TSF_NO_STDIO
     static int tsf_stream_stdio_read(FILE* f, void* ptr, unsigned int size)
     { return (int)fread(ptr, 1, size, f); }
@@ -394,7 +659,12 @@ extern "C"
         struct tsf_stream stream
             = {TSF_NULL,
                (int (*)(void*, void*, unsigned int))&tsf_stream_stdio_read,
-               (int (*)(void*, unsigned int))&tsf_stream_stdio_skip};
+               (int (*)(void*, unsigned int))&tsf_stream_stdio_skip
+#ifdef TSF_SAMPLE_STREAMING
+               ,
+               TSF_NULL
+#endif
+            };
 #if __STDC_WANT_SECURE_LIB__
         FILE* f = TSF_NULL;
         fopen_s(&f, filename, "rb");
@@ -441,7 +711,12 @@ extern "C"
         struct tsf_stream stream
             = {TSF_NULL,
                (int (*)(void*, void*, unsigned int))&tsf_stream_memory_read,
-               (int (*)(void*, unsigned int))&tsf_stream_memory_skip};
+               (int (*)(void*, unsigned int))&tsf_stream_memory_skip
+#ifdef TSF_SAMPLE_STREAMING
+               ,
+               TSF_NULL
+#endif
+            };
         struct tsf_stream_memory f = {0, 0, 0};
         f.buffer                   = (const char*)buffer;
         f.total                    = size;
@@ -449,13 +724,6 @@ extern "C"
         return tsf_load(&stream);
     }
 
-    enum
-    {
-        TSF_LOOPMODE_NONE,
-        TSF_LOOPMODE_CONTINUOUS,
-        TSF_LOOPMODE_SUSTAIN
-    };
-
     enum
     {
         TSF_SEGMENT_NONE,
@@ -596,115 +864,6 @@ extern "C"
         tsf_fourcc id;
         tsf_u32    size;
     };
-    struct tsf_envelope
-    {
-        float delay, attack, hold, decay, sustain, release, keynumToHold,
-            keynumToDecay;
-    };
-    struct tsf_voice_envelope
-    {
-        unsigned char       segment, segmentIsExponential : 1, isAmpEnv : 1;
-        short               midiVelocity;
-        float               level, slope;
-        int                 samplesUntilNextSegment;
-        struct tsf_envelope parameters;
-    };
-    struct tsf_voice_lowpass
-    {
-        double   QInv, a0, a1, b1, b2, z1, z2;
-        TSF_BOOL active;
-    };
-    struct tsf_voice_lfo
-    {
-        int   samplesUntil;
-        float level, delta;
-    };
-    struct tsf_modoper
-    {
-        unsigned char index : 7;
-        unsigned char cc : 1;
-        unsigned char d : 1;
-        unsigned char p : 1;
-        unsigned char type : 6;
-    };
-    struct tsf_modulator
-    {
-        union
-        {
-            unsigned int       modSrcOper;
-            struct tsf_modoper modSrcOperDetails;
-        };
-        unsigned int modDestOper;
-        int          modAmount;
-        union
-        {
-            unsigned int       modAmtSrcOper;
-            struct tsf_modoper modAmtSrcOperDetails;
-        };
-        unsigned int modTransOper;
-    };
-
-    struct tsf_region
-    {
-        int                 loop_mode;
-        unsigned int        sample_rate;
-        unsigned char       lokey, hikey, lovel, hivel;
-        unsigned int        group, offset, end, loop_start, loop_end;
-        int                 transpose, tune, pitch_keycenter, pitch_keytrack;
-        float               attenuation, pan;
-        float               chorusSend, reverbSend;
-        struct tsf_envelope ampenv, modenv;
-        int                 initialFilterQ, initialFilterFc;
-        int   modEnvToPitch, modEnvToFilterFc, modLfoToFilterFc, modLfoToVolume;
-        float delayModLFO;
-        int   freqModLFO, modLfoToPitch;
-        float delayVibLFO;
-        int   freqVibLFO, vibLfoToPitch;
-        int   modulatorNum;
-        struct tsf_modulator* modulators;
-    };
-
-    struct tsf_preset
-    {
-        tsf_char20         presetName;
-        tsf_u16            preset, bank;
-        struct tsf_region* regions;
-        int                regionNum;
-    };
-
-    struct tsf_voice
-    {
-        int   playingPreset, playingKey, playingChannel, heldSustain;
-        short playingVelocity;
-        struct tsf_region*        region;
-        double                    pitchInputTimecents, pitchOutputFactor;
-        double                    sourceSamplePosition;
-        float                     noteGainDB, panFactorLeft, panFactorRight;
-        float                     chorusSend, reverbSend;
-        int                       initialFilterQ, initialFilterFc;
-        int                       vibLfoToPitch, modLfoToVolume;
-        unsigned int              playIndex, loopStart, loopEnd;
-        struct tsf_voice_envelope ampenv, modenv;
-        struct tsf_voice_lowpass  lowpass;
-        struct tsf_voice_lfo      modlfo, viblfo;
-    };
-
-    struct tsf_channel
-    {
-        unsigned short presetIndex, bank, pitchWheel, midiPan, midiVolume,
-            midiExpression, midiRPN, midiData : 14, sustain : 1;
-        unsigned short modWheel, midiQ, midiFc;
-        float          panOffset, gainDB, pitchRange, tuning;
-        float          chorusSend, reverbSend;
-    };
-
-    struct tsf_channels
-    {
-        void (*setupVoice)(tsf* f, struct tsf_voice* voice);
-        int                channelNum, activeChannel;
-        struct tsf_channel channels[1];
-    };
-
     static double tsf_timecents2Secsd(double timecents)
     { return TSF_POW(2.0, timecents / 1200.0); }
     static float tsf_timecents2Secsf(float timecents)
@@ -716,6 +875,96 @@ extern "C"
     static float tsf_gainToDecibels(float gain)
     { return (gain <= .00001f ? -100.f : (float)(20.0 * TSF_LOG10(gain))); }
 
+#ifdef TSF_CONTROL_TABLES
+    // Shared by all voices and built once. exp2 covers one octave; the whole
+    // octaves go straight into the float exponent. tan(pi * x) covers
+    // x = 0..0.5, but is only used up to TSF_TAN_PI_TABLE_MAX where linear
+    // interpolation still holds (the function diverges towards 0.5).
+#define TSF_EXP2_STEPS 256
+#define TSF_TAN_PI_STEPS 512
+#define TSF_TAN_PI_TABLE_MAX 0.45f
+    static float    tsf_exp2_table[TSF_EXP2_STEPS + 1];
+    static float    tsf_tan_pi_table[TSF_TAN_PI_STEPS + 1];
+    static TSF_BOOL tsf_control_tables_ready;
+
+    static void tsf_control_tables_init(void)
+    {
+        int i;
+        if(tsf_control_tables_ready)
+            return;
+        for(i = 0; i <= TSF_EXP2_STEPS; i++)
+            tsf_exp2_table[i] = TSF_POWF(2.0f, (float)i / TSF_EXP2_STEPS);
+        for(i = 0; i <= TSF_TAN_PI_STEPS; i++)
+            tsf_tan_pi_table[i]
+                = (float)TSF_TAN(TSF_PI * 0.5 * i / TSF_TAN_PI_STEPS);
+        tsf_control_tables_ready = TSF_TRUE;
+    }
+
+    static float tsf_exp2(float x)
+    {
+        union
+        {
+            float   f;
+            tsf_u32 u;
+        } scale;
+        int   octave, i;
+        float pos;
+        if(!(x >= -126.0f && x < 128.0f))
+            return TSF_POWF(2.0f, x);
+        octave = (int)x;
+        if(octave > x)
+            octave--;
+        pos = (x - octave) * TSF_EXP2_STEPS;
+        i   = (int)pos;
+        if(i >= TSF_EXP2_STEPS)
+            i = TSF_EXP2_STEPS - 1;
+        scale.u = (tsf_u32)(octave + 127) << 23;
+        return (tsf_exp2_table[i]
+                + (tsf_exp2_table[i + 1] - tsf_exp2_table[i]) * (pos - i))
+               * scale.f;
+    }
+
+    static double tsf_tan_pi(float x)
+    {
+        float pos;
+        int   i;
+        if(!(x >= 0.0f && x < TSF_TAN_PI_TABLE_MAX))
+            return TSF_TAN(TSF_PI * x);
+        pos = x * (2 * TSF_TAN_PI_STEPS);
+        i   = (int)pos;
+        return tsf_tan_pi_table[i]
+               + (tsf_tan_pi_table[i + 1] - tsf_tan_pi_table[i]) * (pos - i);
+    }
+#endif
+
+    // Per-block conversions in tsf_voice_render; table driven with
+    // TSF_CONTROL_TABLES, otherwise the exact functions above.
+    static double tsf_render_timecents2Secs(double timecents)
+    {
+#ifdef TSF_CONTROL_TABLES
+        return tsf_exp2((float)(timecents * (1.0 / 1200.0)));
+#else
+        return tsf_timecents2Secsd(timecents);
+#endif
+    }
+    static float tsf_render_cents2Hertz(float cents)
+    {
+#ifdef TSF_CONTROL_TABLES
+        return 8.176f * tsf_exp2(cents * (1.0f / 1200.0f));
+#else
+        return tsf_cents2Hertz(cents);
+#endif
+    }
+    static float tsf_render_decibelsToGain(float db)
+    {
+#ifdef TSF_CONTROL_TABLES
+        // 10^(db / 20) == 2^(db * log2(10) / 20)
+        return (db > -100.f ? tsf_exp2(db * 0.166096404744f) : 0);
+#else
+        return tsf_decibelsToGain(db);
+#endif
+    }
+
     static TSF_BOOL tsf_riffchunk_read(struct tsf_riffchunk* parent,
                                        struct tsf_riffchunk* chunk,
                                        struct tsf_stream*    stream)
@@ -1814,7 +2063,7 @@ extern "C"
 #endif
 
     static int tsf_load_samples(void**                pRawBuffer,
-                                float**               pFloatBuffer,
+                                tsf_sample**          pFloatBuffer,
                                 unsigned int*         pSmplCount,
                                 struct tsf_riffchunk* chunkSmpl,
                                 struct tsf_stream*    stream)
@@ -1846,6 +2095,13 @@ extern "C"
             *pFloatBuffer = oldres;
         *pSmplCount = resNum;
         return (*pFloatBuffer ? 1 : 0);
+#elif defined(TSF_SAMPLES_INT16)
+    // Keep the samples exactly as stored
+    (void)pRawBuffer;
+    *pSmplCount   = chunkSmpl->size / (unsigned int)sizeof(short);
+    *pFloatBuffer = (tsf_sample*)TSF_MALLOC(*pSmplCount * sizeof(tsf_sample));
+    return (*pFloatBuffer
+            && stream->read(stream->data, *pFloatBuffer, chunkSmpl->size)) ? 1 : 0;
 #else
     // Inline convert the samples from short to float
     float *      res, *out;
@@ -2022,6 +2278,7 @@ extern "C"
         }
         e->midiVelocity = midiVelocity;
         e->isAmpEnv     = isAmpEnv;
+        e->blockSamples = 0;
         tsf_voice_envelope_nextsegment(e, TSF_SEGMENT_NONE, outSampleRate);
     }
 
@@ -2032,7 +2289,12 @@ extern "C"
         if(e->slope)
         {
             if(e->segmentIsExponential)
-                e->level *= TSF_POWF(e->slope, (float)numSamples);
+            {
+                if(e->slope != e->blockSlopeOf || numSamples != e->blockSamples)
+                    e->blockSlope   = TSF_POWF(e->slope, (float)numSamples),
+                    e->blockSlopeOf = e->slope, e->blockSamples = numSamples;
+                e->level *= e->blockSlope;
+            }
             else
                 e->level += (e->slope * numSamples);
         }
@@ -2040,10 +2302,10 @@ extern "C"
             tsf_voice_envelope_nextsegment(e, e->segment, outSampleRate);
     }
 
-    static void tsf_voice_lowpass_setup(struct tsf_voice_lowpass* e, float Fc)
+    // K = tan(pi * Fc)
+    static void tsf_voice_lowpass_setup_k(struct tsf_voice_lowpass* e, double K)
     {
         // Original TSF low-pass design: cheaper than the current SVF path.
-        double K    = TSF_TAN(TSF_PI * Fc);
         double KK   = K * K;
         double norm = 1.0 / (1.0 + K * e->QInv + KK);
         e->a0       = KK * norm;
@@ -2051,6 +2313,9 @@ extern "C"
         e->b1       = 2.0 * (KK - 1.0) * norm;
         e->b2       = (1.0 - K * e->QInv + KK) * norm;
     }
+
+    static void tsf_voice_lowpass_setup(struct tsf_voice_lowpass* e, float Fc)
+    { tsf_voice_lowpass_setup_k(e, TSF_TAN(TSF_PI * Fc)); }
 
     static float tsf_voice_lowpass_process(struct tsf_voice_lowpass* e,
                                            double                    in)
@@ -2091,11 +2356,109 @@ extern "C"
         }
     }
 
-    static void tsf_voice_kill(struct tsf_voice* v)
-    { v->playingPreset = -1; }
+    // Playing voices are tracked as bits in index order, so note-on, render
+    // and counting skip idle voices yet still pick the lowest free voice and
+    // mix voices in the same order as a scan over f->voices.
+#define TSF_VOICE_WORDS(n) (((n) + 31) >> 5)
+
+    static int tsf_ctz(tsf_u32 x)
+    {
+#if defined(__GNUC__)
+        return __builtin_ctz(x);
+#else
+        int n = 0;
+        for(; !(x & 1); x >>= 1)
+            n++;
+        return n;
+#endif
+    }
+
+    // Next playing voice at index >= *next, or NULL:
+    // for(next = 0; (v = tsf_voice_next_active(f, &next));)
+    static struct tsf_voice* tsf_voice_next_active(tsf* f, int* next)
+    {
+        int     w = *next >> 5, i;
+        tsf_u32 bits;
+        if(*next >= f->voiceNum)
+            return TSF_NULL;
+        bits = f->voiceActive[w] & (0xFFFFFFFFu << (*next & 31));
+        while(!bits)
+        {
+            if(++w >= TSF_VOICE_WORDS(f->voiceNum))
+                return TSF_NULL;
+            bits = f->voiceActive[w];
+        }
+        i     = (w << 5) + tsf_ctz(bits);
+        *next = i + 1;
+        return &f->voices[i];
+    }
+
+    // Lowest idle voice, or NULL
+    static struct tsf_voice* tsf_voice_find_free(tsf* f)
+    {
+        int w, words = TSF_VOICE_WORDS(f->voiceNum);
+        for(w = 0; w < words; w++)
+            if(~f->voiceActive[w])
+            {
+                int i = (w << 5) + tsf_ctz(~f->voiceActive[w]);
+                return (i < f->voiceNum ? &f->voices[i] : TSF_NULL);
+            }
+        return TSF_NULL;
+    }
+
+    static void tsf_voice_activate(tsf* f, struct tsf_voice* v)
+    {
+        int i = (int)(v - f->voices);
+        if(!(f->voiceActive[i >> 5] & (1u << (i & 31))))
+        {
+            f->voiceActive[i >> 5] |= 1u << (i & 31);
+            f->activeVoiceNum++;
+        }
+    }
+
+    static void tsf_voice_kill(tsf* f, struct tsf_voice* v)
+    {
+        int i = (int)(v - f->voices);
+        if(f->voiceActive[i >> 5] & (1u << (i & 31)))
+        {
+            f->voiceActive[i >> 5] &= ~(1u << (i & 31));
+            f->activeVoiceNum--;
+        }
+        v->playingPreset = -1;
+    }
+
+    // Resizes and rebuilds the active bits after f->voices was resized.
+    static int tsf_voice_sync_active(tsf* f)
+    {
+        int      i, words = TSF_VOICE_WORDS(f->voiceNum);
+        tsf_u32* bits = (tsf_u32*)TSF_REALLOC(
+            f->voiceActive, (words ? words : 1) * sizeof(tsf_u32));
+        if(!bits)
+            return 0;
+        f->voiceActive = bits;
+        TSF_MEMSET(bits, 0, (words ? words : 1) * sizeof(tsf_u32));
+        f->activeVoiceNum = 0;
+        for(i = 0; i < f->voiceNum; i++)
+            if(f->voices[i].playingPreset != -1)
+                tsf_voice_activate(f, &f->voices[i]);
+        return 1;
+    }
+
+    // In release, or timed to enter it during the next render
+    static TSF_BOOL tsf_voice_releasing(const struct tsf_voice* v)
+    {
+        return (v->ampenv.segment >= TSF_SEGMENT_RELEASE || v->endOffset
+                || v->endQuickOffset);
+    }
 
     static void tsf_voice_end(tsf* f, struct tsf_voice* v)
     {
+        if(f->eventOffset)
+        {
+            if(!v->endOffset)
+                v->endOffset = f->eventOffset;
+            return;
+        }
         // if maxVoiceNum is set, assume that voice rendering and note queuing are on separate threads
         // so to minimize the chance that voice rendering would advance the segment at the same time
         // we just do it twice here and hope that it sticks
@@ -2116,6 +2479,12 @@ extern "C"
 
     static void tsf_voice_endquick(tsf* f, struct tsf_voice* v)
     {
+        if(f->eventOffset)
+        {
+            if(!v->endQuickOffset)
+                v->endQuickOffset = f->eventOffset;
+            return;
+        }
         // if maxVoiceNum is set, assume that voice rendering and note queuing are on separate threads
         // so to minimize the chance that voice rendering would advance the segment at the same time
         // we just do it twice here and hope that it sticks
@@ -2147,28 +2516,146 @@ extern "C"
             = v->region->sample_rate
               / (tsf_timecents2Secsd(v->region->pitch_keycenter * 100.0)
                  * outSampleRate);
+        // Kept here so voices without pitch modulation skip the pow per block
+        v->pitchBaseRatio
+            = tsf_timecents2Secsd(v->pitchInputTimecents) * v->pitchOutputFactor;
+    }
+
+#ifdef TSF_SAMPLE_STREAMING
+    // Slow path of a sample read: move the voice's window to the run holding pos.
+    static tsf_sample tsf_voice_fetch(tsf*               f,
+                                      struct tsf_voice*  v,
+                                      unsigned int       pos,
+                                      const tsf_sample** window,
+                                      unsigned int*      first,
+                                      unsigned int*      count)
+    {
+        const tsf_sample* w = tsf_stream_window(f, v, pos, first, count);
+        if(!w)
+        {
+            *count = 0;
+            return 0;
+        }
+        *window = w;
+        return w[pos - *first];
+    }
+#endif
+
+#ifdef TSF_INTERP_Q14
+    static int tsf_smuad(tsf_u32 x, tsf_u32 y)
+    {
+        return (tsf_s16)x * (tsf_s16)y
+               + (tsf_s16)(x >> 16) * (tsf_s16)(y >> 16);
+    }
+
+    // Samples p[0] and p[1] packed low/high, as one SMUAD operand.
+    static tsf_u32 tsf_sample_pair(const tsf_sample* p)
+    {
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+        tsf_u32 pair;
+        TSF_MEMCPY(&pair, p, sizeof(pair));
+        return pair;
+#else
+        return (tsf_u16)p[0] | ((tsf_u32)(tsf_u16)p[1] << 16);
+#endif
+    }
+
+    // A sample pair interpolated at a 32-bit phase fraction, scaled by 2^14.
+    // The weights are rounded to Q14: a in [0, 16384].
+    static int tsf_interp_q14(tsf_u32 pair, tsf_u32 frac)
+    {
+        tsf_u32 a = ((frac >> 17) + 1) >> 1;
+        return TSF_SMUAD(pair, (a << 16) | (16384 - a));
+    }
+#endif
+
+    // Adds a rendered block to the output and both send buses in one pass.
+    // Stereo buffers are addressed as L[i * step] / R[i * step], so the same
+    // loop serves interleaved and unweaved output; mono passes outR == NULL.
+    // A NULL send buffer is skipped.
+    static void tsf_voice_mix(const float* in,
+                              int          n,
+                              int          step,
+                              float*       outL,
+                              float*       outR,
+                              float        gainLeft,
+                              float        gainRight,
+                              float*       chL,
+                              float*       chR,
+                              float        chorusSend,
+                              float*       rvL,
+                              float*       rvR,
+                              float        reverbSend)
+    {
+        int i;
+        if(!outR)
+        {
+            for(i = 0; i < n; i++)
+            {
+                float val = in[i];
+                outL[i] += val * gainLeft;
+                if(chL)
+                    chL[i] += val * gainLeft * chorusSend;
+                if(rvL)
+                    rvL[i] += val * gainLeft * reverbSend;
+            }
+            return;
+        }
+        for(i = 0; i < n; i++)
+        {
+            float val = in[i];
+            int   at  = i * step;
+            outL[at] += val * gainLeft;
+            outR[at] += val * gainRight;
+            if(chL)
+            {
+                chL[at] += val * gainLeft * chorusSend;
+                chR[at] += val * gainRight * chorusSend;
+            }
+            if(rvL)
+            {
+                rvL[at] += val * gainLeft * reverbSend;
+                rvR[at] += val * gainRight * reverbSend;
+            }
+        }
     }
 
+    // Renders samples [from, to) of buffers bufferSamples long.
     static void tsf_voice_render(tsf*              f,
                                  struct tsf_voice* v,
                                  float*            outputBuffer,
                                  float*            chorusBuffer,
                                  float*            reverbBuffer,
-                                 int               numSamples)
+                                 int               bufferSamples,
+                                 int               from,
+                                 int               to)
     {
-        struct tsf_region* region = v->region;
-        float*             input  = f->fontSamples;
-        float*             outL   = outputBuffer;
-        float* outR = (f->outputmode == TSF_STEREO_UNWEAVED ? outL + numSamples
-                                                            : TSF_NULL);
+        struct tsf_region* region     = v->region;
+        int                numSamples = to - from;
+        const tsf_sample*  input      = f->fontSamples;
+#ifdef TSF_SAMPLE_STREAMING
+        unsigned int inputFirst = 0, inputCount = (input ? f->fontSampleNum : 0);
+#define TSF_INPUT(p)                                                       \
+    ((p) - inputFirst < inputCount                                        \
+         ? input[(p) - inputFirst]                                        \
+         : tsf_voice_fetch(f, v, (p), &input, &inputFirst, &inputCount))
+#else
+#define TSF_INPUT(p) input[p]
+#endif
+        // Interleaved channels sit one float apart, unweaved ones the whole
+        // buffer apart; see tsf_voice_mix. Only [from, to) of it is rendered.
+        int    step = (f->outputmode == TSF_STEREO_INTERLEAVED ? 2 : 1);
+        int    apart
+            = (f->outputmode == TSF_STEREO_INTERLEAVED ? 1
+               : f->outputmode == TSF_STEREO_UNWEAVED  ? bufferSamples
+                                                       : 0);
+        float* outL   = outputBuffer;
+        float* outR   = (apart ? outL + apart : TSF_NULL);
         float* outChL = chorusBuffer;
-        float* outChR = (chorusBuffer && f->outputmode == TSF_STEREO_UNWEAVED
-                             ? outChL + numSamples
-                             : TSF_NULL);
+        float* outChR = (chorusBuffer && apart ? outChL + apart : TSF_NULL);
         float* outRvL = reverbBuffer;
-        float* outRvR = (reverbBuffer && f->outputmode == TSF_STEREO_UNWEAVED
-                             ? outRvL + numSamples
-                             : TSF_NULL);
+        float* outRvR = (reverbBuffer && apart ? outRvL + apart : TSF_NULL);
+        float  tmpBlock[TSF_RENDER_EFFECTSAMPLEBLOCK];
         float  chorusSend            = v->chorusSend;
         float  reverbSend            = v->reverbSend;
         float  renderGainDB          = v->noteGainDB;
@@ -2231,10 +2718,43 @@ extern "C"
         TSF_BOOL     updateVibLFO = (v->viblfo.delta && renderVibLfoToPitch);
         TSF_BOOL     isLooping    = (v->loopStart < v->loopEnd);
         unsigned int tmpLoopStart = v->loopStart, tmpLoopEnd = v->loopEnd;
-        double                   tmpSampleEndDbl         = (double)region->end,
-                                 tmpLoopEndDbl           = (double)tmpLoopEnd + 1.0;
-        double                   tmpSourceSamplePosition = v->sourceSamplePosition;
-        struct tsf_voice_lowpass tmpLowpass              = v->lowpass;
+#ifdef TSF_FIXED_POINT_PHASE
+        unsigned int tmpSampleEnd = region->end, tmpLoopEndNext = tmpLoopEnd + 1;
+        tsf_phase    tmpLoopLength
+            = (tsf_phase)(tmpLoopEnd - tmpLoopStart + 1) << 32;
+        tsf_phase tmpPhase
+            = (tsf_phase)(v->sourceSamplePosition * TSF_PHASE_ONE),
+            tmpPhaseInc = 0;
+#define TSF_PHASE_PLAYING() ((unsigned int)(tmpPhase >> 32) < tmpSampleEnd)
+#define TSF_PHASE_POS() ((unsigned int)(tmpPhase >> 32))
+#define TSF_PHASE_ALPHA(pos) \
+    ((float)(unsigned int)tmpPhase * (float)(1.0 / TSF_PHASE_ONE))
+#define TSF_PHASE_SET_RATIO(ratio) \
+    (tmpPhaseInc = (tsf_phase)((ratio) * TSF_PHASE_ONE + 0.5))
+#define TSF_PHASE_ADVANCE()                                                \
+    do                                                                    \
+    {                                                                     \
+        tmpPhase += tmpPhaseInc;                                          \
+        if((unsigned int)(tmpPhase >> 32) >= tmpLoopEndNext && isLooping) \
+            tmpPhase -= tmpLoopLength;                                    \
+    } while(0)
+#else
+        double tmpSampleEndDbl = (double)region->end,
+               tmpLoopEndDbl   = (double)tmpLoopEnd + 1.0;
+        double tmpSourceSamplePosition = v->sourceSamplePosition;
+#define TSF_PHASE_PLAYING() (tmpSourceSamplePosition < tmpSampleEndDbl)
+#define TSF_PHASE_POS() ((unsigned int)tmpSourceSamplePosition)
+#define TSF_PHASE_ALPHA(pos) ((float)(tmpSourceSamplePosition - (pos)))
+#define TSF_PHASE_SET_RATIO(ratio) ((void)0)
+#define TSF_PHASE_ADVANCE()                                               \
+    do                                                                   \
+    {                                                                    \
+        tmpSourceSamplePosition += pitchRatio;                           \
+        if(tmpSourceSamplePosition >= tmpLoopEndDbl && isLooping)        \
+            tmpSourceSamplePosition -= (tmpLoopEnd - tmpLoopStart + 1.0); \
+    } while(0)
+#endif
+        struct tsf_voice_lowpass tmpLowpass = v->lowpass;
 
         TSF_BOOL dynamicLowpass
             = (region->modLfoToFilterFc || region->modEnvToFilterFc
@@ -2264,18 +2784,31 @@ extern "C"
             tmpVibLfoToPitch = (float)renderVibLfoToPitch,
             tmpModEnvToPitch = (float)region->modEnvToPitch;
         else
-            pitchRatio       = tsf_timecents2Secsd(v->pitchInputTimecents)
-                               * v->pitchOutputFactor,
-            tmpModLfoToPitch = 0, tmpVibLfoToPitch = 0, tmpModEnvToPitch = 0;
+            pitchRatio       = v->pitchBaseRatio,
+            tmpModLfoToPitch = 0, tmpVibLfoToPitch = 0, tmpModEnvToPitch = 0,
+            TSF_PHASE_SET_RATIO(pitchRatio);
 
         if(dynamicGain)
             tmpModLfoToVolume = (float)renderModLfoToVolume * 0.1f;
         else
-            noteGain = tsf_decibelsToGain(renderGainDB), tmpModLfoToVolume = 0;
+            noteGain = tsf_render_decibelsToGain(renderGainDB), tmpModLfoToVolume = 0;
+
+        outL += from * step;
+        if(outR)
+            outR += from * step;
+        if(outChL)
+            outChL += from * step;
+        if(outChR)
+            outChR += from * step;
+        if(outRvL)
+            outRvL += from * step;
+        if(outRvR)
+            outRvR += from * step;
 
         while(numSamples)
         {
             float gainMono, gainLeft, gainRight;
+            int   rendered, i;
             int   blockSamples = (numSamples > TSF_RENDER_EFFECTSAMPLEBLOCK
                                       ? TSF_RENDER_EFFECTSAMPLEBLOCK
                                       : numSamples);
@@ -2286,26 +2819,33 @@ extern "C"
                 float fres      = tmpInitialFilterFc
                                   + v->modlfo.level * tmpModLfoToFilterFc
                                   + v->modenv.level * tmpModEnvToFilterFc;
-                float lowpassFc = (fres <= 13500 ? tsf_cents2Hertz(fres) / tmpSampleRate
+                float lowpassFc = (fres <= 13500 ? tsf_render_cents2Hertz(fres) / tmpSampleRate
                                                  : 1.0f);
                 tmpLowpass.active = (lowpassFc < 0.499f);
                 if(tmpLowpass.active)
+#ifdef TSF_CONTROL_TABLES
+                    tsf_voice_lowpass_setup_k(&tmpLowpass, tsf_tan_pi(lowpassFc));
+#else
                     tsf_voice_lowpass_setup(&tmpLowpass, lowpassFc);
+#endif
             }
 
             if(dynamicPitchRatio)
-                pitchRatio = tsf_timecents2Secsd(
+            {
+                pitchRatio = tsf_render_timecents2Secs(
                                  v->pitchInputTimecents
                                  + (v->modlfo.level * tmpModLfoToPitch
                                     + v->viblfo.level * tmpVibLfoToPitch
                                     + v->modenv.level * tmpModEnvToPitch))
                              * v->pitchOutputFactor;
+                TSF_PHASE_SET_RATIO(pitchRatio);
+            }
 
             if(dynamicGain)
-                noteGain = tsf_decibelsToGain(
+                noteGain = tsf_render_decibelsToGain(
                     renderGainDB + (v->modlfo.level * tmpModLfoToVolume));
 
-            gainMono = noteGain * v->ampenv.level;
+            gainMono = noteGain * v->ampenv.level * TSF_RENDER_GAIN;
 
             // Update EG.
             tsf_voice_envelope_process(&v->ampenv, blockSamples, tmpSampleRate);
@@ -2319,185 +2859,312 @@ extern "C"
             if(updateVibLFO)
                 tsf_voice_lfo_process(&v->viblfo, blockSamples);
 
-            switch(f->outputmode)
-            {
-                case TSF_STEREO_INTERLEAVED:
-                    gainLeft  = gainMono * v->panFactorLeft,
-                    gainRight = gainMono * v->panFactorRight;
-                    while(blockSamples--
-                          && tmpSourceSamplePosition < tmpSampleEndDbl)
-                    {
-                        unsigned int pos
-                            = (unsigned int)tmpSourceSamplePosition,
-                            nextPos
-                            = (pos >= tmpLoopEnd && isLooping ? tmpLoopStart
-                                                              : pos + 1);
-
-                        // Simple linear interpolation.
-                        float alpha = (float)(tmpSourceSamplePosition - pos),
-                              val   = (input[pos] * (1.0f - alpha)
-                                       + input[nextPos] * alpha);
-
-                        // Low-pass filter.
-                        if(tmpLowpass.active)
-                            val = tsf_voice_lowpass_process(&tmpLowpass, val);
-
-                        *outL++ += val * gainLeft;
-                        *outL++ += val * gainRight;
-                        if(outChL)
-                        {
-                            if(doChorus)
-                            {
-                                *outChL += val * gainLeft * chorusSend;
-                            }
-                            outChL++;
-                            if(doChorus)
-                            {
-                                *outChL += val * gainRight * chorusSend;
-                            }
-                            outChL++;
-                        }
-                        if(outRvL)
-                        {
-                            if(doReverb)
-                            {
-                                *outRvL += val * gainLeft * reverbSend;
-                            }
-                            outRvL++;
-                            if(doReverb)
-                            {
-                                *outRvL += val * gainRight * reverbSend;
-                            }
-                            outRvL++;
-                        }
-
-                        // Next sample.
-                        tmpSourceSamplePosition += pitchRatio;
-                        if(tmpSourceSamplePosition >= tmpLoopEndDbl
-                           && isLooping)
-                            tmpSourceSamplePosition
-                                -= (tmpLoopEnd - tmpLoopStart + 1.0);
-                    }
-                    break;
-
-                case TSF_STEREO_UNWEAVED:
-                    gainLeft  = gainMono * v->panFactorLeft,
-                    gainRight = gainMono * v->panFactorRight;
-                    while(blockSamples--
-                          && tmpSourceSamplePosition < tmpSampleEndDbl)
+            // Gather: interpolate the block's source samples, stopping at the
+            // end of the sample.
+            if(f->interpolation == TSF_INTERPOLATION_NONE)
+                for(rendered = 0;
+                    rendered < blockSamples && TSF_PHASE_PLAYING();
+                    rendered++)
+                {
+                    tmpBlock[rendered]
+                        = TSF_INPUT(TSF_PHASE_POS()) * TSF_NEAREST_SCALE;
+                    TSF_PHASE_ADVANCE();
+                }
+            else
+                for(rendered = 0;
+                    rendered < blockSamples && TSF_PHASE_PLAYING();
+                    rendered++)
+                {
+                    unsigned int pos     = TSF_PHASE_POS(),
+                                 nextPos = (pos >= tmpLoopEnd && isLooping
+                                                ? tmpLoopStart
+                                                : pos + 1);
+#ifdef TSF_INTERP_Q14
+                    tsf_u32 pair;
+#ifdef TSF_SAMPLE_STREAMING
+                    if(nextPos == pos + 1 && pos - inputFirst < inputCount
+                       && nextPos - inputFirst < inputCount)
+                        pair = tsf_sample_pair(input + (pos - inputFirst));
+#else
+                    if(nextPos == pos + 1)
+                        pair = tsf_sample_pair(input + pos);
+#endif
+                    else
                     {
-                        unsigned int pos
-                            = (unsigned int)tmpSourceSamplePosition,
-                            nextPos
-                            = (pos >= tmpLoopEnd && isLooping ? tmpLoopStart
-                                                              : pos + 1);
-
-                        // Simple linear interpolation.
-                        float alpha = (float)(tmpSourceSamplePosition - pos),
-                              val   = (input[pos] * (1.0f - alpha)
-                                       + input[nextPos] * alpha);
-
-                        // Low-pass filter.
-                        if(tmpLowpass.active)
-                            val = tsf_voice_lowpass_process(&tmpLowpass, val);
-
-                        *outL++ += val * gainLeft;
-                        *outR++ += val * gainRight;
-                        if(outChL)
-                        {
-                            if(doChorus)
-                            {
-                                *outChL += val * gainLeft * chorusSend;
-                            }
-                            outChL++;
-                            if(doChorus)
-                            {
-                                *outChR += val * gainRight * chorusSend;
-                            }
-                            outChR++;
-                        }
-                        if(outRvL)
-                        {
-                            if(doReverb)
-                            {
-                                *outRvL += val * gainLeft * reverbSend;
-                            }
-                            outRvL++;
-                            if(doReverb)
-                            {
-                                *outRvR += val * gainRight * reverbSend;
-                            }
-                            outRvR++;
-                        }
-
-                        // Next sample.
-                        tmpSourceSamplePosition += pitchRatio;
-                        if(tmpSourceSamplePosition >= tmpLoopEndDbl
-                           && isLooping)
-                            tmpSourceSamplePosition
-                                -= (tmpLoopEnd - tmpLoopStart + 1.0);
+                        tsf_sample s0 = TSF_INPUT(pos);
+                        pair          = (tsf_u16)s0
+                               | ((tsf_u32)(tsf_u16)TSF_INPUT(nextPos) << 16);
                     }
-                    break;
-
-                case TSF_MONO:
-                    while(blockSamples--
-                          && tmpSourceSamplePosition < tmpSampleEndDbl)
-                    {
-                        unsigned int pos
-                            = (unsigned int)tmpSourceSamplePosition,
-                            nextPos
-                            = (pos >= tmpLoopEnd && isLooping ? tmpLoopStart
-                                                              : pos + 1);
-
-                        // Simple linear interpolation.
-                        float alpha = (float)(tmpSourceSamplePosition - pos),
-                              val   = (input[pos] * (1.0f - alpha)
-                                       + input[nextPos] * alpha);
-
-                        // Low-pass filter.
-                        if(tmpLowpass.active)
-                            val = tsf_voice_lowpass_process(&tmpLowpass, val);
-
-                        *outL++ += val * gainMono;
-                        if(outChL)
-                        {
-                            if(doChorus)
-                            {
-                                *outChL += val * gainMono * chorusSend;
-                            }
-                            outChL++;
-                        }
-                        if(outRvL)
-                        {
-                            if(doReverb)
-                            {
-                                *outRvL += val * gainMono * reverbSend;
-                            }
-                            outRvL++;
-                        }
+                    tmpBlock[rendered]
+                        = (float)tsf_interp_q14(pair, (tsf_u32)tmpPhase);
+#else
+                    // Simple linear interpolation.
+                    float alpha        = TSF_PHASE_ALPHA(pos);
+                    tmpBlock[rendered] = (TSF_INPUT(pos) * (1.0f - alpha)
+                                          + TSF_INPUT(nextPos) * alpha);
+#endif
+                    TSF_PHASE_ADVANCE();
+                }
 
-                        // Next sample.
-                        tmpSourceSamplePosition += pitchRatio;
-                        if(tmpSourceSamplePosition >= tmpLoopEndDbl
-                           && isLooping)
-                            tmpSourceSamplePosition
-                                -= (tmpLoopEnd - tmpLoopStart + 1.0);
-                    }
-                    break;
-            }
+            // Low-pass filter.
+            if(tmpLowpass.active)
+                for(i = 0; i < rendered; i++)
+                    tmpBlock[i]
+                        = tsf_voice_lowpass_process(&tmpLowpass, tmpBlock[i]);
 
-            if(tmpSourceSamplePosition >= tmpSampleEndDbl
-               || v->ampenv.segment == TSF_SEGMENT_DONE)
+            // Mix into the output and sends.
+            if(outR)
+                gainLeft  = gainMono * v->panFactorLeft,
+                gainRight = gainMono * v->panFactorRight;
+            else
+                gainLeft = gainRight = gainMono;
+            tsf_voice_mix(tmpBlock,
+                          rendered,
+                          step,
+                          outL,
+                          outR,
+                          gainLeft,
+                          gainRight,
+                          (doChorus ? outChL : TSF_NULL),
+                          outChR,
+                          chorusSend,
+                          (doReverb ? outRvL : TSF_NULL),
+                          outRvR,
+                          reverbSend);
+            outL += rendered * step;
+            if(outR)
+                outR += rendered * step;
+            if(outChL)
+                outChL += rendered * step;
+            if(outChR)
+                outChR += rendered * step;
+            if(outRvL)
+                outRvL += rendered * step;
+            if(outRvR)
+                outRvR += rendered * step;
+
+            if(!TSF_PHASE_PLAYING() || v->ampenv.segment == TSF_SEGMENT_DONE)
             {
-                tsf_voice_kill(v);
+                tsf_voice_kill(f, v);
                 return;
             }
         }
 
+#ifdef TSF_FIXED_POINT_PHASE
+        v->sourceSamplePosition
+            = (double)(tmpPhase >> 32)
+              + (double)(unsigned int)tmpPhase * (1.0 / TSF_PHASE_ONE);
+#else
         v->sourceSamplePosition = tmpSourceSamplePosition;
+#endif
+#undef TSF_INPUT
+#undef TSF_PHASE_PLAYING
+#undef TSF_PHASE_POS
+#undef TSF_PHASE_ALPHA
+#undef TSF_PHASE_SET_RATIO
+#undef TSF_PHASE_ADVANCE
         v->lowpass = tmpLowpass;
+    }
+
+    // Renders the voice over numSamples, starting and ending it at the
+    // offsets timed calls left on it.
+    static void tsf_voice_render_timed(tsf*              f,
+                                       struct tsf_voice* v,
+                                       float*            outputBuffer,
+                                       float*            chorusBuffer,
+                                       float*            reverbBuffer,
+                                       int               numSamples)
+    {
+        int from = (v->startOffset < numSamples ? v->startOffset : numSamples);
+        v->startOffset = 0;
+        while(v->endOffset || v->endQuickOffset)
+        {
+            TSF_BOOL quick = (v->endQuickOffset
+                              && (!v->endOffset
+                                  || v->endQuickOffset <= v->endOffset));
+            int      at    = (quick ? v->endQuickOffset : v->endOffset);
+            if(at > numSamples)
+                at = numSamples;
+            if(quick)
+                v->endQuickOffset = 0;
+            else
+                v->endOffset = 0;
+            if(at > from)
+            {
+                tsf_voice_render(f,
+                                 v,
+                                 outputBuffer,
+                                 chorusBuffer,
+                                 reverbBuffer,
+                                 numSamples,
+                                 from,
+                                 at);
+                from = at;
+            }
+            if(v->playingPreset == -1)
+                return;
+            if(quick)
+                tsf_voice_endquick(f, v);
+            else
+                tsf_voice_end(f, v);
+        }
+        if(from < numSamples)
+            tsf_voice_render(f,
+                             v,
+                             outputBuffer,
+                             chorusBuffer,
+                             reverbBuffer,
+                             numSamples,
+                             from,
+                             numSamples);
     }
 
+    // Dense bank/program table for tsf_get_presetindex, which falls back to a search
+    // when it could not be allocated. Presets are sorted, so the first match wins as before.
+    static void tsf_build_presetlookup(tsf* f)
+    {
+        int i;
+        f->presetLookup = (short*)TSF_MALLOC(129 * 128 * sizeof(short));
+        if(!f->presetLookup)
+            return;
+        for(i = 0; i != 129 * 128; i++)
+            f->presetLookup[i] = -1;
+        for(i = f->presetNum - 1; i >= 0; i--)
+        {
+            const struct tsf_preset* p = &f->presets[i];
+            if(p->bank <= 128 && p->preset < 128)
+                f->presetLookup[p->bank * 128 + p->preset] = (short)i;
+        }
+    }
+
+    // Regions a preset's key index lists for a note, or TSF_NULL with every
+    // region for a preset without one. Velocities outside 0..127 match no
+    // region with the usual ranges, but are left to the full test.
+    static int tsf_preset_candidates(const struct tsf_preset* preset,
+                                     int                      key,
+                                     int                      midiVelocity,
+                                     const unsigned short**   candidates)
+    {
+        const unsigned short* slot;
+        *candidates = TSF_NULL;
+        if(!preset->keyIndex || key < 0 || key > 127 || midiVelocity < 0
+           || midiVelocity > 127)
+            return preset->regionNum;
+        slot = preset->keyIndex + 128 + key * preset->keyBands
+               + preset->keyIndex[midiVelocity];
+        *candidates = preset->keyIndex + slot[0];
+        return slot[1] - slot[0];
+    }
+
+    // Can match a key and velocity in 0..127
+    static TSF_BOOL tsf_region_indexed(const struct tsf_region* region)
+    {
+        return region->lokey <= region->hikey && region->lokey < 128
+               && region->lovel <= region->hivel && region->lovel < 128;
+    }
+
+    // Lays out a preset's key index with velocity bands starting where
+    // edges[vel] is set, or returns 0 if its lists would not fit 16-bit
+    // offsets or the allocation fails.
+    static int tsf_build_keyindex_bands(struct tsf_preset*   preset,
+                                        const unsigned char* edges)
+    {
+        unsigned char   bandOf[128];
+        unsigned short* index;
+        unsigned int    bands = 0, slots, total, at, count;
+        int             v, r, key, band, hikey, hiband;
+        for(v = 0; v != 128; v++)
+            bandOf[v] = (unsigned char)((bands += edges[v]) - 1);
+        slots = 128 * bands;
+        total = 128 + slots + 1;
+        for(r = 0; r != preset->regionNum; r++)
+            if(tsf_region_indexed(&preset->regions[r]))
+            {
+                const struct tsf_region* region = &preset->regions[r];
+                total += ((region->hikey < 128 ? region->hikey : 127) - region->lokey + 1)
+                         * (bandOf[region->hivel < 128 ? region->hivel : 127]
+                            - bandOf[region->lovel] + 1);
+            }
+        if(total > 0xFFFF)
+            return 0;
+        index = (unsigned short*)TSF_MALLOC(total * sizeof(unsigned short));
+        if(!index)
+            return 0;
+        for(v = 0; v != 128; v++)
+            index[v] = bandOf[v];
+
+        // Count per slot, then turn the counts into offsets
+        TSF_MEMSET(index + 128, 0, (slots + 1) * sizeof(unsigned short));
+        for(r = 0; r != preset->regionNum; r++)
+            if(tsf_region_indexed(&preset->regions[r]))
+            {
+                const struct tsf_region* region = &preset->regions[r];
+                hikey  = (region->hikey < 128 ? region->hikey : 127);
+                hiband = bandOf[region->hivel < 128 ? region->hivel : 127];
+                for(key = region->lokey; key <= hikey; key++)
+                    for(band = bandOf[region->lovel]; band <= hiband; band++)
+                        index[128 + key * bands + band]++;
+            }
+        for(at = 128 + slots + 1, v = 0; v != (int)slots; v++)
+        {
+            count          = index[128 + v];
+            index[128 + v] = (unsigned short)at;
+            at += count;
+        }
+        index[128 + slots] = (unsigned short)at;
+
+        // Fill in region order with each slot's offset as its cursor. The
+        // cursors end on the next slot's start, so shift them back after.
+        for(r = 0; r != preset->regionNum; r++)
+            if(tsf_region_indexed(&preset->regions[r]))
+            {
+                const struct tsf_region* region = &preset->regions[r];
+                hikey  = (region->hikey < 128 ? region->hikey : 127);
+                hiband = bandOf[region->hivel < 128 ? region->hivel : 127];
+                for(key = region->lokey; key <= hikey; key++)
+                    for(band = bandOf[region->lovel]; band <= hiband; band++)
+                        index[index[128 + key * bands + band]++] = (unsigned short)r;
+            }
+        for(v = (int)slots - 1; v > 0; v--)
+            index[128 + v] = index[128 + v - 1];
+        index[128] = (unsigned short)(128 + slots + 1);
+
+        preset->keyIndex = index;
+        preset->keyBands = (int)bands;
+        return 1;
+    }
+
+    // Per preset key index for tsf_note_on. Velocity layers get lists of
+    // their own: bands start at every region's lovel and after its hivel, so
+    // a layered piano or kit leaves one or two candidates per note. Presets
+    // whose split lists would not fit 16-bit offsets index keys only; those
+    // that still do not fit, or fail to allocate, go without.
+    static void tsf_build_keyindex(tsf* f)
+    {
+        struct tsf_preset *preset, *presetEnd;
+        for(preset = f->presets, presetEnd = preset + f->presetNum; preset != presetEnd; preset++)
+        {
+            unsigned char edges[128];
+            int           r;
+            preset->keyIndex = TSF_NULL;
+            preset->keyBands = 0;
+            TSF_MEMSET(edges, 0, sizeof(edges));
+            edges[0] = 1;
+            for(r = 0; r != preset->regionNum; r++)
+                if(tsf_region_indexed(&preset->regions[r]))
+                {
+                    edges[preset->regions[r].lovel] = 1;
+                    if(preset->regions[r].hivel < 127)
+                        edges[preset->regions[r].hivel + 1] = 1;
+                }
+            if(tsf_build_keyindex_bands(preset, edges))
+                continue;
+            TSF_MEMSET(edges, 0, sizeof(edges));
+            edges[0] = 1;
+            tsf_build_keyindex_bands(preset, edges);
+        }
+    }
+
     TSFDEF tsf* tsf_load(struct tsf_stream* stream)
     {
         tsf*                 res = TSF_NULL;
@@ -2505,8 +3172,9 @@ extern "C"
         struct tsf_riffchunk chunkList;
         struct tsf_hydra     hydra;
         void*                rawBuffer   = TSF_NULL;
-        float*               floatBuffer = TSF_NULL;
+        tsf_sample*          floatBuffer = TSF_NULL;
         tsf_u32              smplCount   = 0;
+        TSF_BOOL             smplOnDisk  = TSF_FALSE;
 
         if(!tsf_riffchunk_read(TSF_NULL, &chunkHead, stream)
            || !TSF_FourCCEquals(chunkHead.id, "sfbk"))
@@ -2560,20 +3228,35 @@ extern "C"
             {
                 while(tsf_riffchunk_read(&chunkList, &chunk, stream))
                 {
+#ifdef TSF_SAMPLE_STREAMING
+                    if(TSF_FourCCEquals(chunk.id, "smpl") && !floatBuffer
+                       && !smplOnDisk && chunk.size >= sizeof(short)
+                       && stream->skip_samples
+                       && stream->skip_samples(stream->data, chunk.size))
+                    {
+                        smplCount  = chunk.size / (unsigned int)sizeof(short);
+                        smplOnDisk = TSF_TRUE;
+                        if(!stream->skip(stream->data, chunk.size))
+                            goto out_of_memory;
+                    }
+                    else
+#endif
                     if((TSF_FourCCEquals(chunk.id, "smpl")
 #ifdef STB_VORBIS_INCLUDE_STB_VORBIS_H
                         || TSF_FourCCEquals(chunk.id, "smpo")
 #endif
                             )
-                       && !rawBuffer && !floatBuffer
+                       && !rawBuffer && !floatBuffer && !smplOnDisk
                        && chunk.size >= sizeof(short))
                     {
+                        TSF_LOAD_PHASE(TSF_LOAD_SAMPLES);
                         if(!tsf_load_samples(&rawBuffer,
                                              &floatBuffer,
                                              &smplCount,
                                              &chunk,
                                              stream))
                             goto out_of_memory;
+                        TSF_LOAD_PHASE(TSF_LOAD_CHUNKS);
                     }
                     else
                         stream->skip(stream->data, chunk.size);
@@ -2588,7 +3271,7 @@ extern "C"
         {
             //if (e) *e = TSF_INVALID_INCOMPLETE;
         }
-        else if(!rawBuffer && !floatBuffer)
+        else if(!rawBuffer && !floatBuffer && !smplOnDisk)
         {
             //if (e) *e = TSF_INVALID_NOSAMPLEDATA;
         }
@@ -2603,10 +3286,17 @@ extern "C"
             res = (tsf*)TSF_MALLOC(sizeof(tsf));
             if(res)
                 TSF_MEMSET(res, 0, sizeof(tsf));
+            TSF_LOAD_PHASE(TSF_LOAD_PRESETS);
             if(!res || !tsf_load_presets(res, &hydra, smplCount))
                 goto out_of_memory;
+            tsf_build_presetlookup(res);
+            tsf_build_keyindex(res);
             res->outSampleRate = 44100.0f;
+#ifdef TSF_CONTROL_TABLES
+            tsf_control_tables_init();
+#endif
             res->fontSamples   = floatBuffer;
+            res->fontSampleNum = smplCount;
             floatBuffer        = TSF_NULL; // don't free below
         }
         if(0)
@@ -2646,9 +3336,11 @@ extern "C"
         if(!res)
             return TSF_NULL;
         TSF_MEMCPY(res, f, sizeof(tsf));
-        res->voices   = TSF_NULL;
-        res->voiceNum = 0;
-        res->channels = TSF_NULL;
+        res->voices         = TSF_NULL;
+        res->voiceNum       = 0;
+        res->voiceActive    = TSF_NULL;
+        res->activeVoiceNum = 0;
+        res->channels       = TSF_NULL;
         (*res->refCount)++;
         return res;
     }
@@ -2668,23 +3360,26 @@ extern "C"
                     if(preset->regions[r].modulators)
                         TSF_FREE(preset->regions[r].modulators);
                 TSF_FREE(preset->regions);
+                TSF_FREE(preset->keyIndex);
             }
             TSF_FREE(f->presets);
+            TSF_FREE(f->presetLookup);
             TSF_FREE(f->fontSamples);
             TSF_FREE(f->refCount);
         }
         TSF_FREE(f->channels);
         TSF_FREE(f->voices);
+        TSF_FREE(f->voiceActive);
         TSF_FREE(f);
     }
 
     TSFDEF void tsf_reset(tsf* f)
     {
-        struct tsf_voice *v = f->voices, *vEnd = v + f->voiceNum;
-        for(; v != vEnd; v++)
-            if(v->playingPreset != -1
-               && (v->ampenv.segment < TSF_SEGMENT_RELEASE
-                   || v->ampenv.parameters.release))
+        struct tsf_voice* v;
+        int               next;
+        for(next = 0; (v = tsf_voice_next_active(f, &next));)
+            if(v->ampenv.segment < TSF_SEGMENT_RELEASE
+               || v->ampenv.parameters.release)
                 tsf_voice_endquick(f, v);
         if(f->channels)
         {
@@ -2697,12 +3392,38 @@ extern "C"
     {
         const struct tsf_preset* presets;
         int                      i, iMax;
+        if(f->presetLookup && bank >= 0 && bank <= 128 && preset_number >= 0
+           && preset_number < 128)
+            return f->presetLookup[bank * 128 + preset_number];
         for(presets = f->presets, i = 0, iMax = f->presetNum; i < iMax; i++)
             if(presets[i].preset == preset_number && presets[i].bank == bank)
                 return i;
         return -1;
     }
 
+    TSFDEF int tsf_get_presetindex_fallback(const tsf* f,
+                                            int        bank,
+                                            int        preset_number,
+                                            int        flag_mididrums)
+    {
+        int preset_index = -1;
+        if(flag_mididrums)
+        {
+            preset_index = tsf_get_presetindex(f, 128 | bank, preset_number);
+            if(preset_index == -1)
+                preset_index = tsf_get_presetindex(f, 128, preset_number);
+            if(preset_index == -1)
+                preset_index = tsf_get_presetindex(f, 128, 0);
+        }
+        if(preset_index == -1)
+            preset_index = tsf_get_presetindex(f, bank, preset_number);
+        if(preset_index == -1)
+            preset_index = tsf_get_presetindex(f, 0, preset_number);
+        if(preset_index == -1 && f->presetNum > 0)
+            preset_index = 0;
+        return preset_index;
+    }
+
     TSFDEF int tsf_get_presetcount(const tsf* f)
     { return f->presetNum; }
 
@@ -2728,6 +3449,9 @@ extern "C"
         f->outputmode    = outputmode;
         f->outSampleRate = (float)(samplerate >= 1 ? samplerate : 44100.0f);
         f->globalGainDB  = global_gain_db;
+#ifdef TSF_CONTROL_TABLES
+        tsf_control_tables_init();
+#endif
     }
 
     TSFDEF void tsf_set_volume(tsf* f, float global_volume)
@@ -2737,6 +3461,10 @@ extern "C"
                                : -tsf_gainToDecibels(1.0f / global_volume));
     }
 
+    TSFDEF void tsf_set_interpolation(tsf*                  f,
+                                      enum TSFInterpolation interpolation)
+    { f->interpolation = interpolation; }
+
     TSFDEF int tsf_set_max_voices(tsf* f, int max_voices)
     {
         int               i           = f->voiceNum;
@@ -2749,14 +3477,17 @@ extern "C"
         f->voiceNum = f->maxVoiceNum = newVoiceNum;
         for(; i < max_voices; i++)
             f->voices[i].playingPreset = -1;
-        return 1;
+        return tsf_voice_sync_active(f);
     }
 
     TSFDEF int tsf_note_on(tsf* f, int preset_index, int key, float vel)
     {
-        short              midiVelocity = (short)(vel * 127);
-        unsigned int       voicePlayIndex;
-        struct tsf_region *region, *regionEnd;
+        short                    midiVelocity = (short)(vel * 127);
+        unsigned int             voicePlayIndex;
+        const struct tsf_preset* preset;
+        const unsigned short*    candidates = TSF_NULL;
+        int                      candidateNum, i;
+        struct tsf_region*       region;
 
         if(preset_index < 0 || preset_index >= f->presetNum)
             return 1;
@@ -2766,37 +3497,28 @@ extern "C"
             return 1;
         }
 
-        // Play all matching regions.
+        // Play all matching regions, of those the key index lists.
+        preset = &f->presets[preset_index];
+        candidateNum
+            = tsf_preset_candidates(preset, key, midiVelocity, &candidates);
         voicePlayIndex = f->voicePlayIndex++;
-        for(region = f->presets[preset_index].regions,
-        regionEnd  = region + f->presets[preset_index].regionNum;
-            region != regionEnd;
-            region++)
+        for(i = 0; i != candidateNum; i++)
         {
-            struct tsf_voice *voice, *v, *vEnd;
+            struct tsf_voice *voice, *v;
+            int               next;
             TSF_BOOL          doLoop;
             float             lowpassFc, lowpassFilterQDB;
+            region = preset->regions + (candidates ? candidates[i] : i);
             if(key < region->lokey || key > region->hikey
                || midiVelocity < region->lovel || midiVelocity > region->hivel)
                 continue;
 
-            voice = TSF_NULL, v = f->voices, vEnd = v + f->voiceNum;
             if(region->group)
-            {
-                for(; v != vEnd; v++)
+                for(next = 0; (v = tsf_voice_next_active(f, &next));)
                     if(v->playingPreset == preset_index
                        && v->region->group == region->group)
                         tsf_voice_endquick(f, v);
-                    else if(v->playingPreset == -1 && !voice)
-                        voice = v;
-            }
-            else
-                for(; v != vEnd; v++)
-                    if(v->playingPreset == -1)
-                    {
-                        voice = v;
-                        break;
-                    }
+            voice = tsf_voice_find_free(f);
 
             if(!voice)
             {
@@ -2804,25 +3526,32 @@ extern "C"
                 {
                     // Voices have been pre-allocated and limited to a maximum, try to kill a voice off in its release envelope
                     int bestKillReleaseSamplePos = -999999999;
-                    for(v = f->voices; v != vEnd; v++)
+                    for(next = 0; (v = tsf_voice_next_active(f, &next));)
                     {
+                        // We're looking for the voice furthest into its release
+                        int releaseSamplesDone;
                         if(v->ampenv.segment == TSF_SEGMENT_RELEASE)
-                        {
-                            // We're looking for the voice furthest into its release
-                            int releaseSamplesDone
+                            releaseSamplesDone
                                 = tsf_voice_envelope_release_samples(
                                       &v->ampenv, f->outSampleRate)
                                   - v->ampenv.samplesUntilNextSegment;
-                            if(releaseSamplesDone > bestKillReleaseSamplePos)
-                            {
-                                bestKillReleaseSamplePos = releaseSamplesDone;
-                                voice                    = v;
-                            }
+                        else if(tsf_voice_releasing(v))
+                            // Timed to release earlier in the next render
+                            releaseSamplesDone
+                                = f->eventOffset
+                                  - (v->endQuickOffset ? v->endQuickOffset
+                                                       : v->endOffset);
+                        else
+                            continue;
+                        if(releaseSamplesDone > bestKillReleaseSamplePos)
+                        {
+                            bestKillReleaseSamplePos = releaseSamplesDone;
+                            voice                    = v;
                         }
                     }
                     if(!voice)
                         continue;
-                    tsf_voice_kill(voice);
+                    tsf_voice_kill(f, voice);
                 }
                 else
                 {
@@ -2833,13 +3562,16 @@ extern "C"
                         f->voices, f->voiceNum * sizeof(struct tsf_voice));
                     if(!newVoices)
                         return 0;
-                    f->voices                    = newVoices;
-                    voice                        = &f->voices[f->voiceNum - 4];
-                    voice[1].playingPreset       = voice[2].playingPreset
-                        = voice[3].playingPreset = -1;
+                    f->voices = newVoices;
+                    voice     = &f->voices[f->voiceNum - 4];
+                    voice[0].playingPreset = voice[1].playingPreset
+                        = voice[2].playingPreset = voice[3].playingPreset = -1;
+                    if(!tsf_voice_sync_active(f))
+                        return 0;
                 }
             }
 
+            tsf_voice_activate(f, voice);
             voice->region          = region;
             voice->playingPreset   = preset_index;
             voice->playingKey      = key;
@@ -2847,6 +3579,8 @@ extern "C"
             voice->playingVelocity = midiVelocity;
             voice->playIndex       = voicePlayIndex;
             voice->heldSustain     = 0;
+            voice->startOffset     = f->eventOffset;
+            voice->endOffset = voice->endQuickOffset = 0;
             voice->noteGainDB      = f->globalGainDB - region->attenuation
                                      - tsf_gainToDecibels(1.0f / vel);
             // Default sends from region (0..1000 -> 0..1)
@@ -2881,6 +3615,10 @@ extern "C"
                                 && region->loop_start < region->loop_end);
             voice->loopStart = (doLoop ? region->loop_start : 0);
             voice->loopEnd   = (doLoop ? region->loop_end : 0);
+#ifdef TSF_SAMPLE_STREAMING
+            if(!f->fontSamples)
+                tsf_stream_voice_start(f, voice);
+#endif
 
             // Setup envelopes.
             tsf_voice_envelope_setup(&voice->ampenv,
@@ -2943,7 +3681,7 @@ extern "C"
         {
             //Find the first and last entry in the voices list with matching preset, key and look up the smallest play index
             if(v->playingPreset != preset_index || v->playingKey != key
-               || v->ampenv.segment >= TSF_SEGMENT_RELEASE)
+               || tsf_voice_releasing(v))
                 continue;
             else if(!vMatchFirst || v->playIndex < vMatchFirst->playIndex)
                 vMatchFirst = vMatchLast = v;
@@ -2958,7 +3696,7 @@ extern "C"
             if(v != vMatchFirst && v != vMatchLast
                && (v->playIndex != vMatchFirst->playIndex
                    || v->playingPreset != preset_index || v->playingKey != key
-                   || v->ampenv.segment >= TSF_SEGMENT_RELEASE))
+                   || tsf_voice_releasing(v)))
                 continue;
             tsf_voice_end(f, v);
         }
@@ -2982,14 +3720,31 @@ extern "C"
                 tsf_voice_end(f, v);
     }
 
+    TSFDEF void tsf_set_event_offset(tsf* f, int offset)
+    { f->eventOffset = (offset > 0 ? offset : 0); }
+
     TSFDEF int tsf_active_voice_count(tsf* f)
+    { return f->activeVoiceNum; }
+
+    TSFDEF int tsf_note_off_quietest(tsf* f)
     {
-        int               count = 0;
-        struct tsf_voice *v = f->voices, *vEnd = v + f->voiceNum;
-        for(; v != vEnd; v++)
-            if(v->playingPreset != -1)
-                count++;
-        return count;
+        struct tsf_voice *v, *quietest = TSF_NULL;
+        float             level, quietestLevel = 0;
+        int               next;
+        for(next = 0; (v = tsf_voice_next_active(f, &next));)
+        {
+            if(v->ampenv.segment == TSF_SEGMENT_DONE
+               || (v->ampenv.segment == TSF_SEGMENT_RELEASE
+                   && v->ampenv.parameters.release == 0.0f))
+                continue;
+            level = v->ampenv.level * tsf_decibelsToGain(v->noteGainDB);
+            if(!quietest || level < quietestLevel)
+                quietest = v, quietestLevel = level;
+        }
+        if(!quietest)
+            return 0;
+        tsf_voice_endquick(f, quietest);
+        return 1;
     }
 
     TSFDEF void
@@ -3036,15 +3791,16 @@ extern "C"
     TSFDEF void
     tsf_render_float(tsf* f, float* buffer, int samples, int flag_mixing)
     {
-        struct tsf_voice *v = f->voices, *vEnd = v + f->voiceNum;
+        struct tsf_voice* v;
+        int               next;
+        f->eventOffset = 0;
         if(!flag_mixing)
             TSF_MEMSET(buffer,
                        0,
                        (f->outputmode == TSF_MONO ? 1 : 2) * sizeof(float)
                            * samples);
-        for(; v != vEnd; v++)
-            if(v->playingPreset != -1)
-                tsf_voice_render(f, v, buffer, TSF_NULL, TSF_NULL, samples);
+        for(next = 0; (v = tsf_voice_next_active(f, &next));)
+            tsf_voice_render_timed(f, v, buffer, TSF_NULL, TSF_NULL, samples);
     }
 
     TSFDEF void tsf_render_float_fx(tsf*   f,
@@ -3054,8 +3810,10 @@ extern "C"
                                     int    samples,
                                     int    flag_mixing)
     {
-        struct tsf_voice *v = f->voices, *vEnd = v + f->voiceNum;
+        struct tsf_voice* v;
+        int               next;
         int               channels = (f->outputmode == TSF_MONO ? 1 : 2);
+        f->eventOffset             = 0;
         if(!flag_mixing)
         {
             TSF_MEMSET(buffer, 0, channels * sizeof(float) * samples);
@@ -3064,9 +3822,8 @@ extern "C"
             if(reverb)
                 TSF_MEMSET(reverb, 0, channels * sizeof(float) * samples);
         }
-        for(; v != vEnd; v++)
-            if(v->playingPreset != -1)
-                tsf_voice_render(f, v, buffer, chorus, reverb, samples);
+        for(next = 0; (v = tsf_voice_next_active(f, &next));)
+            tsf_voice_render_timed(f, v, buffer, chorus, reverb, samples);
     }
 
     static void tsf_channel_setup_voice(tsf* f, struct tsf_voice* v)
@@ -3198,23 +3955,8 @@ extern "C"
         struct tsf_channel* c = tsf_channel_init(f, channel);
         if(!c)
             return 0;
-        if(flag_mididrums)
-        {
-            preset_index = tsf_get_presetindex(
-                f, 128 | (c->bank & 0x7FFF), preset_number);
-            if(preset_index == -1)
-                preset_index = tsf_get_presetindex(f, 128, preset_number);
-            if(preset_index == -1)
-                preset_index = tsf_get_presetindex(f, 128, 0);
-            if(preset_index == -1)
-                preset_index
-                    = tsf_get_presetindex(f, (c->bank & 0x7FFF), preset_number);
-        }
-        else
-            preset_index
-                = tsf_get_presetindex(f, (c->bank & 0x7FFF), preset_number);
-        if(preset_index == -1)
-            preset_index = tsf_get_presetindex(f, 0, preset_number);
+        preset_index = tsf_get_presetindex_fallback(
+            f, (c->bank & 0x7FFF), preset_number, flag_mididrums);
         if(preset_index != -1)
         {
             c->presetIndex = (unsigned short)preset_index;
@@ -3381,7 +4123,7 @@ extern "C"
             //Find the first and last entry in the voices list with matching channel, key and look up the smallest play index
             if(v->playingPreset == -1 || v->playingChannel != channel
                || v->playingKey != key
-               || v->ampenv.segment >= TSF_SEGMENT_RELEASE || v->heldSustain)
+               || tsf_voice_releasing(v) || v->heldSustain)
                 continue;
             else if(!vMatchFirst || v->playIndex < vMatchFirst->playIndex)
                 vMatchFirst = vMatchLast = v;
@@ -3398,8 +4140,7 @@ extern "C"
             if(v != vMatchFirst && v != vMatchLast
                && (v->playIndex != vMatchFirst->playIndex
                    || v->playingPreset == -1 || v->playingChannel != channel
-                   || v->playingKey != key
-                   || v->ampenv.segment >= TSF_SEGMENT_RELEASE))
+                   || v->playingKey != key || tsf_voice_releasing(v)))
                 continue;
             //Don't turn off if sustain is active, just mark as held by sustain so we don't forget it
             if(sustain)
@@ -0,0 +1,29 @@
+#pragma once
+
+// TinySoundFont feature set of the firmware. synth_tsf.cpp adds the arena
+// allocator and load hooks on top; the host tests include this alone so
+// they check the same sample, phase and interpolation paths the module runs.
+
+#define TSF_NO_STDIO
+// Samples stay 16-bit in SDRAM: twice the SoundFont fits, and each voice
+// fetches half the bytes. Build with -DSYNTH_SF2_FLOAT_SAMPLES for float.
+#ifndef SYNTH_SF2_FLOAT_SAMPLES
+#define TSF_SAMPLES_INT16
+#define TSF_SAMPLE_STREAMING
+#endif
+// Voices step a 32.32 fixed-point phase: index, wrap and end test become
+// integer ops instead of double add/compare/convert on the FPU each sample.
+// Build with -DSYNTH_DOUBLE_PHASE for the original double accumulator.
+#ifndef SYNTH_DOUBLE_PHASE
+#define TSF_FIXED_POINT_PHASE
+#endif
+// Per-block pitch, gain and filter cutoff come from shared lookup tables
+// instead of pow/tan per voice. Build with -DSYNTH_EXACT_CONTROL to compare.
+#ifndef SYNTH_EXACT_CONTROL
+#define TSF_CONTROL_TABLES
+#endif
+// The M7's dual 16x16 multiply-accumulate interpolates a sample pair in one
+// instruction (CMSIS, via daisy_patch_sm.h); the host uses TSF's C fallback.
+#if defined(__ARM_FEATURE_DSP) && __ARM_FEATURE_DSP == 1
+#define TSF_SMUAD(x, y) int32_t(__SMUAD((x), (y)))
+#endif